@@ -0,0 +1,1248 @@
+/*
+ * Content search over indexed files: plain text, gzip (including bgzip) and
+ * zstd, decompressed as a stream and never written to disk.
+ *
+ * Optional codecs are compiled in with -DHAVE_ZLIB (-lz) and -DHAVE_ZSTD
+ * (-lzstd); without them compressed files are skipped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#include "index.h"
+
+// --- Platform Specifics ---
+#if defined(_WIN32) || defined(_WIN64)
+    #define OS_WINDOWS
+    #include <windows.h>
+    typedef CRITICAL_SECTION mutex_t;
+    #define mutex_init(m) InitializeCriticalSection(m)
+    #define mutex_lock(m) EnterCriticalSection(m)
+    #define mutex_unlock(m) LeaveCriticalSection(m)
+    #define mutex_destroy(m) DeleteCriticalSection(m)
+    #define seek64(f, off) _fseeki64(f, off, SEEK_SET)
+    #define size64(f) (_fseeki64(f, 0, SEEK_END) == 0 ? _ftelli64(f) : -1)
+#else
+    #define OS_POSIX
+    #include <sys/types.h>
+    #include <unistd.h>
+    #include <pthread.h>
+    #include <regex.h>
+    typedef pthread_mutex_t mutex_t;
+    #define mutex_init(m) pthread_mutex_init(m, NULL)
+    #define mutex_lock(m) pthread_mutex_lock(m)
+    #define mutex_unlock(m) pthread_mutex_unlock(m)
+    #define mutex_destroy(m) pthread_mutex_destroy(m)
+    #define seek64(f, off) fseeko(f, (off_t)(off), SEEK_SET)
+    #define size64(f) (fseeko(f, 0, SEEK_END) == 0 ? (int64_t)ftello(f) : -1)
+#endif
+
+#ifdef HAVE_ZLIB
+    #include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+    #include <zstd.h>
+#endif
+
+// --- Configuration ---
+#define GREP_WINDOW (1 << 20)       // decompressed bytes held per search; longer lines are split
+#define GREP_INPUT (1 << 16)        // compressed bytes read at a time
+#define GREP_TEXT_MAX 255           // line text kept per hit
+#ifndef GREP_SPLIT_MIN
+#define GREP_SPLIT_MIN (8 << 20)    // compressed bytes before a file is searched in parallel pieces
+#endif
+#define GREP_PLAIN_SEGMENT (4 << 20)
+#define BINARY_PROBE 4096           // a NUL in this many leading bytes marks a binary file
+#define CHECK_SPAN 4096             // bytes checksummed at each end of an indexed prefix
+#define CONTENT_FILE_MAGIC 0x58444943   // "CIDX"
+#define CONTENT_FILE_VERSION 1
+
+enum { FORMAT_PLAIN, FORMAT_GZIP, FORMAT_ZSTD };
+
+// --- System Utilities ---
+
+static int cpuCount(void) {
+    #ifdef OS_WINDOWS
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+    #else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+    #endif
+}
+
+// --- Sources ---
+// A source turns one file, from some compressed offset on, into a stream of
+// decompressed bytes. gzip members and zstd frames follow each other
+// naturally, so a source started at a member or frame boundary reads on to
+// the end of the file.
+
+typedef struct Source {
+    FILE *f;
+    int format;
+    unsigned char *in;
+    int error;
+    #ifdef HAVE_ZLIB
+    z_stream z;
+    int zReady;
+    #endif
+    #ifdef HAVE_ZSTD
+    ZSTD_DStream *zs;
+    ZSTD_inBuffer zin;
+    #endif
+} Source;
+
+static void closeSource(Source *src) {
+    #ifdef HAVE_ZLIB
+    if (src->zReady) inflateEnd(&src->z);
+    #endif
+    #ifdef HAVE_ZSTD
+    if (src->zs) ZSTD_freeDStream(src->zs);
+    #endif
+    free(src->in);
+    if (src->f) fclose(src->f);
+    memset(src, 0, sizeof(*src));
+}
+
+// Opens path positioned at compressed offset. Returns 0, or -1 when the file
+// cannot be read or its codec is not compiled in.
+static int openSource(Source *src, const char *path, int format, int64_t offset) {
+    memset(src, 0, sizeof(*src));
+    src->format = format;
+    src->f = fopen(path, "rb");
+    if (!src->f || seek64(src->f, offset) != 0) {
+        closeSource(src);
+        return -1;
+    }
+    if (format == FORMAT_PLAIN) return 0;
+    src->in = (unsigned char *)malloc(GREP_INPUT);
+    if (!src->in) {
+        closeSource(src);
+        return -1;
+    }
+    #ifdef HAVE_ZLIB
+    if (format == FORMAT_GZIP) {
+        // 16 + MAX_WBITS: gzip framing only.
+        if (inflateInit2(&src->z, 16 + MAX_WBITS) != Z_OK) {
+            closeSource(src);
+            return -1;
+        }
+        src->zReady = 1;
+        return 0;
+    }
+    #endif
+    #ifdef HAVE_ZSTD
+    if (format == FORMAT_ZSTD) {
+        src->zs = ZSTD_createDStream();
+        if (!src->zs || ZSTD_isError(ZSTD_initDStream(src->zs))) {
+            closeSource(src);
+            return -1;
+        }
+        src->zin.src = src->in;
+        return 0;
+    }
+    #endif
+    closeSource(src);
+    return -1;
+}
+
+// Fills out with up to len decompressed bytes. Returns the count, 0 at the
+// end of the file or on a corrupt stream (src->error is then set).
+static size_t readSource(Source *src, char *out, size_t len) {
+    if (src->error) return 0;
+    if (src->format == FORMAT_PLAIN) return fread(out, 1, len, src->f);
+    #ifdef HAVE_ZLIB
+    if (src->format == FORMAT_GZIP) {
+        z_stream *z = &src->z;
+        z->next_out = (Bytef *)out;
+        z->avail_out = (uInt)len;
+        while (z->avail_out == len) {
+            if (z->avail_in == 0) {
+                z->avail_in = (uInt)fread(src->in, 1, GREP_INPUT, src->f);
+                z->next_in = src->in;
+                if (z->avail_in == 0) break;
+            }
+            int rc = inflate(z, Z_NO_FLUSH);
+            if (rc == Z_STREAM_END) {
+                // Another member may follow (always, for bgzip).
+                if (inflateReset(z) != Z_OK) src->error = 1;
+            } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+                src->error = 1;
+            }
+            if (src->error) break;
+        }
+        return len - z->avail_out;
+    }
+    #endif
+    #ifdef HAVE_ZSTD
+    if (src->format == FORMAT_ZSTD) {
+        ZSTD_outBuffer zout = {out, len, 0};
+        while (zout.pos == 0) {
+            if (src->zin.pos == src->zin.size) {
+                src->zin.size = fread(src->in, 1, GREP_INPUT, src->f);
+                src->zin.pos = 0;
+                if (src->zin.size == 0) break;
+            }
+            if (ZSTD_isError(ZSTD_decompressStream(src->zs, &zout, &src->zin))) {
+                src->error = 1;
+                break;
+            }
+        }
+        return zout.pos;
+    }
+    #endif
+    return 0;
+}
+
+// --- Segments ---
+// A file that is large enough and built from independent pieces (bgzip
+// blocks, zstd frames, or any stretch of a plain file) is cut into ranges
+// that are searched in parallel. Each piece's decompressed size must be
+// known up front so line ownership can be settled without decoding.
+
+typedef struct Segment {
+    int64_t offset;         // compressed
+    int64_t length;         // compressed
+    int64_t size;           // decompressed
+} Segment;
+
+typedef struct SegmentList {
+    Segment *items;
+    int count;
+    int cap;
+} SegmentList;
+
+static int addSegment(SegmentList *list, int64_t offset, int64_t length, int64_t size) {
+    if (list->count == list->cap) {
+        int newCap = list->cap ? list->cap * 2 : 256;
+        Segment *grown = (Segment *)realloc(list->items, newCap * sizeof(Segment));
+        if (!grown) return -1;
+        list->items = grown;
+        list->cap = newCap;
+    }
+    list->items[list->count].offset = offset;
+    list->items[list->count].length = length;
+    list->items[list->count].size = size;
+    list->count++;
+    return 0;
+}
+
+static uint32_t le32(const unsigned char *p) {
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// bgzip blocks carry their compressed size in a "BC" extra field and their
+// decompressed size in the trailer. Returns 0 if every block parsed.
+static int bgzipSegments(FILE *f, int64_t fileSize, SegmentList *list) {
+    unsigned char h[18], trailer[4];
+    for (int64_t off = 0; off < fileSize;) {
+        if (seek64(f, off) != 0 || fread(h, 1, sizeof(h), f) != sizeof(h)) return -1;
+        if (h[0] != 0x1f || h[1] != 0x8b || !(h[3] & 4) || h[12] != 'B' || h[13] != 'C') return -1;
+        int64_t length = (int64_t)(h[16] | h[17] << 8) + 1;
+        if (seek64(f, off + length - 4) != 0 || fread(trailer, 1, 4, f) != 4) return -1;
+        if (addSegment(list, off, length, le32(trailer)) < 0) return -1;
+        off += length;
+    }
+    return 0;
+}
+
+// Walks zstd frames by their block headers. Frames without a content size
+// cannot be placed, so they fail the walk. Returns 0 if every frame parsed.
+static int zstdSegments(FILE *f, int64_t fileSize, SegmentList *list) {
+    static const int dictIdSize[4] = {0, 1, 2, 4};
+    static const int contentSizeSize[4] = {0, 2, 4, 8};
+    unsigned char h[18];
+    for (int64_t off = 0; off < fileSize;) {
+        if (seek64(f, off) != 0 || fread(h, 1, 8, f) != 8) return -1;
+        uint32_t magic = le32(h);
+        if ((magic & 0xFFFFFFF0) == 0x184D2A50) {
+            // Skippable frame: no content, just step over it.
+            off += 8 + (int64_t)le32(h + 4);
+            continue;
+        }
+        if (magic != 0xFD2FB528) return -1;
+        int fhd = h[4];
+        int singleSegment = fhd >> 5 & 1;
+        int fcsSize = contentSizeSize[fhd >> 6];
+        if (fcsSize == 0 && singleSegment) fcsSize = 1;
+        if (fcsSize == 0) return -1;
+        int64_t fcsAt = 5 + !singleSegment + dictIdSize[fhd & 3];
+        if (seek64(f, off + fcsAt) != 0 || fread(h, 1, fcsSize, f) != (size_t)fcsSize) return -1;
+        uint64_t size = 0;
+        for (int i = fcsSize - 1; i >= 0; i--) size = size << 8 | h[i];
+        if (fcsSize == 2) size += 256;
+
+        int64_t pos = off + fcsAt + fcsSize;
+        for (int last = 0; !last;) {
+            if (seek64(f, pos) != 0 || fread(h, 1, 3, f) != 3) return -1;
+            uint32_t block = h[0] | h[1] << 8 | (uint32_t)h[2] << 16;
+            last = block & 1;
+            int type = block >> 1 & 3;
+            if (type == 3) return -1;
+            pos += 3 + (type == 1 ? 1 : (int64_t)(block >> 3));
+        }
+        if (fhd >> 2 & 1) pos += 4;
+        if (addSegment(list, off, pos - off, (int64_t)size) < 0) return -1;
+        off = pos;
+    }
+    return 0;
+}
+
+// --- Search Kernel ---
+
+typedef struct Matcher {
+    const char *pattern;
+    size_t length;
+    int ignoreCase;
+    unsigned char fold[256];
+    #ifdef OS_POSIX
+    regex_t regex;
+    int useRegex;
+    #endif
+} Matcher;
+
+// Returns the first literal match in buf[0..len), or NULL.
+static const char *findLiteral(const Matcher *m, const char *buf, size_t len) {
+    if (m->length == 0) return buf;
+    if (len < m->length) return NULL;
+    const char *end = buf + len - m->length + 1;
+    if (!m->ignoreCase) {
+        for (const char *p = buf; p < end; p++) {
+            p = (const char *)memchr(p, m->pattern[0], end - p);
+            if (!p) return NULL;
+            if (memcmp(p, m->pattern, m->length) == 0) return p;
+        }
+        return NULL;
+    }
+    unsigned char first = m->fold[(unsigned char)m->pattern[0]];
+    for (const char *p = buf; p < end; p++) {
+        if (m->fold[(unsigned char)*p] != first) continue;
+        size_t i = 1;
+        while (i < m->length && m->fold[(unsigned char)p[i]] == m->fold[(unsigned char)m->pattern[i]]) i++;
+        if (i == m->length) return p;
+    }
+    return NULL;
+}
+
+// Tests one line, which the caller has NUL-terminated at line[len].
+static int lineMatches(const Matcher *m, const char *line, size_t len) {
+    #ifdef OS_POSIX
+    if (m->useRegex) return regexec(&m->regex, line, 0, NULL, 0) == 0;
+    #endif
+    return findLiteral(m, line, len) != NULL;
+}
+
+// --- Range Search ---
+
+typedef struct Hit {
+    long line;              // within the range
+    char *text;
+} Hit;
+
+typedef struct HitList {
+    Hit *items;
+    long count;
+    long cap;
+} HitList;
+
+typedef struct GrepFile GrepFile;
+
+typedef struct GrepTask {
+    GrepFile *file;
+    int64_t offset;         // compressed offset decoding starts at
+    int64_t skip;           // decompressed bytes to drop before the range
+    int hasPrev;            // one more byte before the range: the previous byte
+    int64_t owned;          // decompressed bytes in the range, -1 for to the end
+    HitList hits;
+    long lines;             // lines the range owns
+    int index;              // position within the file once searched, -1 before
+} GrepTask;
+
+struct GrepFile {
+    char *path;
+    int format;
+    GrepTask *tasks;
+    int taskCount;
+    int emitted;            // tasks whose hits have been reported
+    long lineBase;          // lines owned by the emitted tasks
+};
+
+typedef struct GrepRun {
+    Matcher matcher;
+    GrepFile *files;
+    int fileCount;
+    GrepTask **tasks;
+    int taskCount;
+    int nextTask;
+    mutex_t lock;           // guards nextTask, file progress and output
+    IndexGrepFn fn;
+    void *user;
+    long reported;
+    volatile int stop;
+    IndexTasks *group;      // the workers, on the shared scheduler
+} GrepRun;
+
+static int pushHit(HitList *list, long line, const char *text, size_t len) {
+    if (list->count == list->cap) {
+        long newCap = list->cap ? list->cap * 2 : 64;
+        Hit *grown = (Hit *)realloc(list->items, newCap * sizeof(Hit));
+        if (!grown) return -1;
+        list->items = grown;
+        list->cap = newCap;
+    }
+    if (len > 0 && text[len - 1] == '\r') len--;
+    if (len > GREP_TEXT_MAX) len = GREP_TEXT_MAX;
+    char *copy = (char *)malloc(len + 1);
+    if (!copy) return -1;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    list->items[list->count].line = line;
+    list->items[list->count].text = copy;
+    list->count++;
+    return 0;
+}
+
+static void freeHits(HitList *list) {
+    for (long i = 0; i < list->count; i++) free(list->items[i].text);
+    free(list->items);
+    memset(list, 0, sizeof(*list));
+}
+
+// A file searched as one task reports hits as they are found; pieces of a
+// split file hold theirs until every earlier piece is done, see emitReady.
+static void reportHit(GrepRun *run, GrepTask *task, const char *text, size_t len) {
+    if (task->file->taskCount > 1) {
+        if (pushHit(&task->hits, task->lines, text, len) < 0) run->stop = 1;
+        return;
+    }
+    char line[GREP_TEXT_MAX + 1];
+    if (len > 0 && text[len - 1] == '\r') len--;
+    if (len > GREP_TEXT_MAX) len = GREP_TEXT_MAX;
+    memcpy(line, text, len);
+    line[len] = '\0';
+    IndexGrepHit hit = {task->file->path, task->lines, line};
+    mutex_lock(&run->lock);
+    if (!run->stop) {
+        run->reported++;
+        if (run->fn(&hit, run->user)) run->stop = 1;
+    }
+    mutex_unlock(&run->lock);
+}
+
+// Drops n decompressed bytes. Returns 0 if they were all there.
+static int skipBytes(Source *src, char *buf, int64_t n) {
+    while (n > 0) {
+        size_t got = readSource(src, buf, n < GREP_WINDOW ? (size_t)n : GREP_WINDOW);
+        if (got == 0) return -1;
+        n -= got;
+    }
+    return 0;
+}
+
+// Searches the lines a task owns: those starting inside its range. A range
+// that does not open a line skips the partial one, which belongs to the
+// range before, and reads past its own end to finish its last line.
+static void searchTask(GrepRun *run, GrepTask *task, char *buf) {
+    const Matcher *m = &run->matcher;
+    Source src;
+    if (openSource(&src, task->file->path, task->file->format, task->offset) < 0) return;
+
+    int64_t consumed = 0;   // owned bytes already moved past
+    size_t len = 0;
+    int eof = 0, startMid = 0;
+    if (skipBytes(&src, buf, task->skip) < 0) goto done;
+    if (task->hasPrev) {
+        char prev;
+        if (readSource(&src, &prev, 1) != 1) goto done;
+        startMid = prev != '\n';
+    }
+
+    while (!eof && !run->stop) {
+        size_t got = readSource(&src, buf + len, GREP_WINDOW - len);
+        eof = got == 0;
+        len += got;
+        if (startMid) {
+            char *nl = (char *)memchr(buf, '\n', len);
+            size_t drop = nl ? (size_t)(nl - buf) + 1 : len;
+            memmove(buf, buf + drop, len - drop);
+            len -= drop;
+            consumed += drop;
+            startMid = !nl;
+            continue;
+        }
+
+        // The complete lines in the window, cut at the first line that
+        // starts past the range.
+        size_t region = len;
+        int last = eof;
+        if (!eof) {
+            while (region > 0 && buf[region - 1] != '\n') region--;
+            if (region == 0) region = len;  // a line longer than the window
+        }
+        if (task->owned >= 0 && consumed + (int64_t)region >= task->owned) {
+            size_t r = task->owned > consumed ? (size_t)(task->owned - consumed) - 1 : 0;
+            char *nl = task->owned > consumed ? (char *)memchr(buf + r, '\n', region - r) : buf;
+            if (nl || task->owned <= consumed) {
+                region = task->owned > consumed ? (size_t)(nl - buf) + 1 : 0;
+                last = 1;
+            }
+        }
+
+        for (size_t pos = 0; pos < region && !run->stop;) {
+            char *nl = (char *)memchr(buf + pos, '\n', region - pos);
+            size_t end = nl ? (size_t)(nl - buf) : region;
+            #ifdef OS_POSIX
+            if (m->useRegex) {
+                // buf has a spare byte past the window for this.
+                char saved = buf[end];
+                buf[end] = '\0';
+                int hit = lineMatches(m, buf + pos, end - pos);
+                buf[end] = saved;
+                task->lines++;
+                if (hit) reportHit(run, task, buf + pos, end - pos);
+                pos = end + 1;
+                continue;
+            }
+            #endif
+            // Literal: jump straight to the next match, counting the lines
+            // passed on the way.
+            const char *hit = findLiteral(m, buf + pos, region - pos);
+            if (!hit) {
+                for (const char *p = buf + pos; (p = (const char *)memchr(p, '\n', buf + region - p)); p++) task->lines++;
+                if (region > 0 && buf[region - 1] != '\n') task->lines++;
+                break;
+            }
+            for (const char *p = buf + pos; (p = (const char *)memchr(p, '\n', hit - p)); p++) {
+                task->lines++;
+                pos = (size_t)(p - buf) + 1;
+            }
+            nl = (char *)memchr(hit, '\n', buf + region - hit);
+            end = nl ? (size_t)(nl - buf) : region;
+            task->lines++;
+            reportHit(run, task, buf + pos, end - pos);
+            pos = end + 1;
+        }
+        if (last) break;
+        memmove(buf, buf + region, len - region);
+        len -= region;
+        consumed += region;
+    }
+
+    done:
+    closeSource(&src);
+}
+
+// Reports every task of a file whose earlier tasks have all been reported,
+// so hits come out in file order with absolute line numbers.
+// Caller holds run->lock.
+static void emitReady(GrepRun *run, GrepFile *file) {
+    while (file->emitted < file->taskCount && file->tasks[file->emitted].index >= 0) {
+        GrepTask *task = &file->tasks[file->emitted];
+        for (long i = 0; i < task->hits.count && !run->stop; i++) {
+            IndexGrepHit hit = {file->path, file->lineBase + task->hits.items[i].line, task->hits.items[i].text};
+            run->reported++;
+            if (run->fn(&hit, run->user)) run->stop = 1;
+        }
+        freeHits(&task->hits);
+        file->lineBase += task->lines;
+        file->emitted++;
+    }
+}
+
+static void grepWorker(void *arg) {
+    GrepRun *run = (GrepRun *)arg;
+    char *buf = (char *)malloc(GREP_WINDOW + 1);
+    if (!buf) return;
+    for (;;) {
+        mutex_lock(&run->lock);
+        GrepTask *task = run->stop || run->nextTask >= run->taskCount ? NULL : run->tasks[run->nextTask++];
+        mutex_unlock(&run->lock);
+        if (!task) break;
+        searchTask(run, task, buf);
+        mutex_lock(&run->lock);
+        task->index = (int)(task - task->file->tasks);
+        emitReady(run, task->file);
+        mutex_unlock(&run->lock);
+    }
+    // Workers that have not started yet need not.
+    if (run->stop) indexTasksCancel(run->group);
+    free(buf);
+}
+
+// --- Planning ---
+
+// Sniffs the format and plans the file's tasks. Returns 0, or -1 to skip
+// the file (unreadable, binary, or a codec that is not compiled in).
+static int planFile(GrepFile *file, int maxTasks) {
+    unsigned char probe[BINARY_PROBE];
+    FILE *f = fopen(file->path, "rb");
+    if (!f) return -1;
+    size_t got = fread(probe, 1, sizeof(probe), f);
+    int64_t fileSize = size64(f);
+
+    if (got >= 2 && probe[0] == 0x1f && probe[1] == 0x8b) file->format = FORMAT_GZIP;
+    else if (got >= 4 && le32(probe) == 0xFD2FB528) file->format = FORMAT_ZSTD;
+    else file->format = FORMAT_PLAIN;
+    #ifndef HAVE_ZLIB
+    if (file->format == FORMAT_GZIP) got = 0;
+    #endif
+    #ifndef HAVE_ZSTD
+    if (file->format == FORMAT_ZSTD) got = 0;
+    #endif
+    if (got == 0 || fileSize < 0 || (file->format == FORMAT_PLAIN && memchr(probe, 0, got))) {
+        fclose(f);
+        return -1;
+    }
+
+    SegmentList segs = {NULL, 0, 0};
+    int split = fileSize >= 2 * (int64_t)GREP_SPLIT_MIN && maxTasks > 1;
+    if (split && file->format == FORMAT_PLAIN) {
+        for (int64_t off = 0; off < fileSize && split; off += GREP_PLAIN_SEGMENT) {
+            int64_t length = fileSize - off < GREP_PLAIN_SEGMENT ? fileSize - off : GREP_PLAIN_SEGMENT;
+            split = addSegment(&segs, off, length, length) == 0;
+        }
+    } else if (split && file->format == FORMAT_GZIP) {
+        split = bgzipSegments(f, fileSize, &segs) == 0;
+    } else if (split && file->format == FORMAT_ZSTD) {
+        split = zstdSegments(f, fileSize, &segs) == 0;
+    }
+    fclose(f);
+
+    int tasks = split ? (int)(fileSize / GREP_SPLIT_MIN) : 1;
+    if (tasks > maxTasks) tasks = maxTasks;
+    if (tasks > segs.count) tasks = segs.count;
+    if (tasks < 1) tasks = 1;
+    file->tasks = (GrepTask *)calloc(tasks, sizeof(GrepTask));
+    if (!file->tasks) {
+        free(segs.items);
+        return -1;
+    }
+    file->taskCount = tasks;
+
+    // Consecutive segments, about the same compressed bytes per task.
+    int s = 0;
+    for (int t = 0; t < tasks; t++) {
+        GrepTask *task = &file->tasks[t];
+        task->file = file;
+        task->index = -1;
+        task->owned = -1;
+        if (tasks == 1) continue;
+        int64_t target = segs.items[segs.count - 1].offset + segs.items[segs.count - 1].length;
+        target = target * (t + 1) / tasks;
+        int first = s;
+        task->owned = 0;
+        // Every later task keeps at least one segment.
+        while (s < segs.count && (s == first || t == tasks - 1 ||
+               (segs.items[s].offset < target && segs.count - s > tasks - 1 - t))) {
+            task->owned += segs.items[s].size;
+            s++;
+        }
+        if (first == 0) {
+            task->offset = 0;
+        } else if (file->format == FORMAT_PLAIN) {
+            task->offset = segs.items[first].offset - 1;
+            task->hasPrev = 1;
+        } else {
+            // The previous piece is decoded only for its last byte.
+            task->offset = segs.items[first - 1].offset;
+            task->skip = segs.items[first - 1].size - 1;
+            task->hasPrev = 1;
+        }
+        if (t == tasks - 1) task->owned = -1;
+    }
+    free(segs.items);
+    return 0;
+}
+
+typedef struct PathList {
+    char **paths;
+    int count;
+    int cap;
+} PathList;
+
+static int collectPath(const IndexResult *result, void *user) {
+    PathList *list = (PathList *)user;
+    if (list->count == list->cap) {
+        int newCap = list->cap ? list->cap * 2 : 1024;
+        char **grown = (char **)realloc(list->paths, newCap * sizeof(char *));
+        if (!grown) return 1;
+        list->paths = grown;
+        list->cap = newCap;
+    }
+    list->paths[list->count] = strdup(result->fullpath);
+    if (list->paths[list->count]) list->count++;
+    return 0;
+}
+
+static void freePaths(PathList *list) {
+    for (int i = 0; i < list->count; i++) free(list->paths[i]);
+    free(list->paths);
+    memset(list, 0, sizeof(*list));
+}
+
+// Greps the files in list, taking ownership of its paths. Returns the
+// number of hits reported, or -1 for a bad pattern.
+static long grepPaths(PathList *list, const char *pattern, int flags, IndexGrepFn fn, void *user) {
+    GrepRun run;
+    memset(&run, 0, sizeof(run));
+    run.fn = fn;
+    run.user = user;
+    Matcher *m = &run.matcher;
+    m->pattern = pattern;
+    m->length = strlen(pattern);
+    m->ignoreCase = (flags & GREP_IGNORE_CASE) != 0;
+    for (int c = 0; c < 256; c++) m->fold[c] = (unsigned char)(m->ignoreCase ? tolower(c) : c);
+    if (flags & GREP_REGEX) {
+        #ifdef OS_POSIX
+        int cflags = REG_EXTENDED | REG_NOSUB | (m->ignoreCase ? REG_ICASE : 0);
+        if (regcomp(&m->regex, pattern, cflags) != 0) {
+            freePaths(list);
+            return -1;
+        }
+        m->useRegex = 1;
+        #else
+        freePaths(list);
+        return -1;
+        #endif
+    }
+
+    int threads = cpuCount();
+    run.files = (GrepFile *)calloc(list->count + 1, sizeof(GrepFile));
+    int taskTotal = 0;
+    for (int i = 0; run.files && i < list->count; i++) {
+        GrepFile *file = &run.files[run.fileCount];
+        file->path = list->paths[i];
+        if (planFile(file, 4 * threads) < 0) {
+            free(list->paths[i]);
+            continue;
+        }
+        taskTotal += file->taskCount;
+        run.fileCount++;
+    }
+    free(list->paths);
+    list->paths = NULL;
+    list->count = 0;
+    run.tasks = (GrepTask **)malloc((taskTotal + 1) * sizeof(GrepTask *));
+    for (int i = 0; run.tasks && i < run.fileCount; i++) {
+        for (int t = 0; t < run.files[i].taskCount; t++) run.tasks[run.taskCount++] = &run.files[i].tasks[t];
+    }
+
+    mutex_init(&run.lock);
+    if (threads > run.taskCount) threads = run.taskCount;
+    run.group = indexTasksBegin(TASK_UI);
+    for (int i = 0; i < threads; i++) indexTasksSpawn(run.group, grepWorker, &run);
+    indexTasksWait(run.group);
+    mutex_destroy(&run.lock);
+
+    for (int i = 0; i < run.fileCount; i++) {
+        for (int t = 0; t < run.files[i].taskCount; t++) freeHits(&run.files[i].tasks[t].hits);
+        free(run.files[i].tasks);
+        free(run.files[i].path);
+    }
+    free(run.files);
+    free(run.tasks);
+    #ifdef OS_POSIX
+    if (m->useRegex) regfree(&m->regex);
+    #endif
+    return run.reported;
+}
+
+// --- Content Index ---
+// Per file, the set of case-folded byte trigrams in its indexed prefix,
+// kept sorted so a literal pattern can rule a file out with a few binary
+// searches. A plain file remembers how far it was indexed and checksums of
+// the first and last CHECK_SPAN bytes of that prefix: when it has grown
+// and both still match, only the new tail is read. Truncation, rotation
+// (a new file at the path) or a rewritten prefix cost a full pass, as does
+// any change to a compressed file.
+
+typedef struct ContentFile {
+    char *path;
+    int64_t offset;         // bytes indexed; the whole size for compressed files
+    int64_t mtime;
+    uint64_t headSum;       // first CHECK_SPAN bytes of the prefix
+    uint64_t tailSum;       // last CHECK_SPAN bytes of the prefix
+    uint32_t *grams;        // sorted, distinct
+    uint32_t gramCount;
+    int format;
+    int binary;
+    int seen;               // generation of the last update that listed it
+    int64_t size;           // live size when the update planned it
+    int64_t liveMtime;
+} ContentFile;
+
+struct IndexContent {
+    Index *ix;
+    char file[INDEX_MAX_PATH];  // side file, empty for none
+    mutex_t lock;
+    ContentFile **files;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t *slots;        // path hash -> files index + 1
+    uint32_t slotCap;       // power of two
+    int generation;
+    IndexContentStats stats;
+};
+
+typedef struct ContentJob {
+    IndexContent *ci;
+    ContentFile **todo;
+    uint32_t count;
+    uint32_t next;
+    mutex_t lock;           // guards next and ci->stats
+} ContentJob;
+
+static uint64_t hashBytes(uint64_t h, const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t hashPath(const char *path) {
+    return hashBytes(14695981039346656037ULL, path, strlen(path));
+}
+
+// Checksums len bytes of f from offset. Returns 0 if they could not all
+// be read.
+static uint64_t sumRange(FILE *f, int64_t offset, int64_t len, char *buf) {
+    if (seek64(f, offset) != 0) return 0;
+    size_t n = (size_t)len;
+    if (fread(buf, 1, n, f) != n) return 0;
+    return hashBytes(14695981039346656037ULL, buf, n) | 1;
+}
+
+static ContentFile *findContent(IndexContent *ci, const char *path) {
+    if (!ci->slotCap) return NULL;
+    uint32_t mask = ci->slotCap - 1;
+    for (uint32_t i = (uint32_t)hashPath(path) & mask; ci->slots[i]; i = (i + 1) & mask) {
+        ContentFile *cf = ci->files[ci->slots[i] - 1];
+        if (strcmp(cf->path, path) == 0) return cf;
+    }
+    return NULL;
+}
+
+// Rebuilds the path slots for the first count files.
+static int rehashContent(IndexContent *ci, uint32_t slotCap) {
+    uint32_t *slots = (uint32_t *)calloc(slotCap, sizeof(uint32_t));
+    if (!slots) return -1;
+    for (uint32_t f = 0; f < ci->count; f++) {
+        uint32_t i = (uint32_t)hashPath(ci->files[f]->path) & (slotCap - 1);
+        while (slots[i]) i = (i + 1) & (slotCap - 1);
+        slots[i] = f + 1;
+    }
+    free(ci->slots);
+    ci->slots = slots;
+    ci->slotCap = slotCap;
+    return 0;
+}
+
+static ContentFile *addContent(IndexContent *ci, const char *path) {
+    if (ci->count == ci->cap) {
+        uint32_t newCap = ci->cap ? ci->cap * 2 : 1024;
+        ContentFile **grown = (ContentFile **)realloc(ci->files, newCap * sizeof(ContentFile *));
+        if (!grown) return NULL;
+        ci->files = grown;
+        ci->cap = newCap;
+    }
+    if ((ci->count + 1) * 2 > ci->slotCap && rehashContent(ci, ci->slotCap ? ci->slotCap * 2 : 2048) < 0) return NULL;
+    ContentFile *cf = (ContentFile *)calloc(1, sizeof(ContentFile));
+    if (!cf || !(cf->path = strdup(path))) {
+        free(cf);
+        return NULL;
+    }
+    cf->mtime = -1;
+    ci->files[ci->count++] = cf;
+    uint32_t i = (uint32_t)hashPath(path) & (ci->slotCap - 1);
+    while (ci->slots[i]) i = (i + 1) & (ci->slotCap - 1);
+    ci->slots[i] = ci->count;
+    return cf;
+}
+
+static void freeContentFile(ContentFile *cf) {
+    free(cf->grams);
+    free(cf->path);
+    free(cf);
+}
+
+// Distinct trigrams of one file, deduplicated through a 2^24-bit set that
+// is cleared again from the list.
+typedef struct GramSet {
+    uint64_t *bits;
+    uint32_t *list;
+    uint32_t count;
+    uint32_t cap;
+} GramSet;
+
+static void addGram(GramSet *set, uint32_t gram) {
+    uint64_t bit = 1ULL << (gram & 63);
+    if (set->bits[gram >> 6] & bit) return;
+    if (set->count == set->cap) {
+        uint32_t newCap = set->cap ? set->cap * 2 : 4096;
+        uint32_t *grown = (uint32_t *)realloc(set->list, newCap * sizeof(uint32_t));
+        if (!grown) return;
+        set->list = grown;
+        set->cap = newCap;
+    }
+    set->bits[gram >> 6] |= bit;
+    set->list[set->count++] = gram;
+}
+
+static int compareGram(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Adds every trigram of the stream that does not span a line break.
+// Returns the bytes read.
+static int64_t scanGrams(Source *src, GramSet *set, char *buf) {
+    int64_t total = 0;
+    uint32_t gram = 0;
+    int run = 0;            // bytes since the last line break
+    size_t got;
+    while ((got = readSource(src, buf, GREP_WINDOW)) > 0) {
+        for (size_t i = 0; i < got; i++) {
+            unsigned char c = (unsigned char)buf[i];
+            if (c == '\n') {
+                run = 0;
+                continue;
+            }
+            gram = (gram << 8 | (unsigned char)tolower(c)) & 0xFFFFFF;
+            if (++run >= 3) addGram(set, gram);
+        }
+        total += got;
+    }
+    return total;
+}
+
+// Brings one file up to date. Runs on a worker without ci->lock; the file
+// record is only touched by this worker.
+static void updateContent(ContentJob *job, ContentFile *cf, GramSet *set, char *buf) {
+    unsigned char probe[BINARY_PROBE];
+    FILE *f = fopen(cf->path, "rb");
+    if (!f) return;
+    size_t got = fread(probe, 1, sizeof(probe), f);
+    int format = FORMAT_PLAIN;
+    if (got >= 2 && probe[0] == 0x1f && probe[1] == 0x8b) format = FORMAT_GZIP;
+    else if (got >= 4 && le32(probe) == 0xFD2FB528) format = FORMAT_ZSTD;
+
+    // Append check: same kind of file, at least as long, prefix intact.
+    int64_t from = 0;
+    if (format == FORMAT_PLAIN && cf->format == FORMAT_PLAIN && !cf->binary &&
+        cf->offset > 0 && cf->size >= cf->offset) {
+        int64_t head = cf->offset < CHECK_SPAN ? cf->offset : CHECK_SPAN;
+        if (sumRange(f, 0, head, buf) == cf->headSum &&
+            sumRange(f, cf->offset - head, head, buf) == cf->tailSum) from = cf->offset;
+    }
+    fclose(f);
+
+    int64_t read = 0;
+    int appended = from > 0;
+    set->count = 0;
+    if (appended) {
+        for (uint32_t i = 0; i < cf->gramCount; i++) addGram(set, cf->grams[i]);
+    }
+    cf->binary = format == FORMAT_PLAIN && memchr(probe, 0, got) != NULL;
+    Source src;
+    int64_t start = from >= 2 ? from - 2 : 0;   // trigrams across the old end
+    if (!cf->binary && openSource(&src, cf->path, format, start) == 0) {
+        read = scanGrams(&src, set, buf);
+        closeSource(&src);
+    }
+
+    qsort(set->list, set->count, sizeof(uint32_t), compareGram);
+    uint32_t *grams = (uint32_t *)malloc((set->count + 1) * sizeof(uint32_t));
+    if (grams) {
+        memcpy(grams, set->list, set->count * sizeof(uint32_t));
+        free(cf->grams);
+        cf->grams = grams;
+        cf->gramCount = set->count;
+    }
+    for (uint32_t i = 0; i < set->count; i++) set->bits[set->list[i] >> 6] = 0;
+
+    cf->format = format;
+    cf->mtime = cf->liveMtime;
+    if (format == FORMAT_PLAIN && !cf->binary) {
+        // The file may have grown while it was read; record what was.
+        cf->offset = start + read;
+        int64_t span = cf->offset < CHECK_SPAN ? cf->offset : CHECK_SPAN;
+        f = fopen(cf->path, "rb");
+        cf->headSum = f ? sumRange(f, 0, span, buf) : 0;
+        cf->tailSum = f ? sumRange(f, cf->offset - span, span, buf) : 0;
+        if (f) fclose(f);
+    } else {
+        cf->offset = cf->size;
+        cf->headSum = cf->tailSum = 0;
+    }
+
+    mutex_lock(&job->lock);
+    job->ci->stats.lastRead += read;
+    if (appended) job->ci->stats.lastAppended++;
+    else job->ci->stats.lastReindexed++;
+    mutex_unlock(&job->lock);
+}
+
+static void contentWorker(void *arg) {
+    ContentJob *job = (ContentJob *)arg;
+    GramSet set = {(uint64_t *)calloc(1 << 18, sizeof(uint64_t)), NULL, 0, 0};
+    char *buf = (char *)malloc(GREP_WINDOW);
+    while (set.bits && buf) {
+        mutex_lock(&job->lock);
+        ContentFile *cf = job->next < job->count ? job->todo[job->next++] : NULL;
+        mutex_unlock(&job->lock);
+        if (!cf) break;
+        updateContent(job, cf, &set, buf);
+    }
+    free(set.list);
+    free(set.bits);
+    free(buf);
+}
+
+typedef struct ContentList {
+    IndexContent *ci;
+    ContentFile **todo;
+    uint32_t count;
+    uint32_t cap;
+} ContentList;
+
+// Marks one indexed file as listed and queues it when the size or mtime
+// the index holds differs from what was scanned. Runs under the index
+// lock, so the metadata comes from the result rather than a stat.
+static int listContent(const IndexResult *result, void *user) {
+    ContentList *list = (ContentList *)user;
+    IndexContent *ci = list->ci;
+    ContentFile *cf = findContent(ci, result->fullpath);
+    if (!cf && !(cf = addContent(ci, result->fullpath))) return 0;
+    cf->seen = ci->generation;
+    cf->size = result->size;
+    cf->liveMtime = result->mtime;
+    // Unchanged files are not opened at all.
+    if (cf->liveMtime == cf->mtime && cf->size == cf->offset) return 0;
+    if (list->count == list->cap) {
+        uint32_t newCap = list->cap ? list->cap * 2 : 1024;
+        ContentFile **grown = (ContentFile **)realloc(list->todo, newCap * sizeof(ContentFile *));
+        if (!grown) return 0;
+        list->todo = grown;
+        list->cap = newCap;
+    }
+    list->todo[list->count++] = cf;
+    return 0;
+}
+
+// Updates the files matching nameQuery; with no query, also forgets files
+// that are no longer indexed. Caller holds ci->lock.
+static void refreshContent(IndexContent *ci, const char *nameQuery) {
+    ContentList list = {ci, NULL, 0, 0};
+    ci->generation++;
+    ci->stats.lastRead = 0;
+    ci->stats.lastAppended = 0;
+    ci->stats.lastReindexed = 0;
+    indexQuery(ci->ix, nameQuery ? nameQuery : "", listContent, &list);
+
+    ContentJob job;
+    memset(&job, 0, sizeof(job));
+    job.ci = ci;
+    job.todo = list.todo;
+    job.count = list.count;
+
+    mutex_init(&job.lock);
+    int threads = cpuCount();
+    if (threads > (int)job.count) threads = (int)job.count;
+    IndexTasks *group = indexTasksBegin(TASK_UPDATE);
+    for (int i = 0; i < threads; i++) indexTasksSpawn(group, contentWorker, &job);
+    indexTasksWait(group);
+    mutex_destroy(&job.lock);
+    free(job.todo);
+
+    if (!nameQuery || !*nameQuery) {
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < ci->count; i++) {
+            if (ci->files[i]->seen == ci->generation) ci->files[kept++] = ci->files[i];
+            else freeContentFile(ci->files[i]);
+        }
+        if (kept != ci->count) {
+            ci->count = kept;
+            rehashContent(ci, ci->slotCap);
+        }
+    }
+}
+
+static int hasGram(const ContentFile *cf, uint32_t gram) {
+    uint32_t lo = 0, hi = cf->gramCount;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (cf->grams[mid] < gram) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < cf->gramCount && cf->grams[lo] == gram;
+}
+
+static void writeU32(FILE *f, uint32_t v) { fwrite(&v, sizeof(v), 1, f); }
+static void writeI64(FILE *f, int64_t v) { fwrite(&v, sizeof(v), 1, f); }
+static int readU32(FILE *f, uint32_t *v) { return fread(v, sizeof(*v), 1, f) == 1; }
+static int readI64(FILE *f, int64_t *v) { return fread(v, sizeof(*v), 1, f) == 1; }
+
+static int loadContent(IndexContent *ci, FILE *f) {
+    uint32_t magic, version, count, len, format, gramCount;
+    char path[INDEX_MAX_PATH];
+    int64_t offset, mtime, headSum, tailSum;
+    if (!readU32(f, &magic) || magic != CONTENT_FILE_MAGIC ||
+        !readU32(f, &version) || version != CONTENT_FILE_VERSION || !readU32(f, &count)) return 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!readU32(f, &len) || len >= INDEX_MAX_PATH || fread(path, 1, len, f) != len) return 0;
+        path[len] = '\0';
+        if (!readI64(f, &offset) || !readI64(f, &mtime) || !readI64(f, &headSum) ||
+            !readI64(f, &tailSum) || !readU32(f, &format) || !readU32(f, &gramCount) ||
+            gramCount > 1u << 24) return 0;    // no more than there are trigrams
+        ContentFile *cf = findContent(ci, path) ? NULL : addContent(ci, path);
+        if (!cf) return 0;
+        cf->grams = (uint32_t *)malloc(((size_t)gramCount + 1) * sizeof(uint32_t));
+        if (!cf->grams || fread(cf->grams, sizeof(uint32_t), gramCount, f) != gramCount) return 0;
+        for (uint32_t g = 0; g < gramCount; g++) {
+            if (cf->grams[g] > 0xFFFFFF) return 0;
+        }
+        cf->gramCount = gramCount;
+        cf->offset = offset;
+        cf->mtime = mtime;
+        cf->headSum = (uint64_t)headSum;
+        cf->tailSum = (uint64_t)tailSum;
+        cf->format = (int)(format & 0xFF);
+        cf->binary = (format >> 8) & 1;
+    }
+    return 1;
+}
+
+// --- Public Interface ---
+
+long indexGrep(Index *ix, const char *nameQuery, const char *pattern, int flags, IndexGrepFn fn, void *user) {
+    // Paths are copied out so the index lock is not held while reading.
+    PathList list = {NULL, 0, 0};
+    indexQuery(ix, nameQuery ? nameQuery : "", collectPath, &list);
+    return grepPaths(&list, pattern, flags, fn, user);
+}
+
+IndexContent *indexContentOpen(Index *ix, const char *path) {
+    IndexContent *ci = (IndexContent *)calloc(1, sizeof(IndexContent));
+    if (!ci) return NULL;
+    ci->ix = ix;
+    mutex_init(&ci->lock);
+    if (path) {
+        snprintf(ci->file, sizeof(ci->file), "%s", path);
+        FILE *f = fopen(path, "rb");
+        if (f) {
+            int ok = loadContent(ci, f);
+            fclose(f);
+            if (!ok) {
+                indexContentFree(ci);
+                return NULL;
+            }
+        }
+    }
+    return ci;
+}
+
+void indexContentFree(IndexContent *ci) {
+    if (!ci) return;
+    for (uint32_t i = 0; i < ci->count; i++) freeContentFile(ci->files[i]);
+    free(ci->files);
+    free(ci->slots);
+    mutex_destroy(&ci->lock);
+    free(ci);
+}
+
+int indexContentSave(IndexContent *ci) {
+    if (!ci->file[0]) return -1;
+    // Written beside the old file and renamed over it, like the history.
+    char tmp[INDEX_MAX_PATH + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", ci->file);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return -1;
+    mutex_lock(&ci->lock);
+    writeU32(f, CONTENT_FILE_MAGIC);
+    writeU32(f, CONTENT_FILE_VERSION);
+    writeU32(f, ci->count);
+    for (uint32_t i = 0; i < ci->count; i++) {
+        ContentFile *cf = ci->files[i];
+        uint32_t len = (uint32_t)strlen(cf->path);
+        writeU32(f, len);
+        fwrite(cf->path, 1, len, f);
+        writeI64(f, cf->offset);
+        writeI64(f, cf->mtime);
+        writeI64(f, (int64_t)cf->headSum);
+        writeI64(f, (int64_t)cf->tailSum);
+        writeU32(f, (uint32_t)cf->format | (uint32_t)cf->binary << 8);
+        writeU32(f, cf->gramCount);
+        fwrite(cf->grams, sizeof(uint32_t), cf->gramCount, f);
+    }
+    mutex_unlock(&ci->lock);
+
+    int failed = ferror(f);
+    if (fclose(f) != 0) failed = 1;
+    #ifdef OS_WINDOWS
+    if (!failed) remove(ci->file);
+    #endif
+    if (failed || rename(tmp, ci->file) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+int64_t indexContentUpdate(IndexContent *ci, const char *nameQuery) {
+    mutex_lock(&ci->lock);
+    refreshContent(ci, nameQuery);
+    int64_t read = ci->stats.lastRead;
+    mutex_unlock(&ci->lock);
+    return read;
+}
+
+long indexContentGrep(IndexContent *ci, const char *nameQuery, const char *pattern, int flags,
+                      IndexGrepFn fn, void *user) {
+    mutex_lock(&ci->lock);
+    refreshContent(ci, nameQuery);
+
+    // A file can only hold a literal if it holds all of its trigrams.
+    uint32_t grams[64];
+    int gramCount = 0;
+    if (!(flags & GREP_REGEX)) {
+        uint32_t gram = 0;
+        for (int i = 0; pattern[i] && gramCount < 64; i++) {
+            gram = (gram << 8 | (unsigned char)tolower((unsigned char)pattern[i])) & 0xFFFFFF;
+            if (i >= 2) grams[gramCount++] = gram;
+        }
+    }
+    PathList list = {NULL, 0, 0};
+    for (uint32_t i = 0; i < ci->count; i++) {
+        ContentFile *cf = ci->files[i];
+        if (cf->seen != ci->generation || cf->binary) continue;
+        int keep = 1;
+        for (int g = 0; g < gramCount && keep; g++) keep = hasGram(cf, grams[g]);
+        if (!keep) continue;
+        IndexResult result;
+        memset(&result, 0, sizeof(result));
+        result.fullpath = cf->path;
+        collectPath(&result, &list);
+    }
+    ci->stats.lastCandidates = list.count;
+    long hits = grepPaths(&list, pattern, flags, fn, user);
+    mutex_unlock(&ci->lock);
+    return hits;
+}
+
+void indexContentStats(IndexContent *ci, IndexContentStats *stats) {
+    mutex_lock(&ci->lock);
+    *stats = ci->stats;
+    stats->files = ci->count;
+    stats->grams = 0;
+    stats->indexedBytes = 0;
+    for (uint32_t i = 0; i < ci->count; i++) {
+        stats->grams += ci->files[i]->gramCount;
+        stats->indexedBytes += ci->files[i]->offset;
+    }
+    mutex_unlock(&ci->lock);
+}
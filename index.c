@@ -0,0 +1,5804 @@
+/*
+ * Index engine: crawler, shards, change watcher, directory poller and
+ * persistence. See index.h for the public interface.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE     // statx
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <math.h>
+#include <float.h>
+#include <stdint.h>
+
+#include "index.h"
+
+// --- Platform Specifics ---
+#if defined(_WIN32) || defined(_WIN64)
+    #define OS_WINDOWS
+    #include <windows.h>
+    #define PATH_SEP '\\'
+    typedef HANDLE thread_t;
+    typedef CRITICAL_SECTION mutex_t;
+    #define mutex_init(m) InitializeCriticalSection(m)
+    #define mutex_lock(m) EnterCriticalSection(m)
+    #define mutex_unlock(m) LeaveCriticalSection(m)
+    #define mutex_destroy(m) DeleteCriticalSection(m)
+    #define sleep_ms(ms) Sleep(ms)
+    #define THREAD_LOCAL __declspec(thread)
+    #define counter_add(p, n) ((uint64_t)InterlockedExchangeAdd64((volatile LONG64 *)(p), (LONG64)(n)))
+    #define counter_read(p) ((uint64_t)InterlockedCompareExchange64((volatile LONG64 *)(p), 0, 0))
+#else
+    #define OS_POSIX
+    #include <dirent.h>
+    #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <sys/statvfs.h>
+    #include <unistd.h>
+    #include <pthread.h>
+    #include <pwd.h>
+    #include <sys/mman.h>
+    #include <errno.h>
+    #define PATH_SEP '/'
+    typedef pthread_t thread_t;
+    typedef pthread_mutex_t mutex_t;
+    #define mutex_init(m) pthread_mutex_init(m, NULL)
+    #define mutex_lock(m) pthread_mutex_lock(m)
+    #define mutex_unlock(m) pthread_mutex_unlock(m)
+    #define mutex_destroy(m) pthread_mutex_destroy(m)
+    #define sleep_ms(ms) usleep((ms) * 1000)
+    #define THREAD_LOCAL __thread
+    #define counter_add(p, n) __atomic_fetch_add(p, n, __ATOMIC_RELAXED)
+    #define counter_read(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+    #ifdef __linux__
+        #define HAVE_INOTIFY
+        #include <sys/inotify.h>
+        #include <sys/vfs.h>
+        #include <poll.h>
+        #include <sys/xattr.h>
+        #include <sys/sysmacros.h>
+        #include <fcntl.h>
+        #define HAVE_POSIX_ACL
+        #ifdef STATX_BASIC_STATS
+            #define HAVE_STATX
+        #endif
+    #endif
+#endif
+
+// --- Configuration ---
+#define HASH_TABLE_SIZE 16384        // smallest per-shard table, buckets
+#define MAX_HASH_TABLE_SIZE (1 << 22)
+#define PROGRESS_INTERVAL 0.25      // seconds between crawl progress reports
+#define PROGRESS_BATCH 256          // entries a crawler counts before reporting
+#define DIRS_PER_INODE 8            // inodes per directory, until a crawl has measured it
+#define INODE_BATCH_DIRS 32         // sibling directories read before one inode-ordered stat pass
+#define INODE_BATCH_ENTRIES 65536   // entries that close a batch early
+#define REMOTE_IN_FLIGHT 16         // directory reads a remote crawl keeps waiting on the server
+#define GROUP_BLOCK 1024            // ids filtered per pass in indexGroupBy
+#define NAME_BLOCK 64               // ids per entry of the longest-name column
+#define GROUP_IDS_PER_THREAD 65536
+#define COUNT_BLOCK 64              // hash buckets per sampling unit in indexCountStep
+#define RANK_BLOCK 1024             // ids matched per scoring pass in indexQueryRanked
+#define RANK_IDS_PER_THREAD 65536
+#define RANK_LANES 8                // scoring batches are padded to a multiple of this
+#define MAX_EXT_LEN 15
+#define ORDER_FOLD_MIN 4096         // pending changes a sorted view absorbs before a merge
+#define MINHASH_BANDS 10            // LSH bands per name signature
+#define MINHASH_ROWS 2              // minima hashed together into one band key
+#define MINHASH_SIZE (MINHASH_BANDS * MINHASH_ROWS)
+#define SIMILAR_BUCKET_SCAN 4096    // pairs read per band bucket by indexQuerySimilar
+#define SIMILAR_CANDIDATES 16384    // distinct names it estimates at most
+#define SIMILAR_IDS_PER_THREAD 65536
+#define HISTORY_FILE_MAGIC 0x54534948   // "HIST"
+#define HISTORY_FILE_VERSION 1
+#define HISTORY_INTERVAL 300.0      // seconds between snapshots taken by indexUpdate
+#define MAX_PATH_LEN INDEX_MAX_PATH
+#define MAX_ROOTS 64
+#define MAX_SHARDS 256
+#define DEFAULT_POLL_INTERVAL 30
+#define WATCH_SETTLE_SECONDS 1.0
+#define MIN_POLL_INTERVAL 1.0
+#define MAX_POLL_BACKOFF 8          // a quiet directory backs off to 8x its shard's interval
+#define DEFAULT_POLL_BUDGET 2000    // syscalls per second across all polled shards
+#define INDEX_FILE_MAGIC 0x52584449 // "IDXR"
+#define INDEX_FILE_VERSION 6
+#define ID_MOVE_WINDOW 600          // seconds a vanished file's id can follow its inode
+#define ID_RETENTION (30 * 86400)   // seconds a vanished path keeps its id reserved
+#define VIEW_CACHE 16               // viewers whose visibility bitmaps are kept
+#define MAX_ACL_ENTRIES 8191        // the most a 64 KiB xattr can hold
+#define RESIDENCY_INTERVAL 60.0     // seconds between residency passes in indexUpdate
+#define MINCORE_CHUNK 4096          // pages asked about per mincore call
+#define METRIC_SLOTS 64             // per-thread counter slots, threads share them beyond this
+#define LATENCY_BUCKETS 14          // query latency histogram; the last bucket is open-ended
+#define METRICS_INTERVAL 15.0       // seconds between rewrites of the metrics file
+#define FIND_BATCH 16384           // bytes of matching paths a find task gathers per hand-over
+#define FIND_MAX_QUEUED 1024       // directories a find keeps waiting for the pool
+#define CHANGE_WINDOW 2             // seconds an id may be retired and reclaimed unchanged
+#define STANDING_QUEUE_MAX (1 << 22)    // changed ids held for standing queries; more are dropped
+#define STANDING_MAX_HITS 4096      // once one indexUpdate has this many hits, the rest wait their turn
+#define STANDING_RECENT 16          // hits kept for indexStandingRecent
+
+// --- Data Structures ---
+typedef struct FileEntry {
+    char *filename;
+    char *fullpath;
+    uint32_t id;                // stable id, 0 until the entry joins the index
+    uint32_t links;             // hard links when last stat'ed, 0 if unknown
+    uint64_t pathKey;           // fingerprint of fullpath
+    uint64_t inodeKey;          // fingerprint of (device, inode), 0 if unknown
+    int64_t size;
+    int64_t mtime;              // seconds since the epoch
+    uint32_t uid;
+    uint32_t perm;              // permission class of its directory, see Visibility
+    int root;
+    int shard;
+    int dir;                    // index into the shard's directory table, -1 if untracked
+    struct FileEntry *next;
+    struct FileEntry *dirNext;  // next file in the same directory
+} FileEntry;
+
+// Every directory a crawl reads is remembered with its mtime/ctime, so the
+// poller can re-stat it cheaply and re-read it only when it has changed.
+typedef struct DirEntry {
+    char *path;                 // NULL once the directory has gone away
+    int64_t mtime;              // nanoseconds; whole seconds miss changes made
+    int64_t ctime;              // in the same second as the crawl
+    FileEntry *files;
+    uint32_t perm;              // permission class
+    double interval;            // adaptive poll interval, seconds
+    double nextPoll;
+    int children;               // tracked subdirectories
+} DirEntry;
+
+// One crawl root.
+typedef struct Root {
+    char path[MAX_PATH_LEN];
+} Root;
+
+// A shard owns the files under one subtree, minus the subtrees of any shards
+// nested inside it. Every root starts as a single shard; more can be carved
+// out. A refresh builds a fresh table off to the side and swaps it in whole.
+typedef struct Shard {
+    char path[MAX_PATH_LEN];
+    int root;
+    int policy;
+    int interval;           // seconds between refreshes for REFRESH_POLL
+    FileEntry **table;      // tableSize buckets, owned by the shard
+    size_t tableSize;       // power of two, sized when the table is built
+    DirEntry *dirs;
+    int dirCount;
+    int dirCap;
+    int deadDirs;           // dirs whose path is NULL, reclaimed by compactDirs
+    int *dirSlots;          // open-addressing map from path to dirs index: -1 empty, -2 removed
+    size_t dirSlotCap;      // power of two, 0 when there is no map
+    size_t dirSlotsUsed;    // slots not empty, removed ones included
+    int pollCursor;         // where the poller resumes when it ran out of budget
+    long fileCount;
+    double lastRefresh;
+    double crawlSeconds;
+    int crawling;           // a full crawl is running
+    int recrawl;            // asked for again while it ran
+    int dirty;              // watcher saw a change since the last refresh
+    double dirtySince;      // first event since then
+    double lastEvent;
+} Shard;
+
+// Open-addressing map from a 64-bit key fingerprint to an id. Key 0 marks an
+// empty slot.
+typedef struct IdSlot {
+    uint64_t key;
+    uint32_t id;
+} IdSlot;
+
+typedef struct IdMap {
+    IdSlot *slots;
+    size_t cap;             // power of two
+    size_t count;
+} IdMap;
+
+// A sorted view: ids ordered by one column, largest first. Pairs carry the
+// key they were sorted under, so a pair whose id has since died or changed
+// value is recognisably stale and skipped. Changes land unsorted in pending
+// and are merged in once there are enough of them.
+typedef struct SortEntry {
+    int64_t key;
+    uint32_t id;
+} SortEntry;
+
+typedef struct Ordering {
+    SortEntry *sorted;
+    size_t count;
+    SortEntry *pending;
+    size_t pendingCount;
+    size_t pendingCap;
+} Ordering;
+
+// One LSH band: (band key, id) pairs sorted by key, kept like an Ordering.
+// A pair is stale once its id has died or its band key in colBands moved on.
+typedef struct BandEntry {
+    uint32_t key;
+    uint32_t id;
+} BandEntry;
+
+typedef struct Band {
+    BandEntry *sorted;
+    size_t count;
+    BandEntry *pending;
+    size_t pendingCount;
+    size_t pendingCap;
+} Band;
+
+// Interns group keys (extensions, owners, top-level directories) as small
+// codes so the analytics columns can hold a code instead of a string.
+typedef struct Dict {
+    IdMap codes;            // key fingerprint -> code + 1
+    char **names;
+    uint32_t count;
+    uint32_t cap;
+} Dict;
+
+// One stretch of snapshots in which a path was present.
+typedef struct HistSpan {
+    uint32_t path;          // code in History.paths
+    uint32_t first;         // snapshot times, seconds since the epoch
+    uint32_t last;
+    uint32_t prev;          // earlier span of the same path + 1, 0 if none
+} HistSpan;
+
+// Presence history keyed by path rather than id, so it does not depend on
+// the index it was recorded from. Each path has a chain of spans; a span is
+// extended while the path keeps turning up in consecutive snapshots.
+typedef struct History {
+    char file[MAX_PATH_LEN];
+    uint32_t *snapshots;    // ascending
+    uint32_t snapshotCount;
+    uint32_t snapshotCap;
+    Dict paths;
+    uint32_t *head;         // latest span + 1 per path code
+    uint32_t headCap;
+    HistSpan *spans;
+    uint32_t spanCount;
+    uint32_t spanCap;
+    uint32_t *codeById;     // path code + 1 cached per entry id
+    uint32_t codeCap;
+    double lastSnapshot;    // now_seconds() of the last snapshot
+} History;
+
+// Who may see into a directory: its owner, group, mode bits and ACL, plus
+// the class of the directory above, since a viewer must be able to enter
+// every directory on the way down.
+typedef struct AclEntry {
+    uint16_t tag;           // ACL_* as stored in the Linux xattr
+    uint16_t perm;          // 4 read, 2 write, 1 execute
+    uint32_t id;            // uid or gid for ACL_USER and ACL_GROUP
+} AclEntry;
+
+typedef struct PermClass {
+    uint64_t key;           // fingerprint of the fields below
+    uint32_t parent;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t mode;          // permission bits
+    uint32_t aclCount;
+    AclEntry *acl;          // NULL without an ACL
+} PermClass;
+
+// One viewer's verdicts: per class whether they can enter and list it, and
+// per id whether they can see the file.
+typedef struct View {
+    IndexViewer who;        // groups sorted
+    uint64_t key;           // fingerprint of who, 0 for a free slot
+    uint8_t *verdict;       // VERDICT_* per class, 0 until worked out
+    uint32_t verdictCap;
+    uint64_t *visible;      // idCap bits
+    uint64_t lastUse;
+} View;
+
+// Counters one thread adds to without locking; see Metrics.
+enum { METRIC_CRAWLS, METRIC_CRAWLED, METRIC_CRAWL_NANOS, METRIC_VIEW_HITS, METRIC_VIEW_MISSES,
+       METRIC_SHED, METRIC_COUNTERS };
+enum { QUERY_NAME, QUERY_VIEWER, QUERY_RANKED, QUERY_ORDERED, QUERY_HISTORY, QUERY_GROUP, QUERY_SIMILAR,
+       QUERY_KINDS };
+
+// A standing query. Plain patterns match names containing them, globs
+// (with * or ?) whole names, both ignoring case. literal is the longest
+// run without wildcards; the automaton looks for it.
+typedef struct Standing {
+    char *pattern;          // lowercased, NULL once removed
+    char *literal;
+    int glob;
+    long hits;
+    uint32_t seen;          // name stamp, so a name reports a query once
+    int nextSame;           // next query whose literal ends in the same state, -1
+} Standing;
+
+// Aho-Corasick automaton over the literals of every standing query, as a
+// full transition table over the byte classes the literals use.
+typedef struct Automaton {
+    uint8_t cls[256];       // byte -> class, 0 for bytes in no literal
+    int classes;
+    int32_t *next;          // states x classes
+    int32_t *out;           // first query whose literal ends here, -1
+    int32_t *dict;          // nearest proper suffix state with output, 0
+    int states;
+    int *always;            // queries with no literal ("*"), checked on every name
+    int alwaysCount;
+} Automaton;
+
+typedef struct MetricSlot {
+    uint64_t counters[METRIC_COUNTERS];
+    uint64_t latency[QUERY_KINDS][LATENCY_BUCKETS];     // queries per bucket, not cumulative
+    uint64_t latencyNanos[QUERY_KINDS];
+} MetricSlot;
+
+struct Index {
+    mutex_t lock;
+    long totalFiles;
+    Root roots[MAX_ROOTS];
+    int rootCount;
+    Shard shards[MAX_SHARDS];
+    int shardCount;
+
+    // Change watcher
+    int watchFd;
+    int *watchShard;        // watch descriptor -> shard
+    int watchCap;
+    mutex_t watchLock;
+
+    // Directory poller
+    int pollBudget;
+    long pollSyscalls;      // spent in the last tick
+    int crawlOrder;         // CRAWL_ORDER_*
+    long pollRereads;       // directories re-read since creation
+
+    // Stable ids
+    IdMap pathIds;
+    IdMap inodeIds;
+    uint32_t nextId;
+    uint32_t idCap;
+    FileEntry **byId;       // live entry per id, NULL once retired
+    uint32_t *retiredAt;    // wall-clock seconds the id last went away
+    uint32_t *pathChecks;   // checkPath of the id's last path, to catch pathKey collisions
+
+    // Analytics columns, indexed by id alongside byId. byId says which ids
+    // are live; the columns of a retired id are stale.
+    int64_t *colSize;
+    int64_t *colMtime;
+    uint32_t *colExt;       // code in extDict
+    uint32_t *colOwner;     // code in ownerDict
+    uint32_t *colTop;       // code in topDict
+    uint32_t *colShard;
+    uint16_t *colNameLen;   // ranking features, and lets name scans skip short names
+    uint16_t *colDepth;     // path separators in fullpath
+    uint16_t *blockNameLen; // longest name per NAME_BLOCK ids; only grows, so a bound
+    uint32_t *colOpens;     // indexNoteOpen calls; kept across refreshes
+    int64_t *colOpened;     // time of the last one, seconds since the epoch
+    Dict extDict;
+    Dict ownerDict;
+    Dict topDict;
+    IdMap uidOwners;        // uid fingerprint -> owner code + 1
+
+    // Sorted views over colMtime and colSize, built on first use
+    Ordering byMtime;
+    Ordering bySize;
+    int orderingsBuilt;
+    int orderingsRebuilding;    // sorting off the lock; pending is not folded meanwhile
+
+    // Similar names, built on first use
+    uint32_t *colBands;     // MINHASH_BANDS band keys per id
+    Band bands[MINHASH_BANDS];
+    int similarBuilt;
+
+    History *history;       // NULL unless indexOpenHistory was called
+
+    // Visibility. Crawlers add classes without the index lock, so the class
+    // table has a lock of its own, taken after the index lock.
+    mutex_t permLock;
+    PermClass *perms;
+    uint32_t permCount;
+    uint32_t permCap;
+    uint32_t *permSlots;    // class key -> class + 1, open addressing
+    uint32_t permSlotCap;   // power of two
+    uint32_t *colPerm;      // class per id
+    View views[VIEW_CACHE];
+    uint64_t viewClock;
+
+    // Standing queries. Changed ids queue up in claimId and are matched
+    // in batches by indexUpdate.
+    Standing *standing;
+    int standingCount;      // slots, removed ones included
+    int standingLive;
+    Automaton automaton;
+    int automatonStale;
+    uint32_t nameStamp;
+    uint32_t *changed;
+    size_t changedCount;
+    size_t changedCap;
+    long changeDrops;
+    long namesChecked;
+    long standingHits;
+    IndexStandingHit recent[STANDING_RECENT];   // ring, newest at recentNext - 1
+    int recentNext;
+    int recentCount;
+    IndexStandingFn standingFn;
+    void *standingUser;
+
+    // Residency policy per MEM_* section
+    int residency[MEM_SECTIONS];
+    int64_t lockedBytes[MEM_SECTIONS];
+    int64_t memBytes[MEM_SECTIONS];     // as of the last residency pass
+    int64_t memResident[MEM_SECTIONS];
+    double lastResidency;
+
+    // Metrics, summed over the slots when scraped
+    MetricSlot metrics[METRIC_SLOTS];
+    char metricsFile[MAX_PATH_LEN];     // rewritten by indexUpdate, empty for none
+    double lastMetrics;
+
+    // Background updater
+    volatile int stopRefresher;
+    thread_t refresherThread;
+    int refresherRunning;
+};
+
+// --- System Utilities ---
+
+// Case-insensitive substring search
+static char *stristr(const char *haystack, const char *needle) {
+    if (!*needle) return (char *)haystack;
+    for (; *haystack; haystack++) {
+        if (tolower((unsigned char)*haystack) == tolower((unsigned char)*needle)) {
+            const char *h = haystack, *n = needle;
+            while (*h && *n && tolower((unsigned char)*h) == tolower((unsigned char)*n)) {
+                h++;
+                n++;
+            }
+            if (!*n) return (char *)haystack;
+        }
+    }
+    return NULL;
+}
+
+// Starts fn(arg) on a new thread. Returns 0 on success.
+typedef struct ThreadStart {
+    void *(*fn)(void *);
+    void *arg;
+} ThreadStart;
+
+#ifdef OS_WINDOWS
+static DWORD WINAPI thread_trampoline(LPVOID param) {
+    ThreadStart start = *(ThreadStart *)param;
+    free(param);
+    start.fn(start.arg);
+    return 0;
+}
+#endif
+
+static int thread_start(thread_t *t, void *(*fn)(void *), void *arg) {
+    #ifdef OS_WINDOWS
+    ThreadStart *start = (ThreadStart *)malloc(sizeof(ThreadStart));
+    if (!start) return -1;
+    start->fn = fn;
+    start->arg = arg;
+    *t = CreateThread(NULL, 0, thread_trampoline, start, 0, NULL);
+    if (*t == NULL) { free(start); return -1; }
+    return 0;
+    #else
+    return pthread_create(t, NULL, fn, arg) == 0 ? 0 : -1;
+    #endif
+}
+
+static void thread_join(thread_t t) {
+    #ifdef OS_WINDOWS
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+    #else
+    pthread_join(t, NULL);
+    #endif
+}
+
+static int cpuCount(void) {
+    #ifdef OS_WINDOWS
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+    #else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+    #endif
+}
+
+static double now_seconds() {
+    #ifdef OS_WINDOWS
+    return GetTickCount64() / 1000.0;
+    #else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+    #endif
+}
+
+// Upper bounds of the latency buckets, seconds.
+static const double latencyBounds[LATENCY_BUCKETS - 1] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1
+};
+
+// The calling thread's counters. Threads are dealt slots in turn, so adds
+// are practically uncontended; they are atomic for the threads that share.
+static MetricSlot *metricSlot(Index *ix) {
+    static uint64_t nextSlot;
+    static THREAD_LOCAL int slot = -1;
+    if (slot < 0) slot = (int)(counter_add(&nextSlot, 1) % METRIC_SLOTS);
+    return &ix->metrics[slot];
+}
+
+static void metricAdd(Index *ix, int counter, uint64_t n) {
+    counter_add(&metricSlot(ix)->counters[counter], n);
+}
+
+// Records a query of the given QUERY_* kind that started at start.
+static void noteQuery(Index *ix, int kind, double start) {
+    double seconds = now_seconds() - start;
+    int b = 0;
+    while (b < LATENCY_BUCKETS - 1 && seconds > latencyBounds[b]) b++;
+    MetricSlot *m = metricSlot(ix);
+    counter_add(&m->latency[kind][b], 1);
+    counter_add(&m->latencyNanos[kind], (uint64_t)(seconds > 0 ? seconds * 1e9 : 0));
+}
+
+static unsigned long hash(const char *str) {
+    unsigned long hash = 5381;
+    int c;
+    while ((c = *str++))
+        hash = ((hash << 5) + hash) + tolower(c);
+    return hash;
+}
+
+static size_t bucketOf(const Shard *sh, const char *name) {
+    return hash(name) & (sh->tableSize - 1);
+}
+
+// Smallest power-of-two table that keeps chains around one entry long.
+static size_t tableSizeFor(long entries) {
+    size_t size = HASH_TABLE_SIZE;
+    while ((long)size < entries && size < MAX_HASH_TABLE_SIZE) size *= 2;
+    return size;
+}
+
+// --- Indexing Engine ---
+
+// Entries found by one crawl are collected privately and turned into a table
+// in one go, so crawler threads never contend per file.
+typedef struct Crawl {
+    Index *ix;
+    int root;
+    int shard;
+    FileEntry *head;
+    long count;
+    DirEntry *dirs;
+    int dirCount;
+    int dirCap;
+    int dir;                // directory currently being read, -1 if untracked
+    uint32_t perm;          // its permission class
+    int watch;              // the shard's policy, as of initCrawl
+    int interval;
+    long expected;          // entries expected, 0 if unknown; sizes the table
+    struct Build *build;    // progress reporting, NULL outside indexBuild
+    long unreported;        // entries not yet added to build->scanned
+} Crawl;
+
+// Snapshots the shard's policy, so a crawl is not affected by a change
+// made while it runs. Caller holds the lock.
+static void initCrawl(Index *ix, Crawl *crawl, int shard) {
+    memset(crawl, 0, sizeof(Crawl));
+    crawl->ix = ix;
+    crawl->root = ix->shards[shard].root;
+    crawl->shard = shard;
+    crawl->dir = -1;
+    crawl->watch = ix->shards[shard].policy == REFRESH_WATCH;
+    crawl->interval = ix->shards[shard].interval;
+}
+
+// A crawl of part of another's subtree, sharing its snapshot.
+static void initPiece(Crawl *piece, const Crawl *whole) {
+    memset(piece, 0, sizeof(Crawl));
+    piece->ix = whole->ix;
+    piece->root = whole->root;
+    piece->shard = whole->shard;
+    piece->dir = -1;
+    piece->watch = whole->watch;
+    piece->interval = whole->interval;
+    piece->build = whole->build;
+}
+
+static uint64_t hashPath(const char *str) {
+    uint64_t h = 14695981039346656037ULL;
+    while (*str) {
+        h ^= (unsigned char)*str++;
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+// A second, unrelated hash of a path, which tells apart two paths whose
+// hashPath collides.
+static uint32_t checkPath(const char *str) {
+    uint32_t h = 2166136261u;
+    while (*str) {
+        h ^= (unsigned char)*str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint64_t hashInode(uint64_t device, uint64_t inode) {
+    uint64_t h = device * 0x9E3779B97F4A7C15ULL ^ inode;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h ? h : 1;
+}
+
+// What a crawl learns about a file besides its name.
+typedef struct FileMeta {
+    uint64_t inodeKey;      // hashInode(dev, ino), 0 where there are no inodes
+    int64_t size;
+    int64_t mtime;          // seconds since the epoch
+    uint32_t uid;
+    uint32_t links;         // 0 where unknown
+} FileMeta;
+
+static void addFile(Crawl *crawl, const char *name, const char *path, const FileMeta *meta) {
+    FileEntry *newEntry = (FileEntry *)malloc(sizeof(FileEntry));
+    if (!newEntry) return;
+
+    newEntry->filename = strdup(name);
+    newEntry->fullpath = strdup(path);
+    newEntry->id = 0;
+    newEntry->pathKey = hashPath(path);
+    newEntry->inodeKey = meta->inodeKey;
+    newEntry->links = meta->links;
+    newEntry->size = meta->size;
+    newEntry->mtime = meta->mtime;
+    newEntry->uid = meta->uid;
+    newEntry->perm = crawl->perm;
+    newEntry->root = crawl->root;
+    newEntry->shard = crawl->shard;
+    newEntry->dir = crawl->dir;
+    newEntry->dirNext = NULL;
+    if (crawl->dir >= 0) {
+        newEntry->dirNext = crawl->dirs[crawl->dir].files;
+        crawl->dirs[crawl->dir].files = newEntry;
+    }
+    newEntry->next = crawl->head;
+    crawl->head = newEntry;
+    crawl->count++;
+}
+
+// Grows the crawl's directory table to hold at least cap entries.
+static int reserveDirs(Crawl *crawl, int cap) {
+    if (cap <= crawl->dirCap) return 0;
+    DirEntry *grown = (DirEntry *)realloc(crawl->dirs, cap * sizeof(DirEntry));
+    if (!grown) return -1;
+    crawl->dirs = grown;
+    crawl->dirCap = cap;
+    return 0;
+}
+
+// Returns the new directory's index, or -1 when out of memory.
+static int addDir(Crawl *crawl, const char *path, int64_t mtime, int64_t ctime) {
+    if (crawl->dirCount == crawl->dirCap &&
+        reserveDirs(crawl, crawl->dirCap ? crawl->dirCap * 2 : 64) < 0) return -1;
+    DirEntry *d = &crawl->dirs[crawl->dirCount];
+    d->path = strdup(path);
+    d->mtime = mtime;
+    d->ctime = ctime;
+    d->files = NULL;
+    d->perm = crawl->perm;
+    d->interval = crawl->interval;
+    // Spread the first polls over one interval instead of all at once.
+    d->nextPoll = now_seconds() + d->interval * (rand() / (RAND_MAX + 1.0));
+    d->children = 0;
+    return crawl->dirCount++;
+}
+
+// --- Directory Map ---
+// A shard finds its directories by path through an open-addressing map, so
+// the poller and ingest need not scan them. Each directory also counts its
+// tracked subdirectories. Caller holds the lock throughout.
+
+// Returns the index of the live directory at path, or -1.
+static int findDir(const Shard *sh, const char *path) {
+    if (!sh->dirSlotCap) {
+        // No map (out of memory): scan.
+        for (int d = 0; d < sh->dirCount; d++) {
+            if (sh->dirs[d].path && strcmp(sh->dirs[d].path, path) == 0) return d;
+        }
+        return -1;
+    }
+    size_t mask = sh->dirSlotCap - 1;
+    for (size_t i = hashPath(path) & mask;; i = (i + 1) & mask) {
+        int d = sh->dirSlots[i];
+        if (d == -1) return -1;
+        if (d >= 0 && strcmp(sh->dirs[d].path, path) == 0) return d;
+    }
+}
+
+// Returns the directory that holds path, or -1.
+static int findParentDir(const Shard *sh, const char *path) {
+    char parent[MAX_PATH_LEN];
+    const char *sep = strrchr(path, PATH_SEP);
+    if (!sep) return -1;
+    size_t len = sep > path ? (size_t)(sep - path) : 1;
+    memcpy(parent, path, len);
+    parent[len] = '\0';
+    return strcmp(parent, path) == 0 ? -1 : findDir(sh, parent);
+}
+
+static void putDir(Shard *sh, int d) {
+    size_t mask = sh->dirSlotCap - 1;
+    size_t i = hashPath(sh->dirs[d].path) & mask;
+    while (sh->dirSlots[i] >= 0) i = (i + 1) & mask;
+    if (sh->dirSlots[i] == -1) sh->dirSlotsUsed++;
+    sh->dirSlots[i] = d;
+}
+
+// Rebuilds the map and the subdirectory counts from sh->dirs. Out of
+// memory leaves no map, and findDir scans instead.
+static void mapDirs(Shard *sh) {
+    free(sh->dirSlots);
+    sh->dirSlots = NULL;
+    sh->dirSlotCap = sh->dirSlotsUsed = 0;
+    size_t cap = 64;
+    while (cap < (size_t)sh->dirCount * 2) cap *= 2;
+    int *slots = (int *)malloc(cap * sizeof(int));
+    if (slots) {
+        memset(slots, 0xFF, cap * sizeof(int));
+        sh->dirSlots = slots;
+        sh->dirSlotCap = cap;
+        for (int d = 0; d < sh->dirCount; d++) {
+            if (sh->dirs[d].path) putDir(sh, d);
+        }
+    }
+    for (int d = 0; d < sh->dirCount; d++) sh->dirs[d].children = 0;
+    for (int d = 0; d < sh->dirCount; d++) {
+        int parent = sh->dirs[d].path ? findParentDir(sh, sh->dirs[d].path) : -1;
+        if (parent >= 0) sh->dirs[parent].children++;
+    }
+}
+
+// Adds the live directories from first on, which are new to the map.
+static void mapNewDirs(Shard *sh, int first) {
+    if (!sh->dirSlotCap || (sh->dirSlotsUsed + (size_t)(sh->dirCount - first)) * 2 > sh->dirSlotCap) {
+        mapDirs(sh);
+        return;
+    }
+    for (int d = first; d < sh->dirCount; d++) {
+        if (sh->dirs[d].path) putDir(sh, d);
+    }
+    for (int d = first; d < sh->dirCount; d++) {
+        int parent = sh->dirs[d].path ? findParentDir(sh, sh->dirs[d].path) : -1;
+        if (parent >= 0) sh->dirs[parent].children++;
+    }
+}
+
+// Takes a directory that is about to lose its path out of the map.
+static void unmapDir(Shard *sh, int d) {
+    int parent = findParentDir(sh, sh->dirs[d].path);
+    if (parent >= 0) sh->dirs[parent].children--;
+    sh->deadDirs++;
+    if (!sh->dirSlotCap) return;
+    size_t mask = sh->dirSlotCap - 1;
+    for (size_t i = hashPath(sh->dirs[d].path) & mask; sh->dirSlots[i] != -1; i = (i + 1) & mask) {
+        if (sh->dirSlots[i] == d) {
+            sh->dirSlots[i] = -2;
+            return;
+        }
+    }
+}
+
+// Drops the slots of directories that went away once they make up half
+// the table, renumbering the rest. Directory indexes held across an
+// unlock must be checked against the path again, as they already are
+// against a rebuild.
+static void compactDirs(Shard *sh) {
+    if (sh->deadDirs < 64 || sh->deadDirs * 2 < sh->dirCount) return;
+    int live = 0;
+    for (int d = 0; d < sh->dirCount; d++) {
+        if (!sh->dirs[d].path) continue;
+        if (live != d) {
+            sh->dirs[live] = sh->dirs[d];
+            for (FileEntry *e = sh->dirs[live].files; e; e = e->dirNext) e->dir = live;
+        }
+        live++;
+    }
+    sh->dirCount = live;
+    sh->deadDirs = 0;
+    sh->pollCursor = 0;
+    mapDirs(sh);
+}
+
+static void freeDirs(DirEntry *dirs, int count) {
+    for (int i = 0; i < count; i++) free(dirs[i].path);
+    free(dirs);
+}
+
+static void freeEntry(FileEntry *entry) {
+    free(entry->filename);
+    free(entry->fullpath);
+    free(entry);
+}
+
+static void freeChain(FileEntry *entry) {
+    while (entry) {
+        FileEntry *temp = entry;
+        entry = entry->next;
+        freeEntry(temp);
+    }
+}
+
+static void freeTable(FileEntry **table, size_t size) {
+    if (!table) return;
+    for (size_t i = 0; i < size; i++) freeChain(table[i]);
+    free(table);
+}
+
+// Links the crawl's entries into a table of *size buckets, sized for the
+// larger of what was found and what was expected so later growth from the
+// poller and ingest does not lengthen the chains.
+static FileEntry **buildTable(Crawl *crawl, size_t *size) {
+    *size = tableSizeFor(crawl->count > crawl->expected ? crawl->count : crawl->expected);
+    FileEntry **table = (FileEntry **)calloc(*size, sizeof(FileEntry *));
+    if (!table) return NULL;
+    FileEntry *entry = crawl->head;
+    while (entry) {
+        FileEntry *next = entry->next;
+        unsigned long index = hash(entry->filename) & (*size - 1);
+        entry->next = table[index];
+        table[index] = entry;
+        entry = next;
+    }
+    crawl->head = NULL;
+    return table;
+}
+
+static void clearIndex(Index *ix) {
+    mutex_lock(&ix->lock);
+    for (int s = 0; s < ix->shardCount; s++) {
+        freeTable(ix->shards[s].table, ix->shards[s].tableSize);
+        freeDirs(ix->shards[s].dirs, ix->shards[s].dirCount);
+        ix->shards[s].table = NULL;
+        ix->shards[s].tableSize = 0;
+        ix->shards[s].dirs = NULL;
+        ix->shards[s].dirCount = ix->shards[s].dirCap = 0;
+        ix->shards[s].deadDirs = 0;
+        free(ix->shards[s].dirSlots);
+        ix->shards[s].dirSlots = NULL;
+        ix->shards[s].dirSlotCap = ix->shards[s].dirSlotsUsed = 0;
+        ix->shards[s].fileCount = 0;
+    }
+    if (ix->byId) memset(ix->byId, 0, ix->idCap * sizeof(FileEntry *));
+    ix->totalFiles = 0;
+    mutex_unlock(&ix->lock);
+}
+
+// Strips trailing separators so prefix comparisons between roots and shards
+// line up.
+static void normalizePath(const char *in, char *out) {
+    strncpy(out, in, MAX_PATH_LEN - 1);
+    out[MAX_PATH_LEN - 1] = '\0';
+    size_t len = strlen(out);
+    while (len > 1 && (out[len - 1] == '/' || out[len - 1] == '\\')) out[--len] = '\0';
+}
+
+// Returns 1 when path equals parent or lies underneath it.
+static int isPathWithin(const char *path, const char *parent) {
+    size_t plen = strlen(parent);
+    if (strncmp(path, parent, plen) != 0) return 0;
+    return path[plen] == '\0' || path[plen] == PATH_SEP || parent[plen - 1] == PATH_SEP;
+}
+
+// Returns 1 when path names an entry directly inside parent.
+static int isPathChild(const char *path, const char *parent) {
+    size_t plen = strlen(parent);
+    if (strncmp(path, parent, plen) != 0 || path[plen] == '\0') return 0;
+    if (path[plen] != PATH_SEP && parent[plen - 1] != PATH_SEP) return 0;
+    const char *rest = path + plen;
+    while (*rest == PATH_SEP) rest++;
+    return *rest && !strchr(rest, PATH_SEP);
+}
+
+// Returns 1 when path is the top of a shard other than `shard`; the crawl of
+// `shard` stops there and leaves that subtree to its owner.
+static int isShardBoundary(Index *ix, int shard, const char *path) {
+    for (int s = 0; s < ix->shardCount; s++) {
+        if (s != shard && strcmp(ix->shards[s].path, path) == 0) return 1;
+    }
+    return 0;
+}
+
+// --- Sorted Views ---
+// "Recent" and "largest" walk a prefix of a sorted permutation of ids
+// instead of scanning every file. A full build sorts both views in
+// parallel; after that, each claimed id is queued in pending and folded in
+// by a linear merge.
+
+static int compareSortEntries(const void *a, const void *b) {
+    const SortEntry *x = (const SortEntry *)a, *y = (const SortEntry *)b;
+    if (x->key != y->key) return x->key < y->key ? 1 : -1;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+static int sortEntryLive(const Index *ix, const int64_t *column, const SortEntry *e) {
+    return e->id < ix->idCap && ix->byId[e->id] && column[e->id] == e->key;
+}
+
+// Merges pending into sorted, dropping stale and duplicate pairs.
+// Caller holds the lock.
+static void foldOrdering(Index *ix, Ordering *o, const int64_t *column) {
+    qsort(o->pending, o->pendingCount, sizeof(SortEntry), compareSortEntries);
+    SortEntry *merged = (SortEntry *)malloc((o->count + o->pendingCount + 1) * sizeof(SortEntry));
+    if (!merged) return;
+    size_t i = 0, j = 0, n = 0;
+    while (i < o->count || j < o->pendingCount) {
+        const SortEntry *next = j == o->pendingCount ||
+            (i < o->count && compareSortEntries(&o->sorted[i], &o->pending[j]) <= 0)
+            ? &o->sorted[i++] : &o->pending[j++];
+        if (!sortEntryLive(ix, column, next)) continue;
+        if (n && merged[n - 1].id == next->id && merged[n - 1].key == next->key) continue;
+        merged[n++] = *next;
+    }
+    free(o->sorted);
+    o->sorted = merged;
+    o->count = n;
+    o->pendingCount = 0;
+}
+
+static void pushOrdering(Index *ix, Ordering *o, const int64_t *column, int64_t key, uint32_t id) {
+    if (o->pendingCount == o->pendingCap) {
+        size_t newCap = o->pendingCap ? o->pendingCap * 2 : ORDER_FOLD_MIN;
+        SortEntry *grown = (SortEntry *)realloc(o->pending, newCap * sizeof(SortEntry));
+        if (!grown) return;
+        o->pending = grown;
+        o->pendingCap = newCap;
+    }
+    o->pending[o->pendingCount].key = key;
+    o->pending[o->pendingCount].id = id;
+    o->pendingCount++;
+    if (!ix->orderingsRebuilding && o->pendingCount >= ORDER_FOLD_MIN && o->pendingCount > o->count / 8) {
+        foldOrdering(ix, o, column);
+    }
+}
+
+// Called whenever an id's columns are (re)written. Caller holds the lock.
+static void noteOrderings(Index *ix, uint32_t id) {
+    if (!ix->orderingsBuilt && !ix->orderingsRebuilding) return;
+    pushOrdering(ix, &ix->byMtime, ix->colMtime, ix->colMtime[id], id);
+    pushOrdering(ix, &ix->bySize, ix->colSize, ix->colSize[id], id);
+}
+
+typedef struct SortJob {
+    SortEntry *entries;
+    size_t count;
+} SortJob;
+
+static void sortWorker(void *arg) {
+    SortJob *job = (SortJob *)arg;
+    qsort(job->entries, job->count, sizeof(SortEntry), compareSortEntries);
+}
+
+// Snapshots the live ids under the lock and sorts both views off it, in
+// parallel. Changes made meanwhile queue up in pending and are only folded
+// into the new views once they are in; until then queries read the old
+// views and pending, which the snapshot starts from. A second caller
+// waits for the rebuild in flight.
+static void rebuildOrderings(Index *ix) {
+    mutex_lock(&ix->lock);
+    if (ix->orderingsRebuilding) {
+        while (ix->orderingsRebuilding) {
+            mutex_unlock(&ix->lock);
+            sleep_ms(1);
+            mutex_lock(&ix->lock);
+        }
+        mutex_unlock(&ix->lock);
+        return;
+    }
+    size_t live = 0;
+    uint32_t ids = ix->nextId + 1 < ix->idCap ? ix->nextId + 1 : ix->idCap;
+    for (uint32_t id = 1; id < ids; id++) live += ix->byId[id] != NULL;
+    SortJob jobs[2];
+    jobs[0].entries = (SortEntry *)malloc((live + 1) * sizeof(SortEntry));
+    jobs[1].entries = (SortEntry *)malloc((live + 1) * sizeof(SortEntry));
+    if (!jobs[0].entries || !jobs[1].entries) {
+        free(jobs[0].entries);
+        free(jobs[1].entries);
+        mutex_unlock(&ix->lock);
+        return;
+    }
+    size_t n = 0;
+    for (uint32_t id = 1; id < ids; id++) {
+        if (!ix->byId[id]) continue;
+        jobs[0].entries[n].key = ix->colMtime[id];
+        jobs[0].entries[n].id = id;
+        jobs[1].entries[n].key = ix->colSize[id];
+        jobs[1].entries[n].id = id;
+        n++;
+    }
+    jobs[0].count = jobs[1].count = n;
+    if (ix->orderingsBuilt) {
+        foldOrdering(ix, &ix->byMtime, ix->colMtime);
+        foldOrdering(ix, &ix->bySize, ix->colSize);
+    } else {
+        ix->byMtime.pendingCount = ix->bySize.pendingCount = 0;
+    }
+    ix->orderingsRebuilding = 1;
+    mutex_unlock(&ix->lock);
+
+    IndexTasks *sorts = indexTasksBegin(TASK_BUILD);
+    indexTasksSpawn(sorts, sortWorker, &jobs[0]);
+    indexTasksSpawn(sorts, sortWorker, &jobs[1]);
+    indexTasksWait(sorts);
+
+    mutex_lock(&ix->lock);
+    free(ix->byMtime.sorted);
+    free(ix->bySize.sorted);
+    ix->byMtime.sorted = jobs[0].entries;
+    ix->byMtime.count = n;
+    ix->bySize.sorted = jobs[1].entries;
+    ix->bySize.count = n;
+    if (ix->byMtime.pendingCount) foldOrdering(ix, &ix->byMtime, ix->colMtime);
+    if (ix->bySize.pendingCount) foldOrdering(ix, &ix->bySize, ix->colSize);
+    ix->orderingsRebuilding = 0;
+    ix->orderingsBuilt = 1;
+    mutex_unlock(&ix->lock);
+}
+
+// --- Similar Names ---
+// indexQuerySimilar finds names that share most of their character
+// trigrams with a given one. Each name gets a MinHash signature: per hash
+// function, the smallest hash over its trigrams, so two signatures agree
+// in about the Jaccard similarity of the trigram sets. The signature is
+// cut into bands and each band hashed to a key; names sharing any band key
+// are candidates, found by binary search per band rather than a scan. The
+// bands are built on first use, in parallel, and afterwards every claimed
+// id is queued in pending and folded in like the sorted views.
+
+// MinHash signature of a name's trigrams, lowercased, with the start and
+// end of the name marked so short names and their ends count.
+static void nameSignature(const char *name, uint32_t *sig) {
+    for (int k = 0; k < MINHASH_SIZE; k++) sig[k] = UINT32_MAX;
+    unsigned char prev2 = 1, prev1 = 1;
+    for (const char *p = name;; p++) {
+        unsigned char c = *p ? (unsigned char)tolower((unsigned char)*p) : 2;
+        if (prev1 != 1) {
+            uint64_t h = hashInode(0, (uint64_t)prev2 << 16 | (uint64_t)prev1 << 8 | c);
+            for (int k = 0; k < MINHASH_SIZE; k++) {
+                uint32_t v = (uint32_t)((h * (0x9E3779B97F4A7C15ULL * (k + 1) | 1)) >> 32);
+                if (v < sig[k]) sig[k] = v;
+            }
+        }
+        if (!*p) break;
+        prev2 = prev1;
+        prev1 = c;
+    }
+}
+
+static uint32_t bandKey(const uint32_t *sig, int band) {
+    uint64_t h = (uint64_t)band;
+    for (int r = 0; r < MINHASH_ROWS; r++) h = hashInode(h, sig[band * MINHASH_ROWS + r]);
+    return (uint32_t)(h ^ h >> 32);
+}
+
+static int compareBandEntries(const void *a, const void *b) {
+    const BandEntry *x = (const BandEntry *)a, *y = (const BandEntry *)b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+static int bandEntryLive(const Index *ix, int band, const BandEntry *e) {
+    return e->id < ix->idCap && ix->byId[e->id] && ix->colBands[(size_t)e->id * MINHASH_BANDS + band] == e->key;
+}
+
+// Merges pending into sorted, dropping stale and duplicate pairs.
+// Caller holds the lock.
+static void foldBand(Index *ix, int band) {
+    Band *b = &ix->bands[band];
+    qsort(b->pending, b->pendingCount, sizeof(BandEntry), compareBandEntries);
+    BandEntry *merged = (BandEntry *)malloc((b->count + b->pendingCount + 1) * sizeof(BandEntry));
+    if (!merged) return;
+    size_t i = 0, j = 0, n = 0;
+    while (i < b->count || j < b->pendingCount) {
+        const BandEntry *next = j == b->pendingCount ||
+            (i < b->count && compareBandEntries(&b->sorted[i], &b->pending[j]) <= 0)
+            ? &b->sorted[i++] : &b->pending[j++];
+        if (!bandEntryLive(ix, band, next)) continue;
+        if (n && merged[n - 1].id == next->id && merged[n - 1].key == next->key) continue;
+        merged[n++] = *next;
+    }
+    free(b->sorted);
+    b->sorted = merged;
+    b->count = n;
+    b->pendingCount = 0;
+}
+
+static void pushBand(Index *ix, int band, uint32_t key, uint32_t id) {
+    Band *b = &ix->bands[band];
+    if (b->pendingCount == b->pendingCap) {
+        size_t newCap = b->pendingCap ? b->pendingCap * 2 : ORDER_FOLD_MIN;
+        BandEntry *grown = (BandEntry *)realloc(b->pending, newCap * sizeof(BandEntry));
+        if (!grown) return;
+        b->pending = grown;
+        b->pendingCap = newCap;
+    }
+    b->pending[b->pendingCount].key = key;
+    b->pending[b->pendingCount].id = id;
+    b->pendingCount++;
+    if (b->pendingCount >= ORDER_FOLD_MIN && b->pendingCount > b->count / 8) foldBand(ix, band);
+}
+
+// Called whenever an id's columns are (re)written. Caller holds the lock.
+static void noteSimilar(Index *ix, uint32_t id) {
+    if (!ix->similarBuilt) return;
+    uint32_t sig[MINHASH_SIZE];
+    uint32_t *keys = ix->colBands + (size_t)id * MINHASH_BANDS;
+    nameSignature(ix->byId[id]->filename, sig);
+    for (int band = 0; band < MINHASH_BANDS; band++) {
+        keys[band] = bandKey(sig, band);
+        pushBand(ix, band, keys[band], id);
+    }
+}
+
+typedef struct SignJob {
+    Index *ix;
+    uint32_t from, to;      // id range, to exclusive
+} SignJob;
+
+static void signWorker(void *arg) {
+    SignJob *job = (SignJob *)arg;
+    uint32_t sig[MINHASH_SIZE];
+    for (uint32_t id = job->from; id < job->to; id++) {
+        if (!job->ix->byId[id]) continue;
+        nameSignature(job->ix->byId[id]->filename, sig);
+        for (int band = 0; band < MINHASH_BANDS; band++)
+            job->ix->colBands[(size_t)id * MINHASH_BANDS + band] = bandKey(sig, band);
+    }
+}
+
+typedef struct BandJob {
+    BandEntry *entries;
+    size_t count;
+} BandJob;
+
+static void bandWorker(void *arg) {
+    BandJob *job = (BandJob *)arg;
+    qsort(job->entries, job->count, sizeof(BandEntry), compareBandEntries);
+}
+
+// Signs every live name, then sorts each band, both in parallel. Unlike
+// the sorted views this holds the lock throughout, since the names are
+// read in place. Returns -1 when out of memory.
+static int buildSimilar(Index *ix) {
+    mutex_lock(&ix->lock);
+    if (ix->similarBuilt || !ix->idCap) {
+        mutex_unlock(&ix->lock);
+        return 0;
+    }
+    uint32_t ids = ix->nextId + 1 < ix->idCap ? ix->nextId + 1 : ix->idCap;
+    size_t live = 0;
+    for (uint32_t id = 1; id < ids; id++) live += ix->byId[id] != NULL;
+    BandJob bands[MINHASH_BANDS];
+    int threads = cpuCount();
+    if ((uint32_t)threads > ids / SIMILAR_IDS_PER_THREAD + 1) threads = (int)(ids / SIMILAR_IDS_PER_THREAD + 1);
+    SignJob *signs = (SignJob *)calloc(threads, sizeof(SignJob));
+    ix->colBands = (uint32_t *)calloc((size_t)ix->idCap * MINHASH_BANDS, sizeof(uint32_t));
+    int ok = signs && ix->colBands;
+    for (int band = 0; band < MINHASH_BANDS; band++) {
+        bands[band].entries = ok ? (BandEntry *)malloc((live + 1) * sizeof(BandEntry)) : NULL;
+        ok = ok && bands[band].entries;
+    }
+    if (!ok) {
+        for (int band = 0; band < MINHASH_BANDS; band++) free(bands[band].entries);
+        free(ix->colBands);
+        ix->colBands = NULL;
+        free(signs);
+        mutex_unlock(&ix->lock);
+        return -1;
+    }
+
+    uint32_t chunk = ids > 1 ? (ids - 1) / threads + 1 : 1;
+    IndexTasks *tasks = indexTasksBegin(TASK_BUILD);
+    for (int t = 0; t < threads; t++) {
+        signs[t].ix = ix;
+        signs[t].from = 1 + (uint32_t)t * chunk;
+        signs[t].to = signs[t].from + chunk < ids ? signs[t].from + chunk : ids;
+        indexTasksSpawn(tasks, signWorker, &signs[t]);
+    }
+    indexTasksWait(tasks);
+    free(signs);
+
+    for (int band = 0; band < MINHASH_BANDS; band++) {
+        size_t n = 0;
+        for (uint32_t id = 1; id < ids; id++) {
+            if (!ix->byId[id]) continue;
+            bands[band].entries[n].key = ix->colBands[(size_t)id * MINHASH_BANDS + band];
+            bands[band].entries[n].id = id;
+            n++;
+        }
+        bands[band].count = n;
+    }
+    tasks = indexTasksBegin(TASK_BUILD);
+    for (int band = 0; band < MINHASH_BANDS; band++) indexTasksSpawn(tasks, bandWorker, &bands[band]);
+    indexTasksWait(tasks);
+    for (int band = 0; band < MINHASH_BANDS; band++) {
+        free(ix->bands[band].sorted);
+        ix->bands[band].sorted = bands[band].entries;
+        ix->bands[band].count = bands[band].count;
+        ix->bands[band].pendingCount = 0;
+    }
+    ix->similarBuilt = 1;
+    mutex_unlock(&ix->lock);
+    return 0;
+}
+
+// --- Visibility ---
+// A file is shown to a viewer when they can list its directory and enter
+// every directory above it, judged from the mode bits, owner, group and
+// POSIX ACL recorded at crawl time. Each directory gets a permission class
+// shared by every directory with the same attributes under the same parent
+// class; verdicts are worked out once per class and viewer, and a per-id
+// bitmap per cached viewer turns query filtering into a bit test.
+
+enum { VERDICT_KNOWN = 1, VERDICT_ENTER = 2, VERDICT_LIST = 4 };
+enum { ACL_USER_OBJ = 1, ACL_USER = 2, ACL_GROUP_OBJ = 4, ACL_GROUP = 8, ACL_MASK = 16, ACL_OTHER = 32 };
+
+static uint64_t permKey(const PermClass *c) {
+    uint64_t h = hashInode(c->parent, (uint64_t)c->uid << 32 | c->gid);
+    h = hashInode(h, c->mode);
+    for (uint32_t i = 0; i < c->aclCount; i++) {
+        h = hashInode(h, (uint64_t)c->acl[i].tag << 48 | (uint64_t)c->acl[i].perm << 32 | c->acl[i].id);
+    }
+    return h;
+}
+
+static int samePerm(const PermClass *a, const PermClass *b) {
+    return a->parent == b->parent && a->uid == b->uid && a->gid == b->gid && a->mode == b->mode &&
+           a->aclCount == b->aclCount && (!a->aclCount || !memcmp(a->acl, b->acl, a->aclCount * sizeof(AclEntry)));
+}
+
+static void putPermSlot(uint32_t *slots, uint32_t cap, uint64_t key, uint32_t c) {
+    uint32_t i = (uint32_t)key & (cap - 1);
+    while (slots[i]) i = (i + 1) & (cap - 1);
+    slots[i] = c + 1;
+}
+
+// Returns the class with c's attributes, adding it (and copying its ACL)
+// on first sight. Class 0 is "no restrictions", for files whose
+// directories were never examined. Takes permLock.
+static uint32_t internPerm(Index *ix, const PermClass *c) {
+    uint32_t found = 0;
+    uint64_t key = permKey(c);
+    mutex_lock(&ix->permLock);
+    if (ix->permCount == 0 && (ix->perms = (PermClass *)calloc(64, sizeof(PermClass)))) {
+        ix->permCap = 64;
+        ix->permCount = 1;
+    }
+    for (uint32_t i = ix->permSlotCap ? (uint32_t)key & (ix->permSlotCap - 1) : 0;
+         ix->permSlotCap && ix->permSlots[i]; i = (i + 1) & (ix->permSlotCap - 1)) {
+        PermClass *have = &ix->perms[ix->permSlots[i] - 1];
+        if (have->key == key && samePerm(have, c)) {
+            found = ix->permSlots[i] - 1;
+            break;
+        }
+    }
+    if (!found && ix->permCount && (ix->permCount + 1) * 2 > ix->permSlotCap) {
+        uint32_t cap = ix->permSlotCap ? ix->permSlotCap * 2 : 256;
+        uint32_t *slots = (uint32_t *)calloc(cap, sizeof(uint32_t));
+        if (slots) {
+            for (uint32_t p = 1; p < ix->permCount; p++) putPermSlot(slots, cap, ix->perms[p].key, p);
+            free(ix->permSlots);
+            ix->permSlots = slots;
+            ix->permSlotCap = cap;
+        }
+    }
+    if (!found && ix->permCount && ix->permCount * 2 < ix->permSlotCap) {
+        if (ix->permCount == ix->permCap) {
+            PermClass *grown = (PermClass *)realloc(ix->perms, ix->permCap * 2 * sizeof(PermClass));
+            if (grown) {
+                ix->perms = grown;
+                ix->permCap *= 2;
+            }
+        }
+        AclEntry *acl = c->aclCount ? (AclEntry *)malloc(c->aclCount * sizeof(AclEntry)) : NULL;
+        if (ix->permCount < ix->permCap && (acl || !c->aclCount)) {
+            if (acl) memcpy(acl, c->acl, c->aclCount * sizeof(AclEntry));
+            found = ix->permCount++;
+            ix->perms[found] = *c;
+            ix->perms[found].key = key;
+            ix->perms[found].acl = acl;
+            putPermSlot(ix->permSlots, ix->permSlotCap, key, found);
+        } else {
+            free(acl);
+        }
+    }
+    mutex_unlock(&ix->permLock);
+    return found;
+}
+
+static uint32_t permParent(Index *ix, uint32_t c) {
+    mutex_lock(&ix->permLock);
+    uint32_t parent = c < ix->permCount ? ix->perms[c].parent : 0;
+    mutex_unlock(&ix->permLock);
+    return parent;
+}
+
+#ifdef OS_POSIX
+// Reads a directory's access ACL in the Linux xattr layout: a version word,
+// then (tag, perm, id) entries, into *out, which the caller frees. Returns
+// the entry count, 0 without an ACL, or -1 when it has one that cannot be
+// read.
+static int readAcl(const char *path, AclEntry **out) {
+    *out = NULL;
+    #ifdef HAVE_POSIX_ACL
+    const char *name = "system.posix_acl_access";
+    unsigned char *buf = NULL;
+    ssize_t len = -1;
+    // Sized by asking first; it can grow before the read, so ask again.
+    for (int tries = 0; tries < 3 && len < 0; tries++) {
+        ssize_t size = getxattr(path, name, NULL, 0);
+        if (size < 0) return errno == ENODATA || errno == ENOTSUP ? 0 : -1;
+        unsigned char *grown = (unsigned char *)realloc(buf, size ? (size_t)size : 1);
+        if (!grown) break;
+        buf = grown;
+        len = getxattr(path, name, buf, (size_t)size);
+        if (len < 0 && errno != ERANGE) break;
+    }
+    int count = -1;
+    if (len >= 4 && (len - 4) % 8 == 0 && (len - 4) / 8 <= MAX_ACL_ENTRIES && (buf[0] | buf[1] << 8) == 2) {
+        count = (int)(len - 4) / 8;
+        *out = count ? (AclEntry *)malloc(count * sizeof(AclEntry)) : NULL;
+        if (count && !*out) count = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        const unsigned char *p = buf + 4 + 8 * i;
+        (*out)[i].tag = (uint16_t)(p[0] | p[1] << 8);
+        (*out)[i].perm = (uint16_t)(p[2] | p[3] << 8);
+        (*out)[i].id = p[4] | p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+    }
+    free(buf);
+    return count;
+    #else
+    (void)path;
+    return 0;
+    #endif
+}
+
+// Class of the directory at path, given its stat and its parent's class.
+static uint32_t dirPerm(Index *ix, uint32_t parent, const char *path, const struct stat *st) {
+    AclEntry *acl;
+    PermClass c;
+    memset(&c, 0, sizeof(c));
+    c.parent = parent;
+    c.uid = (uint32_t)st->st_uid;
+    c.gid = (uint32_t)st->st_gid;
+    c.mode = (uint32_t)st->st_mode & 0777;
+    int count = readAcl(path, &acl);
+    // An ACL that cannot be read may deny anyone: fail closed, to the owner.
+    if (count < 0) c.mode &= 0700;
+    c.acl = acl;
+    c.aclCount = count > 0 ? (uint32_t)count : 0;
+    uint32_t perm = internPerm(ix, &c);
+    free(acl);
+    return perm;
+}
+#endif
+
+// Class of the directory holding path, worked out from the filesystem root
+// down. 0 for a path at the top, or where there are no permissions.
+static uint32_t parentPerm(Index *ix, const char *path) {
+    uint32_t perm = 0;
+    #ifdef OS_POSIX
+    char prefix[MAX_PATH_LEN];
+    const char *end = strrchr(path, '/');
+    if (path[0] != '/' || !end || (end == path && !path[1])) return 0;
+    struct stat st;
+    if (stat("/", &st) == 0) perm = dirPerm(ix, 0, "/", &st);
+    for (const char *p = strchr(path + 1, '/'); p && p <= end; p = strchr(p + 1, '/')) {
+        snprintf(prefix, sizeof(prefix), "%.*s", (int)(p - path), path);
+        if (stat(prefix, &st) == 0) perm = dirPerm(ix, perm, prefix, &st);
+    }
+    #else
+    (void)ix;
+    (void)path;
+    #endif
+    return perm;
+}
+
+static int inGroup(const IndexViewer *who, uint32_t gid) {
+    if (who->gid == gid) return 1;
+    for (int i = 0; i < who->groupCount; i++) {
+        if (who->groups[i] == gid) return 1;
+    }
+    return 0;
+}
+
+// Whether who holds every bit of need (4 read, 1 execute) on a directory,
+// following the POSIX ACL check order when the class has one.
+static int permAllows(const PermClass *c, const IndexViewer *who, uint32_t need) {
+    if (who->uid == 0) return 1;
+    if (!c->aclCount) {
+        uint32_t bits = who->uid == c->uid ? c->mode >> 6 : inGroup(who, c->gid) ? c->mode >> 3 : c->mode;
+        return (bits & need) == need;
+    }
+    uint32_t mask = 7, other = 0;
+    int groupMatched = 0, groupGrants = 0;
+    for (uint32_t i = 0; i < c->aclCount; i++) {
+        if (c->acl[i].tag == ACL_MASK) mask = c->acl[i].perm;
+        if (c->acl[i].tag == ACL_OTHER) other = c->acl[i].perm;
+    }
+    if (who->uid == c->uid) return ((c->mode >> 6) & need) == need;
+    for (uint32_t i = 0; i < c->aclCount; i++) {
+        const AclEntry *a = &c->acl[i];
+        if (a->tag == ACL_USER && a->id == who->uid) return (a->perm & mask & need) == need;
+        uint32_t gid = a->tag == ACL_GROUP_OBJ ? c->gid : a->id;
+        if ((a->tag == ACL_GROUP_OBJ || a->tag == ACL_GROUP) && inGroup(who, gid)) {
+            groupMatched = 1;
+            if ((a->perm & mask & need) == need) groupGrants = 1;
+        }
+    }
+    if (groupMatched) return groupGrants;
+    return (other & need) == need;
+}
+
+// Caller holds permLock.
+static uint8_t verdictOf(Index *ix, View *v, uint32_t c) {
+    if (c >= ix->permCount) return 0;
+    if (c >= v->verdictCap) {
+        uint8_t *grown = (uint8_t *)realloc(v->verdict, ix->permCap);
+        if (!grown) return 0;
+        memset(grown + v->verdictCap, 0, ix->permCap - v->verdictCap);
+        v->verdict = grown;
+        v->verdictCap = ix->permCap;
+    }
+    if (v->verdict[c]) return v->verdict[c];
+    uint8_t verdict = VERDICT_KNOWN;
+    if (c == 0) {
+        verdict |= VERDICT_ENTER | VERDICT_LIST;
+    } else if (verdictOf(ix, v, ix->perms[c].parent) & VERDICT_ENTER) {
+        if (permAllows(&ix->perms[c], &v->who, 1)) verdict |= VERDICT_ENTER;
+        if (permAllows(&ix->perms[c], &v->who, 4)) verdict |= VERDICT_LIST;
+    }
+    v->verdict[c] = verdict;
+    return verdict;
+}
+
+// Brings id's bit up to date in every cached view. Caller holds the lock.
+static void noteVisibility(Index *ix, uint32_t id) {
+    int locked = 0;
+    for (int i = 0; i < VIEW_CACHE; i++) {
+        View *v = &ix->views[i];
+        if (!v->key || !v->visible) continue;
+        if (!locked) {
+            mutex_lock(&ix->permLock);
+            locked = 1;
+        }
+        uint64_t bit = 1ULL << (id & 63);
+        if (ix->byId[id] && (verdictOf(ix, v, ix->colPerm[id]) & VERDICT_LIST)) v->visible[id >> 6] |= bit;
+        else v->visible[id >> 6] &= ~bit;
+    }
+    if (locked) mutex_unlock(&ix->permLock);
+}
+
+static int compareGid(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Returns the visibility bitmap for who, building it on first use and
+// evicting the least recently used viewer when the cache is full. NULL when
+// out of memory. Caller holds the lock.
+static const uint64_t *viewBits(Index *ix, const IndexViewer *viewer) {
+    IndexViewer who = *viewer;
+    if (who.groupCount > INDEX_MAX_GROUPS) who.groupCount = INDEX_MAX_GROUPS;
+    if (who.groupCount < 0) who.groupCount = 0;
+    qsort(who.groups, who.groupCount, sizeof(uint32_t), compareGid);
+    uint64_t key = hashInode(who.uid, who.gid);
+    for (int i = 0; i < who.groupCount; i++) key = hashInode(key, who.groups[i]);
+
+    View *slot = &ix->views[0];
+    for (int i = 0; i < VIEW_CACHE; i++) {
+        View *v = &ix->views[i];
+        if (v->key == key && v->who.uid == who.uid && v->who.gid == who.gid &&
+            v->who.groupCount == who.groupCount &&
+            !memcmp(v->who.groups, who.groups, who.groupCount * sizeof(uint32_t))) {
+            v->lastUse = ++ix->viewClock;
+            metricAdd(ix, METRIC_VIEW_HITS, 1);
+            return v->visible;
+        }
+        if (v->lastUse < slot->lastUse) slot = v;
+    }
+    metricAdd(ix, METRIC_VIEW_MISSES, 1);
+
+    free(slot->verdict);
+    free(slot->visible);
+    memset(slot, 0, sizeof(*slot));
+    slot->who = who;
+    slot->visible = (uint64_t *)calloc(ix->idCap / 64 + 1, sizeof(uint64_t));
+    if (!slot->visible) return NULL;
+    mutex_lock(&ix->permLock);
+    for (uint32_t id = 1; id < ix->idCap; id++) {
+        if (ix->byId[id] && (verdictOf(ix, slot, ix->colPerm[id]) & VERDICT_LIST))
+            slot->visible[id >> 6] |= 1ULL << (id & 63);
+    }
+    mutex_unlock(&ix->permLock);
+    slot->key = key;
+    slot->lastUse = ++ix->viewClock;
+    return slot->visible;
+}
+
+// A directory's class went from oldPerm to newPerm: re-hang the classes
+// below it off the new one. Returns c's class after the change.
+static uint32_t remapPerm(Index *ix, uint32_t c, uint32_t oldPerm, uint32_t newPerm) {
+    if (c == oldPerm) return newPerm;
+    if (c == 0) return 0;
+    uint32_t parent = permParent(ix, c);
+    uint32_t moved = remapPerm(ix, parent, oldPerm, newPerm);
+    if (moved == parent) return c;
+    mutex_lock(&ix->permLock);
+    PermClass copy = ix->perms[c];  // ACL arrays never move, so the copy can share it
+    mutex_unlock(&ix->permLock);
+    copy.parent = moved;
+    return internPerm(ix, &copy);
+}
+
+// Moves the directories and files at and below path, in every shard, onto
+// classes under newPerm. Caller holds the lock.
+static void reclassTree(Index *ix, const char *path, uint32_t oldPerm, uint32_t newPerm) {
+    for (int s = 0; s < ix->shardCount; s++) {
+        Shard *sh = &ix->shards[s];
+        for (int d = 0; d < sh->dirCount; d++) {
+            DirEntry *dir = &sh->dirs[d];
+            if (!dir->path || !isPathWithin(dir->path, path)) continue;
+            uint32_t perm = remapPerm(ix, dir->perm, oldPerm, newPerm);
+            if (perm == dir->perm) continue;
+            dir->perm = perm;
+            for (FileEntry *e = dir->files; e; e = e->dirNext) {
+                e->perm = perm;
+                if (e->id < ix->idCap && ix->byId[e->id] == e) {
+                    ix->colPerm[e->id] = perm;
+                    noteVisibility(ix, e->id);
+                }
+            }
+        }
+    }
+}
+
+// --- Stable Ids ---
+// A file keeps its id for as long as its full path is unchanged. A file that
+// moved keeps it too, when its (device, inode) turns up at a new path while
+// the old path is gone or went away within ID_MOVE_WINDOW. Both maps hold
+// 64-bit fingerprints rather than paths, so they stay compact. Ids are never
+// reused; a vanished path keeps its id reserved for ID_RETENTION.
+
+static uint32_t idMapGet(const IdMap *map, uint64_t key) {
+    if (!map->cap) return 0;
+    size_t mask = map->cap - 1;
+    for (size_t i = key & mask;; i = (i + 1) & mask) {
+        if (map->slots[i].key == key) return map->slots[i].id;
+        if (map->slots[i].key == 0) return 0;
+    }
+}
+
+static void idMapInsert(IdSlot *slots, size_t cap, uint64_t key, uint32_t id) {
+    size_t mask = cap - 1, i = key & mask;
+    while (slots[i].key && slots[i].key != key) i = (i + 1) & mask;
+    slots[i].key = key;
+    slots[i].id = id;
+}
+
+static int idMapReserve(IdMap *map, size_t count) {
+    if (map->cap && count * 10 <= map->cap * 7) return 0;
+    size_t newCap = map->cap ? map->cap : 1024;
+    while (count * 10 > newCap * 7) newCap *= 2;
+    IdSlot *slots = (IdSlot *)calloc(newCap, sizeof(IdSlot));
+    if (!slots) return -1;
+    for (size_t i = 0; i < map->cap; i++) {
+        if (map->slots[i].key) idMapInsert(slots, newCap, map->slots[i].key, map->slots[i].id);
+    }
+    free(map->slots);
+    map->slots = slots;
+    map->cap = newCap;
+    return 0;
+}
+
+static void idMapPut(IdMap *map, uint64_t key, uint32_t id) {
+    if (idMapReserve(map, map->count + 1) < 0) return;
+    size_t mask = map->cap - 1, i = key & mask;
+    while (map->slots[i].key && map->slots[i].key != key) i = (i + 1) & mask;
+    if (!map->slots[i].key) map->count++;
+    map->slots[i].key = key;
+    map->slots[i].id = id;
+}
+
+// Grows one id-indexed array, zeroing the new tail.
+static int growColumn(void **column, size_t elemSize, uint32_t oldCap, uint32_t newCap) {
+    char *grown = (char *)realloc(*column, newCap * elemSize);
+    if (!grown) return -1;
+    memset(grown + oldCap * elemSize, 0, (newCap - oldCap) * elemSize);
+    *column = grown;
+    return 0;
+}
+
+static int ensureIdCapacity(Index *ix, uint32_t id) {
+    if (id < ix->idCap) return 0;
+    uint32_t newCap = ix->idCap ? ix->idCap : 1024;
+    while (newCap <= id) newCap *= 2;
+    // idCap only moves once every array has grown.
+    if (growColumn((void **)&ix->byId, sizeof(FileEntry *), ix->idCap, newCap) < 0 ||
+        growColumn((void **)&ix->retiredAt, sizeof(uint32_t), ix->idCap, newCap) < 0 ||
+        growColumn((void **)&ix->pathChecks, sizeof(uint32_t), ix->idCap, newCap) < 0 ||
+        growColumn((void **)&ix->colSize, sizeof(int64_t), ix->idCap, newCap) < 0 ||
+        growColumn((void **)&ix->colMtime, sizeof(int64_t), ix->idCap, newCap) < 0 ||
+        growColumn((void **)&ix->colExt, sizeof(uint32_t), ix->idCap, newCap) < 0 ||
+        growColumn((void **)&ix->colOwner, sizeof(uint32_t), ix->idCap, newCap) < 0 ||
+        growColumn((void **)&ix->colTop, sizeof(uint32_t), ix->idCap, newCap) < 0 ||
+        growColumn((void **)&ix->colShard, sizeof(uint32_t), ix->idCap, newCap) < 0 ||
+        growColumn((void **)&ix->colPerm, sizeof(uint32_t), ix->idCap, newCap) < 0 ||
+        growColumn((void **)&ix->colNameLen, sizeof(uint16_t), ix->idCap, newCap) < 0 ||
+        growColumn((void **)&ix->colDepth, sizeof(uint16_t), ix->idCap, newCap) < 0 ||
+        growColumn((void **)&ix->colOpens, sizeof(uint32_t), ix->idCap, newCap) < 0 ||
+        growColumn((void **)&ix->colOpened, sizeof(int64_t), ix->idCap, newCap) < 0 ||
+        growColumn((void **)&ix->blockNameLen, sizeof(uint16_t), ix->idCap / NAME_BLOCK, newCap / NAME_BLOCK) < 0)
+        return -1;
+    for (int i = 0; i < VIEW_CACHE; i++) {
+        View *v = &ix->views[i];
+        if (v->visible && growColumn((void **)&v->visible, sizeof(uint64_t), ix->idCap / 64 + 1, newCap / 64 + 1) < 0)
+            return -1;
+    }
+    if (ix->colBands && growColumn((void **)&ix->colBands, MINHASH_BANDS * sizeof(uint32_t), ix->idCap, newCap) < 0)
+        return -1;
+    ix->idCap = newCap;
+    return 0;
+}
+
+// Returns the code for name, adding it on first sight.
+static uint32_t dictIntern(Dict *dict, const char *name) {
+    uint64_t key = hashPath(name);
+    uint32_t code = idMapGet(&dict->codes, key);
+    if (code) return code - 1;
+    if (dict->count == dict->cap) {
+        uint32_t newCap = dict->cap ? dict->cap * 2 : 64;
+        char **grown = (char **)realloc(dict->names, newCap * sizeof(char *));
+        if (!grown) return 0;
+        dict->names = grown;
+        dict->cap = newCap;
+    }
+    char *copy = strdup(name);
+    if (!copy) return 0;
+    dict->names[dict->count] = copy;
+    idMapPut(&dict->codes, key, dict->count + 1);
+    return dict->count++;
+}
+
+static void freeDict(Dict *dict) {
+    for (uint32_t i = 0; i < dict->count; i++) free(dict->names[i]);
+    free(dict->names);
+    free(dict->codes.slots);
+}
+
+static void freeHistory(History *h) {
+    if (!h) return;
+    free(h->snapshots);
+    freeDict(&h->paths);
+    free(h->head);
+    free(h->spans);
+    free(h->codeById);
+    free(h);
+}
+
+static uint32_t ownerCode(Index *ix, uint32_t uid) {
+    char name[64];
+    #ifdef OS_POSIX
+    struct passwd pw, *found = NULL;
+    char buf[1024];
+    if (getpwuid_r((uid_t)uid, &pw, buf, sizeof(buf), &found) == 0 && found) {
+        snprintf(name, sizeof(name), "%s", found->pw_name);
+    } else {
+        snprintf(name, sizeof(name), "%u", uid);
+    }
+    #else
+    snprintf(name, sizeof(name), "%u", uid);
+    #endif
+    return dictIntern(&ix->ownerDict, name);
+}
+
+// Fills the analytics columns for a live entry. Caller holds the lock.
+static void setColumns(Index *ix, FileEntry *e) {
+    uint32_t id = e->id;
+    ix->pathChecks[id] = checkPath(e->fullpath);
+    ix->colSize[id] = e->size;
+    ix->colMtime[id] = e->mtime;
+    ix->colShard[id] = (uint32_t)e->shard;
+
+    char ext[MAX_EXT_LEN + 1] = "";
+    const char *dot = strrchr(e->filename, '.');
+    if (dot && dot != e->filename && strlen(dot + 1) <= MAX_EXT_LEN) {
+        int i = 0;
+        for (const char *p = dot + 1; *p; p++) ext[i++] = (char)tolower((unsigned char)*p);
+        ext[i] = '\0';
+    }
+    ix->colExt[id] = dictIntern(&ix->extDict, ext);
+
+    // Owners repeat endlessly, so resolve each uid's name once.
+    uint32_t owner = idMapGet(&ix->uidOwners, hashInode(0, e->uid));
+    if (!owner) {
+        owner = ownerCode(ix, e->uid) + 1;
+        idMapPut(&ix->uidOwners, hashInode(0, e->uid), owner);
+    }
+    ix->colOwner[id] = owner - 1;
+
+    // The first directory level below the root, or the root itself for files
+    // that live directly in it.
+    const char *root = ix->roots[e->root].path;
+    size_t rootLen = strlen(root);
+    char top[MAX_PATH_LEN];
+    snprintf(top, sizeof(top), "%s", root);
+    const char *rest = e->fullpath + rootLen;
+    if (strncmp(e->fullpath, root, rootLen) == 0 && (*rest == '/' || *rest == '\\')) {
+        const char *end = rest + 1;
+        while (*end && *end != '/' && *end != '\\') end++;
+        if (*end) snprintf(top, sizeof(top), "%.*s", (int)(end - e->fullpath), e->fullpath);
+    }
+    ix->colTop[id] = dictIntern(&ix->topDict, top);
+    ix->colPerm[id] = e->perm;
+
+    size_t nameLen = strlen(e->filename);
+    uint16_t depth = 0;
+    for (const char *p = e->fullpath; *p; p++) depth += *p == '/' || *p == '\\';
+    ix->colNameLen[id] = nameLen < UINT16_MAX ? (uint16_t)nameLen : UINT16_MAX;
+    ix->colDepth[id] = depth;
+    if (ix->colNameLen[id] > ix->blockNameLen[id / NAME_BLOCK])
+        ix->blockNameLen[id / NAME_BLOCK] = ix->colNameLen[id];
+    noteOrderings(ix, id);
+    noteSimilar(ix, id);
+    noteVisibility(ix, id);
+}
+
+// The first live id in [id, end) whose name is at least len bytes, or end.
+// A name shorter than the query cannot contain it, so name scans step
+// through ids with this: whole blocks of short names are passed over on
+// blockNameLen, and the rest are weeded out on colNameLen before their
+// entry and name are touched. Caller holds the lock.
+static uint32_t nextLongName(const Index *ix, uint32_t id, uint32_t end, size_t len) {
+    while (id < end) {
+        if (id % NAME_BLOCK == 0 && ix->blockNameLen[id / NAME_BLOCK] < len) {
+            id += NAME_BLOCK;
+            continue;
+        }
+        if (ix->colNameLen[id] >= len && ix->byId[id]) return id;
+        id++;
+    }
+    return end;
+}
+
+// Queues an id for the standing queries. Caller holds the lock.
+static void queueChange(Index *ix, uint32_t id) {
+    if (ix->changedCount == ix->changedCap) {
+        size_t newCap = ix->changedCap ? ix->changedCap * 2 : 1024;
+        uint32_t *grown = newCap > STANDING_QUEUE_MAX ? NULL : (uint32_t *)realloc(ix->changed, newCap * sizeof(uint32_t));
+        if (!grown) {
+            ix->changeDrops++;
+            return;
+        }
+        ix->changed = grown;
+        ix->changedCap = newCap;
+    }
+    ix->changed[ix->changedCount++] = id;
+}
+
+// fresh is set for ids minted or followed across a move. A file that takes
+// back its own id is news to the standing queries only if it changed or
+// had been gone for a while, not when a refresh merely rebuilt its shard;
+// a shard's first crawl is never news.
+static void claimId(Index *ix, FileEntry *e, uint32_t id, int fresh) {
+    if (ensureIdCapacity(ix, id) < 0) return;
+    if (ix->standingLive && ix->shards[e->shard].lastRefresh > 0 &&
+        (fresh || ix->colMtime[id] != e->mtime || ix->colSize[id] != e->size ||
+         (!ix->byId[id] && (uint32_t)time(NULL) - ix->retiredAt[id] > CHANGE_WINDOW)))
+        queueChange(ix, id);
+    e->id = id;
+    ix->byId[id] = e;
+    idMapPut(&ix->pathIds, e->pathKey, id);
+    if (e->inodeKey) idMapPut(&ix->inodeIds, e->inodeKey, id);
+    setColumns(ix, e);
+}
+
+// Call before an entry is freed. Caller holds the lock.
+static void retireEntry(Index *ix, FileEntry *e) {
+    if (e->id && e->id < ix->idCap && ix->byId[e->id] == e) {
+        ix->byId[e->id] = NULL;
+        ix->retiredAt[e->id] = (uint32_t)time(NULL);
+    }
+}
+
+// Gives e its id in two passes. Pass 0 only takes ids by path; pass 1
+// follows moves by inode or mints a fresh id. Run pass 0 over a whole batch
+// before pass 1, so a file that stayed put always keeps its id even when
+// another file now holds its old inode. The maps are keyed by fingerprints
+// alone, so a candidate is checked against what holds the id before it is
+// taken. No system calls: caller holds the lock.
+static void assignId(Index *ix, FileEntry *e, int pass) {
+    if (pass == 0) {
+        uint32_t id = idMapGet(&ix->pathIds, e->pathKey);
+        if (id && id < ix->idCap && ix->pathChecks[id] == checkPath(e->fullpath) &&
+            (!ix->byId[id] || strcmp(ix->byId[id]->fullpath, e->fullpath) == 0)) claimId(ix, e, id, 0);
+        return;
+    }
+    if (e->id) return;
+    uint32_t id = e->inodeKey ? idMapGet(&ix->inodeIds, e->inodeKey) : 0;
+    if (id && id < ix->idCap) {
+        FileEntry *holder = ix->byId[id];
+        // Still held by the same inode under another path: a move whose old
+        // directory has not been re-read yet, unless the inode has more than
+        // one name, as a hard link gets its own id. Gone lately: a move only
+        // if size and mtime, which a rename keeps, agree too, as a freed
+        // inode is soon handed to an unrelated new file.
+        int moved = holder ? holder->inodeKey == e->inodeKey && e->links == 1
+                           : (uint32_t)time(NULL) - ix->retiredAt[id] <= ID_MOVE_WINDOW &&
+                             ix->colSize[id] == e->size && ix->colMtime[id] == e->mtime;
+        if (!moved) id = 0;
+    }
+    if (!id) id = ++ix->nextId;
+    claimId(ix, e, id, 1);
+}
+
+// Assigns ids to a list linked through next. Caller holds the lock.
+static void assignIdList(Index *ix, FileEntry *head) {
+    for (int pass = 0; pass < 2; pass++) {
+        for (FileEntry *e = head; e; e = e->next) assignId(ix, e, pass);
+    }
+}
+
+static void assignIdTable(Index *ix, FileEntry **table, size_t size) {
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < size; i++) {
+            for (FileEntry *e = table[i]; e; e = e->next) assignId(ix, e, pass);
+        }
+    }
+}
+
+static void retireTable(Index *ix, FileEntry **table, size_t size) {
+    for (size_t i = 0; table && i < size; i++) {
+        for (FileEntry *e = table[i]; e; e = e->next) retireEntry(ix, e);
+    }
+}
+
+// Drops reservations for paths and inodes whose id has been gone for longer
+// than ID_RETENTION. Live ids are never touched. Caller holds the lock.
+static void compactIds(Index *ix) {
+    uint32_t now = (uint32_t)time(NULL);
+    IdMap *maps[2] = {&ix->pathIds, &ix->inodeIds};
+    for (int m = 0; m < 2; m++) {
+        IdMap *map = maps[m];
+        size_t kept = 0;
+        for (size_t i = 0; i < map->cap; i++) {
+            uint32_t id = map->slots[i].id;
+            if (map->slots[i].key && id < ix->idCap &&
+                (ix->byId[id] || now - ix->retiredAt[id] < ID_RETENTION)) kept++;
+        }
+        if (kept == map->count) continue;
+        IdMap fresh = {NULL, 0, 0};
+        if (idMapReserve(&fresh, kept) < 0) continue;
+        for (size_t i = 0; i < map->cap; i++) {
+            uint32_t id = map->slots[i].id;
+            if (map->slots[i].key && id < ix->idCap &&
+                (ix->byId[id] || now - ix->retiredAt[id] < ID_RETENTION)) {
+                idMapInsert(fresh.slots, fresh.cap, map->slots[i].key, id);
+            }
+        }
+        fresh.count = kept;
+        free(map->slots);
+        *map = fresh;
+    }
+}
+
+// --- Change Watcher ---
+
+static void watchDirectory(Index *ix, int shard, const char *path) {
+    #ifdef HAVE_INOTIFY
+    if (ix->watchFd < 0) return;
+    int wd = inotify_add_watch(ix->watchFd, path, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                              IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+    if (wd < 0) {
+        // Out of watches (fs.inotify.max_user_watches): poll this shard instead.
+        mutex_lock(&ix->lock);
+        ix->shards[shard].policy = REFRESH_POLL;
+        ix->shards[shard].interval = DEFAULT_POLL_INTERVAL;
+        mutex_unlock(&ix->lock);
+        return;
+    }
+    mutex_lock(&ix->watchLock);
+    if (wd >= ix->watchCap) {
+        int newCap = ix->watchCap ? ix->watchCap : 1024;
+        while (newCap <= wd) newCap *= 2;
+        int *grown = (int *)realloc(ix->watchShard, newCap * sizeof(int));
+        if (grown) {
+            for (int i = ix->watchCap; i < newCap; i++) grown[i] = -1;
+            ix->watchShard = grown;
+            ix->watchCap = newCap;
+        }
+    }
+    if (wd < ix->watchCap) ix->watchShard[wd] = shard;
+    mutex_unlock(&ix->watchLock);
+    #else
+    (void)shard;
+    (void)path;
+    #endif
+}
+
+#ifdef HAVE_INOTIFY
+static void drainWatchEvents(Index *ix) {
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(ix->watchFd, buf, sizeof(buf))) > 0) {
+        double now = now_seconds();
+        for (char *p = buf; p < buf + len;) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            mutex_lock(&ix->watchLock);
+            int shard = (ev->wd >= 0 && ev->wd < ix->watchCap) ? ix->watchShard[ev->wd] : -1;
+            if (ev->mask & IN_IGNORED && shard >= 0) ix->watchShard[ev->wd] = -1;
+            mutex_unlock(&ix->watchLock);
+            if (shard >= 0 && !(ev->mask & IN_IGNORED)) {
+                mutex_lock(&ix->lock);
+                if (!ix->shards[shard].dirty) ix->shards[shard].dirtySince = now;
+                ix->shards[shard].dirty = 1;
+                ix->shards[shard].lastEvent = now;
+                mutex_unlock(&ix->lock);
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
+#endif
+
+// --- Crawler ---
+
+#ifdef OS_POSIX
+#ifdef __APPLE__
+    #define ST_MTIM st_mtimespec
+    #define ST_CTIM st_ctimespec
+#else
+    #define ST_MTIM st_mtim
+    #define ST_CTIM st_ctim
+#endif
+
+static int64_t statMtime(const struct stat *st) {
+    return (int64_t)st->ST_MTIM.tv_sec * 1000000000 + st->ST_MTIM.tv_nsec;
+}
+
+static int64_t statCtime(const struct stat *st) {
+    return (int64_t)st->ST_CTIM.tv_sec * 1000000000 + st->ST_CTIM.tv_nsec;
+}
+
+static void statMeta(const struct stat *st, FileMeta *meta) {
+    meta->inodeKey = hashInode(st->st_dev, st->st_ino);
+    meta->size = (int64_t)st->st_size;
+    meta->mtime = (int64_t)st->st_mtime;
+    meta->uid = (uint32_t)st->st_uid;
+    meta->links = (uint32_t)st->st_nlink;
+}
+
+// Stats name in the open directory dirFd, following symlinks as stat does,
+// without walking the full path again. Fills only what the crawler reads.
+// cached accepts attributes the client already holds (AT_STATX_DONT_SYNC),
+// which on NFS saves a revalidation round trip per file.
+static int statAt(int dirFd, const char *name, struct stat *st, int cached) {
+    #ifdef HAVE_STATX
+    struct statx sx;
+    if (statx(dirFd, name, cached ? AT_STATX_DONT_SYNC : 0, STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID |
+              STATX_INO | STATX_SIZE | STATX_MTIME | STATX_CTIME, &sx) == -1) return -1;
+    memset(st, 0, sizeof(*st));
+    st->st_dev = makedev(sx.stx_dev_major, sx.stx_dev_minor);
+    st->st_ino = (ino_t)sx.stx_ino;
+    st->st_mode = sx.stx_mode;
+    st->st_nlink = sx.stx_nlink;
+    st->st_uid = sx.stx_uid;
+    st->st_gid = sx.stx_gid;
+    st->st_size = (off_t)sx.stx_size;
+    st->st_mtim.tv_sec = sx.stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = sx.stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = sx.stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = sx.stx_ctime.tv_nsec;
+    return 0;
+    #else
+    (void)cached;
+    return fstatat(dirFd, name, st, 0);
+    #endif
+}
+#endif
+
+// Whether the block device behind dev spins, as far as sysfs knows.
+// Partitions keep the flag on their parent disk.
+static int isRotational(unsigned long dev) {
+    #ifdef __linux__
+    const char *paths[] = {"/sys/dev/block/%u:%u/queue/rotational", "/sys/dev/block/%u:%u/../queue/rotational"};
+    for (int i = 0; i < 2; i++) {
+        char path[96];
+        snprintf(path, sizeof(path), paths[i], major((dev_t)dev), minor((dev_t)dev));
+        FILE *f = fopen(path, "r");
+        if (!f) continue;
+        int c = fgetc(f);
+        fclose(f);
+        return c == '1';
+    }
+    #else
+    (void)dev;
+    #endif
+    return 0;
+}
+
+#ifdef OS_WINDOWS
+static void findDataMeta(const WIN32_FIND_DATA *data, FileMeta *meta) {
+    // FILETIME counts 100 ns ticks since 1601.
+    uint64_t ticks = ((uint64_t)data->ftLastWriteTime.dwHighDateTime << 32) | data->ftLastWriteTime.dwLowDateTime;
+    meta->inodeKey = 0;
+    meta->size = ((int64_t)data->nFileSizeHigh << 32) | data->nFileSizeLow;
+    meta->mtime = (int64_t)(ticks / 10000000) - 11644473600LL;
+    meta->uid = 0;
+    meta->links = 0;
+}
+#endif
+
+// Shared by the crawler threads of one indexBuild. Each crawler counts
+// entries privately and adds them here in batches.
+typedef struct Build {
+    mutex_t lock;
+    IndexProgressFn progress;
+    void *user;
+    long scanned;
+    long expected;          // 0 when some shard had no estimate
+    double start;
+    double lastReport;
+} Build;
+
+// Caller holds build->lock.
+static void reportProgress(Build *build, const char *path, int done) {
+    double now = now_seconds();
+    IndexProgress p;
+    p.path = path;
+    p.scanned = build->scanned;
+    p.elapsed = now - build->start;
+    p.done = done;
+    // An estimate that turned out low keeps the bar just short of full.
+    if (build->expected && build->scanned >= build->expected) build->expected = build->scanned + build->scanned / 100 + 1;
+    p.expected = done ? build->scanned : build->expected;
+    p.eta = done ? 0 : (build->expected && build->scanned)
+        ? p.elapsed * (build->expected - build->scanned) / build->scanned : -1;
+    build->lastReport = now;
+    if (build->progress) build->progress(&p, build->user);
+}
+
+// Adds the crawler's batch to the build total, reporting when due.
+static void flushProgress(Crawl *crawl, int force) {
+    Build *build = crawl->build;
+    if (!build) return;
+    mutex_lock(&build->lock);
+    build->scanned += crawl->unreported;
+    crawl->unreported = 0;
+    if (force || now_seconds() - build->lastReport >= PROGRESS_INTERVAL) {
+        reportProgress(build, crawl->ix->shards[crawl->shard].path, 0);
+    }
+    mutex_unlock(&build->lock);
+}
+
+static void countEntry(Crawl *crawl) {
+    if (crawl->build && ++crawl->unreported >= PROGRESS_BATCH) flushProgress(crawl, 0);
+}
+
+#ifdef OS_POSIX
+// A mount point sits on a different device than its parent, or is its own
+// parent (the filesystem root).
+static int isMountPoint(const char *path) {
+    char parent[MAX_PATH_LEN];
+    struct stat st, up;
+    snprintf(parent, sizeof(parent), "%s/..", path);
+    if (stat(path, &st) == -1 || stat(parent, &up) == -1) return 0;
+    return st.st_dev != up.st_dev || st.st_ino == up.st_ino;
+}
+#endif
+
+// Estimates how many files and directories a crawl of the shard will find.
+// The shard's last crawl is the best guide. A shard that was never crawled
+// but covers a whole mount gets the mount's used-inode count, less what
+// nested shards are known to hold. Anything else is unknown (0): used inodes
+// would only bound it, and pre-sizing for the whole mount is wasteful.
+// Caller holds the lock.
+static long estimateShard(Index *ix, int shard, long *dirs) {
+    Shard *sh = &ix->shards[shard];
+    *dirs = 0;
+    if (sh->lastRefresh > 0) {
+        *dirs = sh->dirCount;
+        return sh->fileCount + sh->dirCount;
+    }
+    #ifdef OS_POSIX
+    struct statvfs fs;
+    if (!isMountPoint(sh->path) || statvfs(sh->path, &fs) == -1 || fs.f_files == 0) return 0;
+    long used = (long)(fs.f_files - fs.f_ffree);
+    for (int s = 0; s < ix->shardCount; s++) {
+        if (s != shard && ix->shards[s].lastRefresh > 0 && isPathWithin(ix->shards[s].path, sh->path)) {
+            used -= ix->shards[s].fileCount + ix->shards[s].dirCount;
+        }
+    }
+    if (used <= 0) return 0;
+    *dirs = used / DIRS_PER_INODE;
+    return used;
+    #else
+    return 0;
+    #endif
+}
+
+#ifdef OS_WINDOWS
+static void traverseDirectory(Crawl *crawl, const char *basePath) {
+    char searchPath[MAX_PATH_LEN];
+    snprintf(searchPath, sizeof(searchPath), "%s\\*", basePath);
+    WIN32_FIND_DATA findData;
+    HANDLE hFind = FindFirstFile(searchPath, &findData);
+    if (hFind == INVALID_HANDLE_VALUE) return;
+    do {
+        if (strcmp(findData.cFileName, ".") == 0 || strcmp(findData.cFileName, "..") == 0) continue;
+        countEntry(crawl);
+        char fullPath[MAX_PATH_LEN];
+        snprintf(fullPath, sizeof(fullPath), "%s\\%s", basePath, findData.cFileName);
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            if (!isShardBoundary(crawl->ix, crawl->shard, fullPath)) traverseDirectory(crawl, fullPath);
+        } else {
+            FileMeta meta;
+            findDataMeta(&findData, &meta);
+            addFile(crawl, findData.cFileName, fullPath, &meta);
+        }
+    } while (FindNextFile(hFind, &findData) != 0);
+    FindClose(hFind);
+}
+
+static unsigned long rootDevice(const char *path) {
+    // Drive letter is a good enough proxy for the physical device.
+    return (unsigned long)toupper((unsigned char)path[0]);
+}
+#endif
+
+#ifdef OS_POSIX
+static void traverseDirectory(Crawl *crawl, const char *basePath) {
+    DIR *dir = opendir(basePath);
+    if (!dir) return;
+    if (crawl->watch) watchDirectory(crawl->ix, crawl->shard, basePath);
+    // Stat before reading, so a change made mid-read shows up on the next poll.
+    struct stat dirStat;
+    int parentDir = crawl->dir;
+    uint32_t parentClass = crawl->perm;
+    int statted = fstat(dirfd(dir), &dirStat) == 0;
+    if (statted) crawl->perm = dirPerm(crawl->ix, parentClass, basePath, &dirStat);
+    crawl->dir = statted ? addDir(crawl, basePath, statMtime(&dirStat), statCtime(&dirStat)) : -1;
+    int thisDir = crawl->dir;
+    uint32_t thisClass = crawl->perm;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char fullPath[MAX_PATH_LEN];
+        snprintf(fullPath, sizeof(fullPath), "%s/%s", basePath, entry->d_name);
+        struct stat statbuf;
+        if (stat(fullPath, &statbuf) == -1) continue;
+        countEntry(crawl);
+        if (S_ISDIR(statbuf.st_mode)) {
+            if (!isShardBoundary(crawl->ix, crawl->shard, fullPath)) traverseDirectory(crawl, fullPath);
+            crawl->dir = thisDir;
+            crawl->perm = thisClass;
+        } else {
+            FileMeta meta;
+            statMeta(&statbuf, &meta);
+            addFile(crawl, entry->d_name, fullPath, &meta);
+        }
+    }
+    closedir(dir);
+    crawl->dir = parentDir;
+    crawl->perm = parentClass;
+}
+
+static unsigned long rootDevice(const char *path) {
+    struct stat statbuf;
+    if (stat(path, &statbuf) == -1) return 0;
+    return (unsigned long)statbuf.st_dev;
+}
+
+// Inode order. On a spinning disk, stat in readdir order seeks all over the
+// inode table. traverseByInode reads a batch of sibling directories first,
+// sorts everything they hold by inode number and stats it in that order, so
+// the head sweeps the table once per batch. Subdirectories found in a batch
+// become the next batches.
+
+typedef struct PendingDir {
+    char *path;
+    uint32_t parentPerm;    // class of the directory it was found in
+} PendingDir;
+
+typedef struct InodeEntry {
+    uint64_t ino;
+    size_t name;            // offset in the batch's name buffer
+    int dir;                // directory of the batch it came from
+} InodeEntry;
+
+static int compareInodes(const void *a, const void *b) {
+    const InodeEntry *x = (const InodeEntry *)a, *y = (const InodeEntry *)b;
+    return (x->ino > y->ino) - (x->ino < y->ino);
+}
+
+static void traverseByInode(Crawl *crawl, PendingDir *pending, int count) {
+    Index *ix = crawl->ix;
+    int parentDir = crawl->dir;
+    uint32_t parentClass = crawl->perm;
+    for (int first = 0; first < count;) {
+        DIR *dirs[INODE_BATCH_DIRS];
+        const char *dirPaths[INODE_BATCH_DIRS];
+        int dirIndex[INODE_BATCH_DIRS];
+        uint32_t dirClass[INODE_BATCH_DIRS];
+        InodeEntry *entries = NULL;
+        char *names = NULL;
+        size_t entryCount = 0, entryCap = 0, nameLen = 0, nameCap = 0;
+        int n = 0, oom = 0;
+
+        // Read whole directories until the batch is full.
+        while (first < count && n < INODE_BATCH_DIRS && entryCount < INODE_BATCH_ENTRIES && !oom) {
+            const PendingDir *p = &pending[first++];
+            DIR *dir = opendir(p->path);
+            if (!dir) continue;
+            if (crawl->watch) watchDirectory(ix, crawl->shard, p->path);
+            struct stat dirStat;
+            int statted = fstat(dirfd(dir), &dirStat) == 0;
+            crawl->perm = statted ? dirPerm(ix, p->parentPerm, p->path, &dirStat) : p->parentPerm;
+            dirs[n] = dir;
+            dirPaths[n] = p->path;
+            dirClass[n] = crawl->perm;
+            dirIndex[n] = statted ? addDir(crawl, p->path, statMtime(&dirStat), statCtime(&dirStat)) : -1;
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != NULL) {
+                if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+                size_t len = strlen(entry->d_name) + 1;
+                if (entryCount == entryCap) {
+                    size_t cap = entryCap ? entryCap * 2 : 256;
+                    InodeEntry *grown = (InodeEntry *)realloc(entries, cap * sizeof(InodeEntry));
+                    if (!grown) {
+                        oom = 1;
+                        break;
+                    }
+                    entries = grown;
+                    entryCap = cap;
+                }
+                if (nameLen + len > nameCap) {
+                    size_t cap = nameCap ? nameCap * 2 : 4096;
+                    while (cap < nameLen + len) cap *= 2;
+                    char *grown = (char *)realloc(names, cap);
+                    if (!grown) {
+                        oom = 1;
+                        break;
+                    }
+                    names = grown;
+                    nameCap = cap;
+                }
+                memcpy(names + nameLen, entry->d_name, len);
+                entries[entryCount].ino = (uint64_t)entry->d_ino;
+                entries[entryCount].name = nameLen;
+                entries[entryCount].dir = n;
+                entryCount++;
+                nameLen += len;
+            }
+            n++;
+        }
+
+        qsort(entries, entryCount, sizeof(InodeEntry), compareInodes);
+        PendingDir *children = NULL;
+        int childCount = 0, childCap = 0;
+        for (size_t i = 0; i < entryCount; i++) {
+            const InodeEntry *e = &entries[i];
+            const char *name = names + e->name;
+            char fullPath[MAX_PATH_LEN];
+            struct stat statbuf;
+            if (statAt(dirfd(dirs[e->dir]), name, &statbuf, 0) == -1) continue;
+            countEntry(crawl);
+            snprintf(fullPath, sizeof(fullPath), "%s/%s", dirPaths[e->dir], name);
+            if (S_ISDIR(statbuf.st_mode)) {
+                if (isShardBoundary(ix, crawl->shard, fullPath)) continue;
+                if (childCount == childCap) {
+                    int cap = childCap ? childCap * 2 : 64;
+                    PendingDir *grown = (PendingDir *)realloc(children, cap * sizeof(PendingDir));
+                    if (!grown) continue;
+                    children = grown;
+                    childCap = cap;
+                }
+                children[childCount].path = strdup(fullPath);
+                children[childCount].parentPerm = dirClass[e->dir];
+                if (children[childCount].path) childCount++;
+            } else {
+                FileMeta meta;
+                statMeta(&statbuf, &meta);
+                crawl->dir = dirIndex[e->dir];
+                crawl->perm = dirClass[e->dir];
+                addFile(crawl, name, fullPath, &meta);
+            }
+        }
+        for (int i = 0; i < n; i++) closedir(dirs[i]);
+        free(entries);
+        free(names);
+
+        traverseByInode(crawl, children, childCount);
+        for (int i = 0; i < childCount; i++) free(children[i].path);
+        free(children);
+    }
+    crawl->dir = parentDir;
+    crawl->perm = parentClass;
+}
+#endif
+
+// Network and FUSE mounts: no inotify, and every metadata call may be a
+// round trip.
+static int isRemoteFilesystem(const char *path) {
+    #ifdef HAVE_INOTIFY
+    struct statfs fs;
+    if (statfs(path, &fs) == -1) return 0;
+    switch ((unsigned long)fs.f_type) {
+        case 0x6969:        // NFS
+        case 0xFF534D42:    // CIFS
+        case 0xFE534D42:    // SMB2
+        case 0x517B:        // SMB
+        case 0x65735546:    // FUSE
+            return 1;
+    }
+    #else
+    (void)path;
+    #endif
+    return 0;
+}
+
+#ifdef OS_POSIX
+// Remote crawls. On NFS each stat(fullPath) revalidates attributes with the
+// server, and one crawler waits out every round trip in turn. Instead each
+// directory is read by its own task on the crawl pool, so many round trips
+// are in flight at once. d_type tells subdirectories apart without a stat
+// (they are fstat'ed once opened), and files are stat'ed relative to the
+// open directory accepting the attributes READDIRPLUS already cached. Each
+// task collects into a piece of its own; the pieces are merged at the end.
+
+typedef struct RemoteCrawl {
+    Crawl *crawl;
+    IndexTasks *tasks;
+    mutex_t lock;               // guards pieces
+    struct RemoteDir *pieces;
+} RemoteCrawl;
+
+typedef struct RemoteDir {
+    RemoteCrawl *rc;
+    char *path;
+    uint32_t parentPerm;
+    Crawl piece;                // what this directory held
+    struct RemoteDir *next;
+} RemoteDir;
+
+// Registers a directory to be read; the caller spawns its task.
+static RemoteDir *newRemoteDir(RemoteCrawl *rc, const char *path, uint32_t parentPerm) {
+    RemoteDir *rd = (RemoteDir *)calloc(1, sizeof(RemoteDir));
+    if (!rd) return NULL;
+    rd->path = strdup(path);
+    if (!rd->path) {
+        free(rd);
+        return NULL;
+    }
+    rd->rc = rc;
+    rd->parentPerm = parentPerm;
+    mutex_lock(&rc->lock);
+    rd->next = rc->pieces;
+    rc->pieces = rd;
+    mutex_unlock(&rc->lock);
+    return rd;
+}
+
+static void remoteWorker(void *arg) {
+    RemoteDir *rd = (RemoteDir *)arg;
+    RemoteCrawl *rc = rd->rc;
+    Index *ix = rc->crawl->ix;
+    Crawl *piece = &rd->piece;
+    initPiece(piece, rc->crawl);
+    DIR *dir = opendir(rd->path);
+    if (!dir || reserveDirs(piece, 1) < 0) {
+        if (dir) closedir(dir);
+        return;
+    }
+    if (piece->watch) watchDirectory(ix, piece->shard, rd->path);
+    struct stat dirStat;
+    int statted = fstat(dirfd(dir), &dirStat) == 0;
+    piece->perm = statted ? dirPerm(ix, rd->parentPerm, rd->path, &dirStat) : rd->parentPerm;
+    piece->dir = statted ? addDir(piece, rd->path, statMtime(&dirStat), statCtime(&dirStat)) : -1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char fullPath[MAX_PATH_LEN];
+        snprintf(fullPath, sizeof(fullPath), "%s/%s", rd->path, entry->d_name);
+        struct stat statbuf;
+        int isDir = entry->d_type == DT_DIR;
+        // Symlinks and filesystems without d_type still need a stat to tell.
+        if (!isDir && statAt(dirfd(dir), entry->d_name, &statbuf, 1) == -1) continue;
+        countEntry(piece);
+        if (isDir || S_ISDIR(statbuf.st_mode)) {
+            RemoteDir *sub = isShardBoundary(ix, piece->shard, fullPath) ? NULL : newRemoteDir(rc, fullPath, piece->perm);
+            if (sub) indexTasksSpawn(rc->tasks, remoteWorker, sub);
+        } else {
+            FileMeta meta;
+            statMeta(&statbuf, &meta);
+            addFile(piece, entry->d_name, fullPath, &meta);
+        }
+    }
+    closedir(dir);
+    flushProgress(piece, 0);
+}
+
+// Crawls the tree under path into crawl with one task per directory.
+static void traverseRemote(Crawl *crawl, const char *path) {
+    RemoteCrawl rc;
+    rc.crawl = crawl;
+    rc.pieces = NULL;
+    mutex_init(&rc.lock);
+    rc.tasks = indexTasksBegin(TASK_CRAWL);
+    indexTasksExpectIO(rc.tasks, REMOTE_IN_FLIGHT);
+    RemoteDir *top = newRemoteDir(&rc, path, crawl->perm);
+    if (top) indexTasksSpawn(rc.tasks, remoteWorker, top);
+    indexTasksWait(rc.tasks);
+    mutex_destroy(&rc.lock);
+
+    for (RemoteDir *rd = rc.pieces, *next; rd; rd = next) {
+        next = rd->next;
+        Crawl *piece = &rd->piece;
+        int offset = crawl->dirCount;
+        if (piece->dirCount && reserveDirs(crawl, crawl->dirCount + piece->dirCount) == 0) {
+            memcpy(crawl->dirs + offset, piece->dirs, piece->dirCount * sizeof(DirEntry));
+            crawl->dirCount += piece->dirCount;
+        } else {
+            freeDirs(piece->dirs, piece->dirCount);
+            piece->dirs = NULL;
+            offset = -1;
+        }
+        FileEntry *last = NULL;
+        for (FileEntry *e = piece->head; e; e = e->next) {
+            if (e->dir >= 0) e->dir = offset < 0 ? -1 : e->dir + offset;
+            last = e;
+        }
+        if (last) {
+            last->next = crawl->head;
+            crawl->head = piece->head;
+            crawl->count += piece->count;
+        }
+        free(piece->dirs);
+        free(rd->path);
+        free(rd);
+    }
+}
+#endif
+
+// Crawls one shard into a fresh table and swaps it in. The rest of the index
+// stays searchable throughout; only the pointer swap takes the lock. The
+// directory and hash tables are sized up front from estimateShard, so a big
+// crawl does not keep reallocating them. build may be NULL.
+static void crawlOnce(Index *ix, int shard, Build *build) {
+    Crawl crawl;
+    double start = now_seconds();
+    long dirs;
+
+    mutex_lock(&ix->lock);
+    initCrawl(ix, &crawl, shard);
+    crawl.build = build;
+    ix->shards[shard].dirty = 0;
+    crawl.expected = estimateShard(ix, shard, &dirs) - dirs;
+    mutex_unlock(&ix->lock);
+    if (dirs > 0 && dirs < INT32_MAX) reserveDirs(&crawl, (int)dirs);
+
+    if (build) flushProgress(&crawl, 1);
+    crawl.perm = parentPerm(ix, ix->shards[shard].path);
+    int inodeOrder = ix->crawlOrder == CRAWL_ORDER_INODE ||
+        (ix->crawlOrder == CRAWL_ORDER_AUTO && isRotational(rootDevice(ix->shards[shard].path)));
+    #ifdef OS_POSIX
+    if (isRemoteFilesystem(ix->shards[shard].path)) {
+        traverseRemote(&crawl, ix->shards[shard].path);
+    } else if (inodeOrder) {
+        PendingDir top = {ix->shards[shard].path, crawl.perm};
+        traverseByInode(&crawl, &top, 1);
+    } else
+    #endif
+    traverseDirectory(&crawl, ix->shards[shard].path);
+    flushProgress(&crawl, 0);
+    size_t tableSize;
+    FileEntry **table = buildTable(&crawl, &tableSize);
+    if (!table) {
+        freeChain(crawl.head);
+        freeDirs(crawl.dirs, crawl.dirCount);
+        return;
+    }
+
+    mutex_lock(&ix->lock);
+    FileEntry **old = ix->shards[shard].table;
+    size_t oldSize = ix->shards[shard].tableSize;
+    retireTable(ix, old, oldSize);
+    assignIdTable(ix, table, tableSize);
+    DirEntry *oldDirs = ix->shards[shard].dirs;
+    int oldDirCount = ix->shards[shard].dirCount;
+    ix->shards[shard].table = table;
+    ix->shards[shard].tableSize = tableSize;
+    ix->shards[shard].dirs = crawl.dirs;
+    ix->shards[shard].dirCount = crawl.dirCount;
+    ix->shards[shard].dirCap = crawl.dirCap;
+    ix->shards[shard].deadDirs = 0;
+    mapDirs(&ix->shards[shard]);
+    ix->shards[shard].pollCursor = 0;
+    ix->totalFiles += crawl.count - ix->shards[shard].fileCount;
+    ix->shards[shard].fileCount = crawl.count;
+    ix->shards[shard].lastRefresh = now_seconds();
+    ix->shards[shard].crawlSeconds = ix->shards[shard].lastRefresh - start;
+    mutex_unlock(&ix->lock);
+    metricAdd(ix, METRIC_CRAWLS, 1);
+    metricAdd(ix, METRIC_CRAWLED, (uint64_t)crawl.count);
+    metricAdd(ix, METRIC_CRAWL_NANOS, (uint64_t)((now_seconds() - start) * 1e9));
+
+    // Searches copy their results out under the lock, so nobody can still
+    // be looking at the old table.
+    freeTable(old, oldSize);
+    freeDirs(oldDirs, oldDirCount);
+}
+
+// Only one crawl of a shard runs at a time, since the last to swap its
+// table in would win. A crawl asked for meanwhile is run by the one in
+// progress once it finishes, and the caller returns at once.
+static void crawlShard(Index *ix, int shard, Build *build) {
+    Shard *sh = &ix->shards[shard];
+    mutex_lock(&ix->lock);
+    if (sh->crawling) {
+        sh->recrawl = 1;
+        mutex_unlock(&ix->lock);
+        return;
+    }
+    sh->crawling = 1;
+    do {
+        sh->recrawl = 0;
+        mutex_unlock(&ix->lock);
+        crawlOnce(ix, shard, build);
+        mutex_lock(&ix->lock);
+    } while (sh->recrawl);
+    sh->crawling = 0;
+    mutex_unlock(&ix->lock);
+}
+
+typedef struct DeviceQueue {
+    Index *ix;
+    unsigned long device;
+    int shards[MAX_SHARDS];
+    int count;
+    Build *build;
+} DeviceQueue;
+
+static void deviceWorker(void *arg) {
+    DeviceQueue *queue = (DeviceQueue *)arg;
+    for (int i = 0; i < queue->count; i++) crawlShard(queue->ix, queue->shards[i], queue->build);
+}
+
+static long rootFileCount(Index *ix, int root) {
+    long count = 0;
+    for (int s = 0; s < ix->shardCount; s++) {
+        if (ix->shards[s].root == root) count += ix->shards[s].fileCount;
+    }
+    return count;
+}
+
+// Returns the most specific shard whose subtree holds path, or -1.
+// Caller holds the lock.
+static int shardForPath(Index *ix, const char *path) {
+    int best = -1;
+    size_t bestLen = 0;
+    for (int s = 0; s < ix->shardCount; s++) {
+        size_t len = strlen(ix->shards[s].path);
+        if (len >= bestLen && isPathWithin(path, ix->shards[s].path)) {
+            best = s;
+            bestLen = len;
+        }
+    }
+    return best;
+}
+
+// --- Directory Poller ---
+// inotify sees nothing on NFS, CIFS or FUSE, so poll shards are kept fresh by
+// re-stating the directories they already know about. A directory's mtime
+// and ctime move whenever an entry is created, removed or renamed in it, so
+// only directories that changed are re-read. Each directory adapts its own
+// interval: changes halve it, quiet polls stretch it, and the whole poller
+// stays within a global syscall budget per second.
+
+#ifdef OS_POSIX
+// Unlinks one entry from the shard's hash table and frees it.
+// Caller holds the lock.
+static void unlinkEntry(Index *ix, Shard *sh, FileEntry *entry) {
+    FileEntry **link = &sh->table[bucketOf(sh, entry->filename)];
+    while (*link && *link != entry) link = &(*link)->next;
+    if (*link) *link = entry->next;
+    retireEntry(ix, entry);
+    freeEntry(entry);
+    sh->fileCount--;
+    ix->totalFiles--;
+}
+
+// Drops a directory's files. Caller holds the lock.
+static void dropDirFiles(Index *ix, Shard *sh, int d) {
+    FileEntry *entry = sh->dirs[d].files;
+    while (entry) {
+        FileEntry *next = entry->dirNext;
+        unlinkEntry(ix, sh, entry);
+        entry = next;
+    }
+    sh->dirs[d].files = NULL;
+}
+
+// Drops a directory and everything below it. Caller holds the lock.
+static void dropDirTree(Index *ix, Shard *sh, const char *path) {
+    for (int d = 0; d < sh->dirCount; d++) {
+        if (sh->dirs[d].path && isPathWithin(sh->dirs[d].path, path)) {
+            dropDirFiles(ix, sh, d);
+            unmapDir(sh, d);
+            free(sh->dirs[d].path);
+            sh->dirs[d].path = NULL;
+        }
+    }
+}
+
+// Moves a crawl of new subdirectories into a live shard.
+// Caller holds the lock.
+static void mergeCrawl(Index *ix, Shard *sh, Crawl *crawl) {
+    if (sh->dirCount + crawl->dirCount > sh->dirCap) {
+        int newCap = sh->dirCap ? sh->dirCap : 64;
+        while (newCap < sh->dirCount + crawl->dirCount) newCap *= 2;
+        DirEntry *grown = (DirEntry *)realloc(sh->dirs, newCap * sizeof(DirEntry));
+        if (!grown) {
+            freeChain(crawl->head);
+            freeDirs(crawl->dirs, crawl->dirCount);
+            return;
+        }
+        sh->dirs = grown;
+        sh->dirCap = newCap;
+    }
+    int base = sh->dirCount;
+    memcpy(sh->dirs + base, crawl->dirs, crawl->dirCount * sizeof(DirEntry));
+    sh->dirCount += crawl->dirCount;
+    free(crawl->dirs);
+    mapNewDirs(sh, base);
+
+    assignIdList(ix, crawl->head);
+    FileEntry *entry = crawl->head;
+    while (entry) {
+        FileEntry *next = entry->next;
+        if (entry->dir >= 0) entry->dir += base;
+        size_t index = bucketOf(sh, entry->filename);
+        entry->next = sh->table[index];
+        sh->table[index] = entry;
+        entry = next;
+    }
+    sh->fileCount += crawl->count;
+    ix->totalFiles += crawl->count;
+}
+
+// Re-reads one changed directory: its files are replaced, vanished
+// subdirectories are dropped and new ones are crawled.
+// Returns the number of syscalls spent.
+static long rereadDirectory(Index *ix, int s, int d, const char *path, uint32_t perm) {
+    Shard *sh = &ix->shards[s];
+    DIR *dir = opendir(path);
+    long syscalls = 1;
+    if (!dir) {
+        mutex_lock(&ix->lock);
+        dropDirTree(ix, sh, path);
+        mutex_unlock(&ix->lock);
+        return syscalls;
+    }
+
+    Crawl files;
+    mutex_lock(&ix->lock);
+    initCrawl(ix, &files, s);
+    mutex_unlock(&ix->lock);
+    files.perm = perm;
+    char **subdirs = NULL;
+    int subdirCount = 0, subdirCap = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char fullPath[MAX_PATH_LEN];
+        if (snprintf(fullPath, sizeof(fullPath), "%s/%s", path, entry->d_name) >= (int)sizeof(fullPath)) continue;
+        struct stat statbuf;
+        syscalls++;
+        if (stat(fullPath, &statbuf) == -1) continue;
+        if (S_ISDIR(statbuf.st_mode)) {
+            if (isShardBoundary(ix, s, fullPath)) continue;
+            if (subdirCount == subdirCap) {
+                subdirCap = subdirCap ? subdirCap * 2 : 16;
+                char **grown = (char **)realloc(subdirs, subdirCap * sizeof(char *));
+                if (!grown) break;
+                subdirs = grown;
+            }
+            subdirs[subdirCount++] = strdup(fullPath);
+        } else {
+            FileMeta meta;
+            statMeta(&statbuf, &meta);
+            addFile(&files, entry->d_name, fullPath, &meta);
+        }
+    }
+    closedir(dir);
+
+    mutex_lock(&ix->lock);
+    // The shard may have been rebuilt while we were reading.
+    int stillValid = d < sh->dirCount && sh->dirs[d].path && strcmp(sh->dirs[d].path, path) == 0;
+    if (stillValid) {
+        dropDirFiles(ix, sh, d);
+        assignIdList(ix, files.head);
+        FileEntry *e = files.head;
+        while (e) {
+            FileEntry *next = e->next;
+            size_t index = bucketOf(sh, e->filename);
+            e->dir = d;
+            e->next = sh->table[index];
+            sh->table[index] = e;
+            e->dirNext = sh->dirs[d].files;
+            sh->dirs[d].files = e;
+            e = next;
+        }
+        sh->fileCount += files.count;
+        ix->totalFiles += files.count;
+        files.head = NULL;
+
+        // Drop tracked children that are no longer there. Only when fewer
+        // of them are present than are tracked is there any to look for.
+        int tracked = 0;
+        for (int i = 0; i < subdirCount; i++) tracked += findDir(sh, subdirs[i]) >= 0;
+        for (int c = 0; tracked < sh->dirs[d].children && c < sh->dirCount; c++) {
+            const char *child = sh->dirs[c].path;
+            if (c == d || !child || !isPathChild(child, path)) continue;
+            int present = 0;
+            for (int i = 0; i < subdirCount && !present; i++) present = strcmp(subdirs[i], child) == 0;
+            if (!present) dropDirTree(ix, sh, child);
+        }
+        // Keep only subdirectories we have not seen before.
+        int kept = 0;
+        for (int i = 0; i < subdirCount; i++) {
+            if (findDir(sh, subdirs[i]) >= 0) free(subdirs[i]);
+            else subdirs[kept++] = subdirs[i];
+        }
+        subdirCount = kept;
+    }
+    ix->pollRereads++;
+    mutex_unlock(&ix->lock);
+    freeChain(files.head);
+
+    for (int i = 0; i < subdirCount; i++) {
+        if (stillValid) {
+            Crawl crawl;
+            initPiece(&crawl, &files);
+            crawl.perm = perm;
+            traverseDirectory(&crawl, subdirs[i]);
+            syscalls += crawl.count + crawl.dirCount * 2;
+            mutex_lock(&ix->lock);
+            mergeCrawl(ix, sh, &crawl);
+            mutex_unlock(&ix->lock);
+        }
+        free(subdirs[i]);
+    }
+    free(subdirs);
+    return syscalls;
+}
+
+// Polls due directories of one shard, resuming where the last tick stopped.
+// Returns the number of syscalls spent, never much more than budget.
+static long pollShard(Index *ix, int s, long budget) {
+    Shard *sh = &ix->shards[s];
+    long spent = 0;
+    mutex_lock(&ix->lock);
+    compactDirs(sh);
+    int count = sh->dirCount;
+    mutex_unlock(&ix->lock);
+
+    for (int n = 0; n < count && spent < budget && !ix->stopRefresher; n++) {
+        char path[MAX_PATH_LEN];
+        int64_t mtime, ctime;
+        double now = now_seconds();
+
+        mutex_lock(&ix->lock);
+        if (sh->dirCount == 0) {
+            mutex_unlock(&ix->lock);
+            break;
+        }
+        int d = sh->pollCursor % sh->dirCount;
+        sh->pollCursor = (d + 1) % sh->dirCount;
+        DirEntry *dir = &sh->dirs[d];
+        int due = dir->path && dir->nextPoll <= now;
+        if (due) {
+            snprintf(path, sizeof(path), "%s", dir->path);
+            mtime = dir->mtime;
+            ctime = dir->ctime;
+        }
+        mutex_unlock(&ix->lock);
+        if (!due) continue;
+
+        struct stat st;
+        uint32_t perm = 0;
+        spent++;
+        int gone = stat(path, &st) == -1 || !S_ISDIR(st.st_mode);
+        int changed = gone || statMtime(&st) != mtime || statCtime(&st) != ctime;
+
+        mutex_lock(&ix->lock);
+        int valid = d < sh->dirCount && sh->dirs[d].path && strcmp(sh->dirs[d].path, path) == 0;
+        if (valid && changed && !gone) {
+            // A re-read costs a stat per entry. One that does not fit what
+            // is left of the budget waits for the next tick, unchanged so it
+            // is seen again; one bigger than a whole tick is read anyway.
+            long cost = 1 + sh->dirs[d].children;
+            for (FileEntry *e = sh->dirs[d].files; e; e = e->dirNext) cost++;
+            if (spent + cost > budget && !(cost > ix->pollBudget && spent <= 1)) {
+                sh->pollCursor = d;
+                mutex_unlock(&ix->lock);
+                break;
+            }
+        }
+        if (valid) {
+            dir = &sh->dirs[d];
+            double maxInterval = (double)sh->interval * MAX_POLL_BACKOFF;
+            if (changed) {
+                dir->interval /= 2;
+                if (dir->interval < MIN_POLL_INTERVAL) dir->interval = MIN_POLL_INTERVAL;
+            } else {
+                dir->interval *= 1.5;
+                if (dir->interval > maxInterval) dir->interval = maxInterval;
+            }
+            dir->nextPoll = now + dir->interval;
+            if (changed && !gone) {
+                dir->mtime = statMtime(&st);
+                dir->ctime = statCtime(&st);
+                // A chmod shows up as a ctime change; it can hide or reveal
+                // the whole subtree.
+                uint32_t fresh = dirPerm(ix, permParent(ix, dir->perm), path, &st);
+                if (fresh != dir->perm) reclassTree(ix, path, dir->perm, fresh);
+                perm = fresh;
+            }
+            if (gone) dropDirTree(ix, sh, path);
+        }
+        mutex_unlock(&ix->lock);
+
+        if (valid && changed && !gone) spent += rereadDirectory(ix, s, d, path, perm);
+    }
+    return spent;
+}
+#endif
+
+// Runs one poller tick over every poll shard, sharing the syscall budget.
+static void pollShards(Index *ix) {
+    #ifdef OS_POSIX
+    long spent = 0;
+    for (int s = 0; s < ix->shardCount && spent < ix->pollBudget && !ix->stopRefresher; s++) {
+        if (ix->shards[s].policy == REFRESH_POLL) spent += pollShard(ix, s, ix->pollBudget - spent);
+    }
+    ix->pollSyscalls = spent;
+    #endif
+}
+
+// --- Residency ---
+// Each MEM_* section is a set of memory regions: a few large arrays for
+// tables and columns, and many small heap blocks for entries, names and
+// directory paths. A walk under the lock gathers the pages the regions
+// cover and sorts and merges them into runs; mlock, madvise and mincore
+// then run over the runs after the lock is released, one call per run
+// rather than per entry. Touching uses MADV_POPULATE_READ the same way
+// where the kernel has it, and otherwise reads one byte of every region
+// during the walk. Pages shared with other heap data are included; the
+// advice only ever costs a page fault.
+
+enum { WALK_MEASURE, WALK_TOUCH, WALK_LOCK, WALK_UNLOCK, WALK_COLD, WALK_PAGEOUT };
+
+typedef struct PageRun {
+    uintptr_t first, last;  // page addresses, inclusive
+} PageRun;
+
+typedef struct RegionWalk {
+    int op;
+    int64_t bytes;
+    uintptr_t page;         // page size
+    PageRun *runs;
+    size_t runCount, runCap;
+    int failed;             // out of memory, or a call was refused
+    volatile unsigned char sink;
+} RegionWalk;
+
+static const char *memSectionNames[MEM_SECTIONS] = {"names", "dirs", "tables", "ids", "columns", "history"};
+
+static void visitRegion(RegionWalk *w, const void *addr, size_t len) {
+    if (!addr || !len) return;
+    w->bytes += len;
+    if (w->op == WALK_TOUCH) {
+        w->sink += *(const volatile unsigned char *)addr;
+        return;
+    }
+    if (!w->page) return;
+    uintptr_t first = (uintptr_t)addr & ~(w->page - 1);
+    uintptr_t last = ((uintptr_t)addr + len - 1) & ~(w->page - 1);
+    // Small blocks allocated together often share a page.
+    if (w->runCount && first >= w->runs[w->runCount - 1].first && first <= w->runs[w->runCount - 1].last + w->page) {
+        if (last > w->runs[w->runCount - 1].last) w->runs[w->runCount - 1].last = last;
+        return;
+    }
+    if (w->runCount == w->runCap) {
+        size_t cap = w->runCap ? w->runCap * 2 : 1024;
+        PageRun *runs = (PageRun *)realloc(w->runs, cap * sizeof(PageRun));
+        if (!runs) {
+            w->failed = 1;
+            return;
+        }
+        w->runs = runs;
+        w->runCap = cap;
+    }
+    w->runs[w->runCount].first = first;
+    w->runs[w->runCount].last = last;
+    w->runCount++;
+}
+
+// Large arrays are walked page by page when touched.
+static void visitArray(RegionWalk *w, const void *addr, size_t len) {
+    if (w->op != WALK_TOUCH || !addr) {
+        visitRegion(w, addr, len);
+        return;
+    }
+    w->bytes += len;
+    for (size_t off = 0; off < len; off += 4096) w->sink += ((const volatile unsigned char *)addr)[off];
+}
+
+static void walkIdMap(RegionWalk *w, const IdMap *map) {
+    visitArray(w, map->slots, map->cap * sizeof(IdSlot));
+}
+
+// Visits the regions of one section. Caller holds the lock.
+static void walkSection(Index *ix, int section, RegionWalk *w) {
+    uint32_t cap = ix->idCap;
+    switch (section) {
+        case MEM_NAMES:
+            for (int s = 0; s < ix->shardCount; s++) {
+                for (size_t i = 0; ix->shards[s].table && i < ix->shards[s].tableSize; i++) {
+                    for (FileEntry *e = ix->shards[s].table[i]; e; e = e->next) {
+                        visitRegion(w, e, sizeof(FileEntry));
+                        visitRegion(w, e->filename, strlen(e->filename) + 1);
+                        visitRegion(w, e->fullpath, strlen(e->fullpath) + 1);
+                    }
+                }
+            }
+            break;
+        case MEM_DIRS:
+            for (int s = 0; s < ix->shardCount; s++) {
+                Shard *sh = &ix->shards[s];
+                visitArray(w, sh->dirs, sh->dirCap * sizeof(DirEntry));
+                for (int d = 0; d < sh->dirCount; d++) {
+                    if (sh->dirs[d].path) visitRegion(w, sh->dirs[d].path, strlen(sh->dirs[d].path) + 1);
+                }
+            }
+            break;
+        case MEM_TABLES:
+            for (int s = 0; s < ix->shardCount; s++) {
+                visitArray(w, ix->shards[s].table, ix->shards[s].tableSize * sizeof(FileEntry *));
+            }
+            break;
+        case MEM_IDS:
+            walkIdMap(w, &ix->pathIds);
+            walkIdMap(w, &ix->inodeIds);
+            visitArray(w, ix->byId, cap * sizeof(FileEntry *));
+            visitArray(w, ix->retiredAt, cap * sizeof(uint32_t));
+            visitArray(w, ix->pathChecks, cap * sizeof(uint32_t));
+            break;
+        case MEM_COLUMNS:
+            visitArray(w, ix->colSize, cap * sizeof(int64_t));
+            visitArray(w, ix->colMtime, cap * sizeof(int64_t));
+            visitArray(w, ix->colExt, cap * sizeof(uint32_t));
+            visitArray(w, ix->colOwner, cap * sizeof(uint32_t));
+            visitArray(w, ix->colTop, cap * sizeof(uint32_t));
+            visitArray(w, ix->colShard, cap * sizeof(uint32_t));
+            visitArray(w, ix->colPerm, cap * sizeof(uint32_t));
+            visitArray(w, ix->colNameLen, cap * sizeof(uint16_t));
+            visitArray(w, ix->colDepth, cap * sizeof(uint16_t));
+            visitArray(w, ix->colOpens, cap * sizeof(uint32_t));
+            visitArray(w, ix->colOpened, cap * sizeof(int64_t));
+            visitArray(w, ix->blockNameLen, cap / NAME_BLOCK * sizeof(uint16_t));
+            visitArray(w, ix->byMtime.sorted, ix->byMtime.count * sizeof(SortEntry));
+            visitArray(w, ix->bySize.sorted, ix->bySize.count * sizeof(SortEntry));
+            if (ix->colBands) visitArray(w, ix->colBands, (size_t)cap * MINHASH_BANDS * sizeof(uint32_t));
+            for (int band = 0; band < MINHASH_BANDS; band++)
+                visitArray(w, ix->bands[band].sorted, ix->bands[band].count * sizeof(BandEntry));
+            for (int i = 0; i < VIEW_CACHE; i++) {
+                if (ix->views[i].visible) visitArray(w, ix->views[i].visible, (cap / 64 + 1) * sizeof(uint64_t));
+            }
+            break;
+        case MEM_HISTORY:
+            if (!ix->history) break;
+            visitArray(w, ix->history->snapshots, ix->history->snapshotCap * sizeof(uint32_t));
+            visitArray(w, ix->history->head, ix->history->headCap * sizeof(uint32_t));
+            visitArray(w, ix->history->spans, ix->history->spanCap * sizeof(HistSpan));
+            visitArray(w, ix->history->codeById, ix->history->codeCap * sizeof(uint32_t));
+            walkIdMap(w, &ix->history->paths.codes);
+            break;
+    }
+}
+
+static int compareRuns(const void *a, const void *b) {
+    uintptr_t fa = ((const PageRun *)a)->first, fb = ((const PageRun *)b)->first;
+    return (fa > fb) - (fa < fb);
+}
+
+// Maps each RESIDENCY_* policy to the operation enforcing it.
+static const int residencyOps[] = {WALK_MEASURE, WALK_LOCK, WALK_TOUCH, WALK_COLD, WALK_PAGEOUT};
+
+// Set while the kernel can fault pages in for us (MADV_POPULATE_READ, Linux
+// 5.14), so a touch needs only the runs and not the memory itself.
+#ifdef MADV_POPULATE_READ
+static int touchByAdvice = 1;
+#else
+static int touchByAdvice = 0;
+#endif
+
+// Walks a section, gathering the pages it covers as sorted, merged runs.
+// With w->op WALK_TOUCH the regions are read instead. Caller holds the lock.
+static void collectSection(Index *ix, int section, RegionWalk *w) {
+    #ifdef OS_POSIX
+    w->page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    #endif
+    walkSection(ix, section, w);
+    if (w->op == WALK_TOUCH || !w->page) return;
+
+    qsort(w->runs, w->runCount, sizeof(PageRun), compareRuns);
+    size_t merged = 0;
+    for (size_t i = 0; i < w->runCount; i++) {
+        if (merged && w->runs[i].first <= w->runs[merged - 1].last + w->page) {
+            if (w->runs[i].last > w->runs[merged - 1].last) w->runs[merged - 1].last = w->runs[i].last;
+        } else {
+            w->runs[merged++] = w->runs[i];
+        }
+    }
+    w->runCount = merged;
+}
+
+// Applies op to the runs of an earlier collectSection, without the lock.
+// A range freed since fails with ENOMEM and is skipped; one reused by other
+// heap data gets advice meant for the index, which costs at most a fault.
+// Returns the number of pages, and sets *hit to those resident
+// (WALK_MEASURE) or locked (WALK_LOCK).
+static size_t applyRuns(RegionWalk *w, int op, size_t *hit) {
+    size_t pages = 0;
+    *hit = 0;
+    #ifdef OS_POSIX
+    for (size_t i = 0; i < w->runCount; i++) {
+        void *start = (void *)w->runs[i].first;
+        size_t count = (w->runs[i].last - w->runs[i].first) / w->page + 1, len = count * w->page;
+        pages += count;
+        switch (op) {
+            case WALK_MEASURE:
+                for (size_t done = 0; done < count; done += MINCORE_CHUNK) {
+                    unsigned char vec[MINCORE_CHUNK];
+                    size_t n = count - done < MINCORE_CHUNK ? count - done : MINCORE_CHUNK;
+                    if (mincore((char *)start + done * w->page, n * w->page, (void *)vec) < 0) continue;
+                    for (size_t p = 0; p < n; p++) *hit += vec[p] & 1;
+                }
+                break;
+            case WALK_TOUCH:
+                #ifdef MADV_POPULATE_READ
+                // Older kernels refuse the advice; touch under the lock from then on.
+                if (madvise(start, len, MADV_POPULATE_READ) < 0 && errno == EINVAL) touchByAdvice = 0;
+                #endif
+                break;
+            case WALK_LOCK:
+                if (mlock(start, len) == 0) *hit += count;
+                else w->failed = 1;
+                break;
+            case WALK_UNLOCK:
+                munlock(start, len);
+                break;
+            case WALK_COLD:
+                #ifdef MADV_COLD
+                madvise(start, len, MADV_COLD);
+                #endif
+                break;
+            case WALK_PAGEOUT:
+                #ifdef MADV_PAGEOUT
+                madvise(start, len, MADV_PAGEOUT);
+                #endif
+                break;
+        }
+    }
+    #else
+    (void)w;
+    (void)op;
+    #endif
+    return pages;
+}
+
+static int64_t shareOf(const RegionWalk *w, size_t pages, size_t hit) {
+    return pages && !w->failed ? (int64_t)((double)w->bytes * hit / pages) : w->bytes ? -1 : 0;
+}
+
+// Re-applies every policy, so regions allocated since the last pass (new
+// tables after a refresh, grown columns) are covered too, and measures
+// every section for the metrics file. Only the walks that gather runs
+// hold the lock; the system calls run after it. force skips the interval.
+static void maintainResidency(Index *ix, int force) {
+    RegionWalk walks[MEM_SECTIONS];
+    int policy[MEM_SECTIONS], needed = ix->metricsFile[0] != '\0';
+    mutex_lock(&ix->lock);
+    for (int m = 0; m < MEM_SECTIONS; m++) needed |= ix->residency[m] != RESIDENCY_DEFAULT;
+    if (!needed || (!force && now_seconds() - ix->lastResidency < RESIDENCY_INTERVAL)) {
+        mutex_unlock(&ix->lock);
+        return;
+    }
+    ix->lastResidency = now_seconds();
+    memset(walks, 0, sizeof(walks));
+    for (int m = 0; m < MEM_SECTIONS; m++) {
+        policy[m] = ix->residency[m];
+        walks[m].op = policy[m] == RESIDENCY_TOUCH && !touchByAdvice ? WALK_TOUCH : WALK_MEASURE;
+        collectSection(ix, m, &walks[m]);
+    }
+    mutex_unlock(&ix->lock);
+
+    int64_t locked[MEM_SECTIONS], resident[MEM_SECTIONS];
+    for (int m = 0; m < MEM_SECTIONS; m++) {
+        size_t hit = 0, pages = 0;
+        if (policy[m] != RESIDENCY_DEFAULT && walks[m].op != WALK_TOUCH)
+            pages = applyRuns(&walks[m], residencyOps[policy[m]], &hit);
+        locked[m] = pages ? (int64_t)((double)walks[m].bytes * hit / pages) : 0;
+        pages = applyRuns(&walks[m], WALK_MEASURE, &hit);
+        resident[m] = shareOf(&walks[m], pages, hit);
+    }
+
+    mutex_lock(&ix->lock);
+    for (int m = 0; m < MEM_SECTIONS; m++) {
+        if (policy[m] == RESIDENCY_LOCK && ix->residency[m] == RESIDENCY_LOCK) ix->lockedBytes[m] = locked[m];
+        ix->memBytes[m] = walks[m].bytes;
+        ix->memResident[m] = resident[m];
+        free(walks[m].runs);
+    }
+    mutex_unlock(&ix->lock);
+}
+
+int indexSetResidency(Index *ix, int section, int policy) {
+    if (section < 0 || section >= MEM_SECTIONS || policy < RESIDENCY_DEFAULT || policy > RESIDENCY_PAGEOUT) return -1;
+    #ifndef OS_POSIX
+    if (policy != RESIDENCY_DEFAULT && policy != RESIDENCY_TOUCH) return -1;
+    #endif
+    RegionWalk w;
+    memset(&w, 0, sizeof(w));
+    w.op = policy == RESIDENCY_TOUCH && !touchByAdvice ? WALK_TOUCH : WALK_MEASURE;
+    mutex_lock(&ix->lock);
+    int was = ix->residency[section];
+    ix->residency[section] = policy;
+    if (was == RESIDENCY_LOCK && policy != RESIDENCY_LOCK) ix->lockedBytes[section] = 0;
+    collectSection(ix, section, &w);
+    mutex_unlock(&ix->lock);
+
+    size_t hit = 0, pages = 0;
+    if (was == RESIDENCY_LOCK && policy != RESIDENCY_LOCK) applyRuns(&w, WALK_UNLOCK, &hit);
+    if (w.op != WALK_TOUCH) pages = applyRuns(&w, residencyOps[policy], &hit);
+    int result = w.failed ? -1 : 0;
+    if (policy == RESIDENCY_LOCK) {
+        mutex_lock(&ix->lock);
+        if (ix->residency[section] == RESIDENCY_LOCK) {
+            ix->lockedBytes[section] = pages ? (int64_t)((double)w.bytes * hit / pages) : 0;
+            // Over RLIMIT_MEMLOCK: keep what was locked and touch the rest.
+            if (result < 0) ix->residency[section] = RESIDENCY_TOUCH;
+        }
+        mutex_unlock(&ix->lock);
+    }
+    free(w.runs);
+    return result;
+}
+
+int indexMemoryInfo(Index *ix, int section, IndexMemoryInfo *info) {
+    if (section < 0 || section >= MEM_SECTIONS) return -1;
+    RegionWalk w;
+    size_t hit;
+    memset(&w, 0, sizeof(w));
+    w.op = WALK_MEASURE;
+    mutex_lock(&ix->lock);
+    collectSection(ix, section, &w);
+    info->name = memSectionNames[section];
+    info->locked = ix->lockedBytes[section];
+    info->policy = ix->residency[section];
+    mutex_unlock(&ix->lock);
+    size_t pages = applyRuns(&w, WALK_MEASURE, &hit);
+    info->bytes = w.bytes;
+    info->resident = shareOf(&w, pages, hit);
+    free(w.runs);
+    return 0;
+}
+
+int64_t indexMemoryBytes(Index *ix) {
+    RegionWalk w;
+    memset(&w, 0, sizeof(w));
+    w.op = WALK_MEASURE;
+    // Without a page size the walk only counts bytes.
+    mutex_lock(&ix->lock);
+    for (int m = 0; m < MEM_SECTIONS; m++) walkSection(ix, m, &w);
+    mutex_unlock(&ix->lock);
+    return w.bytes;
+}
+
+// --- Standing Queries ---
+// Patterns registered with indexStandingAdd are checked against the names
+// of files added, moved or changed since the last indexUpdate, never by
+// scanning the index. All of them are matched in one pass per name: an
+// Aho-Corasick automaton finds every query whose literal occurs in the
+// name, and only those are verified, so the cost per name hardly depends
+// on how many queries there are.
+
+static void freeAutomaton(Automaton *a) {
+    free(a->next);
+    free(a->out);
+    free(a->dict);
+    free(a->always);
+    memset(a, 0, sizeof(*a));
+}
+
+// Rebuilds the automaton from the live queries. Caller holds the lock.
+static int buildAutomaton(Index *ix) {
+    Automaton *a = &ix->automaton;
+    freeAutomaton(a);
+    size_t total = 1;
+    for (int q = 0; q < ix->standingCount; q++) {
+        const Standing *sq = &ix->standing[q];
+        if (!sq->pattern) continue;
+        total += strlen(sq->literal);
+        for (const char *p = sq->literal; *p; p++) {
+            if (!a->cls[(unsigned char)*p]) a->cls[(unsigned char)*p] = (uint8_t)++a->classes;
+        }
+    }
+    int k = a->classes + 1;
+    a->next = (int32_t *)malloc(total * k * sizeof(int32_t));
+    a->out = (int32_t *)malloc(total * sizeof(int32_t));
+    a->dict = (int32_t *)calloc(total, sizeof(int32_t));
+    a->always = (int *)malloc((ix->standingCount + 1) * sizeof(int));
+    int32_t *fail = (int32_t *)calloc(total, sizeof(int32_t));
+    int32_t *queue = (int32_t *)malloc(total * sizeof(int32_t));
+    if (!a->next || !a->out || !a->dict || !a->always || !fail || !queue) {
+        freeAutomaton(a);
+        free(fail);
+        free(queue);
+        return -1;
+    }
+    memset(a->next, 0xFF, total * k * sizeof(int32_t));
+    memset(a->out, 0xFF, total * sizeof(int32_t));
+    a->states = 1;
+    for (int q = 0; q < ix->standingCount; q++) {
+        Standing *sq = &ix->standing[q];
+        if (!sq->pattern) continue;
+        if (!*sq->literal) {
+            a->always[a->alwaysCount++] = q;
+            continue;
+        }
+        int32_t state = 0;
+        for (const char *p = sq->literal; *p; p++) {
+            int32_t *slot = &a->next[(size_t)state * k + a->cls[(unsigned char)*p]];
+            if (*slot < 0) *slot = a->states++;
+            state = *slot;
+        }
+        sq->nextSame = a->out[state];
+        a->out[state] = q;
+    }
+
+    // Breadth first, completing the table with the failure transitions.
+    int head = 0, tail = 0;
+    for (int c = 0; c < k; c++) {
+        int32_t *slot = &a->next[c];
+        if (*slot < 0) *slot = 0;
+        else queue[tail++] = *slot;
+    }
+    while (head < tail) {
+        int32_t state = queue[head++];
+        int32_t f = fail[state];
+        a->dict[state] = a->out[f] >= 0 ? f : a->dict[f];
+        for (int c = 0; c < k; c++) {
+            int32_t *slot = &a->next[(size_t)state * k + c];
+            if (*slot < 0) {
+                *slot = a->next[(size_t)f * k + c];
+            } else {
+                fail[*slot] = a->next[(size_t)f * k + c];
+                queue[tail++] = *slot;
+            }
+        }
+    }
+    free(fail);
+    free(queue);
+    ix->automatonStale = 0;
+    return 0;
+}
+
+// Glob match ignoring case; pattern is lowercase. * matches any run,
+// ? any one byte.
+static int globMatch(const char *pattern, const char *name) {
+    const char *star = NULL, *resume = NULL;
+    while (*name) {
+        if (*pattern == '*') {
+            star = ++pattern;
+            resume = name;
+        } else if (*pattern == '?' || *pattern == tolower((unsigned char)*name)) {
+            pattern++;
+            name++;
+        } else if (star) {
+            pattern = star;
+            name = ++resume;
+        } else {
+            return 0;
+        }
+    }
+    while (*pattern == '*') pattern++;
+    return !*pattern;
+}
+
+// Hits gathered by one maintainStanding pass.
+typedef struct HitList {
+    IndexStandingHit *items;
+    int count, cap;
+} HitList;
+
+// Appends a hit for query q on entry e. Caller holds the lock.
+static void addStandingHit(Index *ix, HitList *hits, int q, const FileEntry *e) {
+    if (hits->count == hits->cap) {
+        int cap = hits->cap ? hits->cap * 2 : 64;
+        IndexStandingHit *grown = (IndexStandingHit *)realloc(hits->items, cap * sizeof(IndexStandingHit));
+        if (!grown) return;
+        hits->items = grown;
+        hits->cap = cap;
+    }
+    IndexStandingHit *hit = &hits->items[hits->count++];
+    hit->query = q;
+    snprintf(hit->pattern, sizeof(hit->pattern), "%s", ix->standing[q].pattern);
+    snprintf(hit->file.filename, sizeof(hit->file.filename), "%s", e->filename);
+    snprintf(hit->file.fullpath, sizeof(hit->file.fullpath), "%s", e->fullpath);
+    hit->file.id = e->id;
+    hit->file.size = e->size;
+    hit->file.mtime = e->mtime;
+    hit->file.root = e->root;
+    hit->file.shard = e->shard;
+    hit->when = (int64_t)time(NULL);
+    ix->standing[q].hits++;
+    ix->standingHits++;
+    ix->recent[ix->recentNext] = *hit;
+    ix->recentNext = (ix->recentNext + 1) % STANDING_RECENT;
+    if (ix->recentCount < STANDING_RECENT) ix->recentCount++;
+}
+
+static void checkStanding(Index *ix, HitList *hits, int q, const FileEntry *e) {
+    Standing *sq = &ix->standing[q];
+    if (sq->seen == ix->nameStamp) return;
+    sq->seen = ix->nameStamp;
+    if (!sq->glob || globMatch(sq->pattern, e->filename)) addStandingHit(ix, hits, q, e);
+}
+
+static int compareIds(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Matches the queued changes against every standing query and hands the
+// hits to the callback, outside the lock.
+static void maintainStanding(Index *ix) {
+    mutex_lock(&ix->lock);
+    if (!ix->changedCount || !ix->standingLive) {
+        ix->changedCount = 0;
+        mutex_unlock(&ix->lock);
+        return;
+    }
+    if (ix->automatonStale && buildAutomaton(ix) < 0) {
+        mutex_unlock(&ix->lock);
+        return;
+    }
+    const Automaton *a = &ix->automaton;
+    HitList hits = {NULL, 0, 0};
+    int k = a->classes + 1;
+    qsort(ix->changed, ix->changedCount, sizeof(uint32_t), compareIds);
+    size_t i = 0;
+    for (; i < ix->changedCount && hits.count < STANDING_MAX_HITS; i++) {
+        uint32_t id = ix->changed[i];
+        if ((i && ix->changed[i - 1] == id) || id >= ix->idCap || !ix->byId[id]) continue;
+        const FileEntry *e = ix->byId[id];
+        ix->nameStamp++;
+        ix->namesChecked++;
+        for (int n = 0; n < a->alwaysCount; n++) checkStanding(ix, &hits, a->always[n], e);
+        int32_t state = 0;
+        for (const char *p = e->filename; *p; p++) {
+            state = a->next[(size_t)state * k + a->cls[(unsigned char)tolower((unsigned char)*p)]];
+            for (int32_t t = a->out[state] >= 0 ? state : a->dict[state]; t > 0; t = a->dict[t]) {
+                for (int q = a->out[t]; q >= 0; q = ix->standing[q].nextSame) checkStanding(ix, &hits, q, e);
+            }
+        }
+    }
+    // What did not fit waits for the next update.
+    memmove(ix->changed, ix->changed + i, (ix->changedCount - i) * sizeof(uint32_t));
+    ix->changedCount -= i;
+    IndexStandingFn fn = ix->standingFn;
+    void *user = ix->standingUser;
+    mutex_unlock(&ix->lock);
+    for (int h = 0; fn && h < hits.count; h++) fn(&hits.items[h], user);
+    free(hits.items);
+}
+
+int indexStandingAdd(Index *ix, const char *pattern) {
+    if (!pattern || !*pattern) return -1;
+    mutex_lock(&ix->lock);
+    if (ix->standingCount % 64 == 0) {
+        Standing *grown = (Standing *)realloc(ix->standing, (ix->standingCount + 64) * sizeof(Standing));
+        if (!grown) {
+            mutex_unlock(&ix->lock);
+            return -1;
+        }
+        ix->standing = grown;
+    }
+    Standing *sq = &ix->standing[ix->standingCount];
+    memset(sq, 0, sizeof(*sq));
+    sq->pattern = strdup(pattern);
+    sq->literal = (char *)calloc(strlen(pattern) + 1, 1);
+    if (!sq->pattern || !sq->literal) {
+        free(sq->pattern);
+        free(sq->literal);
+        mutex_unlock(&ix->lock);
+        return -1;
+    }
+    for (char *p = sq->pattern; *p; p++) *p = (char)tolower((unsigned char)*p);
+    sq->glob = strpbrk(sq->pattern, "*?") != NULL;
+    size_t best = 0;
+    for (const char *p = sq->pattern; *p;) {
+        size_t run = strcspn(p, "*?");
+        if (run > best) {
+            memcpy(sq->literal, p, run);
+            sq->literal[run] = '\0';
+            best = run;
+        }
+        p += run;
+        if (*p) p++;
+    }
+    sq->nextSame = -1;
+    int q = ix->standingCount++;
+    ix->standingLive++;
+    ix->automatonStale = 1;
+    mutex_unlock(&ix->lock);
+    return q;
+}
+
+int indexStandingRemove(Index *ix, int query) {
+    mutex_lock(&ix->lock);
+    int found = query >= 0 && query < ix->standingCount && ix->standing[query].pattern;
+    if (found) {
+        free(ix->standing[query].pattern);
+        free(ix->standing[query].literal);
+        ix->standing[query].pattern = ix->standing[query].literal = NULL;
+        ix->standingLive--;
+        ix->automatonStale = 1;
+    }
+    mutex_unlock(&ix->lock);
+    return found ? 0 : -1;
+}
+
+void indexSetStandingFn(Index *ix, IndexStandingFn fn, void *user) {
+    mutex_lock(&ix->lock);
+    ix->standingFn = fn;
+    ix->standingUser = user;
+    mutex_unlock(&ix->lock);
+}
+
+int indexStandingRecent(Index *ix, IndexStandingHit *out, int max) {
+    mutex_lock(&ix->lock);
+    int n = 0;
+    for (; n < max && n < ix->recentCount; n++)
+        out[n] = ix->recent[(ix->recentNext - 1 - n + STANDING_RECENT) % STANDING_RECENT];
+    mutex_unlock(&ix->lock);
+    return n;
+}
+
+void indexStandingStats(Index *ix, IndexStandingStats *stats) {
+    mutex_lock(&ix->lock);
+    stats->queries = ix->standingLive;
+    stats->checked = ix->namesChecked;
+    stats->hits = ix->standingHits;
+    stats->queued = (long)ix->changedCount;
+    stats->dropped = ix->changeDrops;
+    mutex_unlock(&ix->lock);
+}
+
+// --- Metrics ---
+// Hot paths only add to the calling thread's MetricSlot. A scrape sums the
+// slots with plain atomic reads, so it never waits on a query, and then
+// takes the lock briefly for the gauges. Memory figures are the ones the
+// residency pass in indexUpdate cached, at most a minute old, as a fresh
+// measurement would walk every section. The text is in the Prometheus
+// exposition format.
+
+static const char *queryKindNames[QUERY_KINDS] = {"name", "viewer", "ranked", "ordered", "history", "group",
+                                                  "similar"};
+static const char *refreshNames[] = {"manual", "poll", "watch"};    // REFRESH_*
+static const char *taskClassNames[TASK_CLASSES] = {"query", "ui", "update", "build", "crawl"};
+
+static void sumMetrics(Index *ix, MetricSlot *sum) {
+    memset(sum, 0, sizeof(*sum));
+    for (int s = 0; s < METRIC_SLOTS; s++) {
+        MetricSlot *m = &ix->metrics[s];
+        for (int c = 0; c < METRIC_COUNTERS; c++) sum->counters[c] += counter_read(&m->counters[c]);
+        for (int k = 0; k < QUERY_KINDS; k++) {
+            for (int b = 0; b < LATENCY_BUCKETS; b++) sum->latency[k][b] += counter_read(&m->latency[k][b]);
+            sum->latencyNanos[k] += counter_read(&m->latencyNanos[k]);
+        }
+    }
+}
+
+// Quantile q of one kind's latency, interpolated within its bucket the way
+// histogram_quantile does. Returns -1 before the first query.
+static double latencyQuantile(const MetricSlot *sum, int kind, double q) {
+    uint64_t total = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) total += sum->latency[kind][b];
+    if (!total) return -1;
+    double rank = q * total, seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS - 1; b++) {
+        uint64_t n = sum->latency[kind][b];
+        if (n && seen + n >= rank) {
+            double lower = b ? latencyBounds[b - 1] : 0;
+            return lower + (latencyBounds[b] - lower) * (rank - seen) / n;
+        }
+        seen += n;
+    }
+    return latencyBounds[LATENCY_BUCKETS - 2];
+}
+
+// Seconds that changes to a shard can go unseen: since the first watch
+// event not yet applied, or how overdue the poller's most overdue
+// directory is. Caller holds the lock.
+static double shardLag(const Shard *sh, double now) {
+    if (sh->policy == REFRESH_WATCH) return sh->dirty ? now - sh->dirtySince : 0;
+    double lag = 0;
+    for (int d = 0; d < sh->dirCount; d++) {
+        if (sh->dirs[d].path && now - sh->dirs[d].nextPoll > lag) lag = now - sh->dirs[d].nextPoll;
+    }
+    return lag;
+}
+
+// Writes s as a label value, escaped.
+static void writeLabel(FILE *out, const char *s) {
+    for (; *s; s++) {
+        if (*s == '\\') fputs("\\\\", out);
+        else if (*s == '"') fputs("\\\"", out);
+        else if (*s == '\n') fputs("\\n", out);
+        else fputc(*s, out);
+    }
+}
+
+static void writeHeader(FILE *out, const char *name, const char *type, const char *help) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void writeShardGauge(FILE *out, const char *name, const Shard *sh, double value) {
+    fprintf(out, "%s{shard=\"", name);
+    writeLabel(out, sh->path);
+    fprintf(out, "\"} %.6g\n", value);
+}
+
+static int writeMetricsFile(Index *ix, const char *path) {
+    // Renamed over the old file, so a scraper never reads half of it.
+    char tmp[MAX_PATH_LEN + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    int failed = indexWriteMetrics(ix, f) < 0;
+    if (fclose(f) != 0) failed = 1;
+    #ifdef OS_WINDOWS
+    if (!failed) remove(path);
+    #endif
+    if (failed || rename(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static void maintainMetrics(Index *ix) {
+    char path[MAX_PATH_LEN];
+    double now = now_seconds();
+    mutex_lock(&ix->lock);
+    int due = ix->metricsFile[0] && now - ix->lastMetrics >= METRICS_INTERVAL;
+    if (due) {
+        snprintf(path, sizeof(path), "%s", ix->metricsFile);
+        ix->lastMetrics = now;
+    }
+    mutex_unlock(&ix->lock);
+    if (due) writeMetricsFile(ix, path);
+}
+
+int indexWriteMetrics(Index *ix, FILE *out) {
+    MetricSlot sum;
+    sumMetrics(ix, &sum);
+    double now = now_seconds();
+
+    mutex_lock(&ix->lock);
+    long dirs = 0;
+    for (int s = 0; s < ix->shardCount; s++) dirs += ix->shards[s].dirCount;
+    writeHeader(out, "index_files", "gauge", "Files in the index.");
+    fprintf(out, "index_files %ld\n", ix->totalFiles);
+    writeHeader(out, "index_directories", "gauge", "Directories the crawlers and poller track.");
+    fprintf(out, "index_directories %ld\n", dirs);
+    writeHeader(out, "index_ids", "gauge", "Ids assigned, live or reserved.");
+    fprintf(out, "index_ids %lu\n", (unsigned long)ix->nextId);
+    writeHeader(out, "index_roots", "gauge", "Crawl roots.");
+    fprintf(out, "index_roots %d\n", ix->rootCount);
+    writeHeader(out, "index_shard_files", "gauge", "Files per shard.");
+    for (int s = 0; s < ix->shardCount; s++) writeShardGauge(out, "index_shard_files", &ix->shards[s], ix->shards[s].fileCount);
+    writeHeader(out, "index_shard_crawl_seconds", "gauge", "Duration of each shard's last full crawl.");
+    for (int s = 0; s < ix->shardCount; s++) writeShardGauge(out, "index_shard_crawl_seconds", &ix->shards[s], ix->shards[s].crawlSeconds);
+    writeHeader(out, "index_shard_age_seconds", "gauge", "Seconds since each shard's last full crawl.");
+    for (int s = 0; s < ix->shardCount; s++) writeShardGauge(out, "index_shard_age_seconds", &ix->shards[s], now - ix->shards[s].lastRefresh);
+    writeHeader(out, "index_update_lag_seconds", "gauge",
+                "How long changes can go unseen in watched and polled shards.");
+    for (int s = 0; s < ix->shardCount; s++) {
+        const Shard *sh = &ix->shards[s];
+        if (sh->policy == REFRESH_MANUAL) continue;
+        fprintf(out, "index_update_lag_seconds{shard=\"");
+        writeLabel(out, sh->path);
+        fprintf(out, "\",policy=\"%s\"} %.6g\n", refreshNames[sh->policy], shardLag(sh, now));
+    }
+    writeHeader(out, "index_poll_rereads_total", "counter", "Directories the poller found changed and re-read.");
+    fprintf(out, "index_poll_rereads_total %ld\n", ix->pollRereads);
+    writeHeader(out, "index_poll_syscalls", "gauge", "Syscalls spent by the poller's last tick.");
+    fprintf(out, "index_poll_syscalls %ld\n", ix->pollSyscalls);
+    int64_t memBytes[MEM_SECTIONS], memResident[MEM_SECTIONS], memLocked[MEM_SECTIONS];
+    memcpy(memBytes, ix->memBytes, sizeof(memBytes));
+    memcpy(memResident, ix->memResident, sizeof(memResident));
+    memcpy(memLocked, ix->lockedBytes, sizeof(memLocked));
+    mutex_unlock(&ix->lock);
+
+    writeHeader(out, "index_crawls_total", "counter", "Shard crawls finished.");
+    fprintf(out, "index_crawls_total %llu\n", (unsigned long long)sum.counters[METRIC_CRAWLS]);
+    writeHeader(out, "index_crawled_files_total", "counter", "Files found by crawls.");
+    fprintf(out, "index_crawled_files_total %llu\n", (unsigned long long)sum.counters[METRIC_CRAWLED]);
+    writeHeader(out, "index_crawl_seconds_total", "counter", "Time spent crawling; crawl rate is files over seconds.");
+    fprintf(out, "index_crawl_seconds_total %.6f\n", sum.counters[METRIC_CRAWL_NANOS] / 1e9);
+
+    writeHeader(out, "index_query_seconds", "histogram", "Query latency by kind.");
+    for (int k = 0; k < QUERY_KINDS; k++) {
+        uint64_t cumulative = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            cumulative += sum.latency[k][b];
+            if (b < LATENCY_BUCKETS - 1)
+                fprintf(out, "index_query_seconds_bucket{kind=\"%s\",le=\"%g\"} %llu\n",
+                        queryKindNames[k], latencyBounds[b], (unsigned long long)cumulative);
+            else
+                fprintf(out, "index_query_seconds_bucket{kind=\"%s\",le=\"+Inf\"} %llu\n",
+                        queryKindNames[k], (unsigned long long)cumulative);
+        }
+        fprintf(out, "index_query_seconds_sum{kind=\"%s\"} %.6f\n", queryKindNames[k], sum.latencyNanos[k] / 1e9);
+        fprintf(out, "index_query_seconds_count{kind=\"%s\"} %llu\n", queryKindNames[k], (unsigned long long)cumulative);
+    }
+    writeHeader(out, "index_query_quantile_seconds", "gauge",
+                "Query latency percentiles since start, estimated from the histogram.");
+    static const double quantiles[] = {0.5, 0.9, 0.99};
+    for (int k = 0; k < QUERY_KINDS; k++) {
+        for (int q = 0; q < 3; q++) {
+            double value = latencyQuantile(&sum, k, quantiles[q]);
+            if (value >= 0)
+                fprintf(out, "index_query_quantile_seconds{kind=\"%s\",quantile=\"%g\"} %.6g\n",
+                        queryKindNames[k], quantiles[q], value);
+        }
+    }
+
+    writeHeader(out, "index_view_cache_hits_total", "counter", "Viewer queries served from a cached visibility bitmap.");
+    fprintf(out, "index_view_cache_hits_total %llu\n", (unsigned long long)sum.counters[METRIC_VIEW_HITS]);
+    writeHeader(out, "index_view_cache_misses_total", "counter", "Viewer queries that had to build a bitmap.");
+    fprintf(out, "index_view_cache_misses_total %llu\n", (unsigned long long)sum.counters[METRIC_VIEW_MISSES]);
+    writeHeader(out, "index_requests_shed_total", "counter", "Requests dropped unanswered, see indexNoteShed.");
+    fprintf(out, "index_requests_shed_total %llu\n", (unsigned long long)sum.counters[METRIC_SHED]);
+
+    writeHeader(out, "index_memory_bytes", "gauge", "Memory held per index section, as of the last residency pass.");
+    for (int m = 0; m < MEM_SECTIONS; m++)
+        fprintf(out, "index_memory_bytes{section=\"%s\"} %lld\n", memSectionNames[m], (long long)memBytes[m]);
+    writeHeader(out, "index_memory_resident_bytes", "gauge", "Memory per section that is in RAM.");
+    for (int m = 0; m < MEM_SECTIONS; m++) {
+        if (memResident[m] >= 0)
+            fprintf(out, "index_memory_resident_bytes{section=\"%s\"} %lld\n", memSectionNames[m], (long long)memResident[m]);
+    }
+    writeHeader(out, "index_memory_locked_bytes", "gauge", "Memory per section pinned by a lock policy.");
+    for (int m = 0; m < MEM_SECTIONS; m++)
+        fprintf(out, "index_memory_locked_bytes{section=\"%s\"} %lld\n", memSectionNames[m], (long long)memLocked[m]);
+
+    IndexSchedStats sched;
+    indexSchedStats(&sched);
+    writeHeader(out, "index_task_cpu_seconds_total", "counter", "CPU time spent in scheduler tasks, process-wide.");
+    for (int c = 0; c < TASK_CLASSES; c++)
+        fprintf(out, "index_task_cpu_seconds_total{class=\"%s\"} %.6f\n", taskClassNames[c], sched.cpuSeconds[c]);
+    writeHeader(out, "index_tasks_total", "counter", "Scheduler tasks run, process-wide.");
+    for (int c = 0; c < TASK_CLASSES; c++)
+        fprintf(out, "index_tasks_total{class=\"%s\"} %ld\n", taskClassNames[c], sched.tasks[c]);
+    writeHeader(out, "index_tasks_queued", "gauge", "Scheduler tasks waiting, process-wide.");
+    for (int c = 0; c < TASK_CLASSES; c++)
+        fprintf(out, "index_tasks_queued{class=\"%s\"} %ld\n", taskClassNames[c], sched.queued[c]);
+    return ferror(out) ? -1 : 0;
+}
+
+int indexSetMetricsFile(Index *ix, const char *path) {
+    mutex_lock(&ix->lock);
+    snprintf(ix->metricsFile, sizeof(ix->metricsFile), "%s", path ? path : "");
+    ix->lastMetrics = now_seconds();
+    mutex_unlock(&ix->lock);
+    if (!path) return 0;
+    maintainResidency(ix, 1);
+    return writeMetricsFile(ix, path);
+}
+
+void indexNoteShed(Index *ix) {
+    metricAdd(ix, METRIC_SHED, 1);
+}
+
+// --- Background Refresh ---
+
+// Returns 1 for filesystems where inotify misses remote changes.
+// Opens the watcher before the first crawl so directories get registered
+// as they are scanned. Watch shards on remote filesystems are polled instead.
+static void initWatcher(Index *ix) {
+    for (int s = 0; s < ix->shardCount; s++) {
+        if (ix->shards[s].policy == REFRESH_WATCH && isRemoteFilesystem(ix->shards[s].path)) {
+            ix->shards[s].policy = REFRESH_POLL;
+            ix->shards[s].interval = DEFAULT_POLL_INTERVAL;
+        }
+    }
+    #ifdef HAVE_INOTIFY
+    if (ix->watchFd >= 0) return;
+    for (int s = 0; s < ix->shardCount; s++) {
+        if (ix->shards[s].policy == REFRESH_WATCH) {
+            ix->watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            break;
+        }
+    }
+    if (ix->watchFd >= 0) return;
+    #endif
+    for (int s = 0; s < ix->shardCount; s++) {
+        if (ix->shards[s].policy == REFRESH_WATCH) {
+            ix->shards[s].policy = REFRESH_POLL;
+            ix->shards[s].interval = DEFAULT_POLL_INTERVAL;
+        }
+    }
+}
+
+void indexUpdate(Index *ix, int timeoutMs) {
+    #ifdef HAVE_INOTIFY
+    if (ix->watchFd >= 0) {
+        struct pollfd pfd = {ix->watchFd, POLLIN, 0};
+        if (poll(&pfd, 1, timeoutMs) > 0) drainWatchEvents(ix);
+    } else if (timeoutMs > 0) {
+        sleep_ms(timeoutMs);
+    }
+    #else
+    if (timeoutMs > 0) sleep_ms(timeoutMs);
+    #endif
+
+    for (int s = 0; s < ix->shardCount && !ix->stopRefresher; s++) {
+        double now = now_seconds();
+        mutex_lock(&ix->lock);
+        Shard *sh = &ix->shards[s];
+        int due = sh->policy == REFRESH_WATCH && sh->dirty && now - sh->lastEvent >= WATCH_SETTLE_SECONDS;
+        #ifdef OS_WINDOWS
+        // No directory table on Windows yet: poll shards rebuild whole.
+        due = due || (sh->policy == REFRESH_POLL && now - sh->lastRefresh >= sh->interval);
+        #endif
+        mutex_unlock(&ix->lock);
+        if (due) crawlShard(ix, s, NULL);
+    }
+    pollShards(ix);
+
+    mutex_lock(&ix->lock);
+    int snapshotDue = ix->history && now_seconds() - ix->history->lastSnapshot >= HISTORY_INTERVAL;
+    mutex_unlock(&ix->lock);
+    if (snapshotDue) indexSnapshot(ix);
+    maintainStanding(ix);
+    maintainResidency(ix, 0);
+    maintainMetrics(ix);
+}
+
+// Wakes about once a second, drains watcher events, rebuilds watch shards
+// that saw changes and runs a poller tick. Manual shards are never touched.
+static void *refreshWorker(void *arg) {
+    Index *ix = (Index *)arg;
+    while (!ix->stopRefresher) indexUpdate(ix, 1000);
+    return NULL;
+}
+
+void indexStartUpdater(Index *ix) {
+    int needed = 0;
+    for (int s = 0; s < ix->shardCount; s++) {
+        if (ix->shards[s].policy != REFRESH_MANUAL) needed = 1;
+    }
+    for (int m = 0; m < MEM_SECTIONS; m++) {
+        if (ix->residency[m] != RESIDENCY_DEFAULT) needed = 1;
+    }
+    if (ix->metricsFile[0] || ix->standingLive) needed = 1;
+    if (!needed || ix->refresherRunning) return;
+    ix->stopRefresher = 0;
+    if (thread_start(&ix->refresherThread, refreshWorker, ix) == 0) ix->refresherRunning = 1;
+}
+
+void indexStopUpdater(Index *ix) {
+    if (!ix->refresherRunning) return;
+    ix->stopRefresher = 1;
+    thread_join(ix->refresherThread);
+    ix->refresherRunning = 0;
+}
+
+// --- Public Interface ---
+
+Index *indexCreate(void) {
+    Index *ix = (Index *)calloc(1, sizeof(Index));
+    if (!ix) return NULL;
+    mutex_init(&ix->lock);
+    mutex_init(&ix->watchLock);
+    mutex_init(&ix->permLock);
+    ix->watchFd = -1;
+    ix->pollBudget = DEFAULT_POLL_BUDGET;
+    return ix;
+}
+
+void indexFree(Index *ix) {
+    if (!ix) return;
+    indexStopUpdater(ix);
+    clearIndex(ix);
+    #ifdef HAVE_INOTIFY
+    if (ix->watchFd >= 0) close(ix->watchFd);
+    #endif
+    free(ix->watchShard);
+    free(ix->pathIds.slots);
+    free(ix->inodeIds.slots);
+    free(ix->byId);
+    free(ix->retiredAt);
+    free(ix->pathChecks);
+    free(ix->colSize);
+    free(ix->colMtime);
+    free(ix->colExt);
+    free(ix->colOwner);
+    free(ix->colTop);
+    free(ix->colShard);
+    free(ix->colNameLen);
+    free(ix->colDepth);
+    free(ix->colOpens);
+    free(ix->colOpened);
+    free(ix->blockNameLen);
+    freeDict(&ix->extDict);
+    freeDict(&ix->ownerDict);
+    freeDict(&ix->topDict);
+    free(ix->uidOwners.slots);
+    free(ix->byMtime.sorted);
+    free(ix->byMtime.pending);
+    free(ix->bySize.sorted);
+    free(ix->bySize.pending);
+    free(ix->colBands);
+    for (int band = 0; band < MINHASH_BANDS; band++) {
+        free(ix->bands[band].sorted);
+        free(ix->bands[band].pending);
+    }
+    freeHistory(ix->history);
+    for (int q = 0; q < ix->standingCount; q++) {
+        free(ix->standing[q].pattern);
+        free(ix->standing[q].literal);
+    }
+    free(ix->standing);
+    freeAutomaton(&ix->automaton);
+    free(ix->changed);
+    for (uint32_t c = 0; c < ix->permCount; c++) free(ix->perms[c].acl);
+    free(ix->perms);
+    free(ix->permSlots);
+    free(ix->colPerm);
+    for (int i = 0; i < VIEW_CACHE; i++) {
+        free(ix->views[i].verdict);
+        free(ix->views[i].visible);
+    }
+    mutex_destroy(&ix->permLock);
+    mutex_destroy(&ix->watchLock);
+    mutex_destroy(&ix->lock);
+    free(ix);
+}
+
+// Each root starts out as one manually refreshed shard. Roots inside the
+// new one are absorbed: their shards become shards of the new root. That
+// is only possible before they hold files, whose columns name their root.
+int indexAddRoot(Index *ix, const char *path) {
+    char clean[MAX_PATH_LEN];
+    normalizePath(path, clean);
+
+    mutex_lock(&ix->lock);
+    int nested = 0;
+    for (int i = 0; i < ix->rootCount; i++) {
+        int inside = isPathWithin(ix->roots[i].path, clean);
+        for (int s = 0; inside && s < ix->shardCount; s++) {
+            if (ix->shards[s].root == i && (ix->shards[s].table || ix->shards[s].fileCount)) inside = -1;
+        }
+        if (isPathWithin(clean, ix->roots[i].path) || inside < 0) {
+            mutex_unlock(&ix->lock);
+            return -1;
+        }
+        nested += inside;
+    }
+    if (ix->rootCount - nested >= MAX_ROOTS || ix->shardCount >= MAX_SHARDS) {
+        mutex_unlock(&ix->lock);
+        return -1;
+    }
+    // Drop the absorbed roots, renumbering the later ones and their shards.
+    int kept = 0;
+    for (int i = 0; i < ix->rootCount; i++) {
+        int inside = isPathWithin(ix->roots[i].path, clean);
+        for (int s = 0; s < ix->shardCount; s++) {
+            if (ix->shards[s].root == i) ix->shards[s].root = inside ? MAX_ROOTS : kept;
+        }
+        if (!inside) ix->roots[kept++] = ix->roots[i];
+    }
+    ix->rootCount = kept;
+    for (int s = 0; s < ix->shardCount; s++) {
+        if (ix->shards[s].root == MAX_ROOTS) ix->shards[s].root = kept;
+    }
+
+    Root *r = &ix->roots[ix->rootCount];
+    strcpy(r->path, clean);
+
+    Shard *s = &ix->shards[ix->shardCount++];
+    memset(s, 0, sizeof(Shard));
+    strcpy(s->path, clean);
+    s->root = ix->rootCount;
+    s->policy = REFRESH_MANUAL;
+    int root = ix->rootCount++;
+    mutex_unlock(&ix->lock);
+    return root;
+}
+
+int indexAddShard(Index *ix, const char *spec) {
+    char raw[MAX_PATH_LEN], path[MAX_PATH_LEN];
+    int policy = REFRESH_WATCH;
+    int interval = DEFAULT_POLL_INTERVAL;
+    snprintf(raw, sizeof(raw), "%s", spec);
+
+    char *colon = strrchr(raw, ':');
+    if (colon) {
+        int secs;
+        if (strcmp(colon + 1, "watch") == 0) {
+            *colon = '\0';
+        } else if (strcmp(colon + 1, "manual") == 0) {
+            policy = REFRESH_MANUAL;
+            *colon = '\0';
+        } else if (sscanf(colon + 1, "poll=%d", &secs) == 1 && secs > 0) {
+            policy = REFRESH_POLL;
+            interval = secs;
+            *colon = '\0';
+        }
+    }
+    normalizePath(raw, path);
+    #ifndef HAVE_INOTIFY
+    if (policy == REFRESH_WATCH) policy = REFRESH_POLL;
+    #endif
+
+    mutex_lock(&ix->lock);
+    int root = -1;
+    for (int r = 0; r < ix->rootCount; r++) {
+        if (isPathWithin(path, ix->roots[r].path)) root = r;
+    }
+    int shard = 0;
+    while (shard < ix->shardCount && strcmp(ix->shards[shard].path, path) != 0) shard++;
+    if (root < 0 || (shard == ix->shardCount && ix->shardCount >= MAX_SHARDS)) {
+        mutex_unlock(&ix->lock);
+        return -1;
+    }
+    if (shard == ix->shardCount) {
+        memset(&ix->shards[shard], 0, sizeof(Shard));
+        strcpy(ix->shards[shard].path, path);
+        ix->shards[shard].root = root;
+        ix->shardCount++;
+    }
+    int watching = policy == REFRESH_WATCH && ix->shards[shard].policy != REFRESH_WATCH;
+    ix->shards[shard].policy = policy;
+    ix->shards[shard].interval = interval;
+    // A loaded shard that starts watching has its directories already; no
+    // crawl will register them, so do it here.
+    char **dirs = NULL;
+    int dirCount = 0;
+    if (watching && ix->shards[shard].dirCount) {
+        const Shard *sh = &ix->shards[shard];
+        dirs = (char **)malloc(sh->dirCount * sizeof(char *));
+        for (int d = 0; dirs && d < sh->dirCount; d++) {
+            if (sh->dirs[d].path && (dirs[dirCount] = strdup(sh->dirs[d].path))) dirCount++;
+        }
+    }
+    mutex_unlock(&ix->lock);
+
+    if (watching) {
+        initWatcher(ix);
+        for (int d = 0; d < dirCount; d++) {
+            if (ix->shards[shard].policy == REFRESH_WATCH) watchDirectory(ix, shard, dirs[d]);
+            free(dirs[d]);
+        }
+    }
+    free(dirs);
+    return shard;
+}
+
+void indexSetPollBudget(Index *ix, int syscallsPerSecond) {
+    ix->pollBudget = syscallsPerSecond < 1 ? 1 : syscallsPerSecond;
+}
+
+void indexSetCrawlOrder(Index *ix, int order) {
+    if (order >= CRAWL_ORDER_AUTO && order <= CRAWL_ORDER_INODE) ix->crawlOrder = order;
+}
+
+void indexBuild(Index *ix, IndexProgressFn progress, void *user) {
+    initWatcher(ix);
+
+    Build build;
+    memset(&build, 0, sizeof(build));
+    mutex_init(&build.lock);
+    build.progress = progress;
+    build.user = user;
+    build.start = build.lastReport = now_seconds();
+
+    // Percent and ETA need every shard estimated; the id tables are sized
+    // for whatever is known.
+    long files = 0, known = 0;
+    int unknown = 0;
+    mutex_lock(&ix->lock);
+    for (int s = 0; s < ix->shardCount; s++) {
+        long dirs, entries = estimateShard(ix, s, &dirs);
+        if (!entries) unknown = 1;
+        known += entries;
+        files += entries - dirs;
+    }
+    build.expected = unknown ? 0 : known;
+    idMapReserve(&ix->pathIds, ix->pathIds.count + files);
+    idMapReserve(&ix->inodeIds, ix->inodeIds.count + files);
+    if (files > 0 && files < (long)(UINT32_MAX - ix->nextId)) ensureIdCapacity(ix, ix->nextId + (uint32_t)files);
+    mutex_unlock(&ix->lock);
+
+    // Shards on the same device share a crawl queue, so a single disk is
+    // never hit by two crawlers at once; different devices run in parallel.
+    // The device is that of the shard's own path, which for a shard on
+    // another mount is not its root's.
+    DeviceQueue *queues = (DeviceQueue *)calloc(ix->shardCount + 1, sizeof(DeviceQueue));
+    int queueCount = 0;
+    for (int s = 0; s < ix->shardCount && !queues; s++) crawlShard(ix, s, &build);
+    for (int s = 0; s < ix->shardCount && queues; s++) {
+        unsigned long device = rootDevice(ix->shards[s].path);
+        int q = 0;
+        while (q < queueCount && queues[q].device != device) q++;
+        if (q == queueCount) {
+            queues[q].ix = ix;
+            queues[q].device = device;
+            queues[q].count = 0;
+            queues[q].build = &build;
+            queueCount++;
+        }
+        queues[q].shards[queues[q].count++] = s;
+    }
+
+    // One task per device, so each disk sees a single crawler.
+    IndexTasks *crawls = indexTasksBegin(TASK_CRAWL);
+    for (int q = 0; q < queueCount; q++) indexTasksSpawn(crawls, deviceWorker, &queues[q]);
+    indexTasksWait(crawls);
+    free(queues);
+
+    mutex_lock(&ix->lock);
+    compactIds(ix);
+    mutex_unlock(&ix->lock);
+    rebuildOrderings(ix);
+    indexSnapshot(ix);
+
+    mutex_lock(&build.lock);
+    reportProgress(&build, NULL, 1);
+    mutex_unlock(&build.lock);
+    mutex_destroy(&build.lock);
+}
+
+int indexRefreshRoot(Index *ix, int root) {
+    if (root < 0 || root >= ix->rootCount) return -1;
+    for (int s = 0; s < ix->shardCount; s++) {
+        if (ix->shards[s].root == root) crawlShard(ix, s, NULL);
+    }
+    indexSnapshot(ix);
+    return 0;
+}
+
+int indexRefreshShard(Index *ix, int shard) {
+    if (shard < 0 || shard >= ix->shardCount) return -1;
+    crawlShard(ix, shard, NULL);
+    indexSnapshot(ix);
+    return 0;
+}
+
+static IndexResult resultOf(const FileEntry *e) {
+    IndexResult result = {e->filename, e->fullpath, e->id, e->size, e->mtime, e->root, e->shard};
+    return result;
+}
+
+// Finds an indexed file by full path. Caller holds the lock.
+static FileEntry *findEntry(Shard *sh, const char *path, const char *name) {
+    if (!sh->table) return NULL;
+    for (FileEntry *e = sh->table[bucketOf(sh, name)]; e; e = e->next) {
+        if (strcmp(e->fullpath, path) == 0) return e;
+    }
+    return NULL;
+}
+
+// Returns the final path component.
+static const char *baseName(const char *path) {
+    const char *name = path;
+    for (const char *p = path; *p; p++) {
+        if (*p == '/' || *p == '\\') name = p + 1;
+    }
+    return name;
+}
+
+int indexIngest(Index *ix, const char *path) {
+    char clean[MAX_PATH_LEN];
+    normalizePath(path, clean);
+    const char *name = baseName(clean);
+
+    // The syscalls come first, outside the lock: a stat of the file, and
+    // of every ancestor (with its ACL) for the permission class.
+    FileMeta meta;
+    #ifdef OS_POSIX
+    struct stat st;
+    if (stat(clean, &st) == -1) return -1;
+    statMeta(&st, &meta);
+    #else
+    WIN32_FIND_DATA findData;
+    HANDLE hFind = FindFirstFile(clean, &findData);
+    if (hFind == INVALID_HANDLE_VALUE) return -1;
+    findDataMeta(&findData, &meta);
+    FindClose(hFind);
+    #endif
+    uint32_t perm = parentPerm(ix, clean);
+
+    mutex_lock(&ix->lock);
+    int s = shardForPath(ix, clean);
+    if (s < 0) {
+        mutex_unlock(&ix->lock);
+        return -1;
+    }
+    Shard *sh = &ix->shards[s];
+    if (!sh->table) {
+        sh->table = (FileEntry **)calloc(HASH_TABLE_SIZE, sizeof(FileEntry *));
+        sh->tableSize = HASH_TABLE_SIZE;
+    }
+    if (!sh->table) {
+        mutex_unlock(&ix->lock);
+        return -1;
+    }
+    FileEntry *known = findEntry(sh, clean, name);
+    if (known) {
+        // Replaced in place. The id stays; claimId compares the new size
+        // and mtime with its columns, so standing queries hear of a change.
+        known->inodeKey = meta.inodeKey;
+        known->links = meta.links;
+        known->size = meta.size;
+        known->mtime = meta.mtime;
+        known->uid = meta.uid;
+        known->perm = perm;
+        claimId(ix, known, known->id, 0);
+        mutex_unlock(&ix->lock);
+        return 0;
+    }
+
+    Crawl one;
+    initCrawl(ix, &one, s);
+    one.perm = perm;
+    addFile(&one, name, clean, &meta);
+    FileEntry *entry = one.head;
+    if (!entry) {
+        mutex_unlock(&ix->lock);
+        return -1;
+    }
+    assignIdList(ix, entry);
+    // Link the file into its directory when the directory is tracked, so a
+    // later poll of that directory sees it.
+    int d = findParentDir(sh, clean);
+    if (d >= 0) {
+        entry->dir = d;
+        entry->dirNext = sh->dirs[d].files;
+        sh->dirs[d].files = entry;
+    }
+    size_t index = bucketOf(sh, name);
+    entry->next = sh->table[index];
+    sh->table[index] = entry;
+    sh->fileCount++;
+    ix->totalFiles++;
+    mutex_unlock(&ix->lock);
+    return 0;
+}
+
+int indexRemove(Index *ix, const char *path) {
+    char clean[MAX_PATH_LEN];
+    normalizePath(path, clean);
+
+    mutex_lock(&ix->lock);
+    int s = shardForPath(ix, clean);
+    FileEntry *entry = s >= 0 ? findEntry(&ix->shards[s], clean, baseName(clean)) : NULL;
+    if (!entry) {
+        mutex_unlock(&ix->lock);
+        return -1;
+    }
+    Shard *sh = &ix->shards[s];
+    if (entry->dir >= 0) {
+        FileEntry **link = &sh->dirs[entry->dir].files;
+        while (*link && *link != entry) link = &(*link)->dirNext;
+        if (*link) *link = entry->dirNext;
+    }
+    FileEntry **link = &sh->table[bucketOf(sh, entry->filename)];
+    while (*link && *link != entry) link = &(*link)->next;
+    if (*link) *link = entry->next;
+    retireEntry(ix, entry);
+    freeEntry(entry);
+    sh->fileCount--;
+    ix->totalFiles--;
+    mutex_unlock(&ix->lock);
+    return 0;
+}
+
+long indexQuery(Index *ix, const char *query, IndexMatchFn fn, void *user) {
+    return indexQueryAs(ix, NULL, query, fn, user);
+}
+
+long indexQueryAs(Index *ix, const IndexViewer *viewer, const char *query, IndexMatchFn fn, void *user) {
+    double start = now_seconds();
+    long count = 0;
+    mutex_lock(&ix->lock);
+    const uint64_t *visible = viewer ? viewBits(ix, viewer) : NULL;
+    if (viewer && !visible) goto done;
+    // Every indexed file is live in byId, so walk that rather than the hash
+    // chains and let nextLongName skip names too short to match.
+    size_t len = strlen(query);
+    uint32_t end = ix->nextId + 1 < ix->idCap ? ix->nextId + 1 : ix->idCap;
+    for (uint32_t id = nextLongName(ix, 1, end, len); id < end; id = nextLongName(ix, id + 1, end, len)) {
+        FileEntry *entry = ix->byId[id];
+        if (!stristr(entry->filename, query)) continue;
+        if (visible && !(visible[id >> 6] >> (id & 63) & 1)) continue;
+        IndexResult result = resultOf(entry);
+        count++;
+        if (fn(&result, user)) goto done;
+    }
+    done:
+    mutex_unlock(&ix->lock);
+    noteQuery(ix, viewer ? QUERY_VIEWER : QUERY_NAME, start);
+    return count;
+}
+
+typedef struct MatchBuffer {
+    IndexMatch *out;
+    int count;
+    int max;
+} MatchBuffer;
+
+static int copyMatch(const IndexResult *result, void *user) {
+    MatchBuffer *buf = (MatchBuffer *)user;
+    IndexMatch *m = &buf->out[buf->count++];
+    snprintf(m->filename, sizeof(m->filename), "%s", result->filename);
+    snprintf(m->fullpath, sizeof(m->fullpath), "%s", result->fullpath);
+    m->id = result->id;
+    m->size = result->size;
+    m->mtime = result->mtime;
+    m->root = result->root;
+    m->shard = result->shard;
+    return buf->count >= buf->max;
+}
+
+int indexQueryBuf(Index *ix, const char *query, IndexMatch *out, int max) {
+    return indexQueryBufAs(ix, NULL, query, out, max);
+}
+
+int indexQueryBufAs(Index *ix, const IndexViewer *viewer, const char *query, IndexMatch *out, int max) {
+    MatchBuffer buf = {out, 0, max};
+    if (max <= 0) return 0;
+    indexQueryAs(ix, viewer, query, copyMatch, &buf);
+    return buf.count;
+}
+
+int indexQueryOrdered(Index *ix, int order, const char *query, int64_t bound, IndexMatch *out, int max) {
+    if (max <= 0) return 0;
+    double start = now_seconds();
+    mutex_lock(&ix->lock);
+    int built = ix->orderingsBuilt;
+    mutex_unlock(&ix->lock);
+    if (!built) rebuildOrderings(ix);
+
+    mutex_lock(&ix->lock);
+    Ordering *o = order == ORDER_LARGEST ? &ix->bySize : &ix->byMtime;
+    const int64_t *column = order == ORDER_LARGEST ? ix->colSize : ix->colMtime;
+    // Walk the sorted array and the (sorted) pending queue as one stream.
+    qsort(o->pending, o->pendingCount, sizeof(SortEntry), compareSortEntries);
+    size_t queryLen = query ? strlen(query) : 0;
+    MatchBuffer buf = {out, 0, max};
+    size_t i = 0, j = 0;
+    SortEntry last = {0, 0};
+    while (buf.count < max && (i < o->count || j < o->pendingCount)) {
+        const SortEntry *next = j == o->pendingCount ||
+            (i < o->count && compareSortEntries(&o->sorted[i], &o->pending[j]) <= 0)
+            ? &o->sorted[i++] : &o->pending[j++];
+        if (bound && next->key < bound) break;
+        if (!sortEntryLive(ix, column, next) || (next->id == last.id && next->key == last.key)) continue;
+        last = *next;
+        FileEntry *e = ix->byId[next->id];
+        if (query && *query && (ix->colNameLen[next->id] < queryLen || !stristr(e->filename, query))) continue;
+        IndexResult result = resultOf(e);
+        copyMatch(&result, &buf);
+    }
+    mutex_unlock(&ix->lock);
+    noteQuery(ix, QUERY_ORDERED, start);
+    return buf.count;
+}
+
+uint32_t indexLookupId(Index *ix, const char *path) {
+    char clean[MAX_PATH_LEN];
+    normalizePath(path, clean);
+
+    mutex_lock(&ix->lock);
+    uint32_t id = idMapGet(&ix->pathIds, hashPath(clean));
+    // A path that moved away still maps to the id its new path now holds.
+    if (id >= ix->idCap || !ix->byId[id] || strcmp(ix->byId[id]->fullpath, clean) != 0) id = 0;
+    mutex_unlock(&ix->lock);
+    return id;
+}
+
+int indexGetById(Index *ix, uint32_t id, IndexMatch *out) {
+    mutex_lock(&ix->lock);
+    FileEntry *e = id && id < ix->idCap ? ix->byId[id] : NULL;
+    if (e) {
+        IndexResult result = resultOf(e);
+        MatchBuffer buf = {out, 0, 1};
+        copyMatch(&result, &buf);
+    }
+    mutex_unlock(&ix->lock);
+    return e ? 0 : -1;
+}
+
+long indexFileCount(Index *ix) {
+    return ix->totalFiles;
+}
+
+int indexRootCount(Index *ix) {
+    return ix->rootCount;
+}
+
+int indexShardCount(Index *ix) {
+    return ix->shardCount;
+}
+
+int indexRootInfo(Index *ix, int root, IndexRootInfo *info) {
+    if (root < 0 || root >= ix->rootCount) return -1;
+    mutex_lock(&ix->lock);
+    snprintf(info->path, sizeof(info->path), "%s", ix->roots[root].path);
+    info->fileCount = rootFileCount(ix, root);
+    mutex_unlock(&ix->lock);
+    return 0;
+}
+
+int indexShardInfo(Index *ix, int shard, IndexShardInfo *info) {
+    if (shard < 0 || shard >= ix->shardCount) return -1;
+    mutex_lock(&ix->lock);
+    Shard *sh = &ix->shards[shard];
+    snprintf(info->path, sizeof(info->path), "%s", sh->path);
+    info->root = sh->root;
+    info->policy = sh->policy;
+    info->interval = sh->interval;
+    info->fileCount = sh->fileCount;
+    info->dirCount = 0;
+    for (int d = 0; d < sh->dirCount; d++) info->dirCount += sh->dirs[d].path != NULL;
+    info->age = now_seconds() - sh->lastRefresh;
+    info->crawlSeconds = sh->crawlSeconds;
+    mutex_unlock(&ix->lock);
+    return 0;
+}
+
+void indexPollStats(Index *ix, IndexPollStats *stats) {
+    mutex_lock(&ix->lock);
+    stats->trackedDirs = 0;
+    for (int s = 0; s < ix->shardCount; s++) {
+        if (ix->shards[s].policy != REFRESH_POLL) continue;
+        for (int d = 0; d < ix->shards[s].dirCount; d++) stats->trackedDirs += ix->shards[s].dirs[d].path != NULL;
+    }
+    stats->syscallsLastTick = ix->pollSyscalls;
+    stats->rereads = ix->pollRereads;
+    stats->budget = ix->pollBudget;
+    mutex_unlock(&ix->lock);
+}
+
+// --- Analytics ---
+// Group-by queries run over the id-indexed columns rather than the hash
+// chains. Each thread takes a contiguous id range and works through it a
+// block at a time. First a branch-free pass over the size and mtime
+// columns builds a keep mask, which the compiler can vectorize. Then a
+// scatter pass folds the kept rows into per-thread partials. The caller
+// holds the index lock throughout, so workers read the columns without
+// taking it themselves.
+
+typedef struct GroupPartial {
+    long *count;
+    int64_t *size;
+    int64_t *oldest;
+    int64_t *newest;
+} GroupPartial;
+
+typedef struct GroupWorker {
+    Index *ix;
+    const uint32_t *keys;
+    uint32_t from, to;      // id range, to exclusive
+    int64_t minMtime, maxMtime, minSize, maxSize;
+    const char *name;
+    uint16_t nameLen;
+    GroupPartial part;
+} GroupWorker;
+
+static int allocPartial(GroupPartial *p, uint32_t groups) {
+    p->count = (long *)calloc(groups, sizeof(long));
+    p->size = (int64_t *)calloc(groups, sizeof(int64_t));
+    p->oldest = (int64_t *)malloc(groups * sizeof(int64_t));
+    p->newest = (int64_t *)malloc(groups * sizeof(int64_t));
+    if (!p->count || !p->size || !p->oldest || !p->newest) return -1;
+    for (uint32_t g = 0; g < groups; g++) {
+        p->oldest[g] = INT64_MAX;
+        p->newest[g] = INT64_MIN;
+    }
+    return 0;
+}
+
+static void freePartial(GroupPartial *p) {
+    free(p->count);
+    free(p->size);
+    free(p->oldest);
+    free(p->newest);
+}
+
+static void groupWorker(void *arg) {
+    GroupWorker *w = (GroupWorker *)arg;
+    Index *ix = w->ix;
+    unsigned char keep[GROUP_BLOCK];
+    for (uint32_t base = w->from; base < w->to; base += GROUP_BLOCK) {
+        uint32_t n = w->to - base < GROUP_BLOCK ? w->to - base : GROUP_BLOCK;
+        FileEntry *const *live = ix->byId + base;
+        const int64_t *size = ix->colSize + base;
+        const int64_t *mtime = ix->colMtime + base;
+        const uint16_t *nameLen = ix->colNameLen + base;
+        for (uint32_t i = 0; i < n; i++) {
+            keep[i] = (live[i] != NULL) & (mtime[i] >= w->minMtime) & (mtime[i] <= w->maxMtime) &
+                      (size[i] >= w->minSize) & (size[i] <= w->maxSize) & (nameLen[i] >= w->nameLen);
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            if (!keep[i] || (w->name && !stristr(live[i]->filename, w->name))) continue;
+            uint32_t g = w->keys[base + i];
+            w->part.count[g]++;
+            w->part.size[g] += size[i];
+            if (mtime[i] < w->part.oldest[g]) w->part.oldest[g] = mtime[i];
+            if (mtime[i] > w->part.newest[g]) w->part.newest[g] = mtime[i];
+        }
+    }
+}
+
+static int compareGroups(const void *a, const void *b) {
+    const IndexGroup *ga = (const IndexGroup *)a, *gb = (const IndexGroup *)b;
+    if (ga->size != gb->size) return ga->size < gb->size ? 1 : -1;
+    if (ga->count != gb->count) return ga->count < gb->count ? 1 : -1;
+    return strcmp(ga->key, gb->key);
+}
+
+int indexGroupBy(Index *ix, int by, const IndexGroupFilter *filter, IndexGroup *out, int max) {
+    double start = now_seconds();
+    mutex_lock(&ix->lock);
+    const uint32_t *keys;
+    uint32_t groups;
+    switch (by) {
+        case GROUP_BY_EXT:   keys = ix->colExt;   groups = ix->extDict.count;   break;
+        case GROUP_BY_OWNER: keys = ix->colOwner; groups = ix->ownerDict.count; break;
+        case GROUP_BY_TOP:   keys = ix->colTop;   groups = ix->topDict.count;   break;
+        case GROUP_BY_SHARD:
+        case GROUP_BY_ROOT:  keys = ix->colShard; groups = (uint32_t)ix->shardCount; break;
+        default:
+            mutex_unlock(&ix->lock);
+            return -1;
+    }
+    uint32_t ids = ix->nextId + 1 < ix->idCap ? ix->nextId + 1 : ix->idCap;
+    if (groups == 0 || ids <= 1) {
+        mutex_unlock(&ix->lock);
+        return 0;
+    }
+
+    int threads = cpuCount();
+    if ((uint32_t)threads > ids / GROUP_IDS_PER_THREAD + 1) threads = (int)(ids / GROUP_IDS_PER_THREAD + 1);
+    GroupWorker *workers = (GroupWorker *)calloc(threads, sizeof(GroupWorker));
+    GroupPartial total;
+    int failed = !workers || allocPartial(&total, groups) < 0;
+    uint32_t chunk = (ids - 1) / threads + 1;
+    for (int t = 0; !failed && t < threads; t++) {
+        GroupWorker *w = &workers[t];
+        w->ix = ix;
+        w->keys = keys;
+        w->from = 1 + (uint32_t)t * chunk;
+        w->to = w->from + chunk < ids ? w->from + chunk : ids;
+        w->minMtime = filter && filter->newerThan ? filter->newerThan : INT64_MIN;
+        w->maxMtime = filter && filter->olderThan ? filter->olderThan - 1 : INT64_MAX;
+        w->minSize = filter ? filter->minSize : 0;
+        w->maxSize = filter && filter->maxSize ? filter->maxSize : INT64_MAX;
+        w->name = filter && filter->name && *filter->name ? filter->name : NULL;
+        w->nameLen = w->name ? (uint16_t)strlen(w->name) : 0;
+        if (allocPartial(&w->part, groups) < 0) failed = 1;
+    }
+    if (failed) {
+        for (int t = 0; workers && t < threads; t++) freePartial(&workers[t].part);
+        free(workers);
+        if (workers) freePartial(&total);
+        mutex_unlock(&ix->lock);
+        return -1;
+    }
+
+    IndexTasks *ranges = indexTasksBegin(TASK_UI);
+    for (int t = 0; t < threads; t++) indexTasksSpawn(ranges, groupWorker, &workers[t]);
+    indexTasksWait(ranges);
+    for (int t = 0; t < threads; t++) {
+        GroupPartial *p = &workers[t].part;
+        for (uint32_t g = 0; g < groups; g++) {
+            // Roots fold their shards together.
+            uint32_t k = by == GROUP_BY_ROOT ? (uint32_t)ix->shards[g].root : g;
+            total.count[k] += p->count[g];
+            total.size[k] += p->size[g];
+            if (p->oldest[g] < total.oldest[k]) total.oldest[k] = p->oldest[g];
+            if (p->newest[g] > total.newest[k]) total.newest[k] = p->newest[g];
+        }
+        freePartial(p);
+    }
+    free(workers);
+
+    int found = 0;
+    IndexGroup *rows = (IndexGroup *)malloc(groups * sizeof(IndexGroup));
+    for (uint32_t g = 0; rows && g < groups; g++) {
+        if (!total.count[g]) continue;
+        IndexGroup *row = &rows[found++];
+        const char *key;
+        switch (by) {
+            case GROUP_BY_EXT:   key = ix->extDict.names[g];   break;
+            case GROUP_BY_OWNER: key = ix->ownerDict.names[g]; break;
+            case GROUP_BY_TOP:   key = ix->topDict.names[g];   break;
+            case GROUP_BY_SHARD: key = ix->shards[g].path;     break;
+            default:             key = ix->roots[g].path;      break;
+        }
+        snprintf(row->key, sizeof(row->key), "%s", key);
+        row->count = total.count[g];
+        row->size = total.size[g];
+        row->oldest = total.oldest[g];
+        row->newest = total.newest[g];
+    }
+    freePartial(&total);
+    mutex_unlock(&ix->lock);
+    if (!rows) return -1;
+
+    qsort(rows, found, sizeof(IndexGroup), compareGroups);
+    memcpy(out, rows, (found < max ? found : max) * sizeof(IndexGroup));
+    free(rows);
+    noteQuery(ix, QUERY_GROUP, start);
+    return found;
+}
+
+// --- Estimated Counts ---
+// An exact count has to visit every chain, so indexCountStep samples
+// instead. The sampling unit is a block of COUNT_BLOCK buckets and the
+// strata are the shards. The plan gives every block a key of
+// (rank + offset) / blocks, where rank is its position in a shuffle of its
+// shard and offset is one random draw per shard, and then sorts all blocks
+// by key. Every prefix of the order is therefore a proportional
+// stratified sample, and walking the whole of it visits every block once.
+// Each shard's count is the ratio estimate of matches per entry in its
+// sampled blocks times its file count. The variance is the usual
+// cluster-sampling one, with the finite population correction.
+
+typedef struct CountBlock {
+    double key;
+    int shard;
+    uint32_t block;
+} CountBlock;
+
+typedef struct CountStratum {
+    FileEntry **table;      // the table the plan was made for
+    size_t tableSize;
+    uint32_t blocks;
+    uint32_t sampled;
+    double matches;         // sums over the sampled blocks
+    double entries;
+    double mm, ee, me;      // sums of squares and cross products
+} CountStratum;
+
+struct IndexCount {
+    Index *ix;
+    char *query;
+    CountBlock *order;
+    size_t blockCount;
+    size_t next;            // blocks of order already counted
+    int shardCount;
+    CountStratum strata[MAX_SHARDS];
+};
+
+static int compareCountBlocks(const void *a, const void *b) {
+    double ka = ((const CountBlock *)a)->key, kb = ((const CountBlock *)b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+// Caller holds the lock.
+static int planCount(IndexCount *c) {
+    Index *ix = c->ix;
+    size_t total = 0;
+    memset(c->strata, 0, sizeof(c->strata));
+    c->shardCount = ix->shardCount;
+    for (int s = 0; s < ix->shardCount; s++) {
+        CountStratum *st = &c->strata[s];
+        st->table = ix->shards[s].table;
+        st->tableSize = ix->shards[s].tableSize;
+        st->blocks = st->table ? (uint32_t)((st->tableSize + COUNT_BLOCK - 1) / COUNT_BLOCK) : 0;
+        total += st->blocks;
+    }
+    CountBlock *order = (CountBlock *)realloc(c->order, (total ? total : 1) * sizeof(CountBlock));
+    if (!order) return -1;
+    size_t k = 0;
+    for (int s = 0; s < ix->shardCount; s++) {
+        uint32_t blocks = c->strata[s].blocks;
+        CountBlock *first = order + k;
+        double offset = rand() / (RAND_MAX + 1.0);
+        for (uint32_t b = 0; b < blocks; b++) first[b].block = b;
+        for (uint32_t i = blocks; i > 1; i--) {
+            uint32_t j = (uint32_t)(rand() / (RAND_MAX + 1.0) * i);
+            uint32_t t = first[i - 1].block;
+            first[i - 1].block = first[j].block;
+            first[j].block = t;
+        }
+        for (uint32_t i = 0; i < blocks; i++) {
+            first[i].shard = s;
+            first[i].key = (i + offset) / blocks;
+        }
+        k += blocks;
+    }
+    qsort(order, total, sizeof(CountBlock), compareCountBlocks);
+    c->order = order;
+    c->blockCount = total;
+    c->next = 0;
+    return 0;
+}
+
+// Caller holds the lock.
+static int planStale(IndexCount *c) {
+    Index *ix = c->ix;
+    if (c->shardCount != ix->shardCount) return 1;
+    for (int s = 0; s < ix->shardCount; s++) {
+        if (c->strata[s].table != ix->shards[s].table ||
+            c->strata[s].tableSize != ix->shards[s].tableSize) return 1;
+    }
+    return 0;
+}
+
+// Caller holds the lock.
+static void estimateCount(IndexCount *c, IndexEstimate *out) {
+    Index *ix = c->ix;
+    double count = 0, variance = 0, matches = 0, entries = 0, unsampled = 0, files = 0;
+    int exact = c->next == c->blockCount;
+    for (int s = 0; s < c->shardCount; s++) {
+        const CountStratum *st = &c->strata[s];
+        double total = (double)ix->shards[s].fileCount;
+        if (!st->blocks) continue;
+        files += total;
+        matches += st->matches;
+        entries += st->entries;
+        if (st->sampled == st->blocks) {
+            count += st->matches;
+        } else if (!st->sampled) {
+            unsampled += total;
+        } else {
+            double n = st->sampled, ratio = st->entries ? st->matches / st->entries : 0;
+            double mean = st->entries / n;
+            count += ratio * total;
+            if (n > 1 && mean > 0) {
+                double spread = (st->mm - 2 * ratio * st->me + ratio * ratio * st->ee) / (n - 1);
+                variance += total * total * (1 - n / st->blocks) * spread / (n * mean * mean);
+            }
+        }
+    }
+    // Shards not reached yet borrow the overall ratio.
+    if (unsampled > 0 && entries > 0) count += matches / entries * unsampled;
+
+    out->count = (long)(count + 0.5);
+    out->exact = exact;
+    out->sampled = c->blockCount ? (double)c->next / c->blockCount : 1.0;
+    if (exact) out->margin = 0;
+    // With no match seen the variance is zero too; use the rule of three.
+    else if (matches == 0) out->margin = (long)(entries > 0 ? 3.0 * files / entries : files);
+    else out->margin = variance > 0 ? (long)(1.96 * sqrt(variance) + 0.5) : 0;
+}
+
+IndexCount *indexCountStart(Index *ix, const char *query) {
+    IndexCount *c = (IndexCount *)calloc(1, sizeof(IndexCount));
+    if (!c) return NULL;
+    c->ix = ix;
+    c->query = strdup(query ? query : "");
+    mutex_lock(&ix->lock);
+    int planned = c->query ? planCount(c) : -1;
+    mutex_unlock(&ix->lock);
+    if (planned < 0) {
+        indexCountFree(c);
+        return NULL;
+    }
+    return c;
+}
+
+int indexCountStep(IndexCount *c, double seconds, IndexEstimate *out) {
+    Index *ix = c->ix;
+    double deadline = now_seconds() + seconds;
+    mutex_lock(&ix->lock);
+    // A refresh swapped a table out from under the plan; sample afresh.
+    if (planStale(c) && planCount(c) < 0) c->next = c->blockCount = 0;
+    while (c->next < c->blockCount) {
+        const CountBlock *b = &c->order[c->next++];
+        CountStratum *st = &c->strata[b->shard];
+        size_t from = (size_t)b->block * COUNT_BLOCK;
+        size_t to = from + COUNT_BLOCK < st->tableSize ? from + COUNT_BLOCK : st->tableSize;
+        double m = 0, e = 0;
+        for (size_t i = from; i < to; i++) {
+            for (FileEntry *entry = st->table[i]; entry; entry = entry->next) {
+                e++;
+                if (stristr(entry->filename, c->query)) m++;
+            }
+        }
+        st->sampled++;
+        st->matches += m;
+        st->entries += e;
+        st->mm += m * m;
+        st->ee += e * e;
+        st->me += m * e;
+        if (now_seconds() >= deadline) break;
+    }
+    estimateCount(c, out);
+    mutex_unlock(&ix->lock);
+    return out->exact;
+}
+
+void indexCountFree(IndexCount *c) {
+    if (!c) return;
+    free(c->order);
+    free(c->query);
+    free(c);
+}
+
+// --- Ranking ---
+// indexQueryRanked scores every match and keeps the best. Workers split the
+// id range as in indexGroupBy and take it a block at a time. The name match
+// collects the ids of the matches along with the match position and
+// whether it starts a word. Their features are then gathered into float
+// columns and scored in one branch-free loop, and a second such loop
+// compares the scores against the worst hit kept so far. Both loops can be
+// vectorized by the compiler. Only the survivors reach the heap, which
+// once full is rarely touched.
+
+// Score weights. Matches are ranked by where the match falls in the name,
+// how much of the name it covers, depth, how often and how lately the file
+// was opened and how lately it was modified.
+#define RANK_POSITION 4.0f          // a match at the start of the name
+#define RANK_WORD 3.0f              // a match at a word boundary
+#define RANK_COVER 2.0f             // the match is the whole name
+#define RANK_DEPTH 0.1f             // per directory level
+#define RANK_OPENS 6.0f             // often and lately opened
+#define RANK_RECENT 1.5f            // modified just now
+#define RANK_OPEN_DECAY (7 * 86400.0f)
+#define RANK_MTIME_DECAY 86400.0f
+
+typedef struct RankHit {
+    float score;
+    uint32_t id;
+} RankHit;
+
+typedef struct RankWorker {
+    Index *ix;
+    const char *query;
+    size_t queryBytes;
+    float queryLen;         // queryBytes, for the score
+    int64_t now;
+    uint32_t from, to;      // id range, to exclusive
+    RankHit *heap;          // min-heap, the worst kept hit on top
+    int count, max;
+    long matches;
+    long limit;             // matches to score before stopping, 0 for all
+} RankWorker;
+
+// Nonzero when a ranks below b. Equal scores go to the older id.
+static int ranksBelow(const RankHit *a, const RankHit *b) {
+    return a->score < b->score || (a->score == b->score && a->id > b->id);
+}
+
+static void pushHit(RankWorker *w, RankHit hit) {
+    RankHit *heap = w->heap;
+    int i;
+    if (w->count < w->max) {
+        for (i = w->count++; i > 0 && ranksBelow(&hit, &heap[(i - 1) / 2]); i = (i - 1) / 2) {
+            heap[i] = heap[(i - 1) / 2];
+        }
+        heap[i] = hit;
+        return;
+    }
+    if (!ranksBelow(&heap[0], &hit)) return;
+    for (i = 0;;) {
+        int c = 2 * i + 1;
+        if (c >= w->count) break;
+        if (c + 1 < w->count && ranksBelow(&heap[c + 1], &heap[c])) c++;
+        if (!ranksBelow(&heap[c], &hit)) break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = hit;
+}
+
+static int startsWord(const char *name, const char *at) {
+    if (at == name) return 1;
+    unsigned char prev = (unsigned char)at[-1], cur = (unsigned char)at[0];
+    return !isalnum(prev) || (islower(prev) && isupper(cur)) || (isalpha(prev) && isdigit(cur));
+}
+
+long indexNameMatch(const char *name, const char *query, int *word) {
+    const char *at = stristr(name, query);
+    if (!at) return -1;
+    *word = startsWord(name, at);
+    return (long)(at - name);
+}
+
+static void rankWorker(void *arg) {
+    RankWorker *w = (RankWorker *)arg;
+    Index *ix = w->ix;
+    uint32_t ids[RANK_BLOCK];
+    float position[RANK_BLOCK], word[RANK_BLOCK], length[RANK_BLOCK], depth[RANK_BLOCK];
+    float opens[RANK_BLOCK], idle[RANK_BLOCK], age[RANK_BLOCK], score[RANK_BLOCK];
+    unsigned char keep[RANK_BLOCK];
+    for (uint32_t base = w->from; base < w->to && (!w->limit || w->matches < w->limit); base += RANK_BLOCK) {
+        uint32_t n = w->to - base < RANK_BLOCK ? w->to - base : RANK_BLOCK;
+        int found = 0;
+        for (uint32_t id = nextLongName(ix, base, base + n, w->queryBytes); id < base + n;
+             id = nextLongName(ix, id + 1, base + n, w->queryBytes)) {
+            int starts;
+            long at = indexNameMatch(ix->byId[id]->filename, w->query, &starts);
+            if (at < 0) continue;
+            ids[found] = id;
+            position[found] = (float)at;
+            word[found] = (float)starts;
+            found++;
+        }
+        w->matches += found;
+
+        // Pad the batch to a multiple of RANK_LANES with copies of the
+        // last hit, so the scoring loops need no scalar tail.
+        int padded = (found + RANK_LANES - 1) & ~(RANK_LANES - 1);
+        for (int k = found; k < padded; k++) {
+            ids[k] = ids[found - 1];
+            position[k] = position[found - 1];
+            word[k] = word[found - 1];
+        }
+        for (int k = 0; k < padded; k++) {
+            uint32_t id = ids[k];
+            int64_t modified = w->now - ix->colMtime[id];
+            length[k] = (float)ix->colNameLen[id];
+            depth[k] = (float)ix->colDepth[id];
+            opens[k] = (float)ix->colOpens[id];
+            idle[k] = (float)(w->now - ix->colOpened[id]);
+            age[k] = modified > 0 ? (float)modified : 0.0f;
+        }
+        for (int k = 0; k < padded; k++) {
+            score[k] = RANK_POSITION / (1.0f + position[k]) +
+                       RANK_WORD * word[k] +
+                       RANK_COVER * w->queryLen / (length[k] + 1.0f) -
+                       RANK_DEPTH * depth[k] +
+                       RANK_OPENS * opens[k] / (opens[k] + 2.0f) / (1.0f + idle[k] / RANK_OPEN_DECAY) +
+                       RANK_RECENT / (1.0f + age[k] / RANK_MTIME_DECAY);
+        }
+        float floor = w->count == w->max ? w->heap[0].score : -FLT_MAX;
+        for (int k = 0; k < padded; k++) keep[k] = score[k] >= floor;
+        for (int k = 0; k < found; k++) {
+            if (!keep[k]) continue;
+            RankHit hit = {score[k], ids[k]};
+            pushHit(w, hit);
+        }
+    }
+}
+
+static int compareHits(const void *a, const void *b) {
+    const RankHit *ha = (const RankHit *)a, *hb = (const RankHit *)b;
+    return ranksBelow(ha, hb) ? 1 : ranksBelow(hb, ha) ? -1 : 0;
+}
+
+// Ranks the matches of query, or with a nonzero limit about the first
+// limit of them in id order, split evenly over the workers.
+static long rankQuery(Index *ix, const char *query, long limit, IndexMatch *out, int max) {
+    if (max <= 0) return 0;
+    if (!query) query = "";
+    double start = now_seconds();
+    mutex_lock(&ix->lock);
+    uint32_t ids = ix->nextId + 1 < ix->idCap ? ix->nextId + 1 : ix->idCap;
+    if (ids <= 1) {
+        mutex_unlock(&ix->lock);
+        return 0;
+    }
+
+    int threads = cpuCount();
+    if ((uint32_t)threads > ids / RANK_IDS_PER_THREAD + 1) threads = (int)(ids / RANK_IDS_PER_THREAD + 1);
+    RankWorker *workers = (RankWorker *)calloc(threads, sizeof(RankWorker));
+    RankHit *hits = (RankHit *)malloc((size_t)threads * max * sizeof(RankHit));
+    if (!workers || !hits) {
+        free(workers);
+        free(hits);
+        mutex_unlock(&ix->lock);
+        return -1;
+    }
+    uint32_t chunk = (ids - 1) / threads + 1;
+    for (int t = 0; t < threads; t++) {
+        RankWorker *w = &workers[t];
+        w->ix = ix;
+        w->query = query;
+        w->queryBytes = strlen(query);
+        w->queryLen = (float)w->queryBytes;
+        w->now = (int64_t)time(NULL);
+        w->from = 1 + (uint32_t)t * chunk;
+        w->to = w->from + chunk < ids ? w->from + chunk : ids;
+        w->heap = hits + (size_t)t * max;
+        w->max = max;
+        w->limit = limit ? limit / threads + 1 : 0;
+    }
+
+    IndexTasks *ranges = indexTasksBegin(TASK_QUERY);
+    for (int t = 0; t < threads; t++) indexTasksSpawn(ranges, rankWorker, &workers[t]);
+    indexTasksWait(ranges);
+    long matches = 0;
+    int kept = 0;
+    for (int t = 0; t < threads; t++) {
+        matches += workers[t].matches;
+        memmove(hits + kept, workers[t].heap, workers[t].count * sizeof(RankHit));
+        kept += workers[t].count;
+    }
+    free(workers);
+
+    qsort(hits, kept, sizeof(RankHit), compareHits);
+    MatchBuffer buf = {out, 0, max};
+    for (int i = 0; i < kept && buf.count < max; i++) {
+        IndexResult result = resultOf(ix->byId[hits[i].id]);
+        copyMatch(&result, &buf);
+    }
+    mutex_unlock(&ix->lock);
+    free(hits);
+    noteQuery(ix, QUERY_RANKED, start);
+    return matches;
+}
+
+long indexQueryRanked(Index *ix, const char *query, IndexMatch *out, int max) {
+    return rankQuery(ix, query, 0, out, max);
+}
+
+long indexQueryRankedSample(Index *ix, const char *query, long candidates, IndexMatch *out, int max) {
+    return rankQuery(ix, query, candidates > 0 ? candidates : 1, out, max);
+}
+
+// --- Similarity Search ---
+// Candidates come from the band buckets the query's signature falls in;
+// a bucket shared by very many names (common stems and extensions) is
+// only read SIMILAR_BUCKET_SCAN pairs deep. Each candidate is then ranked
+// by the share of its signature that agrees with the query's.
+
+// Adds id to an open-addressing set of ids; returns 1 if it was new.
+static int addCandidate(uint32_t *set, uint32_t mask, uint32_t id) {
+    uint32_t i = (uint32_t)hashInode(0, id) & mask;
+    while (set[i] && set[i] != id) i = (i + 1) & mask;
+    if (set[i]) return 0;
+    set[i] = id;
+    return 1;
+}
+
+// First pair in entries[0, count) whose key is at least key.
+static size_t bandLowerBound(const BandEntry *entries, size_t count, uint32_t key) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].key < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+int indexQuerySimilar(Index *ix, const char *name, IndexMatch *out, float *similarity, int max) {
+    if (max <= 0 || !name || !*baseName(name)) return 0;
+    double start = now_seconds();
+    if (buildSimilar(ix) < 0) return -1;
+    uint32_t sig[MINHASH_SIZE], other[MINHASH_SIZE];
+    nameSignature(baseName(name), sig);
+    uint32_t mask = 2 * SIMILAR_CANDIDATES - 1;
+    uint32_t *seen = (uint32_t *)calloc(mask + 1, sizeof(uint32_t));
+    RankHit *hits = (RankHit *)malloc(SIMILAR_CANDIDATES * sizeof(RankHit));
+    if (!seen || !hits) {
+        free(seen);
+        free(hits);
+        return -1;
+    }
+
+    mutex_lock(&ix->lock);
+    int found = 0;
+    for (int band = 0; band < MINHASH_BANDS && found < SIMILAR_CANDIDATES; band++) {
+        Band *b = &ix->bands[band];
+        uint32_t key = bandKey(sig, band);
+        qsort(b->pending, b->pendingCount, sizeof(BandEntry), compareBandEntries);
+        const BandEntry *runs[2] = {b->sorted, b->pending};
+        size_t counts[2] = {b->count, b->pendingCount};
+        for (int r = 0; r < 2 && found < SIMILAR_CANDIDATES; r++) {
+            size_t i = bandLowerBound(runs[r], counts[r], key);
+            for (size_t end = i + SIMILAR_BUCKET_SCAN;
+                 found < SIMILAR_CANDIDATES && i < counts[r] && i < end && runs[r][i].key == key; i++) {
+                const BandEntry *e = &runs[r][i];
+                if (!bandEntryLive(ix, band, e) || strcmp(ix->byId[e->id]->fullpath, name) == 0) continue;
+                if (!addCandidate(seen, mask, e->id)) continue;
+                hits[found++].id = e->id;
+            }
+        }
+    }
+    for (int i = 0; i < found; i++) {
+        int agree = 0;
+        nameSignature(ix->byId[hits[i].id]->filename, other);
+        for (int k = 0; k < MINHASH_SIZE; k++) agree += other[k] == sig[k];
+        hits[i].score = (float)agree / MINHASH_SIZE;
+    }
+    qsort(hits, found, sizeof(RankHit), compareHits);
+    MatchBuffer buf = {out, 0, max};
+    for (int i = 0; i < found && buf.count < max; i++) {
+        if (similarity) similarity[buf.count] = hits[i].score;
+        IndexResult result = resultOf(ix->byId[hits[i].id]);
+        copyMatch(&result, &buf);
+    }
+    mutex_unlock(&ix->lock);
+    free(seen);
+    free(hits);
+    noteQuery(ix, QUERY_SIMILAR, start);
+    return buf.count;
+}
+
+int indexNoteOpen(Index *ix, uint32_t id) {
+    mutex_lock(&ix->lock);
+    int found = id < ix->idCap && ix->byId[id];
+    if (found) {
+        ix->colOpens[id]++;
+        ix->colOpened[id] = (int64_t)time(NULL);
+    }
+    mutex_unlock(&ix->lock);
+    return found ? 0 : -1;
+}
+
+// --- Streaming Find ---
+// indexFind walks a tree without indexing it. Like a remote crawl it runs
+// one task per directory on the crawl pool, but names are matched as each
+// directory is read and the matches handed over as a batch; nothing else
+// outlives its directory. Once FIND_MAX_QUEUED directories are waiting, a
+// task walks further subdirectories itself, depth first, so memory is
+// bounded by that limit and the tree's depth rather than its width. Such
+// inline levels extend the task's path buffer in place and share its batch,
+// so each costs a small stack frame only.
+// Subdirectories are told apart by d_type, so nothing needs a stat.
+
+typedef struct FindWalk {
+    IndexTasks *tasks;
+    char *pattern;          // lowercased
+    int glob;
+    IndexFindFn fn;
+    void *user;
+    mutex_t lock;           // serializes fn, guards queued
+    long found;
+    int queued;             // FindDirs spawned and not yet started
+    volatile int stopped;   // fn asked to stop; queued directories are skipped
+} FindWalk;
+
+// Matching paths, one per line, waiting to be handed over.
+typedef struct FindBatch {
+    char text[FIND_BATCH];
+    size_t len;
+    long count;
+} FindBatch;
+
+// A pool task: the directory it starts from, extended in place while
+// subdirectories are walked inline, and the matches gathered meanwhile.
+typedef struct FindDir {
+    FindWalk *walk;
+    char path[MAX_PATH_LEN];
+    int depth;              // inline levels below the task's own directory
+    FindBatch batch;
+} FindDir;
+
+// Same rules as standing queries: a glob over the whole name, otherwise a
+// substring, ignoring case either way.
+static int findMatches(const FindWalk *w, const char *name) {
+    return w->glob ? globMatch(w->pattern, name) : stristr(name, w->pattern) != NULL;
+}
+
+// A directory for the pool, or NULL when FIND_MAX_QUEUED are waiting.
+static FindDir *newFindDir(FindWalk *w, const char *path) {
+    mutex_lock(&w->lock);
+    int room = w->queued < FIND_MAX_QUEUED;
+    if (room) w->queued++;
+    mutex_unlock(&w->lock);
+    FindDir *fd = room ? (FindDir *)malloc(sizeof(FindDir)) : NULL;
+    if (fd) {
+        fd->walk = w;
+        snprintf(fd->path, sizeof(fd->path), "%s", path);
+        fd->depth = 0;
+        fd->batch.len = 0;
+        fd->batch.count = 0;
+        return fd;
+    }
+    if (room) {
+        mutex_lock(&w->lock);
+        w->queued--;
+        mutex_unlock(&w->lock);
+    }
+    return NULL;
+}
+
+// Hands a batch of lines to the caller, stopping the walk if asked to.
+static void flushFind(FindWalk *w, FindBatch *batch) {
+    if (!batch->len) return;
+    mutex_lock(&w->lock);
+    if (!w->stopped) {
+        w->found += batch->count;
+        if (w->fn(batch->text, batch->len, w->user)) w->stopped = 1;
+    }
+    mutex_unlock(&w->lock);
+    batch->len = 0;
+    batch->count = 0;
+}
+
+// Reads the directory in fd->path. A task from the pool owns fd; a
+// subdirectory walked inline appends itself to the path and returns it as
+// it was.
+static void findWorker(void *arg) {
+    FindDir *fd = (FindDir *)arg;
+    FindWalk *w = fd->walk;
+    FindBatch *batch = &fd->batch;
+    size_t len = strlen(fd->path);
+    if (fd->depth == 0) {
+        mutex_lock(&w->lock);
+        w->queued--;
+        mutex_unlock(&w->lock);
+    }
+    // The root's own name is not matched; "/" must not become "//".
+    const char *sep = fd->path[len - 1] == PATH_SEP ? "" : (PATH_SEP == '/' ? "/" : "\\");
+    #ifdef OS_WINDOWS
+    snprintf(fd->path + len, sizeof(fd->path) - len, "%s*", sep);
+    WIN32_FIND_DATA findData;
+    HANDLE hFind = w->stopped ? INVALID_HANDLE_VALUE : FindFirstFile(fd->path, &findData);
+    fd->path[len] = '\0';
+    int more = hFind != INVALID_HANDLE_VALUE;
+    for (; more && !w->stopped; more = FindNextFile(hFind, &findData) != 0) {
+        const char *name = findData.cFileName;
+        // Junctions are not followed, as find does not follow symlinks.
+        int isDir = (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+                    !(findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT);
+    #else
+    DIR *dir = w->stopped ? NULL : opendir(fd->path);
+    struct dirent *entry;
+    while (dir && !w->stopped && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        int isDir = entry->d_type == DT_DIR;
+    #endif
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        // Inline walks below overwrite the path past pathLen only.
+        size_t pathLen = len + (size_t)snprintf(fd->path + len, sizeof(fd->path) - len, "%s%s", sep, name);
+        if (pathLen >= sizeof(fd->path)) continue;
+        #ifdef OS_POSIX
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            isDir = lstat(fd->path, &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        #endif
+        if (isDir) {
+            FindDir *sub = newFindDir(w, fd->path);
+            if (sub) {
+                indexTasksSpawn(w->tasks, findWorker, sub);
+            } else {
+                fd->depth++;
+                findWorker(fd);
+                fd->depth--;
+            }
+        }
+        if (!findMatches(w, name)) continue;
+        if (batch->len + pathLen + 1 > FIND_BATCH) flushFind(w, batch);
+        memcpy(batch->text + batch->len, fd->path, pathLen);
+        batch->len += pathLen;
+        batch->text[batch->len++] = '\n';
+        batch->count++;
+    }
+    #ifdef OS_WINDOWS
+    if (hFind != INVALID_HANDLE_VALUE) FindClose(hFind);
+    #else
+    if (dir) closedir(dir);
+    #endif
+    fd->path[len] = '\0';
+    if (fd->depth == 0) {
+        flushFind(w, batch);
+        free(fd);
+    }
+}
+
+long indexFind(const char *path, const char *pattern, IndexFindFn fn, void *user) {
+    if (!pattern || !*pattern) return -1;
+    #ifdef OS_WINDOWS
+    DWORD attributes = GetFileAttributes(path);
+    if (attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY)) return -1;
+    #else
+    struct stat st;
+    if (stat(path, &st) == -1 || !S_ISDIR(st.st_mode)) return -1;
+    #endif
+    FindWalk w;
+    memset(&w, 0, sizeof(w));
+    w.pattern = strdup(pattern);
+    if (!w.pattern) return -1;
+    for (char *p = w.pattern; *p; p++) *p = (char)tolower((unsigned char)*p);
+    w.glob = strpbrk(w.pattern, "*?") != NULL;
+    w.fn = fn;
+    w.user = user;
+    mutex_init(&w.lock);
+    w.tasks = indexTasksBegin(TASK_CRAWL);
+    FindDir *top = newFindDir(&w, path);
+    if (top) indexTasksSpawn(w.tasks, findWorker, top);
+    indexTasksWait(w.tasks);
+    mutex_destroy(&w.lock);
+    free(w.pattern);
+    return w.found;
+}
+
+// --- Persistence ---
+// Native-endian binary dump: header, roots, the id tables, then each shard
+// with its directory table and files. Dead directories are dropped on the
+// way out.
+
+static void writeU32(FILE *f, uint32_t v) { fwrite(&v, sizeof(v), 1, f); }
+static void writeI64(FILE *f, int64_t v) { fwrite(&v, sizeof(v), 1, f); }
+
+static void writeIdMap(FILE *f, const IdMap *map) {
+    writeU32(f, (uint32_t)map->count);
+    for (size_t i = 0; i < map->cap; i++) {
+        if (!map->slots[i].key) continue;
+        writeI64(f, (int64_t)map->slots[i].key);
+        writeU32(f, map->slots[i].id);
+    }
+}
+
+static void writeString(FILE *f, const char *str) {
+    uint32_t len = (uint32_t)strlen(str);
+    writeU32(f, len);
+    fwrite(str, 1, len, f);
+}
+
+static int readU32(FILE *f, uint32_t *v) { return fread(v, sizeof(*v), 1, f) == 1; }
+static int readI64(FILE *f, int64_t *v) { return fread(v, sizeof(*v), 1, f) == 1; }
+
+// Bytes between the read position and the end of f, or -1. Counts read
+// from a file are checked against it before anything is sized by them.
+static int64_t bytesLeft(FILE *f) {
+    #ifdef OS_WINDOWS
+    int64_t at = _ftelli64(f);
+    int64_t end = _fseeki64(f, 0, SEEK_END) == 0 ? _ftelli64(f) : -1;
+    if (at < 0 || end < 0 || _fseeki64(f, at, SEEK_SET) != 0) return -1;
+    #else
+    int64_t at = (int64_t)ftello(f);
+    int64_t end = fseeko(f, 0, SEEK_END) == 0 ? (int64_t)ftello(f) : -1;
+    if (at < 0 || end < 0 || fseeko(f, (off_t)at, SEEK_SET) != 0) return -1;
+    #endif
+    return end - at;
+}
+
+static int readIdMap(FILE *f, IdMap *map, uint32_t nextId) {
+    uint32_t count, id;
+    int64_t key;
+    if (!readU32(f, &count) || idMapReserve(map, count) < 0) return 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!readI64(f, &key) || !readU32(f, &id) || key == 0 || id > nextId) return 0;
+        idMapPut(map, (uint64_t)key, id);
+    }
+    return 1;
+}
+
+// Reads a string into buf (size MAX_PATH_LEN). Returns 0 on error.
+static int readString(FILE *f, char *buf) {
+    uint32_t len;
+    if (!readU32(f, &len) || len >= MAX_PATH_LEN) return 0;
+    if (fread(buf, 1, len, f) != len) return 0;
+    buf[len] = '\0';
+    return 1;
+}
+
+int indexSave(Index *ix, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+
+    mutex_lock(&ix->lock);
+    compactIds(ix);
+    writeU32(f, INDEX_FILE_MAGIC);
+    writeU32(f, INDEX_FILE_VERSION);
+    writeU32(f, (uint32_t)ix->rootCount);
+    for (int r = 0; r < ix->rootCount; r++) writeString(f, ix->roots[r].path);
+
+    writeU32(f, ix->nextId);
+    writeIdMap(f, &ix->pathIds);
+    writeIdMap(f, &ix->inodeIds);
+    for (uint32_t id = 1; id <= ix->nextId; id++) {
+        writeU32(f, id < ix->idCap ? ix->retiredAt[id] : 0);
+        writeU32(f, id < ix->idCap ? ix->pathChecks[id] : 0);
+    }
+    for (uint32_t id = 1; id <= ix->nextId; id++) {
+        writeU32(f, id < ix->idCap ? ix->colOpens[id] : 0);
+        writeI64(f, id < ix->idCap ? ix->colOpened[id] : 0);
+    }
+
+    // Permission classes after the implicit class 0; parents come first.
+    mutex_lock(&ix->permLock);
+    writeU32(f, ix->permCount ? ix->permCount - 1 : 0);
+    for (uint32_t c = 1; c < ix->permCount; c++) {
+        const PermClass *pc = &ix->perms[c];
+        writeU32(f, pc->parent);
+        writeU32(f, pc->uid);
+        writeU32(f, pc->gid);
+        writeU32(f, pc->mode);
+        writeU32(f, pc->aclCount);
+        for (uint32_t i = 0; i < pc->aclCount; i++) {
+            writeU32(f, (uint32_t)pc->acl[i].tag | (uint32_t)pc->acl[i].perm << 16);
+            writeU32(f, pc->acl[i].id);
+        }
+    }
+    mutex_unlock(&ix->permLock);
+
+    writeU32(f, (uint32_t)ix->shardCount);
+    for (int s = 0; s < ix->shardCount; s++) {
+        Shard *sh = &ix->shards[s];
+        writeString(f, sh->path);
+        writeU32(f, (uint32_t)sh->root);
+        writeU32(f, (uint32_t)sh->policy);
+        writeU32(f, (uint32_t)sh->interval);
+
+        int *remap = (int *)malloc((sh->dirCount + 1) * sizeof(int));
+        int live = 0;
+        for (int d = 0; d < sh->dirCount; d++) {
+            if (remap) remap[d] = sh->dirs[d].path ? live : -1;
+            if (sh->dirs[d].path) live++;
+        }
+        writeU32(f, remap ? (uint32_t)live : 0);
+        for (int d = 0; remap && d < sh->dirCount; d++) {
+            if (!sh->dirs[d].path) continue;
+            writeString(f, sh->dirs[d].path);
+            writeI64(f, sh->dirs[d].mtime);
+            writeI64(f, sh->dirs[d].ctime);
+            writeU32(f, sh->dirs[d].perm);
+        }
+
+        writeU32(f, (uint32_t)sh->fileCount);
+        for (size_t i = 0; sh->table && i < sh->tableSize; i++) {
+            for (FileEntry *e = sh->table[i]; e; e = e->next) {
+                writeU32(f, (uint32_t)(remap && e->dir >= 0 ? remap[e->dir] : -1));
+                writeString(f, e->filename);
+                writeString(f, e->fullpath);
+                writeU32(f, e->id);
+                writeI64(f, (int64_t)e->inodeKey);
+                writeI64(f, e->size);
+                writeI64(f, e->mtime);
+                writeU32(f, e->uid);
+                writeU32(f, e->perm);
+            }
+        }
+        free(remap);
+    }
+    mutex_unlock(&ix->lock);
+
+    int failed = ferror(f);
+    if (fclose(f) != 0) failed = 1;
+    return failed ? -1 : 0;
+}
+
+// Reads one shard's directories and files into sh. Returns 0 on error.
+static int loadShard(Index *ix, FILE *f, int s) {
+    Shard *sh = &ix->shards[s];
+    char buf[MAX_PATH_LEN], name[MAX_PATH_LEN];
+    uint32_t dirCount, fileCount;
+
+    Crawl crawl;
+    initCrawl(ix, &crawl, s);
+    if (!readU32(f, &dirCount)) return 0;
+    // The counts are known up front; a corrupt one just fails the reserve.
+    if (dirCount < INT32_MAX && reserveDirs(&crawl, (int)dirCount) < 0) return 0;
+    for (uint32_t d = 0; d < dirCount; d++) {
+        int64_t mtime, ctime;
+        if (!readString(f, buf) || !readI64(f, &mtime) || !readI64(f, &ctime) ||
+            !readU32(f, &crawl.perm) || (crawl.perm > 0 && crawl.perm >= ix->permCount)) goto fail;
+        if (addDir(&crawl, buf, mtime, ctime) < 0) goto fail;
+    }
+    if (!readU32(f, &fileCount)) goto fail;
+    crawl.expected = fileCount < INT32_MAX ? (long)fileCount : 0;
+    for (uint32_t i = 0; i < fileCount; i++) {
+        uint32_t dir, id;
+        int64_t inodeKey;
+        FileMeta meta;
+        if (!readU32(f, &dir) || !readString(f, name) || !readString(f, buf) ||
+            !readU32(f, &id) || !readI64(f, &inodeKey) || !readI64(f, &meta.size) ||
+            !readI64(f, &meta.mtime) || !readU32(f, &meta.uid) || !readU32(f, &crawl.perm) ||
+            (crawl.perm > 0 && crawl.perm >= ix->permCount) || id == 0 || id > ix->nextId) goto fail;
+        meta.inodeKey = (uint64_t)inodeKey;
+        meta.links = 0;
+        crawl.dir = (int32_t)dir < (int32_t)crawl.dirCount ? (int32_t)dir : -1;
+        addFile(&crawl, name, buf, &meta);
+        if (!crawl.head || crawl.head->id) goto fail;
+        crawl.head->id = id;
+    }
+
+    sh->table = buildTable(&crawl, &sh->tableSize);
+    if (!sh->table) goto fail;
+    for (size_t i = 0; i < sh->tableSize; i++) {
+        for (FileEntry *e = sh->table[i]; e; e = e->next) {
+            ix->byId[e->id] = e;
+            setColumns(ix, e);
+        }
+    }
+    sh->dirs = crawl.dirs;
+    sh->dirCount = crawl.dirCount;
+    sh->dirCap = crawl.dirCap;
+    mapDirs(sh);
+    sh->fileCount = crawl.count;
+    sh->lastRefresh = now_seconds();
+    ix->totalFiles += crawl.count;
+    return 1;
+
+    fail:
+    freeChain(crawl.head);
+    freeDirs(crawl.dirs, crawl.dirCount);
+    return 0;
+}
+
+// Reads the permission classes written by indexSave. Returns 0 on error.
+static int loadPerms(Index *ix, FILE *f) {
+    uint32_t count;
+    AclEntry *acl = (AclEntry *)malloc(MAX_ACL_ENTRIES * sizeof(AclEntry));
+    if (!acl || !readU32(f, &count)) goto fail;
+    for (uint32_t c = 1; c <= count; c++) {
+        PermClass pc;
+        memset(&pc, 0, sizeof(pc));
+        pc.acl = acl;
+        if (!readU32(f, &pc.parent) || !readU32(f, &pc.uid) || !readU32(f, &pc.gid) ||
+            !readU32(f, &pc.mode) || !readU32(f, &pc.aclCount) ||
+            pc.aclCount > MAX_ACL_ENTRIES || pc.parent >= c) goto fail;
+        for (uint32_t i = 0; i < pc.aclCount; i++) {
+            uint32_t tagPerm;
+            if (!readU32(f, &tagPerm) || !readU32(f, &acl[i].id)) goto fail;
+            acl[i].tag = (uint16_t)tagPerm;
+            acl[i].perm = (uint16_t)(tagPerm >> 16);
+        }
+        // Classes are distinct, so interning them in order gives them back
+        // their numbers.
+        if (internPerm(ix, &pc) != c) goto fail;
+    }
+    free(acl);
+    return 1;
+
+    fail:
+    free(acl);
+    return 0;
+}
+
+Index *indexLoad(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    Index *ix = indexCreate();
+    uint32_t magic, version, rootCount, shardCount;
+    char buf[MAX_PATH_LEN];
+
+    if (!ix || !readU32(f, &magic) || magic != INDEX_FILE_MAGIC ||
+        !readU32(f, &version) || version != INDEX_FILE_VERSION ||
+        !readU32(f, &rootCount) || rootCount > MAX_ROOTS) goto fail;
+    for (uint32_t r = 0; r < rootCount; r++) {
+        if (!readString(f, buf)) goto fail;
+        snprintf(ix->roots[r].path, MAX_PATH_LEN, "%s", buf);
+    }
+    ix->rootCount = (int)rootCount;
+
+    if (!readU32(f, &ix->nextId) || ensureIdCapacity(ix, ix->nextId) < 0 ||
+        !readIdMap(f, &ix->pathIds, ix->nextId) ||
+        !readIdMap(f, &ix->inodeIds, ix->nextId)) goto fail;
+    for (uint32_t id = 1; id <= ix->nextId; id++) {
+        if (!readU32(f, &ix->retiredAt[id]) || !readU32(f, &ix->pathChecks[id])) goto fail;
+    }
+    for (uint32_t id = 1; id <= ix->nextId; id++) {
+        if (!readU32(f, &ix->colOpens[id]) || !readI64(f, &ix->colOpened[id])) goto fail;
+    }
+    if (!loadPerms(ix, f)) goto fail;
+
+    if (!readU32(f, &shardCount) || shardCount > MAX_SHARDS) goto fail;
+    for (uint32_t s = 0; s < shardCount; s++) {
+        uint32_t root, policy, interval;
+        Shard *sh = &ix->shards[s];
+        if (!readString(f, buf) || !readU32(f, &root) || !readU32(f, &policy) ||
+            !readU32(f, &interval) || root >= rootCount) goto fail;
+        snprintf(sh->path, MAX_PATH_LEN, "%s", buf);
+        sh->root = (int)root;
+        sh->policy = (int)policy;
+        sh->interval = (int)interval;
+        ix->shardCount = (int)s + 1;
+        if (!loadShard(ix, f, (int)s)) goto fail;
+    }
+    fclose(f);
+
+    rebuildOrderings(ix);
+
+    // The watcher only learns about directories as they are crawled, so
+    // register the loaded ones now.
+    initWatcher(ix);
+    for (int s = 0; s < ix->shardCount; s++) {
+        for (int d = 0; ix->shards[s].policy == REFRESH_WATCH && d < ix->shards[s].dirCount; d++) {
+            watchDirectory(ix, s, ix->shards[s].dirs[d].path);
+        }
+    }
+    return ix;
+
+    fail:
+    fclose(f);
+    indexFree(ix);
+    return NULL;
+}
+
+// --- History ---
+// A snapshot records which paths are present at one moment. The spans stay
+// compact because a path that is still there only has the last time of its
+// open span moved forward. Snapshots follow every full build and refresh,
+// and indexUpdate takes one every HISTORY_INTERVAL. The side file is
+// columnar: snapshot times, then the path table, then one array per span
+// field.
+
+static int growU32(uint32_t **array, uint32_t *cap, uint32_t need) {
+    if (need <= *cap) return 0;
+    if (need > UINT32_MAX / 2) return -1;
+    uint32_t newCap = *cap ? *cap : 1024;
+    while (newCap < need) newCap *= 2;
+    if (growColumn((void **)array, sizeof(uint32_t), *cap, newCap) < 0) return -1;
+    *cap = newCap;
+    return 0;
+}
+
+// Appends a span for path code, linking it into the path's chain.
+static int addSpan(History *h, uint32_t code, uint32_t first, uint32_t last) {
+    if (growU32(&h->head, &h->headCap, code + 1) < 0) return -1;
+    if (h->spanCount == h->spanCap) {
+        uint32_t newCap = h->spanCap ? h->spanCap * 2 : 1024;
+        HistSpan *grown = (HistSpan *)realloc(h->spans, newCap * sizeof(HistSpan));
+        if (!grown) return -1;
+        h->spans = grown;
+        h->spanCap = newCap;
+    }
+    HistSpan *span = &h->spans[h->spanCount];
+    span->path = code;
+    span->first = first;
+    span->last = last;
+    span->prev = h->head[code];
+    h->head[code] = ++h->spanCount;
+    return 0;
+}
+
+// First snapshot taken after time t, or 0 if there is none.
+static uint32_t snapshotAfter(const History *h, uint32_t t) {
+    uint32_t lo = 0, hi = h->snapshotCount;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (h->snapshots[mid] <= t) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < h->snapshotCount ? h->snapshots[lo] : 0;
+}
+
+void indexSnapshot(Index *ix) {
+    mutex_lock(&ix->lock);
+    History *h = ix->history;
+    uint32_t now = (uint32_t)time(NULL);
+    if (!h || growU32(&h->snapshots, &h->snapshotCap, h->snapshotCount + 1) < 0 ||
+        growU32(&h->codeById, &h->codeCap, ix->idCap) < 0) {
+        mutex_unlock(&ix->lock);
+        return;
+    }
+    uint32_t previous = h->snapshotCount ? h->snapshots[h->snapshotCount - 1] : 0;
+    if (now < previous) now = previous;
+    h->snapshots[h->snapshotCount++] = now;
+    h->lastSnapshot = now_seconds();
+
+    uint32_t ids = ix->nextId + 1 < ix->idCap ? ix->nextId + 1 : ix->idCap;
+    for (uint32_t id = 1; id < ids; id++) {
+        FileEntry *e = ix->byId[id];
+        if (!e) continue;
+        // Ids keep their path unless the file moved, so the cached code
+        // usually saves hashing the path again.
+        uint32_t code = h->codeById[id];
+        if (!code || strcmp(h->paths.names[code - 1], e->fullpath) != 0) {
+            code = dictIntern(&h->paths, e->fullpath) + 1;
+            h->codeById[id] = code;
+        }
+        code--;
+        uint32_t latest = code < h->headCap ? h->head[code] : 0;
+        if (latest && h->spans[latest - 1].last == previous && previous) {
+            h->spans[latest - 1].last = now;
+        } else if (!latest || h->spans[latest - 1].last != now) {
+            addSpan(h, code, now, now);
+        }
+    }
+    mutex_unlock(&ix->lock);
+}
+
+// Fills out from a path's spans, newest first. Caller holds the lock.
+static int copySpans(const History *h, uint32_t code, IndexSpan *out, int max) {
+    int n = 0;
+    uint32_t latest = h->snapshotCount ? h->snapshots[h->snapshotCount - 1] : 0;
+    for (uint32_t s = code < h->headCap ? h->head[code] : 0; s && n < max; s = h->spans[s - 1].prev) {
+        const HistSpan *span = &h->spans[s - 1];
+        out[n].first = span->first;
+        out[n].last = span->last;
+        out[n].goneBy = span->last == latest ? 0 : snapshotAfter(h, span->last);
+        n++;
+    }
+    return n;
+}
+
+int indexHistory(Index *ix, const char *path, IndexSpan *out, int max) {
+    char clean[MAX_PATH_LEN];
+    normalizePath(path, clean);
+
+    mutex_lock(&ix->lock);
+    History *h = ix->history;
+    uint32_t code = h ? idMapGet(&h->paths.codes, hashPath(clean)) : 0;
+    int n = code ? copySpans(h, code - 1, out, max) : -1;
+    mutex_unlock(&ix->lock);
+    return n;
+}
+
+int indexQueryAt(Index *ix, const char *query, int64_t when, IndexMatch *out, int max) {
+    double start = now_seconds();
+    mutex_lock(&ix->lock);
+    History *h = ix->history;
+    if (!h) {
+        mutex_unlock(&ix->lock);
+        return -1;
+    }
+    uint32_t latest = h->snapshotCount ? h->snapshots[h->snapshotCount - 1] : 0;
+    int count = 0;
+    for (uint32_t code = 0; code < h->paths.count && count < max; code++) {
+        const char *path = h->paths.names[code];
+        const char *name = baseName(path);
+        if (query && *query && !stristr(name, query)) continue;
+        // An open span covers everything after its first snapshot.
+        int present = 0;
+        for (uint32_t s = code < h->headCap ? h->head[code] : 0; s && !present; s = h->spans[s - 1].prev) {
+            const HistSpan *span = &h->spans[s - 1];
+            present = span->first <= when && (when <= span->last || span->last == latest);
+        }
+        if (!present) continue;
+        IndexMatch *m = &out[count++];
+        memset(m, 0, sizeof(*m));
+        snprintf(m->filename, sizeof(m->filename), "%s", name);
+        snprintf(m->fullpath, sizeof(m->fullpath), "%s", path);
+        m->root = m->shard = -1;
+        // Still indexed under the same path: report what the index knows.
+        uint32_t id = idMapGet(&ix->pathIds, hashPath(path));
+        if (id && id < ix->idCap && ix->byId[id] && strcmp(ix->byId[id]->fullpath, path) == 0) {
+            IndexResult result = resultOf(ix->byId[id]);
+            MatchBuffer buf = {m, 0, 1};
+            copyMatch(&result, &buf);
+        }
+    }
+    mutex_unlock(&ix->lock);
+    noteQuery(ix, QUERY_HISTORY, start);
+    return count;
+}
+
+int indexHistoryStats(Index *ix, IndexHistoryStats *stats) {
+    mutex_lock(&ix->lock);
+    History *h = ix->history;
+    if (h) {
+        stats->snapshots = h->snapshotCount;
+        stats->paths = h->paths.count;
+        stats->spans = h->spanCount;
+        stats->oldest = h->snapshotCount ? h->snapshots[0] : 0;
+    }
+    mutex_unlock(&ix->lock);
+    return h ? 0 : -1;
+}
+
+static void writeU32Array(FILE *f, const uint32_t *values, uint32_t count) {
+    writeU32(f, count);
+    fwrite(values, sizeof(uint32_t), count, f);
+}
+
+int indexSaveHistory(Index *ix) {
+    mutex_lock(&ix->lock);
+    History *h = ix->history;
+    if (!h) {
+        mutex_unlock(&ix->lock);
+        return -1;
+    }
+    // Written beside the old file and renamed over it, so a crash never
+    // leaves a half-written history.
+    char tmp[MAX_PATH_LEN + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", h->file);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        mutex_unlock(&ix->lock);
+        return -1;
+    }
+    writeU32(f, HISTORY_FILE_MAGIC);
+    writeU32(f, HISTORY_FILE_VERSION);
+    writeU32Array(f, h->snapshots, h->snapshotCount);
+    writeU32(f, h->paths.count);
+    for (uint32_t i = 0; i < h->paths.count; i++) writeString(f, h->paths.names[i]);
+    writeU32(f, h->spanCount);
+    for (uint32_t i = 0; i < h->spanCount; i++) writeU32(f, h->spans[i].path);
+    for (uint32_t i = 0; i < h->spanCount; i++) writeU32(f, h->spans[i].first);
+    for (uint32_t i = 0; i < h->spanCount; i++) writeU32(f, h->spans[i].last);
+    mutex_unlock(&ix->lock);
+
+    int failed = ferror(f);
+    if (fclose(f) != 0) failed = 1;
+    #ifdef OS_WINDOWS
+    if (!failed) remove(h->file);
+    #endif
+    if (failed || rename(tmp, h->file) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static int loadHistory(History *h, FILE *f) {
+    uint32_t magic, version, count, pathCount, spanCount;
+    char buf[MAX_PATH_LEN];
+    if (!readU32(f, &magic) || magic != HISTORY_FILE_MAGIC ||
+        !readU32(f, &version) || version != HISTORY_FILE_VERSION ||
+        !readU32(f, &count) || (int64_t)sizeof(uint32_t) * count > bytesLeft(f) ||
+        growU32(&h->snapshots, &h->snapshotCap, count) < 0 ||
+        fread(h->snapshots, sizeof(uint32_t), count, f) != count) return 0;
+    h->snapshotCount = count;
+    // Every path takes at least its length.
+    if (!readU32(f, &pathCount) || (int64_t)sizeof(uint32_t) * pathCount > bytesLeft(f)) return 0;
+    for (uint32_t i = 0; i < pathCount; i++) {
+        if (!readString(f, buf) || dictIntern(&h->paths, buf) != i) return 0;
+    }
+    if (!readU32(f, &spanCount) || (int64_t)sizeof(uint32_t) * 3 * spanCount > bytesLeft(f)) return 0;
+    uint32_t *columns[3] = {NULL, NULL, NULL};
+    int ok = 1;
+    for (int c = 0; c < 3 && ok; c++) {
+        columns[c] = (uint32_t *)malloc(((size_t)spanCount + 1) * sizeof(uint32_t));
+        ok = columns[c] && fread(columns[c], sizeof(uint32_t), spanCount, f) == spanCount;
+    }
+    for (uint32_t i = 0; ok && i < spanCount; i++) {
+        ok = columns[0][i] < pathCount && addSpan(h, columns[0][i], columns[1][i], columns[2][i]) == 0;
+    }
+    for (int c = 0; c < 3; c++) free(columns[c]);
+    return ok;
+}
+
+int indexOpenHistory(Index *ix, const char *path) {
+    History *h = (History *)calloc(1, sizeof(History));
+    if (!h) return -1;
+    snprintf(h->file, sizeof(h->file), "%s", path);
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        int ok = loadHistory(h, f);
+        fclose(f);
+        if (!ok) {
+            freeHistory(h);
+            return -1;
+        }
+    }
+    mutex_lock(&ix->lock);
+    freeHistory(ix->history);
+    ix->history = h;
+    mutex_unlock(&ix->lock);
+    return 0;
+}
@@ -0,0 +1,560 @@
+/*
+ * Index engine behind the file searcher.
+ *
+ * Everything hangs off an opaque Index handle, so a process can hold several
+ * indexes and query them from any thread. The only state they share is the
+ * task scheduler (sched.c) that runs their parallel work.
+ * Every call takes the index lock itself; callbacks run with it held and
+ * must not call back into the same index.
+ */
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define INDEX_MAX_PATH 1024
+#define INDEX_MAX_GROUPS 32
+
+enum { REFRESH_MANUAL, REFRESH_POLL, REFRESH_WATCH };
+enum { GROUP_BY_EXT, GROUP_BY_OWNER, GROUP_BY_TOP, GROUP_BY_SHARD, GROUP_BY_ROOT };
+enum { ORDER_RECENT, ORDER_LARGEST };
+enum { GREP_IGNORE_CASE = 1, GREP_REGEX = 2 };
+enum { MEM_NAMES, MEM_DIRS, MEM_TABLES, MEM_IDS, MEM_COLUMNS, MEM_HISTORY, MEM_SECTIONS };
+enum { RESIDENCY_DEFAULT, RESIDENCY_LOCK, RESIDENCY_TOUCH, RESIDENCY_COLD, RESIDENCY_PAGEOUT };
+enum { TASK_QUERY, TASK_UI, TASK_UPDATE, TASK_BUILD, TASK_CRAWL, TASK_CLASSES };
+enum { SYMBOL_FUNCTION, SYMBOL_METHOD, SYMBOL_TYPE, SYMBOL_MACRO };
+enum { CRAWL_ORDER_AUTO, CRAWL_ORDER_READDIR, CRAWL_ORDER_INODE };
+
+typedef struct Index Index;
+typedef struct IndexContent IndexContent;
+typedef struct IndexCount IndexCount;
+typedef struct IndexTasks IndexTasks;
+typedef struct IndexSymbols IndexSymbols;
+
+// Passed to query callbacks. The strings belong to the index and are only
+// valid for the duration of the callback.
+typedef struct IndexResult {
+    const char *filename;
+    const char *fullpath;
+    uint32_t id;            // stable id, see indexLookupId
+    int64_t size;
+    int64_t mtime;          // seconds since the epoch
+    int root;
+    int shard;
+} IndexResult;
+
+// A result copied out of the index, safe to keep after the query returns.
+typedef struct IndexMatch {
+    char filename[256];
+    char fullpath[INDEX_MAX_PATH];
+    uint32_t id;            // stable id, see indexLookupId
+    int64_t size;
+    int64_t mtime;          // seconds since the epoch
+    int root;
+    int shard;
+} IndexMatch;
+
+// Someone a query answers for, as a shared index server sees its clients.
+typedef struct IndexViewer {
+    uint32_t uid;
+    uint32_t gid;           // primary group
+    uint32_t groups[INDEX_MAX_GROUPS];  // supplementary groups
+    int groupCount;
+} IndexViewer;
+
+typedef struct IndexRootInfo {
+    char path[INDEX_MAX_PATH];
+    long fileCount;
+} IndexRootInfo;
+
+typedef struct IndexShardInfo {
+    char path[INDEX_MAX_PATH];
+    int root;
+    int policy;             // REFRESH_*
+    int interval;           // seconds, for REFRESH_POLL
+    long fileCount;
+    int dirCount;
+    double age;             // seconds since the last full crawl
+    double crawlSeconds;
+} IndexShardInfo;
+
+typedef struct IndexPollStats {
+    int trackedDirs;        // directories watched by the poller
+    long syscallsLastTick;
+    long rereads;           // directories re-read since creation
+    int budget;             // syscalls per second
+} IndexPollStats;
+
+// Memory held by one MEM_* section of the index.
+typedef struct IndexMemoryInfo {
+    const char *name;       // "names", "dirs", "tables", "ids", "columns" or "history"
+    int64_t bytes;
+    int64_t resident;       // bytes in RAM now, -1 when unknown
+    int64_t locked;         // bytes pinned by RESIDENCY_LOCK
+    int policy;             // RESIDENCY_*
+} IndexMemoryInfo;
+
+// Restricts indexGroupBy to some files. Zero fields are ignored.
+typedef struct IndexGroupFilter {
+    int64_t newerThan;      // mtime >= this, seconds since the epoch
+    int64_t olderThan;      // mtime < this
+    int64_t minSize;        // bytes
+    int64_t maxSize;
+    const char *name;       // case-insensitive substring of the file name
+} IndexGroupFilter;
+
+// One row of an indexGroupBy answer.
+typedef struct IndexGroup {
+    char key[INDEX_MAX_PATH];   // extension (empty for none), owner, directory or path
+    long count;
+    int64_t size;               // total bytes
+    int64_t oldest;             // min mtime, seconds since the epoch
+    int64_t newest;             // max mtime
+} IndexGroup;
+
+// One stretch of snapshots in which a path was present. Times are seconds
+// since the epoch.
+typedef struct IndexSpan {
+    int64_t first;          // first snapshot that saw it
+    int64_t last;           // last snapshot that saw it
+    int64_t goneBy;         // first snapshot without it, 0 while still present
+} IndexSpan;
+
+typedef struct IndexHistoryStats {
+    long snapshots;
+    long paths;
+    long spans;
+    int64_t oldest;         // time of the first snapshot
+} IndexHistoryStats;
+
+// A match count from indexCountStep, estimated until exact is set.
+typedef struct IndexEstimate {
+    long count;
+    long margin;            // half-width of a ~95% interval around count, 0 when exact
+    double sampled;         // fraction of the index examined so far
+    int exact;
+} IndexEstimate;
+
+// Scheduler counters since the process started, per TASK_* class.
+typedef struct IndexSchedStats {
+    double cpuSeconds[TASK_CLASSES];    // thread CPU time spent in tasks
+    long tasks[TASK_CLASSES];           // tasks run
+    long queued[TASK_CLASSES];          // tasks waiting now
+    int foreground;                     // workers for query, UI and update
+    int background;                     // workers for build and crawl
+    int io;                             // workers for groups that wait on I/O
+} IndexSchedStats;
+
+typedef void (*IndexTaskFn)(void *arg);
+
+// Return nonzero from a match callback to stop the query early.
+typedef int (*IndexMatchFn)(const IndexResult *result, void *user);
+
+// One matching line from indexGrep. The strings are only valid for the
+// duration of the callback.
+typedef struct IndexGrepHit {
+    const char *fullpath;
+    long line;              // 1-based
+    const char *text;       // the line, cut to 255 bytes
+} IndexGrepHit;
+
+// Return nonzero to stop the search. Calls are serialized but come from
+// worker threads, without the index lock held.
+typedef int (*IndexGrepFn)(const IndexGrepHit *hit, void *user);
+
+// Matching paths from indexFind, each followed by a newline, len bytes in
+// all. Return nonzero to stop the walk. Calls are serialized but come from
+// worker threads.
+typedef int (*IndexFindFn)(const char *paths, size_t len, void *user);
+
+typedef struct IndexContentStats {
+    long files;
+    long grams;             // trigrams held, summed over files
+    int64_t indexedBytes;   // file bytes covered
+    int64_t lastRead;       // bytes read by the last update
+    long lastAppended;      // files the last update read only the tail of
+    long lastReindexed;     // files it read in full
+    long lastCandidates;    // files the last indexContentGrep searched
+} IndexContentStats;
+
+// A definition found by indexSymbolQuery.
+typedef struct IndexSymbol {
+    char name[128];
+    char fullpath[INDEX_MAX_PATH];
+    uint32_t id;            // entry id of the file, see indexLookupId
+    long line;              // 1-based
+    int kind;               // SYMBOL_*
+} IndexSymbol;
+
+typedef struct IndexSymbolStats {
+    long files;             // source files tracked
+    long symbols;
+    long names;             // distinct names in use
+    long lastScanned;       // files the last update read
+    long lastDropped;       // files it forgot, no longer indexed
+} IndexSymbolStats;
+
+// A standing query's match, as delivered to an IndexStandingFn.
+typedef struct IndexStandingHit {
+    int query;              // from indexStandingAdd
+    char pattern[256];
+    IndexMatch file;
+    int64_t when;           // seconds since the epoch
+} IndexStandingHit;
+
+typedef void (*IndexStandingFn)(const IndexStandingHit *hit, void *user);
+
+typedef struct IndexStandingStats {
+    long queries;
+    long checked;           // changed names matched against them
+    long hits;
+    long queued;            // changes waiting for the next indexUpdate
+    long dropped;           // changes lost to a full queue
+} IndexStandingStats;
+
+// Crawl progress, aggregated over every shard in an indexBuild.
+typedef struct IndexProgress {
+    const char *path;       // shard being crawled, NULL on the final report
+    long scanned;           // files and directories seen so far
+    long expected;          // estimated total, 0 when unknown
+    double elapsed;         // seconds since the build started
+    double eta;             // seconds left, -1 when unknown
+    int done;               // set on the final report
+} IndexProgress;
+
+// Called as each shard starts, every quarter second while crawling and once
+// when the build finishes. Calls are serialized but may come from crawler
+// threads.
+typedef void (*IndexProgressFn)(const IndexProgress *progress, void *user);
+
+// Parallel work goes through one scheduler, highest class first:
+//   TASK_QUERY   name queries
+//   TASK_UI      analytics and content search behind the interface
+//   TASK_UPDATE  incremental updates such as the content index
+//   TASK_BUILD   sorted-view rebuilds
+//   TASK_CRAWL   filesystem crawls
+// Build and crawl tasks run on their own, lower priority workers, so they
+// never keep the others from starting. indexTasksBegin opens a group of the
+// given class; NULL (out of memory) is a valid group whose tasks run inline
+// in indexTasksSpawn. indexTasksWait runs queued tasks of the group on the
+// calling thread until all are done, then frees it. Tasks of a cancelled
+// group that have not started are dropped; running ones can poll
+// indexTasksCancelled. A group whose tasks mostly block on the network
+// calls indexTasksExpectIO to have up to workers of them in flight at once:
+// they also run on a separate pool of I/O workers, grown to the largest
+// such request, so the CPU-sized pools stay as they are.
+IndexTasks *indexTasksBegin(int taskClass);
+void indexTasksExpectIO(IndexTasks *tasks, int workers);
+void indexTasksSpawn(IndexTasks *tasks, IndexTaskFn fn, void *arg);
+void indexTasksCancel(IndexTasks *tasks);
+int indexTasksCancelled(const IndexTasks *tasks);
+void indexTasksWait(IndexTasks *tasks);
+void indexSchedStats(IndexSchedStats *stats);
+
+Index *indexCreate(void);
+void indexFree(Index *ix);
+
+// Registers a root. Duplicates and roots nested in an existing root are
+// refused. Existing roots nested in the new one are absorbed, their shards
+// kept under the new root, which renumbers the roots after them; once
+// they hold files the new root is refused instead. Returns the root id,
+// or -1.
+int indexAddRoot(Index *ix, const char *path);
+
+// Registers a shard from "PATH[:watch|:manual|:poll=SECONDS]" (default
+// watch). The path must lie under a root; naming an existing shard or root
+// only changes its policy; a loaded shard turned to watch has its known
+// directories registered with the watcher. Returns the shard id, or -1.
+int indexAddShard(Index *ix, const char *spec);
+
+void indexSetPollBudget(Index *ix, int syscallsPerSecond);
+
+// How crawls order their stat calls. CRAWL_ORDER_INODE reads a batch of
+// sibling directories, then stats what they hold sorted by inode number,
+// which saves most of the seeks of a cold crawl on a spinning disk;
+// CRAWL_ORDER_READDIR stats entries as readdir returns them. The default,
+// CRAWL_ORDER_AUTO, picks inode order for roots on rotational disks.
+// Shards on NFS, CIFS or FUSE mounts ignore it: their directories are read
+// in parallel, one task each, using d_type and cached attributes to keep
+// round trips to the server down.
+void indexSetCrawlOrder(Index *ix, int order);
+
+// Crawls every shard, one thread per device. Tables are pre-sized from each
+// shard's previous crawl, or from the used-inode count of a shard that
+// covers a whole mount. progress may be NULL.
+void indexBuild(Index *ix, IndexProgressFn progress, void *user);
+
+// Re-crawl a root (all its shards) or a single shard. A shard already being
+// crawled is crawled once more when that finishes, and the call returns at
+// once. Return 0, or -1 for a bad id.
+int indexRefreshRoot(Index *ix, int root);
+int indexRefreshShard(Index *ix, int shard);
+
+// Adds one file, or replaces it if the path is already indexed. The file is
+// placed in the most specific shard containing it. Returns 0, or -1 when the
+// path is not under any root or cannot be stat'ed.
+int indexIngest(Index *ix, const char *path);
+
+// Removes one file. Returns 0, or -1 when it was not indexed.
+int indexRemove(Index *ix, const char *path);
+
+// Runs one round of background maintenance on the calling thread: drains
+// watcher events, rebuilds watch shards that changed and runs a poller tick.
+// Waits up to timeoutMs for watcher events first.
+void indexUpdate(Index *ix, int timeoutMs);
+
+// Runs indexUpdate on a background thread until indexStopUpdater or
+// indexFree. Does nothing when every shard is manual, no section has a
+// residency policy and no metrics file is set.
+void indexStartUpdater(Index *ix);
+void indexStopUpdater(Index *ix);
+
+// Calls fn for every file whose name contains query, case-insensitively.
+// Returns the number of matches reported.
+long indexQuery(Index *ix, const char *query, IndexMatchFn fn, void *user);
+
+// Copies up to max matches into out. Returns the number copied.
+int indexQueryBuf(Index *ix, const char *query, IndexMatch *out, int max);
+
+// Like indexQuery and indexQueryBuf, but only files viewer may see: those
+// in a directory they can read, below directories they can all enter.
+// Permissions (mode bits, owner, group and POSIX ACLs) are recorded per
+// directory at crawl time and re-checked when the poller sees a directory
+// change; no per-result access() calls are made. Verdicts for recently
+// seen viewers are cached as bitmaps. uid 0 sees everything.
+long indexQueryAs(Index *ix, const IndexViewer *viewer, const char *query, IndexMatchFn fn, void *user);
+int indexQueryBufAs(Index *ix, const IndexViewer *viewer, const char *query, IndexMatch *out, int max);
+
+// Counts the files whose name contains query without paying for a full
+// scan up front. Each indexCountStep call examines about seconds' worth
+// more of a random sample of hash buckets, stratified by shard, and
+// updates out. Once the sample covers every bucket the count is exact.
+// A refresh that swaps a shard's table restarts the sample. Returns
+// out->exact. indexCountStart returns NULL when out of memory.
+IndexCount *indexCountStart(Index *ix, const char *query);
+int indexCountStep(IndexCount *c, double seconds, IndexEstimate *out);
+void indexCountFree(IndexCount *c);
+
+// Copies up to max files whose name contains query (NULL or "" for all),
+// most recently modified first (ORDER_RECENT) or largest first
+// (ORDER_LARGEST). A nonzero bound stops the walk at files older than bound
+// (seconds since the epoch) or smaller than bound bytes. Walks a sorted
+// view, so the cost follows the number of files visited rather than the
+// size of the index. Returns the number copied.
+int indexQueryOrdered(Index *ix, int order, const char *query, int64_t bound, IndexMatch *out, int max);
+
+// Copies the best max files whose name contains query (NULL or "" for
+// all) into out, best first. Matches at the start of the name or of a word
+// in it, names the match covers, shallow paths, files opened often and
+// lately (see indexNoteOpen) and recently modified files rank higher.
+// Every match is scored, in parallel and in batches. Returns the number of
+// matches, which may exceed max, or -1.
+long indexQueryRanked(Index *ix, const char *query, IndexMatch *out, int max);
+
+// indexQueryRanked over a bounded prefix: scoring stops after about
+// candidates matches, taken in id order, so the cost no longer follows a
+// huge result set. Pair it with indexCountStep for the total. Returns the
+// number of matches scored, or -1.
+long indexQueryRankedSample(Index *ix, const char *query, long candidates, IndexMatch *out, int max);
+
+// The name features indexQueryRanked scores, for rankers of other names:
+// the offset of the first case-insensitive match of query in name, or -1
+// for none, and in word whether the match starts a word of name (after a
+// separator, at a lower-to-upper case change or where digits begin).
+long indexNameMatch(const char *name, const char *query, int *word);
+
+// Copies up to max files whose names are most like name (a file name, or
+// a path whose last component is used) into out, most similar first, so
+// app-1.2.4.tar.gz finds app-1.2.3.tar.gz. Similarity is the Jaccard
+// index of the names' character trigrams, estimated from MinHash
+// signatures; when similarity is not NULL it receives each estimate
+// (0..1). Lookups go through LSH buckets, built on the first call, so they
+// do not scan the index. The file at path name itself is left out.
+// Returns the number copied, or -1 when out of memory.
+int indexQuerySimilar(Index *ix, const char *name, IndexMatch *out, float *similarity, int max);
+
+// Records that the file with the given id was opened, for ranking. Open
+// counts stay with the id, so they survive refreshes, renames and
+// save/load. Returns 0, or -1 when no indexed file has that id.
+int indexNoteOpen(Index *ix, uint32_t id);
+
+// Every indexed file carries an id that is never 0 and never reused. It
+// survives refreshes, save/load and renames that keep the inode, so callers
+// can key their own state (bookmarks, tags, open-count) on it.
+// indexLookupId returns the id of an indexed path, or 0 when it is not
+// indexed.
+uint32_t indexLookupId(Index *ix, const char *path);
+
+// Copies the file with the given id into out. Returns 0, or -1 when no
+// indexed file has that id.
+int indexGetById(Index *ix, uint32_t id, IndexMatch *out);
+
+// Aggregates the files matching filter (NULL for all) by extension, owner,
+// top-level directory under the root, shard or root (GROUP_BY_*). Copies up
+// to max groups into out, largest total size first. Returns the number of
+// non-empty groups, which may exceed max, or -1.
+int indexGroupBy(Index *ix, int by, const IndexGroupFilter *filter, IndexGroup *out, int max);
+
+// Searches the contents of every file whose name contains nameQuery (NULL
+// or "" for all) for pattern, a literal or, with GREP_REGEX, a POSIX
+// extended regex. gzip (bgzip included) and zstd files are decompressed on
+// the fly when built with HAVE_ZLIB / HAVE_ZSTD; binary files are skipped.
+// Files are searched in parallel, and large bgzip, multi-frame zstd and
+// plain files are split across threads too. Hits for one file arrive in
+// line order. Implemented in content.c. Returns the number of hits
+// reported, or -1 for a bad pattern.
+long indexGrep(Index *ix, const char *nameQuery, const char *pattern, int flags, IndexGrepFn fn, void *user);
+
+// Walks the tree under path without an index, like find -iname, and hands
+// every file or directory whose name matches pattern to fn as soon as its
+// directory has been read. A pattern with * or ? is a glob over the whole
+// name; any other matches names containing it. Case is ignored, symlinks
+// are not followed and path itself is not reported. Directories are read
+// in parallel; past a fixed number waiting, a worker walks the rest of its
+// subtree itself, so memory does not grow with the width of the tree.
+// Needs no Index. Returns the number of paths reported, or -1 when path is
+// not a directory.
+long indexFind(const char *path, const char *pattern, IndexFindFn fn, void *user);
+
+// Content index: per-file trigram sets that let indexContentGrep skip
+// files that cannot hold a literal pattern. It lives beside the index in
+// its own side file. indexContentOpen loads path if it exists (NULL for an
+// in-memory index) and returns NULL when it is unreadable.
+//
+// Updates are incremental. A file is opened only when the size or mtime
+// the index holds for it changed, so changes show once a refresh, the
+// watcher, the poller or indexIngest has recorded them. A plain file that
+// only grew has just its new tail read, as long as checksums of
+// the start and end of the part already indexed still match. Truncated,
+// rotated or rewritten files and changed compressed files are read in
+// full. So keeping busy log directories fresh costs about their append
+// rate.
+IndexContent *indexContentOpen(Index *ix, const char *path);
+void indexContentFree(IndexContent *ci);
+int indexContentSave(IndexContent *ci);
+
+// Brings the files matching nameQuery (NULL or "" for all, which also
+// drops files no longer indexed) up to date. Returns the bytes read.
+int64_t indexContentUpdate(IndexContent *ci, const char *nameQuery);
+
+// indexGrep, but updating the matching files first and only searching
+// those whose trigrams admit the pattern. Regex patterns are not pruned.
+// Callbacks must not call back into ci.
+long indexContentGrep(IndexContent *ci, const char *nameQuery, const char *pattern, int flags,
+                      IndexGrepFn fn, void *user);
+void indexContentStats(IndexContent *ci, IndexContentStats *stats);
+
+// Symbol index: definitions of functions, methods, types and macros in
+// the indexed C/C++, Python, Go, JavaScript/TypeScript and Java files
+// (known by extension), found by lightweight per-language line scanners.
+// It lives beside the index in its own side file; indexSymbolsOpen loads
+// path if it exists (NULL for an in-memory index) and returns NULL when
+// it is unreadable.
+//
+// Updates rescan, in parallel, only the files whose mtime or size in the
+// index differs from when they were scanned, and drop files no longer
+// indexed. indexSymbolsUpdate returns the number of files read.
+IndexSymbols *indexSymbolsOpen(Index *ix, const char *path);
+void indexSymbolsFree(IndexSymbols *si);
+int indexSymbolsSave(IndexSymbols *si);
+long indexSymbolsUpdate(IndexSymbols *si);
+
+// Updates, then copies up to max definitions whose name contains query
+// (ignoring case) into out, best first: whole-name matches, then
+// prefixes, then word starts, shorter names first. Returns the total
+// number of matching definitions, or -1 when out of memory.
+long indexSymbolQuery(IndexSymbols *si, const char *query, IndexSymbol *out, int max);
+void indexSymbolStats(IndexSymbols *si, IndexSymbolStats *stats);
+
+// Standing queries report files that start to match: files added, moved
+// or changed after their shard's first crawl, by any refresh, the poller,
+// the watcher or indexIngest. A pattern with * or ? is a glob over the
+// whole name ("core.*", "*.rej"); any other matches names containing it.
+// Case is ignored. indexUpdate matches the changes against every query in
+// one pass and calls the function set with indexSetStandingFn, on the
+// updater thread and without the lock held; indexStandingRecent copies the
+// latest hits, newest first, for callers that would rather poll.
+// indexStandingAdd returns the query's id, or -1. indexStartUpdater runs
+// the updater whenever standing queries exist.
+int indexStandingAdd(Index *ix, const char *pattern);
+int indexStandingRemove(Index *ix, int query);
+void indexSetStandingFn(Index *ix, IndexStandingFn fn, void *user);
+int indexStandingRecent(Index *ix, IndexStandingHit *out, int max);
+void indexStandingStats(Index *ix, IndexStandingStats *stats);
+
+// Residency: after hours idle the kernel may reclaim index pages, and the
+// first queries then fault them back at disk speed. A policy per section
+// steers this:
+//   RESIDENCY_LOCK     pins the pages with mlock
+//   RESIDENCY_TOUCH    touches every page each minute from indexUpdate,
+//                      keeping the pages recently used; without
+//                      MADV_POPULATE_READ this reads each region under
+//                      the lock, so it costs a walk of the section
+//   RESIDENCY_COLD     marks the pages first to reclaim (MADV_COLD)
+//   RESIDENCY_PAGEOUT  has them reclaimed now (MADV_PAGEOUT)
+// The names section holds the file entries with their names and paths.
+// Policies are re-applied by indexUpdate, which covers memory allocated
+// since. Returns 0, or -1 for a bad argument or a policy this platform
+// lacks. A lock refused by RLIMIT_MEMLOCK also returns -1, keeps the
+// pages already locked and touches the section from then on.
+int indexSetResidency(Index *ix, int section, int policy);
+
+// Fills info for a MEM_* section. Residency is measured with mincore over
+// the pages the section covers. Returns 0, or -1 for a bad section.
+int indexMemoryInfo(Index *ix, int section, IndexMemoryInfo *info);
+
+// Bytes held by all sections together, counted in one walk without
+// measuring residency.
+int64_t indexMemoryBytes(Index *ix);
+
+// Metrics in the Prometheus text format: index and shard sizes, crawl
+// totals, update lag per shard, query latency histograms and percentiles
+// per kind, view cache hits, shed requests, memory per section as of the
+// last residency pass (once a minute while a metrics file is set) and the
+// scheduler's counters. Queries and crawls count into per-thread slots
+// without locking; writing sums them. indexWriteMetrics returns 0, or -1
+// on a write error. indexSetMetricsFile writes path now and has indexUpdate
+// rewrite it every 15 seconds through a rename, so scrapers never see it
+// half written; NULL stops. Returns -1 when the first write fails.
+int indexWriteMetrics(Index *ix, FILE *out);
+int indexSetMetricsFile(Index *ix, const char *path);
+
+// Counts a request the caller dropped unanswered, for index_requests_shed_total.
+void indexNoteShed(Index *ix);
+
+long indexFileCount(Index *ix);
+int indexRootCount(Index *ix);
+int indexShardCount(Index *ix);
+int indexRootInfo(Index *ix, int root, IndexRootInfo *info);
+int indexShardInfo(Index *ix, int shard, IndexShardInfo *info);
+void indexPollStats(Index *ix, IndexPollStats *stats);
+
+// History: which paths were present when. indexOpenHistory starts
+// recording into a side file, loading what it already holds; returns -1
+// when the file exists but is unreadable. From then on every build and
+// refresh takes a snapshot, as does indexUpdate every few minutes.
+// indexSaveHistory writes the file back.
+int indexOpenHistory(Index *ix, const char *path);
+int indexSaveHistory(Index *ix);
+void indexSnapshot(Index *ix);
+int indexHistoryStats(Index *ix, IndexHistoryStats *stats);
+
+// Copies up to max spans of path, newest first. Returns the number copied,
+// or -1 when the path was never recorded.
+int indexHistory(Index *ix, const char *path, IndexSpan *out, int max);
+
+// Like indexQueryBuf, but over the paths present at time when (seconds
+// since the epoch). Paths no longer indexed come back with root and shard
+// -1 and zero size and mtime. Returns -1 without history.
+int indexQueryAt(Index *ix, const char *query, int64_t when, IndexMatch *out, int max);
+
+// Writes roots, shards, directories and files to path. Returns 0 or -1.
+int indexSave(Index *ix, const char *path);
+
+// Reads an index written by indexSave. Returns NULL on error or when the
+// file was written by an incompatible version.
+Index *indexLoad(const char *path);
+
+#endif
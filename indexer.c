@@ -1,388 +1,1505 @@
-/*
-
- * The Ultimate CLI File Searcher.
- * "Simplicity is the ultimate sophistication."
- */
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <ctype.h>
-#include <time.h>
-
-// --- Platform Specifics ---
-#if defined(_WIN32) || defined(_WIN64)
-    #define OS_WINDOWS
-    #include <windows.h>
-    #include <conio.h>
-    #include <shellapi.h>
-    #define PATH_SEP '\\'
-#else
-    #define OS_POSIX
-    #include <dirent.h>
-    #include <sys/types.h>
-    #include <sys/stat.h>
-    #include <unistd.h>
-    #include <termios.h>
-    #define PATH_SEP '/'
-    #ifndef STDIN_FILENO
-        #define STDIN_FILENO 0
-    #endif
-#endif
-
-// --- Configuration ---
-#define HASH_TABLE_SIZE 16384
-#define MAX_PATH_LEN 1024
-#define VIEWPORT_HEIGHT 12
-#define MAX_RESULTS 50
-
-// --- ANSI Colors ---
-#define COLOR_RESET "\033[0m"
-#define COLOR_BOLD "\033[1m"
-#define COLOR_DIM "\033[2m"
-#define COLOR_CYAN "\033[36m"
-#define COLOR_WHITE "\033[37m"
-#define COLOR_YELLOW "\033[33m"
-
-// --- Data Structures ---
-typedef struct FileEntry {
-    char *filename;
-    char *fullpath;
-    struct FileEntry *next;
-} FileEntry;
-
-FileEntry *hashTable[HASH_TABLE_SIZE];
-long totalFiles = 0;
-
-// --- System Utilities ---
-
-void enable_ansi() {
-    #ifdef OS_WINDOWS
-    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
-    DWORD dwMode = 0;
-    GetConsoleMode(hOut, &dwMode);
-    dwMode |= ENABLE_VIRTUAL_TERMINAL_PROCESSING;
-    SetConsoleMode(hOut, dwMode);
-    #endif
-}
-
-// Case-insensitive substring search
-char *stristr(const char *haystack, const char *needle) {
-    if (!*needle) return (char *)haystack;
-    for (; *haystack; haystack++) {
-        if (tolower((unsigned char)*haystack) == tolower((unsigned char)*needle)) {
-            const char *h = haystack, *n = needle;
-            while (*h && *n && tolower((unsigned char)*h) == tolower((unsigned char)*n)) {
-                h++;
-                n++;
-            }
-            if (!*n) return (char *)haystack;
-        }
-    }
-    return NULL;
-}
-
-unsigned long hash(const char *str) {
-    unsigned long hash = 5381;
-    int c;
-    while ((c = *str++))
-        hash = ((hash << 5) + hash) + tolower(c);
-    return hash % HASH_TABLE_SIZE;
-}
-
-// --- Indexing Engine ---
-
-void addFile(const char *name, const char *path) {
-    unsigned long index = hash(name);
-    FileEntry *newEntry = (FileEntry *)malloc(sizeof(FileEntry));
-    if (!newEntry) return;
-
-    newEntry->filename = strdup(name);
-    newEntry->fullpath = strdup(path);
-    newEntry->next = hashTable[index];
-    hashTable[index] = newEntry;
-    totalFiles++;
-}
-
-void clearIndex() {
-    for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-        FileEntry *entry = hashTable[i];
-        while (entry) {
-            FileEntry *temp = entry;
-            entry = entry->next;
-            free(temp->filename);
-            free(temp->fullpath);
-            free(temp);
-        }
-        hashTable[i] = NULL;
-    }
-    totalFiles = 0;
-}
-
-#ifdef OS_WINDOWS
-void traverseDirectory(const char *basePath) {
-    char searchPath[MAX_PATH_LEN];
-    snprintf(searchPath, sizeof(searchPath), "%s\\*", basePath);
-    WIN32_FIND_DATA findData;
-    HANDLE hFind = FindFirstFile(searchPath, &findData);
-    if (hFind == INVALID_HANDLE_VALUE) return;
-    do {
-        if (strcmp(findData.cFileName, ".") == 0 || strcmp(findData.cFileName, "..") == 0) continue;
-        char fullPath[MAX_PATH_LEN];
-        snprintf(fullPath, sizeof(fullPath), "%s\\%s", basePath, findData.cFileName);
-        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-            traverseDirectory(fullPath);
-        } else {
-            addFile(findData.cFileName, fullPath);
-        }
-    } while (FindNextFile(hFind, &findData) != 0);
-    FindClose(hFind);
-}
-#endif
-
-#ifdef OS_POSIX
-void traverseDirectory(const char *basePath) {
-    DIR *dir = opendir(basePath);
-    if (!dir) return;
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
-        char fullPath[MAX_PATH_LEN];
-        snprintf(fullPath, sizeof(fullPath), "%s/%s", basePath, entry->d_name);
-        struct stat statbuf;
-        if (stat(fullPath, &statbuf) == -1) continue;
-        if (S_ISDIR(statbuf.st_mode)) {
-            traverseDirectory(fullPath);
-        } else {
-            addFile(entry->d_name, fullPath);
-        }
-    }
-    closedir(dir);
-}
-#endif
-
-void buildIndex(const char *root) {
-    printf(COLOR_CYAN "  Index > " COLOR_RESET "Scanning %s ...\n", root);
-    traverseDirectory(root);
-}
-
-// --- Interaction Logic ---
-
-void openFile(const char *path) {
-    #ifdef OS_WINDOWS
-        ShellExecute(NULL, "open", path, NULL, NULL, SW_SHOWNORMAL);
-    #elif defined(__APPLE__)
-        char command[MAX_PATH_LEN + 10];
-        snprintf(command, sizeof(command), "open \"%s\"", path);
-        system(command);
-    #else
-        char command[MAX_PATH_LEN + 15];
-        snprintf(command, sizeof(command), "xdg-open \"%s\"", path);
-        system(command);
-    #endif
-}
-
-int get_char_raw() {
-    #ifdef OS_WINDOWS
-        return _getch();
-    #else
-        struct termios oldt, newt;
-        int ch;
-        tcgetattr(STDIN_FILENO, &oldt);
-        newt = oldt;
-        newt.c_lflag &= ~(ICANON | ECHO);
-        tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-        ch = getchar();
-        tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-        return ch;
-    #endif
-}
-
-
-void shorten_path(const char *in, char *out, int max_len) {
-    int len = strlen(in);
-    if (len < max_len) {
-        strcpy(out, in);
-    } else {
-        snprintf(out, max_len, "...%s", in + (len - (max_len - 4)));
-    }
-}
-
-void render_ui(const char *query, FileEntry **matches, int count, double searchTime) {
-    // Save Cursor
-    printf("\0337"); 
-
-    // Render matches in viewport
-    for (int i = 0; i < VIEWPORT_HEIGHT; i++) {
-        printf("\033[B");   // Move down
-        printf("\033[2K");  // Clear line
-        printf("\r");       // Return to start
-
-        if (i < count && i < VIEWPORT_HEIGHT) {
-            char shortPath[60];
-            shorten_path(matches[i]->fullpath, shortPath, 55);
-
-            // [ID] Filename (Bold) ... Path (Dimmed)
-            printf("  " COLOR_CYAN "[%2d]" COLOR_RESET "  " COLOR_BOLD "%-35s" COLOR_RESET "  " COLOR_DIM "%s" COLOR_RESET, 
-                   i + 1, 
-                   // Truncate filename visual if too long
-                   (strlen(matches[i]->filename) > 35) ? "..." : matches[i]->filename,
-                   shortPath);
-        } else if (i == 0 && strlen(query) > 0 && count == 0) {
-            printf(COLOR_YELLOW "       No matches found." COLOR_RESET);
-        }
-    }
-
-    // Status Bar (below viewport)
-    printf("\033[B\033[2K\r");
-    printf(COLOR_DIM "  ______________________________________________________" COLOR_RESET);
-    printf("\033[B\033[2K\r");
-    if (strlen(query) > 0)
-        printf(COLOR_DIM "  Found %d matches in %.4fs" COLOR_RESET, count, searchTime);
-    else 
-        printf(COLOR_DIM "  %ld files indexed. Ready." COLOR_RESET, totalFiles);
-
-    // Restore Cursor to search bar
-    printf("\0338"); 
-}
-
-void app_loop() {
-    char query[256] = {0};
-    int pos = 0;
-    int ch;
-    
-    #ifdef OS_WINDOWS
-        system("cls");
-    #else
-        system("clear");
-    #endif
-
-    printf("\n" COLOR_BOLD COLOR_WHITE "  SPOTLIGHT SEARCH" COLOR_RESET "\n");
-    printf(COLOR_DIM "  Type to search. Enter to open. ESC to quit." COLOR_RESET "\n\n");
-    
-    // Prepare blank lines for the UI to sit in
-    for(int i = 0; i < VIEWPORT_HEIGHT + 4; i++) printf("\n");
-    // Move cursor back up to input position
-    printf("\033[%dA", VIEWPORT_HEIGHT + 4);
-
-    while (1) {
-        // Render Search Bar
-        printf("\r\033[2K  " COLOR_CYAN "> " COLOR_RESET COLOR_BOLD "%s" COLOR_RESET, query);
-        fflush(stdout);
-
-        // Search Logic
-        FileEntry *matches[MAX_RESULTS];
-        int count = 0;
-        clock_t start = clock();
-
-        if (strlen(query) > 0) {
-            for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-                FileEntry *entry = hashTable[i];
-                while (entry) {
-                    if (stristr(entry->filename, query)) {
-                        matches[count++] = entry;
-                        if (count >= VIEWPORT_HEIGHT) goto search_finished;
-                    }
-                    entry = entry->next;
-                }
-            }
-        }
-        search_finished:;
-        
-        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
-
-        // Render Viewport
-        render_ui(query, matches, count, elapsed);
-        fflush(stdout);
-
-        // Input
-        ch = get_char_raw();
-
-        // Handle Escape
-        if (ch == 27) break;
-
-        // Handle Enter
-        else if (ch == '\r' || ch == '\n') {
-            if (count > 0) {
-                // Freeze UI and ask for selection
-                printf("\033[%dB", VIEWPORT_HEIGHT + 3); // Move to bottom
-                printf("\n  " COLOR_CYAN "Open file ID (1-%d): " COLOR_RESET, count);
-                
-                // Switch to buffered input
-                #ifdef OS_POSIX
-                    struct termios oldt, newt;
-                    tcgetattr(STDIN_FILENO, &oldt);
-                    newt = oldt;
-                    newt.c_lflag |= (ICANON | ECHO);
-                    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-                #endif
-
-                char numBuf[16];
-                if (fgets(numBuf, sizeof(numBuf), stdin)) {
-                    int choice = atoi(numBuf);
-                    if (choice > 0 && choice <= count) {
-                        openFile(matches[choice-1]->fullpath);
-                    }
-                }
-
-                #ifdef OS_POSIX
-                    tcgetattr(STDIN_FILENO, &oldt);
-                    newt = oldt;
-                    newt.c_lflag &= ~(ICANON | ECHO);
-                    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-                #endif
-
-                // Reset UI
-                memset(query, 0, sizeof(query));
-                pos = 0;
-                
-                // Clear the input line we just made
-                printf("\033[A\033[2K");
-                // Move back to search bar
-                printf("\033[%dA", VIEWPORT_HEIGHT + 3);
-            }
-        }
-        // Handle Backspace
-        else if (ch == 127 || ch == 8) {
-            if (pos > 0) {
-                query[--pos] = '\0';
-            }
-        }
-        // Handle Typing
-        else if (isprint(ch) && pos < sizeof(query) - 1) {
-            query[pos++] = (char)ch;
-            query[pos] = '\0';
-        }
-    }
-}
-
-// --- Main ---
-
-int main(int argc, char *argv[]) {
-    enable_ansi();
-    char rootPath[MAX_PATH_LEN];
-
-    if (argc > 1) {
-        strncpy(rootPath, argv[1], MAX_PATH_LEN - 1);
-    } else {
-        #ifdef OS_WINDOWS
-            GetCurrentDirectory(MAX_PATH_LEN, rootPath);
-        #else
-            if (getcwd(rootPath, MAX_PATH_LEN) == NULL) return 1;
-        #endif
-    }
-
-    memset(hashTable, 0, sizeof(hashTable));
-    buildIndex(rootPath);
-    app_loop();
-    clearIndex();
-    
-    // Clear screen on exit 
-    #ifdef OS_WINDOWS
-        system("cls");
-    #else
-        system("clear");
-    #endif
-    return 0;
-}
-
+/*
+
+ * The Ultimate CLI File Searcher.
+ * "Simplicity is the ultimate sophistication."
+ *
+ * Build: cc -O2 indexer.c index.c content.c sched.c symbols.c -o indexer -lpthread -lm
+ * Add -DHAVE_ZLIB ... -lz and -DHAVE_ZSTD ... -lzstd to search inside
+ * compressed files.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE     // struct ucred, for --serve
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "index.h"
+
+// --- Platform Specifics ---
+#if defined(_WIN32) || defined(_WIN64)
+    #define OS_WINDOWS
+    #include <windows.h>
+    #include <conio.h>
+    #include <shellapi.h>
+    #define PATH_SEP '\\'
+#else
+    #define OS_POSIX
+    #include <dirent.h>
+    #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #include <termios.h>
+    #include <signal.h>
+    #include <pwd.h>
+    #include <grp.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <sys/time.h>
+    #include <poll.h>
+    #define PATH_SEP '/'
+    #ifndef STDIN_FILENO
+        #define STDIN_FILENO 0
+    #endif
+#endif
+
+// --- Configuration ---
+#define MAX_PATH_LEN INDEX_MAX_PATH
+#define VIEWPORT_HEIGHT 12
+#define MAX_RESULTS 50
+#define COUNT_FIRST_STEP 0.005      // seconds of sampling before the first estimate
+#define COUNT_STEP 0.05             // seconds per refinement step while idle
+#define COUNT_REDRAW_STEPS 4        // refinement steps between status line redraws
+#define RANK_ALL_MAX 20000          // estimated matches up to which every match is ranked
+#define RANK_CANDIDATES 20000       // matches ranked when there are more
+#define SERVE_MAX_RESULTS 1000      // paths sent back per --serve query
+#define SERVE_READ_TIMEOUT 2        // seconds a --serve client has to send its query
+#define MAX_HOSTED 256              // --host indexes one server can register
+#define HOST_MEASURE_INTERVAL 60    // seconds a loaded index's memory figure is trusted
+
+// --- ANSI Colors ---
+#define COLOR_RESET "\033[0m"
+#define COLOR_BOLD "\033[1m"
+#define COLOR_DIM "\033[2m"
+#define COLOR_CYAN "\033[36m"
+#define COLOR_WHITE "\033[37m"
+#define COLOR_YELLOW "\033[33m"
+
+// --- State ---
+Index *searchIndex = NULL;
+IndexContent *contentIndex = NULL;  // --content, NULL to grep without one
+IndexSymbols *symbolIndex = NULL;   // --symbols, opened in memory by the first :sym
+char statusMessage[256] = {0};
+long alertsSeen = 0;        // standing query hits already announced in the status line
+enum { VIEW_NAME, VIEW_RECENT, VIEW_LARGEST, VIEW_SIMILAR };
+int viewMode = VIEW_NAME;   // Tab cycles through the views
+long long historyTime = 0;  // searching as of this time (:at), 0 for now
+const char *policyNames[] = {"default", "lock", "touch", "cold", "pageout"};  // RESIDENCY_*
+const char *taskNames[] = {"query", "ui", "update", "build", "crawl"};          // TASK_*
+const char *kindNames[] = {"function", "method", "type", "macro"};              // SYMBOL_*
+
+// --- System Utilities ---
+
+void enable_ansi() {
+    #ifdef OS_WINDOWS
+    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD dwMode = 0;
+    GetConsoleMode(hOut, &dwMode);
+    dwMode |= ENABLE_VIRTUAL_TERMINAL_PROCESSING;
+    SetConsoleMode(hOut, dwMode);
+    #endif
+}
+
+// --- Interaction Logic ---
+
+void openFile(const char *path) {
+    #ifdef OS_WINDOWS
+        ShellExecute(NULL, "open", path, NULL, NULL, SW_SHOWNORMAL);
+    #elif defined(__APPLE__)
+        char command[MAX_PATH_LEN + 10];
+        snprintf(command, sizeof(command), "open \"%s\"", path);
+        system(command);
+    #else
+        char command[MAX_PATH_LEN + 15];
+        snprintf(command, sizeof(command), "xdg-open \"%s\"", path);
+        system(command);
+    #endif
+}
+
+int get_char_raw() {
+    #ifdef OS_WINDOWS
+        return _getch();
+    #else
+        struct termios oldt, newt;
+        int ch;
+        tcgetattr(STDIN_FILENO, &oldt);
+        newt = oldt;
+        newt.c_lflag &= ~(ICANON | ECHO);
+        tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+        ch = getchar();
+        tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+        return ch;
+    #endif
+}
+
+// Nonzero when a key is waiting to be read. Call with echo and line
+// buffering off, or typed keys are not seen until Enter.
+int key_waiting() {
+    #ifdef OS_WINDOWS
+        return _kbhit();
+    #else
+        struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        return poll(&pfd, 1, 0) > 0;
+    #endif
+}
+
+
+void shorten_path(const char *in, char *out, int max_len) {
+    int len = strlen(in);
+    if (len < max_len) {
+        strcpy(out, in);
+    } else {
+        snprintf(out, max_len, "...%s", in + (len - (max_len - 4)));
+    }
+}
+
+void format_size(long long bytes, char *out, size_t len) {
+    const char *units = "BKMGTP";
+    double value = (double)bytes;
+    int u = 0;
+    while (value >= 1024 && units[u + 1]) {
+        value /= 1024;
+        u++;
+    }
+    if (u == 0) snprintf(out, len, "%lldB", bytes);
+    else snprintf(out, len, "%.1f%c", value, units[u]);
+}
+
+// "950", "12.4k", "1.3M"
+void format_count(long count, char *out, size_t len) {
+    const char *units = " kMGT";
+    double value = (double)count;
+    int u = 0;
+    while (value >= 1000 && units[u + 1]) {
+        value /= 1000;
+        u++;
+    }
+    if (u == 0) snprintf(out, len, "%ld", count);
+    else snprintf(out, len, "%.1f%c", value, units[u]);
+}
+
+void format_date(long long seconds, char *out, size_t len) {
+    time_t t = (time_t)seconds;
+    struct tm *tm = localtime(&t);
+    if (!tm || !strftime(out, len, "%Y-%m-%d", tm)) snprintf(out, len, "-");
+}
+
+// "40s", "12m", "3h" or "9d" since mtime.
+void format_age(long long mtime, char *out, size_t len) {
+    long long age = (long long)time(NULL) - mtime;
+    if (age < 0) age = 0;
+    if (age < 60) snprintf(out, len, "%llds", age);
+    else if (age < 3600) snprintf(out, len, "%lldm", age / 60);
+    else if (age < 86400) snprintf(out, len, "%lldh", age / 3600);
+    else snprintf(out, len, "%lldd", age / 86400);
+}
+
+// order is the ORDER_* the matches came in, or -1 for a name search; ordered
+// results show their age or size in front of the path, similar names
+// (similarity not NULL) how alike they are. total is the number of matches
+// a name search ranked, or -1 when only the shown ones are known. estimate
+// is the total match count when only a sample was ranked, or NULL.
+void render_ui(const char *query, IndexMatch *matches, int count, double searchTime, int order,
+               long total, const float *similarity, const IndexEstimate *estimate) {
+    // Save Cursor
+    printf("\0337"); 
+
+    // Render matches in viewport
+    for (int i = 0; i < VIEWPORT_HEIGHT; i++) {
+        printf("\033[B");   // Move down
+        printf("\033[2K");  // Clear line
+        printf("\r");       // Return to start
+
+        if (i < count && i < VIEWPORT_HEIGHT) {
+            char shortPath[60], detail[16] = "";
+            shorten_path(matches[i].fullpath, shortPath, order < 0 && !similarity ? 55 : 47);
+            if (order == ORDER_RECENT) format_age(matches[i].mtime, detail, sizeof(detail));
+            else if (order == ORDER_LARGEST) format_size(matches[i].size, detail, sizeof(detail));
+            else if (similarity) snprintf(detail, sizeof(detail), "%d%%", (int)(100 * similarity[i] + 0.5f));
+
+            // [ID] Filename (Bold) ... [age or size] Path (Dimmed)
+            printf("  " COLOR_CYAN "[%2d]" COLOR_RESET "  " COLOR_BOLD "%-35s" COLOR_RESET "  ", 
+                   i + 1, 
+                   // Truncate filename visual if too long
+                   (strlen(matches[i].filename) > 35) ? "..." : matches[i].filename);
+            if (order >= 0 || similarity) printf(COLOR_YELLOW "%7s " COLOR_RESET, detail);
+            printf(COLOR_DIM "%s" COLOR_RESET, shortPath);
+        } else if (i == 0 && strlen(query) > 0 && count == 0) {
+            printf(COLOR_YELLOW "       No matches found." COLOR_RESET);
+        }
+    }
+
+    // Status Bar (below viewport)
+    printf("\033[B\033[2K\r");
+    printf(COLOR_DIM "  ______________________________________________________" COLOR_RESET);
+    printf("\033[B\033[2K\r");
+    if (statusMessage[0])
+        printf(COLOR_DIM "  %s" COLOR_RESET, statusMessage);
+    else if (historyTime) {
+        char when[32];
+        time_t t = (time_t)historyTime;
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime(&t));
+        printf(COLOR_DIM "  As of %s: %d matches in %.4fs. :at now to return" COLOR_RESET, when, count, searchTime);
+    }
+    else if (viewMode == VIEW_RECENT)
+        printf(COLOR_DIM "  Recently modified, %d shown in %.4fs. Tab: largest" COLOR_RESET, count, searchTime);
+    else if (viewMode == VIEW_LARGEST)
+        printf(COLOR_DIM "  Largest files, %d shown in %.4fs. Tab: similar names" COLOR_RESET, count, searchTime);
+    else if (similarity)
+        printf(COLOR_DIM "  Names like this, %d shown in %.4fs. Tab: by name" COLOR_RESET, count, searchTime);
+    else if (estimate && !estimate->exact) {
+        char matchCount[16], margin[24], ranked[16];
+        format_count(estimate->count, matchCount, sizeof(matchCount));
+        format_count(total, ranked, sizeof(ranked));
+        if (estimate->margin < estimate->count) {
+            snprintf(margin, sizeof(margin), "%.*f%%", estimate->margin * 100 < estimate->count ? 1 : 0,
+                     100.0 * estimate->margin / estimate->count);
+        } else {
+            format_count(estimate->margin, margin, sizeof(margin));
+        }
+        printf(COLOR_DIM "  ~%s matches (+/-%s), %d%% sampled; best of %s in %.4fs" COLOR_RESET,
+               matchCount, margin, (int)(estimate->sampled * 100), ranked, searchTime);
+    }
+    else if (estimate)
+        printf(COLOR_DIM "  Found %ld matches; best of %ld in %.4fs" COLOR_RESET, estimate->count, total, searchTime);
+    else if (total >= 0 && strlen(query) > 0 && query[0] != ':')
+        printf(COLOR_DIM "  Found %ld matches in %.4fs, best first" COLOR_RESET, total, searchTime);
+    else if (strlen(query) > 0 && query[0] != ':')
+        printf(COLOR_DIM "  Found %d matches in %.4fs" COLOR_RESET, count, searchTime);
+    else if (indexRootCount(searchIndex) > 1)
+        printf(COLOR_DIM "  %ld files indexed across %d roots. Ready." COLOR_RESET,
+               indexFileCount(searchIndex), indexRootCount(searchIndex));
+    else 
+        printf(COLOR_DIM "  %ld files indexed. Ready." COLOR_RESET, indexFileCount(searchIndex));
+
+    // Restore Cursor to search bar
+    printf("\0338"); 
+}
+
+// --- Analytics ---
+
+static const char *groupNames[] = {"ext", "owner", "top", "shard", "root"};
+
+// Returns a GROUP_BY_* value, or -1.
+int parse_group(const char *name) {
+    for (int i = 0; i < (int)(sizeof(groupNames) / sizeof(groupNames[0])); i++) {
+        if (strcmp(name, groupNames[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// "90" or "90s", "15m", "12h", "30d", "2w", "1y" -> seconds.
+long long parse_age(const char *text) {
+    char *end;
+    double value = strtod(text, &end);
+    switch (tolower((unsigned char)*end)) {
+        case 'm': value *= 60; break;
+        case 'h': value *= 3600; break;
+        case 'd': value *= 86400; break;
+        case 'w': value *= 7 * 86400; break;
+        case 'y': value *= 365 * 86400; break;
+    }
+    return (long long)value;
+}
+
+// "2026-10-01", "2026-10-01 14:30" or an age like "3d" -> seconds since
+// the epoch.
+long long parse_when(const char *text) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(text, "%d-%d-%d %d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min) >= 3) {
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        tm.tm_isdst = -1;
+        return (long long)mktime(&tm);
+    }
+    return (long long)time(NULL) - parse_age(text);
+}
+
+// "512", "64K", "10M", "2G", "1T" -> bytes.
+long long parse_size(const char *text) {
+    char *end;
+    double value = strtod(text, &end);
+    switch (toupper((unsigned char)*end)) {
+        case 'T': value *= 1024; // fall through
+        case 'G': value *= 1024; // fall through
+        case 'M': value *= 1024; // fall through
+        case 'K': value *= 1024; break;
+    }
+    return (long long)value;
+}
+
+// Prints the files named most like name, most similar first.
+int print_similar(const char *name) {
+    IndexMatch matches[MAX_RESULTS];
+    float similarity[MAX_RESULTS];
+    int count = indexQuerySimilar(searchIndex, name, matches, similarity, MAX_RESULTS);
+    for (int i = 0; i < count; i++) printf("%3d%%  %s\n", (int)(100 * similarity[i] + 0.5f), matches[i].fullpath);
+    return count;
+}
+
+// Prints a group-by table to stdout.
+void print_groups(int by, const IndexGroupFilter *filter) {
+    IndexGroup groups[MAX_RESULTS];
+    clock_t start = clock();
+    int found = indexGroupBy(searchIndex, by, filter, groups, MAX_RESULTS);
+    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (found < 0) {
+        fprintf(stderr, "  Group-by failed\n");
+        return;
+    }
+    printf(COLOR_BOLD "  %-40s %10s %10s  %-10s  %-10s" COLOR_RESET "\n", groupNames[by], "files", "size", "oldest", "newest");
+    for (int i = 0; i < found && i < MAX_RESULTS; i++) {
+        char key[48], size[16], oldest[16], newest[16];
+        shorten_path(groups[i].key[0] ? groups[i].key : "(none)", key, sizeof(key) - 7);
+        format_size(groups[i].size, size, sizeof(size));
+        format_date(groups[i].oldest, oldest, sizeof(oldest));
+        format_date(groups[i].newest, newest, sizeof(newest));
+        printf("  %-40s %10ld %10s  %-10s  %-10s\n", key, groups[i].count, size, oldest, newest);
+    }
+    printf(COLOR_DIM "  %d groups in %.3fs%s" COLOR_RESET "\n", found, elapsed,
+           found > MAX_RESULTS ? ", largest shown" : "");
+}
+
+// --- Content Search ---
+
+typedef struct GrepStatus {
+    long hits;
+    char first[MAX_PATH_LEN + 64];
+} GrepStatus;
+
+// Prints path:line:text, like grep -n over several files.
+int print_found(const char *paths, size_t len, void *user) {
+    (void)user;
+    return fwrite(paths, 1, len, stdout) != len;
+}
+
+int print_hit(const IndexGrepHit *hit, void *user) {
+    (void)user;
+    printf("%s:%ld:%s\n", hit->fullpath, hit->line, hit->text);
+    return 0;
+}
+
+// Keeps the first hit for the status line and stops after MAX_RESULTS.
+int note_hit(const IndexGrepHit *hit, void *user) {
+    GrepStatus *status = (GrepStatus *)user;
+    if (status->hits++ == 0) {
+        char path[64];
+        shorten_path(hit->fullpath, path, sizeof(path));
+        snprintf(status->first, sizeof(status->first), "%s:%ld: %.80s", path, hit->line, hit->text);
+    }
+    return status->hits >= MAX_RESULTS;
+}
+
+// Prints path:line: kind name for the best definitions matching query.
+long print_symbols(const char *query) {
+    IndexSymbol found[MAX_RESULTS];
+    long total = indexSymbolQuery(symbolIndex, query, found, MAX_RESULTS);
+    for (long i = 0; i < total && i < MAX_RESULTS; i++)
+        printf("%s:%ld: %s %s\n", found[i].fullpath, found[i].line, kindNames[found[i].kind], found[i].name);
+    return total;
+}
+
+// --- Hosted Indexes ---
+// --host NAME=FILE registers a saved index with the server, so one process
+// can serve every project, volume and home directory on a host. Each is
+// loaded on its first query and stays loaded while it is used; when the
+// loaded ones together outgrow --host-budget, the least recently queried
+// are unloaded, saved first if they refresh. A refresh spec after the file
+// (:watch, :poll=SECS or :manual) is applied to its roots on every load;
+// without one the policies saved with the index hold.
+
+typedef struct Hosted {
+    char name[64];
+    char path[MAX_PATH_LEN];
+    char refresh[32];       // ":poll=60" and the like, empty to keep the saved policies
+    Index *index;           // NULL while unloaded
+    long long bytes;        // memory while loaded
+    time_t measured;        // when bytes was taken
+    long lastUsed;          // hostClock at the last query
+    long queries;
+    long loads;
+    long unloads;
+    double loadSeconds;     // CPU time of the last load
+} Hosted;
+
+Hosted hosted[MAX_HOSTED];
+int hostedCount = 0;
+long hostClock = 0;
+long long hostBudget = 0;   // --host-budget, 0 for no limit
+
+// Registers NAME=FILE[:refresh]. Returns 0, or -1.
+int add_hosted(const char *spec) {
+    const char *eq = strchr(spec, '=');
+    if (!eq || eq == spec || eq - spec >= (int)sizeof(hosted[0].name) || hostedCount == MAX_HOSTED) return -1;
+    Hosted *h = &hosted[hostedCount];
+    memset(h, 0, sizeof(*h));
+    snprintf(h->name, sizeof(h->name), "%.*s", (int)(eq - spec), spec);
+    if (strchr(h->name, ' ')) return -1;
+    for (int i = 0; i < hostedCount; i++) {
+        if (strcmp(hosted[i].name, h->name) == 0) return -1;
+    }
+    snprintf(h->path, sizeof(h->path), "%s", eq + 1);
+    char *colon = strrchr(h->path, ':');
+    if (colon && (strcmp(colon, ":watch") == 0 || strcmp(colon, ":manual") == 0 || strncmp(colon, ":poll=", 6) == 0)) {
+        snprintf(h->refresh, sizeof(h->refresh), "%s", colon);
+        *colon = '\0';
+    }
+    hostedCount++;
+    return 0;
+}
+
+void measure_hosted(Hosted *h) {
+    h->bytes = indexMemoryBytes(h->index);
+    h->measured = time(NULL);
+}
+
+// Frees a loaded index. One that refreshes is saved first, through a
+// rename, so what its refreshes learned is not crawled again next load.
+void unload_hosted(Hosted *h) {
+    if (!h->index) return;
+    indexStopUpdater(h->index);
+    int refreshes = 0;
+    for (int s = 0; s < indexShardCount(h->index); s++) {
+        IndexShardInfo info;
+        if (indexShardInfo(h->index, s, &info) == 0 && info.policy != REFRESH_MANUAL) refreshes = 1;
+    }
+    if (refreshes) {
+        char tmp[MAX_PATH_LEN + 8];
+        snprintf(tmp, sizeof(tmp), "%s.tmp", h->path);
+        if (indexSave(h->index, tmp) < 0 || rename(tmp, h->path) != 0) {
+            fprintf(stderr, "  Could not save %s to %s\n", h->name, h->path);
+            remove(tmp);
+        }
+    }
+    indexFree(h->index);
+    h->index = NULL;
+    h->bytes = 0;
+    h->unloads++;
+}
+
+// Unloads the least recently queried indexes other than keep until the
+// loaded ones fit the budget.
+void trim_hosted(const Hosted *keep) {
+    if (!hostBudget) return;
+    for (;;) {
+        long long total = 0;
+        Hosted *coldest = NULL;
+        time_t now = time(NULL);
+        for (int i = 0; i < hostedCount; i++) {
+            Hosted *h = &hosted[i];
+            if (!h->index) continue;
+            // Refreshes move the figure slowly; measuring walks the index.
+            if (now - h->measured >= HOST_MEASURE_INTERVAL) measure_hosted(h);
+            total += h->bytes;
+            if (h != keep && (!coldest || h->lastUsed < coldest->lastUsed)) coldest = h;
+        }
+        if (total <= hostBudget || !coldest) return;
+        unload_hosted(coldest);
+    }
+}
+
+// Returns the hosted index, loading it if need be, or NULL when its file
+// cannot be read.
+Index *use_hosted(Hosted *h) {
+    h->lastUsed = ++hostClock;
+    h->queries++;
+    if (!h->index) {
+        clock_t start = clock();
+        h->index = indexLoad(h->path);
+        if (!h->index) return NULL;
+        for (int r = 0; h->refresh[0] && r < indexRootCount(h->index); r++) {
+            IndexRootInfo info;
+            char spec[MAX_PATH_LEN + 32];
+            if (indexRootInfo(h->index, r, &info) < 0) continue;
+            snprintf(spec, sizeof(spec), "%s%s", info.path, h->refresh);
+            indexAddShard(h->index, spec);
+        }
+        indexStartUpdater(h->index);
+        h->loads++;
+        h->loadSeconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        measure_hosted(h);
+    }
+    trim_hosted(h);
+    return h->index;
+}
+
+// Resolves a query line. "@NAME text" goes to the hosted index NAME, any
+// other line to the served index. Points text at the query proper; returns
+// NULL for an unknown or unreadable index.
+Index *route_query(const char *line, const char **text) {
+    *text = line;
+    if (line[0] != '@') return searchIndex;
+    size_t len = strcspn(line + 1, " ");
+    *text = line + 1 + len + (line[1 + len] == ' ');
+    for (int i = 0; i < hostedCount; i++) {
+        if (strlen(hosted[i].name) == len && strncmp(hosted[i].name, line + 1, len) == 0) return use_hosted(&hosted[i]);
+    }
+    return NULL;
+}
+
+// Answers a lone "@": one line per hosted index with whether it is
+// loaded, its files and memory, queries, loads, unloads, the last load's
+// time and its refresh spec.
+void print_hosted(FILE *out) {
+    for (int i = 0; i < hostedCount; i++) {
+        const Hosted *h = &hosted[i];
+        char size[16];
+        format_size(h->bytes, size, sizeof(size));
+        fprintf(out, "%s\t%s\t%ld\t%s\t%ld\t%ld\t%ld\t%.2fs\t%s\n", h->name, h->index ? "loaded" : "unloaded",
+                h->index ? indexFileCount(h->index) : 0, size, h->queries, h->loads, h->unloads,
+                h->loadSeconds, h->refresh[0] ? h->refresh + 1 : "saved");
+    }
+}
+
+// --- Index Server ---
+// --serve shares one index between the users of a machine over a Unix
+// socket. A client sends a query line and gets back the paths it may see,
+// one per line; who is asking comes from the kernel, not the client. A
+// line "@NAME query" asks the hosted index NAME instead, and "@" alone
+// lists the hosted indexes.
+
+#ifdef OS_POSIX
+volatile sig_atomic_t stopServing = 0;
+
+void stop_serving(int sig) {
+    (void)sig;
+    stopServing = 1;
+}
+
+// Fills who from the credentials of the process at the other end of fd.
+// Returns 0, or -1 when the kernel cannot say.
+int peer_viewer(int fd, IndexViewer *who) {
+    memset(who, 0, sizeof(*who));
+    #ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) return -1;
+    who->uid = cred.uid;
+    who->gid = cred.gid;
+    #else
+    uid_t uid;
+    gid_t gid;
+    if (getpeereid(fd, &uid, &gid) != 0) return -1;
+    who->uid = uid;
+    who->gid = gid;
+    #endif
+    #ifdef SO_PEERGROUPS
+    // The groups the peer actually holds, where the kernel reports them.
+    gid_t peerGroups[INDEX_MAX_GROUPS];
+    socklen_t groupLen = sizeof(peerGroups);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERGROUPS, peerGroups, &groupLen) == 0) {
+        who->groupCount = (int)(groupLen / sizeof(gid_t));
+        for (int i = 0; i < who->groupCount; i++) who->groups[i] = peerGroups[i];
+        return 0;
+    }
+    #endif
+    struct passwd pw, *found = NULL;
+    char buf[1024];
+    if (getpwuid_r(who->uid, &pw, buf, sizeof(buf), &found) == 0 && found) {
+        gid_t groups[INDEX_MAX_GROUPS];
+        int count = INDEX_MAX_GROUPS;
+        getgrouplist(found->pw_name, who->gid, groups, &count);
+        if (count > INDEX_MAX_GROUPS) count = INDEX_MAX_GROUPS;
+        for (int i = 0; i < count; i++) who->groups[i] = groups[i];
+        who->groupCount = count;
+    }
+    return 0;
+}
+
+// Serves queries on socketPath until SIGINT or SIGTERM. Returns 0, or -1
+// when the socket cannot be set up.
+int serve(const char *socketPath) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, socketPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    // Anyone may ask; answers are filtered per user.
+    chmod(socketPath, 0666);
+    IndexMatch *matches = (IndexMatch *)malloc(SERVE_MAX_RESULTS * sizeof(IndexMatch));
+
+    // No SA_RESTART, so a signal breaks accept() and ends the loop.
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_serving;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    printf(COLOR_CYAN "  Serve > " COLOR_RESET "%ld files and %d hosted indexes on %s\n",
+           indexFileCount(searchIndex), hostedCount, socketPath);
+    fflush(stdout);
+
+    while (matches && !stopServing) {
+        int client = accept(fd, NULL, NULL);
+        if (client < 0) continue;
+        // Clients are answered one at a time, so one that never finishes
+        // its line would stall everyone behind it. It is dropped instead.
+        struct timeval timeout = {SERVE_READ_TIMEOUT, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        char query[256];
+        size_t len = 0;
+        ssize_t got = 0;
+        while (len < sizeof(query) - 1 && (got = read(client, query + len, sizeof(query) - 1 - len)) > 0) {
+            len += (size_t)got;
+            if (memchr(query, '\n', len)) break;
+        }
+        if (got < 0) {
+            indexNoteShed(searchIndex);
+            close(client);
+            continue;
+        }
+        query[len] = '\0';
+        query[strcspn(query, "\r\n")] = '\0';
+        IndexViewer who;
+        FILE *out = fdopen(client, "w");
+        if (!out) {
+            close(client);
+            continue;
+        }
+        const char *text;
+        Index *target;
+        if (peer_viewer(client, &who) < 0) {
+            indexNoteShed(searchIndex);
+        } else if (strcmp(query, "@") == 0) {
+            print_hosted(out);
+        } else if ((target = route_query(query, &text)) != NULL) {
+            int count = indexQueryBufAs(target, &who, text, matches, SERVE_MAX_RESULTS);
+            for (int i = 0; i < count; i++) fprintf(out, "%s\n", matches[i].fullpath);
+        }
+        fclose(out);
+    }
+    for (int i = 0; i < hostedCount; i++) unload_hosted(&hosted[i]);
+    free(matches);
+    close(fd);
+    unlink(socketPath);
+    return 0;
+}
+#endif
+
+// --- Alerts ---
+// Standing queries (--alert, :alert) report files that start to match.
+// --alert-out appends "time<TAB>pattern<TAB>path" lines to a file for each,
+// or sends them to the Unix socket when the path is one.
+
+const char *alertPath = NULL;
+FILE *alertFile = NULL;
+#ifdef OS_POSIX
+int alertSocket = -1;
+
+// Connects to a listener on socketPath, stream or datagram. Returns the
+// socket, or -1.
+int connect_alert_socket(const char *socketPath) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, socketPath);
+    int types[2] = {SOCK_STREAM, SOCK_DGRAM};
+    for (int t = 0; t < 2; t++) {
+        int fd = socket(AF_UNIX, types[t], 0);
+        if (fd < 0) continue;
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) return fd;
+        close(fd);
+    }
+    return -1;
+}
+#endif
+
+// Runs on the updater thread for every hit.
+void deliver_alert(const IndexStandingHit *hit, void *user) {
+    (void)user;
+    char line[MAX_PATH_LEN + 320];
+    int len = snprintf(line, sizeof(line), "%lld\t%s\t%s\n", (long long)hit->when, hit->pattern, hit->file.fullpath);
+    if (len >= (int)sizeof(line)) len = (int)sizeof(line) - 1;
+    #ifdef OS_POSIX
+    struct stat st;
+    if (stat(alertPath, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        // A listener that restarted gets a fresh connection; if there is
+        // none the line is dropped.
+        for (int attempt = 0; attempt < 2; attempt++) {
+            if (alertSocket < 0 && (alertSocket = connect_alert_socket(alertPath)) < 0) return;
+            if (send(alertSocket, line, (size_t)len, 0) == len) return;
+            close(alertSocket);
+            alertSocket = -1;
+        }
+        return;
+    }
+    #endif
+    if (!alertFile) alertFile = fopen(alertPath, "a");
+    if (!alertFile) return;
+    fputs(line, alertFile);
+    fflush(alertFile);
+}
+
+// Adds the patterns in path, one per line; blank lines and lines starting
+// with # are skipped. Returns how many were added, or -1.
+int load_alerts(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char line[256];
+    int added = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!line[0] || line[0] == '#') continue;
+        if (indexStandingAdd(searchIndex, line) >= 0) added++;
+    }
+    fclose(f);
+    return added;
+}
+
+// Commands are typed into the search bar with a leading ':' and run on Enter.
+//   :roots          list roots with their ids and file counts
+//   :refresh [id]   re-crawl one root, or every root when no id is given
+//   :shards         list shards with their refresh policy and file counts
+//   :refresh-shard id  rebuild a single shard
+//   :poller         directory poller activity
+//   :group key      largest groups by ext, owner, top, shard or root
+//   :at when        search as of a date ("2026-10-01 14:30") or age ("3d");
+//                   ":at now" returns to the live index
+//   :when path      when a path was present and when it went away
+//   :history        snapshot and span counts
+//   :grep text      search file contents (including .gz/.zst) for text
+//   :content        content index size and what the last update read
+//   :sym text       definitions whose name contains text, best first
+//   :alert pattern  report files that start to match pattern ("core.*")
+//   :unalert id     drop an alert
+//   :alerts         alert count, hits and the latest hit
+//   :mem [section policy]  memory per index section and how much is resident;
+//                   with arguments, sets a section's policy (default, lock,
+//                   touch, cold or pageout)
+//   :sched          CPU time, tasks run and tasks queued per scheduler class
+void run_command(const char *cmd) {
+    char name[32] = {0};
+    int arg = -1;
+    int fields = sscanf(cmd + 1, "%31s %d", name, &arg);
+    if (fields < 1) return;
+    int rootCount = indexRootCount(searchIndex);
+    int shardCount = indexShardCount(searchIndex);
+
+    if (strcmp(name, "roots") == 0) {
+        int len = 0;
+        for (int i = 0; i < rootCount && len < (int)sizeof(statusMessage); i++) {
+            IndexRootInfo info;
+            if (indexRootInfo(searchIndex, i, &info) < 0) continue;
+            len += snprintf(statusMessage + len, sizeof(statusMessage) - len, "%s[%d] %s (%ld)",
+                            i ? "  " : "", i + 1, info.path, info.fileCount);
+        }
+    } else if (strcmp(name, "shards") == 0) {
+        int len = 0;
+        for (int i = 0; i < shardCount && len < (int)sizeof(statusMessage); i++) {
+            IndexShardInfo info;
+            char policy[32];
+            if (indexShardInfo(searchIndex, i, &info) < 0) continue;
+            if (info.policy == REFRESH_POLL) snprintf(policy, sizeof(policy), "poll=%ds", info.interval);
+            else strcpy(policy, info.policy == REFRESH_WATCH ? "watch" : "manual");
+            len += snprintf(statusMessage + len, sizeof(statusMessage) - len, "%s[%d] %s %s (%ld, %.0fs ago)",
+                            i ? "  " : "", i + 1, info.path, policy, info.fileCount, info.age);
+        }
+    } else if (strcmp(name, "group") == 0) {
+        char key[32] = {0};
+        sscanf(cmd + 1, "%*s %31s", key);
+        int by = parse_group(key);
+        IndexGroup groups[3];
+        int found = by < 0 ? -1 : indexGroupBy(searchIndex, by, NULL, groups, 3);
+        if (found < 0) {
+            snprintf(statusMessage, sizeof(statusMessage), "Usage: :group ext|owner|top|shard|root");
+            return;
+        }
+        int len = snprintf(statusMessage, sizeof(statusMessage), "%d groups by %s:", found, key);
+        for (int i = 0; i < found && i < 3 && len < (int)sizeof(statusMessage); i++) {
+            char size[16];
+            format_size(groups[i].size, size, sizeof(size));
+            len += snprintf(statusMessage + len, sizeof(statusMessage) - len, "  %s %s (%ld)",
+                            groups[i].key[0] ? groups[i].key : "(none)", size, groups[i].count);
+        }
+    } else if (strcmp(name, "at") == 0) {
+        const char *when = cmd + 3;
+        while (*when == ' ') when++;
+        if (!*when || strcmp(when, "now") == 0) {
+            historyTime = 0;
+            return;
+        }
+        IndexHistoryStats stats;
+        if (indexHistoryStats(searchIndex, &stats) < 0) {
+            snprintf(statusMessage, sizeof(statusMessage), "No history; start with --history FILE");
+            return;
+        }
+        historyTime = parse_when(when);
+        if (historyTime < stats.oldest)
+            snprintf(statusMessage, sizeof(statusMessage), "History only goes back %lldd",
+                     ((long long)time(NULL) - stats.oldest) / 86400);
+    } else if (strcmp(name, "when") == 0) {
+        const char *path = cmd + 5;
+        while (*path == ' ') path++;
+        IndexSpan spans[4];
+        int n = indexHistory(searchIndex, path, spans, 4);
+        if (n <= 0) {
+            snprintf(statusMessage, sizeof(statusMessage), "No history for %s", path);
+            return;
+        }
+        int len = 0;
+        for (int i = 0; i < n && len < (int)sizeof(statusMessage); i++) {
+            char first[16], last[16], gone[16];
+            format_date(spans[i].first, first, sizeof(first));
+            format_date(spans[i].last, last, sizeof(last));
+            format_date(spans[i].goneBy, gone, sizeof(gone));
+            len += snprintf(statusMessage + len, sizeof(statusMessage) - len, "%s%s..%s%s%s", i ? "; " : "",
+                            first, spans[i].goneBy ? last : "now", spans[i].goneBy ? ", gone by " : "",
+                            spans[i].goneBy ? gone : "");
+        }
+    } else if (strcmp(name, "history") == 0) {
+        IndexHistoryStats stats;
+        char oldest[16];
+        if (indexHistoryStats(searchIndex, &stats) < 0) {
+            snprintf(statusMessage, sizeof(statusMessage), "No history; start with --history FILE");
+            return;
+        }
+        format_date(stats.oldest, oldest, sizeof(oldest));
+        snprintf(statusMessage, sizeof(statusMessage), "History: %ld snapshots since %s, %ld paths, %ld spans",
+                 stats.snapshots, oldest, stats.paths, stats.spans);
+    } else if (strcmp(name, "grep") == 0) {
+        const char *pattern = cmd + 5;
+        while (*pattern == ' ') pattern++;
+        if (!*pattern) {
+            snprintf(statusMessage, sizeof(statusMessage), "Usage: :grep text");
+            return;
+        }
+        GrepStatus status = {0, ""};
+        clock_t start = clock();
+        if (contentIndex) indexContentGrep(contentIndex, NULL, pattern, GREP_IGNORE_CASE, note_hit, &status);
+        else indexGrep(searchIndex, NULL, pattern, GREP_IGNORE_CASE, note_hit, &status);
+        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+        if (status.hits == 0)
+            snprintf(statusMessage, sizeof(statusMessage), "No file contains \"%s\" (%.2fs)", pattern, elapsed);
+        else
+            snprintf(statusMessage, sizeof(statusMessage), "%s%ld hits in %.2fs, first %s",
+                     status.hits >= MAX_RESULTS ? "At least " : "", status.hits, elapsed, status.first);
+    } else if (strcmp(name, "content") == 0) {
+        IndexContentStats stats;
+        char indexed[16], read[16];
+        if (!contentIndex) {
+            snprintf(statusMessage, sizeof(statusMessage), "No content index; start with --content FILE");
+            return;
+        }
+        indexContentStats(contentIndex, &stats);
+        format_size(stats.indexedBytes, indexed, sizeof(indexed));
+        format_size(stats.lastRead, read, sizeof(read));
+        snprintf(statusMessage, sizeof(statusMessage),
+                 "Content: %ld files, %s indexed, %ld trigrams; last update read %s (%ld appended, %ld in full)",
+                 stats.files, indexed, stats.grams, read, stats.lastAppended, stats.lastReindexed);
+    } else if (strcmp(name, "sym") == 0) {
+        const char *query = cmd + 4;
+        while (*query == ' ') query++;
+        if (!*query) {
+            snprintf(statusMessage, sizeof(statusMessage), "Usage: :sym text");
+            return;
+        }
+        if (!symbolIndex) symbolIndex = indexSymbolsOpen(searchIndex, NULL);
+        IndexSymbol best;
+        clock_t start = clock();
+        long total = symbolIndex ? indexSymbolQuery(symbolIndex, query, &best, 1) : -1;
+        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+        IndexSymbolStats stats;
+        if (total > 0) {
+            char path[48];
+            shorten_path(best.fullpath, path, sizeof(path));
+            indexSymbolStats(symbolIndex, &stats);
+            snprintf(statusMessage, sizeof(statusMessage), "%ld definitions in %.2fs (%ld files read), best %s %.40s at %s:%ld",
+                     total, elapsed, stats.lastScanned, kindNames[best.kind], best.name, path, best.line);
+        } else {
+            snprintf(statusMessage, sizeof(statusMessage), "No definition matches \"%s\"", query);
+        }
+    } else if (strcmp(name, "alert") == 0) {
+        const char *pattern = cmd + 6;
+        while (*pattern == ' ') pattern++;
+        int query = *pattern ? indexStandingAdd(searchIndex, pattern) : -1;
+        if (query < 0) {
+            snprintf(statusMessage, sizeof(statusMessage), "Usage: :alert pattern");
+            return;
+        }
+        indexStartUpdater(searchIndex);
+        snprintf(statusMessage, sizeof(statusMessage), "Alert %d: files matching \"%s\"", query + 1, pattern);
+    } else if (strcmp(name, "unalert") == 0) {
+        if (fields < 2 || indexStandingRemove(searchIndex, arg - 1) < 0)
+            snprintf(statusMessage, sizeof(statusMessage), "Usage: :unalert id");
+        else
+            snprintf(statusMessage, sizeof(statusMessage), "Alert %d dropped", arg);
+    } else if (strcmp(name, "alerts") == 0) {
+        IndexStandingStats stats;
+        IndexStandingHit latest;
+        indexStandingStats(searchIndex, &stats);
+        int len = snprintf(statusMessage, sizeof(statusMessage), "Alerts: %ld, %ld hits in %ld changed files",
+                           stats.queries, stats.hits, stats.checked);
+        if (stats.dropped) len += snprintf(statusMessage + len, sizeof(statusMessage) - len, " (%ld changes dropped)", stats.dropped);
+        if (indexStandingRecent(searchIndex, &latest, 1) == 1) {
+            char path[64];
+            shorten_path(latest.file.fullpath, path, sizeof(path));
+            snprintf(statusMessage + len, sizeof(statusMessage) - len, "; latest [%d] %s", latest.query + 1, path);
+        }
+    } else if (strcmp(name, "mem") == 0) {
+        char section[16] = {0}, policy[16] = {0};
+        if (sscanf(cmd + 1, "%*s %15s %15s", section, policy) == 2) {
+            int m, p;
+            IndexMemoryInfo info;
+            for (m = 0; m < MEM_SECTIONS; m++) {
+                if (indexMemoryInfo(searchIndex, m, &info) == 0 && strcmp(info.name, section) == 0) break;
+            }
+            for (p = 0; p <= RESIDENCY_PAGEOUT && strcmp(policyNames[p], policy) != 0; p++);
+            if (m == MEM_SECTIONS || p > RESIDENCY_PAGEOUT) {
+                snprintf(statusMessage, sizeof(statusMessage),
+                         "Usage: :mem names|dirs|tables|ids|columns|history default|lock|touch|cold|pageout");
+            } else if (indexSetResidency(searchIndex, m, p) < 0) {
+                snprintf(statusMessage, sizeof(statusMessage), "Could not %s %s%s", policy, section,
+                         p == RESIDENCY_LOCK ? " (RLIMIT_MEMLOCK?), touching it instead" : "");
+            } else {
+                indexStartUpdater(searchIndex);
+                snprintf(statusMessage, sizeof(statusMessage), "Memory: %s now %s", section, policy);
+            }
+            return;
+        }
+        int len = snprintf(statusMessage, sizeof(statusMessage), "Memory:");
+        for (int m = 0; m < MEM_SECTIONS && len < (int)sizeof(statusMessage); m++) {
+            IndexMemoryInfo info;
+            char size[16], resident[16] = "-";
+            if (indexMemoryInfo(searchIndex, m, &info) < 0) continue;
+            format_size(info.bytes, size, sizeof(size));
+            if (info.resident < 0) strcpy(resident, "?");
+            else if (info.bytes > 0) snprintf(resident, sizeof(resident), "%d%%", (int)(100 * info.resident / info.bytes));
+            len += snprintf(statusMessage + len, sizeof(statusMessage) - len, " %s %s (%s%s%s)",
+                            info.name, size, resident, info.policy ? " " : "",
+                            info.policy ? policyNames[info.policy] : "");
+        }
+    } else if (strcmp(name, "sched") == 0) {
+        IndexSchedStats stats;
+        indexSchedStats(&stats);
+        int len = snprintf(statusMessage, sizeof(statusMessage), "Tasks (%d+%d+%d workers):",
+                           stats.foreground, stats.background, stats.io);
+        for (int c = 0; c < TASK_CLASSES && len < (int)sizeof(statusMessage); c++) {
+            len += snprintf(statusMessage + len, sizeof(statusMessage) - len, " %s %.2fs/%ld",
+                            taskNames[c], stats.cpuSeconds[c], stats.tasks[c]);
+            if (stats.queued[c] && len < (int)sizeof(statusMessage))
+                len += snprintf(statusMessage + len, sizeof(statusMessage) - len, " (%ld queued)", stats.queued[c]);
+        }
+    } else if (strcmp(name, "poller") == 0) {
+        IndexPollStats stats;
+        indexPollStats(searchIndex, &stats);
+        snprintf(statusMessage, sizeof(statusMessage),
+                 "Poller: %d dirs tracked, %ld syscalls last tick (budget %d/s), %ld dirs re-read",
+                 stats.trackedDirs, stats.syscallsLastTick, stats.budget, stats.rereads);
+    } else if (strcmp(name, "refresh-shard") == 0) {
+        IndexShardInfo info;
+        if (fields < 2 || indexRefreshShard(searchIndex, arg - 1) < 0) {
+            snprintf(statusMessage, sizeof(statusMessage), "No shard %d (1-%d)", arg, shardCount);
+            return;
+        }
+        indexShardInfo(searchIndex, arg - 1, &info);
+        char path[64];
+        shorten_path(info.path, path, sizeof(path));
+        snprintf(statusMessage, sizeof(statusMessage), "Refreshed shard %s: %ld files in %.2fs",
+                 path, info.fileCount, info.crawlSeconds);
+    } else if (strcmp(name, "refresh") == 0) {
+        clock_t start = clock();
+        if (fields == 2) {
+            IndexRootInfo info;
+            if (indexRefreshRoot(searchIndex, arg - 1) < 0) {
+                snprintf(statusMessage, sizeof(statusMessage), "No root %d (1-%d)", arg, rootCount);
+                return;
+            }
+            indexRootInfo(searchIndex, arg - 1, &info);
+            char path[64];
+            shorten_path(info.path, path, sizeof(path));
+            snprintf(statusMessage, sizeof(statusMessage), "Refreshed %s: %ld files in %.2fs",
+                     path, info.fileCount, (double)(clock() - start) / CLOCKS_PER_SEC);
+        } else {
+            indexBuild(searchIndex, NULL, NULL);
+            snprintf(statusMessage, sizeof(statusMessage), "Refreshed %d roots: %ld files in %.2fs",
+                     rootCount, indexFileCount(searchIndex), (double)(clock() - start) / CLOCKS_PER_SEC);
+        }
+    } else {
+        snprintf(statusMessage, sizeof(statusMessage), "Unknown command :%s", name);
+    }
+}
+
+void app_loop() {
+    char query[256] = {0};
+    int pos = 0;
+    int ch;
+    
+    #ifdef OS_WINDOWS
+        system("cls");
+    #else
+        system("clear");
+        // Unbuffered, so a key read by getchar is never hidden from poll.
+        setvbuf(stdin, NULL, _IONBF, 0);
+    #endif
+
+    printf("\n" COLOR_BOLD COLOR_WHITE "  SPOTLIGHT SEARCH" COLOR_RESET "\n");
+    printf(COLOR_DIM "  Type to search. Tab for recent/largest/similar. Enter to open. ESC to quit." COLOR_RESET "\n\n");
+    
+    // Prepare blank lines for the UI to sit in
+    for(int i = 0; i < VIEWPORT_HEIGHT + 4; i++) printf("\n");
+    // Move cursor back up to input position
+    printf("\033[%dA", VIEWPORT_HEIGHT + 4);
+
+    while (1) {
+        // Announce alerts that fired since the last redraw.
+        IndexStandingStats alerts;
+        IndexStandingHit latest;
+        indexStandingStats(searchIndex, &alerts);
+        if (alerts.hits > alertsSeen && !statusMessage[0] && indexStandingRecent(searchIndex, &latest, 1) == 1) {
+            char path[64];
+            shorten_path(latest.file.fullpath, path, sizeof(path));
+            snprintf(statusMessage, sizeof(statusMessage), "Alert %d \"%.40s\": %s (%ld new)",
+                     latest.query + 1, latest.pattern, path, alerts.hits - alertsSeen);
+        }
+        alertsSeen = alerts.hits;
+
+        // Render Search Bar
+        printf("\r\033[2K  " COLOR_CYAN "> " COLOR_RESET COLOR_BOLD "%s" COLOR_RESET, query);
+        fflush(stdout);
+
+        // Search Logic
+        IndexMatch matches[VIEWPORT_HEIGHT];
+        float similarity[VIEWPORT_HEIGHT];
+        IndexEstimate estimate;
+        IndexCount *counter = NULL;
+        long total = -1;
+        int count = 0, order = -1, similar = 0;
+        clock_t start = clock();
+
+        // With nothing typed, the name view shows recent files.
+        if (historyTime) {
+            if (query[0] && query[0] != ':')
+                count = indexQueryAt(searchIndex, query, historyTime, matches, VIEWPORT_HEIGHT);
+            if (count < 0) count = 0;
+        } else if (query[0] != ':') {
+            if (viewMode == VIEW_LARGEST) order = ORDER_LARGEST;
+            else if (viewMode == VIEW_RECENT || !query[0]) order = ORDER_RECENT;
+            else similar = viewMode == VIEW_SIMILAR;
+        }
+        if (historyTime) {
+            // Point-in-time results were filled in above.
+        } else if (similar) {
+            count = indexQuerySimilar(searchIndex, query, matches, similarity, VIEWPORT_HEIGHT);
+            if (count < 0) count = 0;
+        } else if (order >= 0) {
+            count = indexQueryOrdered(searchIndex, order, query, 0, matches, VIEWPORT_HEIGHT);
+        } else if (strlen(query) > 0 && query[0] != ':') {
+            // A quick sample tells whether ranking every match is cheap.
+            // When it is not, only a prefix is ranked and the total is the
+            // estimate, refined below while no key is pressed.
+            if ((counter = indexCountStart(searchIndex, query)))
+                indexCountStep(counter, COUNT_FIRST_STEP, &estimate);
+            if (!counter || estimate.exact || estimate.count <= RANK_ALL_MAX) {
+                indexCountFree(counter);
+                counter = NULL;
+                total = indexQueryRanked(searchIndex, query, matches, VIEWPORT_HEIGHT);
+            } else {
+                total = indexQueryRankedSample(searchIndex, query, RANK_CANDIDATES, matches, VIEWPORT_HEIGHT);
+            }
+            if (total < 0) total = indexQueryBuf(searchIndex, query, matches, VIEWPORT_HEIGHT);
+            count = total < VIEWPORT_HEIGHT ? (int)total : VIEWPORT_HEIGHT;
+        }
+        
+        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        // Render Viewport
+        render_ui(query, matches, count, elapsed, order, total, similar ? similarity : NULL,
+                  counter ? &estimate : NULL);
+        fflush(stdout);
+
+        // Refine the estimate toward the exact count until a key arrives.
+        if (counter) {
+            #ifdef OS_POSIX
+                struct termios oldt, newt;
+                tcgetattr(STDIN_FILENO, &oldt);
+                newt = oldt;
+                newt.c_lflag &= ~(ICANON | ECHO);
+                tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+            #endif
+            for (int step = 1; !estimate.exact && !key_waiting(); step++) {
+                indexCountStep(counter, COUNT_STEP, &estimate);
+                if (estimate.exact || step % COUNT_REDRAW_STEPS == 0) {
+                    elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+                    render_ui(query, matches, count, elapsed, order, total, NULL, &estimate);
+                    fflush(stdout);
+                }
+            }
+            #ifdef OS_POSIX
+                tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+            #endif
+            indexCountFree(counter);
+        }
+
+        // Input
+        ch = get_char_raw();
+
+        statusMessage[0] = '\0';
+
+        // Handle Escape
+        if (ch == 27) break;
+
+        else if (ch == '\t') viewMode = (viewMode + 1) % 4;
+
+        // Handle Enter
+        else if ((ch == '\r' || ch == '\n') && query[0] == ':') {
+            run_command(query);
+            memset(query, 0, sizeof(query));
+            pos = 0;
+        }
+        else if (ch == '\r' || ch == '\n') {
+            if (count > 0) {
+                // Freeze UI and ask for selection
+                printf("\033[%dB", VIEWPORT_HEIGHT + 3); // Move to bottom
+                printf("\n  " COLOR_CYAN "Open file ID (1-%d): " COLOR_RESET, count);
+                
+                // Switch to buffered input
+                #ifdef OS_POSIX
+                    struct termios oldt, newt;
+                    tcgetattr(STDIN_FILENO, &oldt);
+                    newt = oldt;
+                    newt.c_lflag |= (ICANON | ECHO);
+                    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+                #endif
+
+                char numBuf[16];
+                if (fgets(numBuf, sizeof(numBuf), stdin)) {
+                    int choice = atoi(numBuf);
+                    if (choice > 0 && choice <= count) {
+                        indexNoteOpen(searchIndex, matches[choice-1].id);
+                        openFile(matches[choice-1].fullpath);
+                    }
+                }
+
+                #ifdef OS_POSIX
+                    tcgetattr(STDIN_FILENO, &oldt);
+                    newt = oldt;
+                    newt.c_lflag &= ~(ICANON | ECHO);
+                    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+                #endif
+
+                // Reset UI
+                memset(query, 0, sizeof(query));
+                pos = 0;
+                
+                // Clear the input line we just made
+                printf("\033[A\033[2K");
+                // Move back to search bar
+                printf("\033[%dA", VIEWPORT_HEIGHT + 3);
+            }
+        }
+        // Handle Backspace
+        else if (ch == 127 || ch == 8) {
+            if (pos > 0) {
+                query[--pos] = '\0';
+            }
+        }
+        // Handle Typing
+        else if (isprint(ch) && pos < sizeof(query) - 1) {
+            query[pos++] = (char)ch;
+            query[pos] = '\0';
+        }
+    }
+}
+
+// --- Main ---
+
+// Redraws one status line in place while crawling.
+void print_progress(const IndexProgress *p, void *user) {
+    (void)user;
+    if (p->done) {
+        printf("\r\033[K" COLOR_CYAN "  Index > " COLOR_RESET "%ld entries in %.1fs\n", p->scanned, p->elapsed);
+        return;
+    }
+    char shortPath[48];
+    shorten_path(p->path, shortPath, sizeof(shortPath));
+    printf("\r\033[K" COLOR_CYAN "  Index > " COLOR_RESET "Scanning %s  %ld", shortPath, p->scanned);
+    if (p->expected > 0) {
+        int eta = (int)(p->eta + 0.5);
+        printf(" / ~%ld  %d%%  ETA %d:%02d", p->expected, (int)(100.0 * p->scanned / p->expected), eta / 60, eta % 60);
+    } else if (p->scanned > 0 && p->elapsed > 0) {
+        printf("  %.0f/s", p->scanned / p->elapsed);
+    }
+    fflush(stdout);
+}
+
+// Usage: indexer [ROOT...] [--shard PATH[:watch|:poll=SECS|:manual]]...
+//                [--poll-budget N] [--crawl-order auto|readdir|inode]
+//                [--load FILE] [--save FILE]
+//                [--group-by ext|owner|top|shard|root [--older AGE] [--newer AGE]
+//                 [--larger SIZE] [--smaller SIZE] [--name TEXT]]
+//                [--history FILE]
+//                [--grep PATTERN [-i|--ignore-case] [-E|--regex] [--name TEXT]]
+//                [--content FILE] [--serve SOCKET] [--metrics FILE]
+//                [--symbols FILE] [--symbol TEXT] [--like NAME]
+//                [--alert PATTERN]... [--alerts FILE] [--alert-out FILE|SOCKET]
+//                [--find PATTERN] [--host NAME=FILE[:watch|:poll=SECS|:manual]]...
+//                [--host-budget SIZE]
+// --group-by prints an analytics table and exits instead of starting the UI.
+// --grep prints path:line:text for every matching line and exits likewise.
+// --serve answers queries from other local users over a Unix socket, each
+// seeing only the files their permissions allow, instead of starting the UI.
+// --host has --serve answer "@NAME query" lines from the index saved in
+// FILE, loaded on first use; --host-budget caps the memory the loaded ones
+// may take before the least recently used are unloaded.
+// --content keeps a content index in FILE so :grep and --grep skip files
+// that cannot match and only re-read what was appended since last time.
+// --crawl-order inode stats files in inode order, which is much faster on
+// spinning disks; auto (the default) does so for roots on rotational disks.
+// --history records which paths were present when into FILE (see :at).
+// --symbols keeps the definitions found in source files in FILE, so :sym
+// and --symbol only rescan files that changed; --symbol prints the best
+// definitions whose name contains TEXT as path:line: kind name and exits.
+// --find prints the paths under the roots whose names match PATTERN (a
+// glob like "*.log", or a substring) and exits, without building an index:
+// a faster find -iname whose memory does not grow with the tree.
+// --like prints the files whose names are most like NAME (a name or a
+// path), with how alike they are, and exits.
+// --alert reports files that start to match PATTERN while running (see
+// :alert); --alerts reads patterns from FILE, one per line. --alert-out
+// sends each report to FILE or to the Unix socket listening there.
+// --metrics keeps FILE rewritten with Prometheus metrics while running, for
+// a node exporter's textfile collector or any scraper that reads files.
+
+static const char *valueFlags[] = {
+    "--shard", "--load", "--save", "--group-by", "--older", "--newer",
+    "--larger", "--smaller", "--name", "--history", "--grep",
+    "--content", "--serve", "--metrics", "--symbols", "--symbol", "--like",
+    "--alert", "--alerts", "--alert-out", "--find", "--host", "--host-budget", NULL
+};
+
+static const char *switchFlags[] = {
+    "-i", "--ignore-case", "-E", "--regex", NULL
+};
+
+static const char *crawlOrders[] = {"auto", "readdir", "inode", NULL};   // CRAWL_ORDER_*
+
+// Returns a CRAWL_ORDER_* value, or -1.
+int parse_crawl_order(const char *name) {
+    for (int i = 0; crawlOrders[i]; i++) {
+        if (strcmp(name, crawlOrders[i]) == 0) return i;
+    }
+    return -1;
+}
+
+// Returns 1 for options whose value is the next argument.
+int takes_value(const char *arg) {
+    for (int i = 0; valueFlags[i]; i++) {
+        if (strcmp(arg, valueFlags[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// Returns 1 for options that take no value.
+int is_switch(const char *arg) {
+    for (int i = 0; switchFlags[i]; i++) {
+        if (strcmp(arg, switchFlags[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// --find: streams matches under every root on the command line, or the
+// current directory. Returns the exit status.
+int find_files(int argc, char *argv[], const char *pattern) {
+    static char buffer[1 << 16];
+    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+    long found = 0;
+    int roots = 0;
+    for (int i = 1; i < argc; i++) {
+        if (takes_value(argv[i]) || strcmp(argv[i], "--poll-budget") == 0 || strcmp(argv[i], "--crawl-order") == 0) {
+            i++;
+            continue;
+        }
+        if (is_switch(argv[i])) continue;
+        long n = indexFind(argv[i], pattern, print_found, NULL);
+        if (n < 0) fprintf(stderr, "  Could not read %s\n", argv[i]);
+        else found += n;
+        roots++;
+    }
+    if (!roots) found = indexFind(".", pattern, print_found, NULL);
+    fflush(stdout);
+    return found > 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    enable_ansi();
+    const char *loadPath = NULL, *savePath = NULL, *historyPath = NULL, *grepPattern = NULL;
+    const char *contentPath = NULL, *servePath = NULL, *metricsPath = NULL;
+    const char *symbolsPath = NULL, *symbolQuery = NULL, *likeName = NULL, *findPattern = NULL;
+    int groupBy = -1, grepFlags = 0;
+    IndexGroupFilter filter = {0, 0, 0, 0, NULL};
+    long long now = (long long)time(NULL);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "--ignore-case") == 0) grepFlags |= GREP_IGNORE_CASE;
+        else if (strcmp(argv[i], "-E") == 0 || strcmp(argv[i], "--regex") == 0) grepFlags |= GREP_REGEX;
+    }
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--load") == 0) loadPath = argv[++i];
+        else if (strcmp(argv[i], "--save") == 0) savePath = argv[++i];
+        else if (strcmp(argv[i], "--older") == 0) filter.olderThan = now - parse_age(argv[++i]);
+        else if (strcmp(argv[i], "--newer") == 0) filter.newerThan = now - parse_age(argv[++i]);
+        else if (strcmp(argv[i], "--larger") == 0) filter.minSize = parse_size(argv[++i]);
+        else if (strcmp(argv[i], "--smaller") == 0) filter.maxSize = parse_size(argv[++i]);
+        else if (strcmp(argv[i], "--name") == 0) filter.name = argv[++i];
+        else if (strcmp(argv[i], "--history") == 0) historyPath = argv[++i];
+        else if (strcmp(argv[i], "--grep") == 0) grepPattern = argv[++i];
+        else if (strcmp(argv[i], "--content") == 0) contentPath = argv[++i];
+        else if (strcmp(argv[i], "--serve") == 0) servePath = argv[++i];
+        else if (strcmp(argv[i], "--metrics") == 0) metricsPath = argv[++i];
+        else if (strcmp(argv[i], "--symbols") == 0) symbolsPath = argv[++i];
+        else if (strcmp(argv[i], "--symbol") == 0) symbolQuery = argv[++i];
+        else if (strcmp(argv[i], "--like") == 0) likeName = argv[++i];
+        else if (strcmp(argv[i], "--alert-out") == 0) alertPath = argv[++i];
+        else if (strcmp(argv[i], "--find") == 0) findPattern = argv[++i];
+        else if (strcmp(argv[i], "--host-budget") == 0) hostBudget = parse_size(argv[++i]);
+        else if (strcmp(argv[i], "--host") == 0 && add_hosted(argv[++i]) < 0) {
+            fprintf(stderr, "  --host takes NAME=FILE with a new NAME without spaces\n");
+            return 1;
+        }
+        else if (strcmp(argv[i], "--group-by") == 0 && (groupBy = parse_group(argv[++i])) < 0) {
+            fprintf(stderr, "  --group-by takes ext, owner, top, shard or root\n");
+            return 1;
+        }
+    }
+    if (findPattern) return find_files(argc, argv, findPattern);
+    if (hostedCount && !servePath) fprintf(stderr, "  --host only applies to --serve\n");
+
+    if (loadPath) {
+        searchIndex = indexLoad(loadPath);
+        if (!searchIndex) fprintf(stderr, "  Could not load %s, crawling instead\n", loadPath);
+    }
+    int crawl = searchIndex == NULL;
+    if (!searchIndex) searchIndex = indexCreate();
+    if (!searchIndex) return 1;
+
+    // Roots first, so --shard specs can be matched to the root they live in.
+    for (int i = 1; i < argc; i++) {
+        if (takes_value(argv[i])) {
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--poll-budget") == 0 && i + 1 < argc) {
+            indexSetPollBudget(searchIndex, atoi(argv[++i]));
+            continue;
+        }
+        if (strcmp(argv[i], "--crawl-order") == 0 && i + 1 < argc) {
+            int order = parse_crawl_order(argv[++i]);
+            if (order < 0) {
+                fprintf(stderr, "  --crawl-order takes auto, readdir or inode\n");
+                return 1;
+            }
+            indexSetCrawlOrder(searchIndex, order);
+            continue;
+        }
+        if (!crawl || is_switch(argv[i])) continue;
+        if (indexAddRoot(searchIndex, argv[i]) < 0)
+            fprintf(stderr, "  Skipping %s (duplicate or nested root)\n", argv[i]);
+    }
+    // A server that only hosts saved indexes has nothing of its own to crawl.
+    if (indexRootCount(searchIndex) == 0 && !(servePath && hostedCount)) {
+        char rootPath[MAX_PATH_LEN];
+        #ifdef OS_WINDOWS
+            GetCurrentDirectory(MAX_PATH_LEN, rootPath);
+        #else
+            if (getcwd(rootPath, MAX_PATH_LEN) == NULL) return 1;
+        #endif
+        indexAddRoot(searchIndex, rootPath);
+    }
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--shard") == 0 && indexAddShard(searchIndex, argv[++i]) < 0)
+            fprintf(stderr, "  Skipping shard %s (not under any root)\n", argv[i]);
+    }
+
+    // Opened before the crawl so the build lands in the history as a snapshot.
+    if (historyPath && indexOpenHistory(searchIndex, historyPath) < 0) {
+        fprintf(stderr, "  Could not read history from %s\n", historyPath);
+        historyPath = NULL;
+    }
+    // --grep, --symbol and --like output is meant for pipes, so they crawl quietly.
+    if (crawl) indexBuild(searchIndex, grepPattern || symbolQuery || likeName ? NULL : print_progress, NULL);
+    else if (historyPath) indexSnapshot(searchIndex);
+    if (historyPath && indexSaveHistory(searchIndex) < 0)
+        fprintf(stderr, "  Could not save history to %s\n", historyPath);
+    if (savePath && indexSave(searchIndex, savePath) < 0)
+        fprintf(stderr, "  Could not save index to %s\n", savePath);
+    if (groupBy >= 0) {
+        print_groups(groupBy, &filter);
+        indexFree(searchIndex);
+        return 0;
+    }
+    if (likeName) {
+        int found = print_similar(likeName);
+        indexFree(searchIndex);
+        return found > 0 ? 0 : 1;
+    }
+    if (contentPath && !(contentIndex = indexContentOpen(searchIndex, contentPath)))
+        fprintf(stderr, "  Could not read content index from %s\n", contentPath);
+    if (grepPattern) {
+        long hits = contentIndex
+            ? indexContentGrep(contentIndex, filter.name, grepPattern, grepFlags, print_hit, NULL)
+            : indexGrep(searchIndex, filter.name, grepPattern, grepFlags, print_hit, NULL);
+        if (hits < 0) fprintf(stderr, "  Bad pattern %s\n", grepPattern);
+        if (contentIndex && indexContentSave(contentIndex) < 0)
+            fprintf(stderr, "  Could not save content index to %s\n", contentPath);
+        indexContentFree(contentIndex);
+        indexFree(searchIndex);
+        return hits > 0 ? 0 : 1;
+    }
+    if (symbolsPath && !(symbolIndex = indexSymbolsOpen(searchIndex, symbolsPath)))
+        fprintf(stderr, "  Could not read symbol index from %s\n", symbolsPath);
+    if (symbolQuery) {
+        if (!symbolIndex) symbolIndex = indexSymbolsOpen(searchIndex, NULL);
+        long total = symbolIndex ? print_symbols(symbolQuery) : -1;
+        if (symbolsPath && symbolIndex && indexSymbolsSave(symbolIndex) < 0)
+            fprintf(stderr, "  Could not save symbol index to %s\n", symbolsPath);
+        indexSymbolsFree(symbolIndex);
+        indexFree(searchIndex);
+        return total > 0 ? 0 : 1;
+    }
+    // History is only read by :at and :when. Other sections keep the
+    // kernel's default unless :mem asks otherwise.
+    indexSetResidency(searchIndex, MEM_HISTORY, RESIDENCY_COLD);
+    if (metricsPath && indexSetMetricsFile(searchIndex, metricsPath) < 0)
+        fprintf(stderr, "  Could not write metrics to %s\n", metricsPath);
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--alert") == 0 && indexStandingAdd(searchIndex, argv[++i]) < 0)
+            fprintf(stderr, "  Skipping alert \"%s\"\n", argv[i]);
+        else if (strcmp(argv[i], "--alerts") == 0 && load_alerts(argv[++i]) < 0)
+            fprintf(stderr, "  Could not read alerts from %s\n", argv[i]);
+    }
+    if (alertPath) {
+        #ifdef OS_POSIX
+        signal(SIGPIPE, SIG_IGN);
+        #endif
+        indexSetStandingFn(searchIndex, deliver_alert, NULL);
+    }
+    indexStartUpdater(searchIndex);
+    if (servePath) {
+        #ifdef OS_POSIX
+        if (serve(servePath) < 0) fprintf(stderr, "  Could not listen on %s\n", servePath);
+        #else
+        fprintf(stderr, "  --serve needs Unix sockets\n");
+        #endif
+    } else {
+        app_loop();
+    }
+    indexStopUpdater(searchIndex);
+    if (savePath) indexSave(searchIndex, savePath);
+    if (historyPath) indexSaveHistory(searchIndex);
+    if (contentIndex) indexContentSave(contentIndex);
+    indexContentFree(contentIndex);
+    if (symbolsPath && symbolIndex) indexSymbolsSave(symbolIndex);
+    indexSymbolsFree(symbolIndex);
+    indexFree(searchIndex);
+    if (alertFile) fclose(alertFile);
+    if (servePath) return 0;
+    
+    // Clear screen on exit 
+    #ifdef OS_WINDOWS
+        system("cls");
+    #else
+        system("clear");
+    #endif
+    return 0;
+}
@@ -0,0 +1,328 @@
+/*
+ * Task scheduler shared by everything in the process that works in
+ * parallel: name queries, analytics, content search, content index
+ * updates, sorted-view builds and crawls.
+ *
+ * Work is submitted in groups. A group is a deque owned by the thread that
+ * fills it: while that thread waits it pops tasks off the back, and idle
+ * workers steal them off the front, always from the highest priority class
+ * with queued work. Two pools of workers split the classes. The foreground
+ * pool runs queries, UI work and incremental updates. The background pool
+ * runs builds and crawls at a lower OS priority. A crawl can therefore
+ * never hold every worker, and a query never queues behind it; the thread
+ * that waits on a group keeps making progress on it in any case.
+ *
+ * Both pools are sized for CPU work. A group whose tasks mostly wait on
+ * the network asks for I/O workers instead: a third pool, grown to the
+ * largest such request, whose workers only take tasks of those groups.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "index.h"
+
+// --- Platform Specifics ---
+#if defined(_WIN32) || defined(_WIN64)
+    #define OS_WINDOWS
+    #include <windows.h>
+    typedef SRWLOCK mutex_t;
+    typedef CONDITION_VARIABLE cond_t;
+    #define MUTEX_INIT SRWLOCK_INIT
+    #define COND_INIT CONDITION_VARIABLE_INIT
+    #define mutex_lock(m) AcquireSRWLockExclusive(m)
+    #define mutex_unlock(m) ReleaseSRWLockExclusive(m)
+    #define cond_wait(c, m) SleepConditionVariableSRW(c, m, INFINITE, 0)
+    #define cond_signal(c) WakeConditionVariable(c)
+    #define cond_broadcast(c) WakeAllConditionVariable(c)
+#else
+    #define OS_POSIX
+    #include <unistd.h>
+    #include <pthread.h>
+    #include <time.h>
+    typedef pthread_mutex_t mutex_t;
+    typedef pthread_cond_t cond_t;
+    #define MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+    #define COND_INIT PTHREAD_COND_INITIALIZER
+    #define mutex_lock(m) pthread_mutex_lock(m)
+    #define mutex_unlock(m) pthread_mutex_unlock(m)
+    #define cond_wait(c, m) pthread_cond_wait(c, m)
+    #define cond_signal(c) pthread_cond_signal(c)
+    #define cond_broadcast(c) pthread_cond_broadcast(c)
+    #ifdef __linux__
+        #include <sys/resource.h>
+        #include <sys/syscall.h>
+    #endif
+#endif
+
+// --- Configuration ---
+#define MIN_BACKGROUND_WORKERS 4    // crawls are I/O bound; keep a few devices busy
+#define MAX_IO_WORKERS 64           // cap on the pool groups grow with indexTasksExpectIO
+#define BACKGROUND_NICE 10
+
+enum { WORKER_FOREGROUND, WORKER_BACKGROUND, WORKER_IO };
+
+// --- Data Structures ---
+typedef struct Task {
+    IndexTaskFn fn;
+    void *arg;
+} Task;
+
+struct IndexTasks {
+    int taskClass;
+    Task *items;            // queued tasks are items[head, tail)
+    size_t head, tail, cap;
+    int running;            // taken and not finished
+    volatile int cancelled;
+    int io;                 // tasks wait on I/O; I/O workers may take them
+    int listed;             // on its class's ready list
+    IndexTasks *nextReady;
+};
+
+static struct {
+    mutex_t lock;
+    cond_t foreWork;        // foreground workers wait here
+    cond_t backWork;        // background workers wait here
+    cond_t ioWork;          // I/O workers wait here
+    cond_t finished;        // a group ran dry
+    IndexTasks *ready[TASK_CLASSES];    // groups with queued tasks, oldest first
+    int started;
+    int foreground;
+    int background;
+    int io;
+    double cpu[TASK_CLASSES];
+    long tasks[TASK_CLASSES];
+    long queued[TASK_CLASSES];
+} sched = {.lock = MUTEX_INIT, .foreWork = COND_INIT, .backWork = COND_INIT, .ioWork = COND_INIT, .finished = COND_INIT};
+
+// --- System Utilities ---
+
+static int cpuCount(void) {
+    #ifdef OS_WINDOWS
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+    #else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+    #endif
+}
+
+// CPU seconds used by the calling thread.
+static double threadCpu(void) {
+    #ifdef OS_WINDOWS
+    FILETIME created, exited, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) return 0;
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return (double)(k.QuadPart + u.QuadPart) / 1e7;
+    #else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+    #endif
+}
+
+static int isBackground(int taskClass) {
+    return taskClass >= TASK_BUILD;
+}
+
+// --- Queues ---
+// Everything below runs with sched.lock held.
+
+static void unlistGroup(IndexTasks *t) {
+    IndexTasks **p = &sched.ready[t->taskClass];
+    while (*p && *p != t) p = &(*p)->nextReady;
+    if (*p) *p = t->nextReady;
+    t->listed = 0;
+    t->nextReady = NULL;
+}
+
+static void listGroup(IndexTasks *t) {
+    IndexTasks **p = &sched.ready[t->taskClass];
+    while (*p) p = &(*p)->nextReady;
+    *p = t;
+    t->listed = 1;
+}
+
+// Oldest queued group that asked for I/O workers, highest class first.
+static IndexTasks *nextIOGroup(void) {
+    for (int c = 0; c < TASK_CLASSES; c++) {
+        for (IndexTasks *t = sched.ready[c]; t; t = t->nextReady) {
+            if (t->io) return t;
+        }
+    }
+    return NULL;
+}
+
+// Runs a task taken off t, dropping the lock meanwhile. A cancelled
+// group's tasks are taken but not run.
+static void runTask(IndexTasks *t, Task task) {
+    if (t->head == t->tail && t->listed) unlistGroup(t);
+    t->running++;
+    sched.queued[t->taskClass]--;
+    mutex_unlock(&sched.lock);
+    double start = threadCpu();
+    int run = !t->cancelled;
+    if (run) task.fn(task.arg);
+    double spent = threadCpu() - start;
+    mutex_lock(&sched.lock);
+    sched.cpu[t->taskClass] += spent;
+    sched.tasks[t->taskClass] += run;
+    if (--t->running == 0 && t->head == t->tail) cond_broadcast(&sched.finished);
+}
+
+#ifdef OS_WINDOWS
+static DWORD WINAPI schedWorker(LPVOID arg) {
+#else
+static void *schedWorker(void *arg) {
+#endif
+    int kind = (int)(intptr_t)arg;
+    int background = kind != WORKER_FOREGROUND;
+    #ifdef __linux__
+    // Niceness is per thread on Linux.
+    if (background) setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), BACKGROUND_NICE);
+    #elif defined(OS_WINDOWS)
+    if (background) SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+    #endif
+    int first = background ? TASK_BUILD : TASK_QUERY;
+    int last = background ? TASK_CRAWL : TASK_UPDATE;
+    cond_t *work = kind == WORKER_IO ? &sched.ioWork : background ? &sched.backWork : &sched.foreWork;
+    mutex_lock(&sched.lock);
+    for (;;) {
+        IndexTasks *t = NULL;
+        if (kind == WORKER_IO) t = nextIOGroup();
+        else for (int c = first; c <= last && !t; c++) t = sched.ready[c];
+        if (!t) {
+            cond_wait(work, &sched.lock);
+            continue;
+        }
+        Task task = t->items[t->head++];
+        runTask(t, task);
+    }
+    return 0;
+}
+
+static int startWorker(int kind) {
+    void *arg = (void *)(intptr_t)kind;
+    #ifdef OS_WINDOWS
+    HANDLE h = CreateThread(NULL, 0, schedWorker, arg, 0, NULL);
+    if (!h) return -1;
+    CloseHandle(h);
+    return 0;
+    #else
+    pthread_t t;
+    if (pthread_create(&t, NULL, schedWorker, arg) != 0) return -1;
+    pthread_detach(t);
+    return 0;
+    #endif
+}
+
+// Workers start with the first task and live as long as the process. If
+// none can be started, waiting threads run their groups themselves.
+static void startWorkers(void) {
+    if (sched.started) return;
+    sched.started = 1;
+    int cpus = cpuCount();
+    int back = cpus > MIN_BACKGROUND_WORKERS ? cpus : MIN_BACKGROUND_WORKERS;
+    while (sched.foreground < cpus && startWorker(WORKER_FOREGROUND) == 0) sched.foreground++;
+    while (sched.background < back && startWorker(WORKER_BACKGROUND) == 0) sched.background++;
+}
+
+// --- Public Interface ---
+
+IndexTasks *indexTasksBegin(int taskClass) {
+    if (taskClass < 0 || taskClass >= TASK_CLASSES) return NULL;
+    IndexTasks *t = (IndexTasks *)calloc(1, sizeof(IndexTasks));
+    if (t) t->taskClass = taskClass;
+    return t;
+}
+
+void indexTasksExpectIO(IndexTasks *t, int workers) {
+    if (!t) return;
+    if (workers > MAX_IO_WORKERS) workers = MAX_IO_WORKERS;
+    mutex_lock(&sched.lock);
+    t->io = 1;
+    while (sched.io < workers && startWorker(WORKER_IO) == 0) sched.io++;
+    mutex_unlock(&sched.lock);
+}
+
+void indexTasksSpawn(IndexTasks *t, IndexTaskFn fn, void *arg) {
+    if (!t) {
+        fn(arg);
+        return;
+    }
+    mutex_lock(&sched.lock);
+    startWorkers();
+    if (t->tail == t->cap) {
+        // Slide out the slots workers already took before growing.
+        size_t queued = t->tail - t->head;
+        memmove(t->items, t->items + t->head, queued * sizeof(Task));
+        t->head = 0;
+        t->tail = queued;
+        if (t->tail == t->cap) {
+            size_t cap = t->cap ? t->cap * 2 : 16;
+            Task *items = (Task *)realloc(t->items, cap * sizeof(Task));
+            if (!items) {
+                mutex_unlock(&sched.lock);
+                fn(arg);
+                return;
+            }
+            t->items = items;
+            t->cap = cap;
+        }
+    }
+    t->items[t->tail].fn = fn;
+    t->items[t->tail].arg = arg;
+    t->tail++;
+    sched.queued[t->taskClass]++;
+    if (!t->listed) listGroup(t);
+    cond_signal(isBackground(t->taskClass) ? &sched.backWork : &sched.foreWork);
+    if (t->io) cond_signal(&sched.ioWork);
+    mutex_unlock(&sched.lock);
+}
+
+void indexTasksCancel(IndexTasks *t) {
+    if (t) t->cancelled = 1;
+}
+
+int indexTasksCancelled(const IndexTasks *t) {
+    return t && t->cancelled;
+}
+
+void indexTasksWait(IndexTasks *t) {
+    if (!t) return;
+    mutex_lock(&sched.lock);
+    for (;;) {
+        if (t->head < t->tail) {
+            Task task = t->items[--t->tail];
+            runTask(t, task);
+        } else if (t->running) {
+            cond_wait(&sched.finished, &sched.lock);
+        } else {
+            break;
+        }
+    }
+    if (t->listed) unlistGroup(t);
+    mutex_unlock(&sched.lock);
+    free(t->items);
+    free(t);
+}
+
+void indexSchedStats(IndexSchedStats *stats) {
+    mutex_lock(&sched.lock);
+    for (int c = 0; c < TASK_CLASSES; c++) {
+        stats->cpuSeconds[c] = sched.cpu[c];
+        stats->tasks[c] = sched.tasks[c];
+        stats->queued[c] = sched.queued[c];
+    }
+    stats->foreground = sched.foreground;
+    stats->background = sched.background;
+    stats->io = sched.io;
+    mutex_unlock(&sched.lock);
+}
@@ -0,0 +1,1045 @@
+/*
+ * Symbol index: where functions, methods, types and macros are defined in
+ * the indexed source files, found by small line-oriented scanners per
+ * language rather than a parser. C and C++, Python, Go, JavaScript and
+ * TypeScript, and Java are recognised by extension.
+ *
+ * Names are interned once; each file holds (name, line, kind) triples and
+ * the index entry id it was scanned under. Files are rescanned when the
+ * index reports a new mtime or size for them, in parallel on the shared
+ * scheduler, and dropped when they leave the index.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#include "index.h"
+
+// --- Platform Specifics ---
+#if defined(_WIN32) || defined(_WIN64)
+    #define OS_WINDOWS
+    #include <windows.h>
+    typedef CRITICAL_SECTION mutex_t;
+    #define mutex_init(m) InitializeCriticalSection(m)
+    #define mutex_lock(m) EnterCriticalSection(m)
+    #define mutex_unlock(m) LeaveCriticalSection(m)
+    #define mutex_destroy(m) DeleteCriticalSection(m)
+#else
+    #define OS_POSIX
+    #include <unistd.h>
+    #include <pthread.h>
+    typedef pthread_mutex_t mutex_t;
+    #define mutex_init(m) pthread_mutex_init(m, NULL)
+    #define mutex_lock(m) pthread_mutex_lock(m)
+    #define mutex_unlock(m) pthread_mutex_unlock(m)
+    #define mutex_destroy(m) pthread_mutex_destroy(m)
+#endif
+
+// --- Configuration ---
+#define SYMBOL_MAX_FILE (8 << 20)   // larger sources are generated; skip them
+#define SYMBOL_LOOKAHEAD 4096       // bytes searched for the end of a parameter list
+#define SYMBOL_NAME_MAX 127
+#define BINARY_PROBE 4096           // a NUL in this many leading bytes marks a binary file
+#define SYMBOL_FILE_MAGIC 0x534D5953    // "SYMS"
+#define SYMBOL_FILE_VERSION 1
+
+// Ranking: a name matching the whole query beats a prefix, which beats a
+// match at a word start, which beats any other substring. Shorter names
+// break the rest, as in the name ranking.
+#define SYMBOL_EXACT 4.0f
+#define SYMBOL_POSITION 2.0f
+#define SYMBOL_WORD 1.0f
+#define SYMBOL_COVER 2.0f
+
+enum { LANG_NONE, LANG_C, LANG_PYTHON, LANG_GO, LANG_JS, LANG_JAVA };
+
+// --- System Utilities ---
+
+static int cpuCount(void) {
+    #ifdef OS_WINDOWS
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+    #else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+    #endif
+}
+
+static uint64_t hashBytes(const char *data, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static int languageOf(const char *path) {
+    static const struct { const char *ext; int lang; } exts[] = {
+        {"c", LANG_C}, {"h", LANG_C}, {"cc", LANG_C}, {"cpp", LANG_C}, {"cxx", LANG_C},
+        {"hh", LANG_C}, {"hpp", LANG_C}, {"hxx", LANG_C}, {"py", LANG_PYTHON}, {"go", LANG_GO},
+        {"js", LANG_JS}, {"jsx", LANG_JS}, {"mjs", LANG_JS}, {"cjs", LANG_JS}, {"ts", LANG_JS},
+        {"tsx", LANG_JS}, {"java", LANG_JAVA}
+    };
+    const char *dot = strrchr(path, '.');
+    if (!dot || strchr(dot, '/') || strchr(dot, '\\')) return LANG_NONE;
+    for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); i++) {
+        if (strcmp(dot + 1, exts[i].ext) == 0) return exts[i].lang;
+    }
+    return LANG_NONE;
+}
+
+// --- Scanners ---
+// Comments and string literals are blanked out first, keeping line breaks,
+// so the scanners only ever see code. Each then looks at one line at a
+// time for the shapes definitions take in its language. Where a line could
+// be a call or a prototype as well as a definition, what follows the
+// closing parenthesis decides.
+
+typedef struct Found {
+    uint32_t offset;        // name in the scanned buffer
+    uint32_t len;
+    uint32_t line;          // 1-based
+    int kind;               // SYMBOL_*
+} Found;
+
+typedef struct Scan {
+    const char *buf;
+    const char *end;
+    Found *items;
+    uint32_t count;
+    uint32_t cap;
+} Scan;
+
+static int isIdentChar(int c) {
+    return isalnum(c) || c == '_' || c == '$' || c >= 0x80;
+}
+
+static size_t identAt(const char *p, const char *end) {
+    if (p >= end || isdigit((unsigned char)*p)) return 0;
+    const char *q = p;
+    while (q < end && isIdentChar((unsigned char)*q)) q++;
+    return (size_t)(q - p);
+}
+
+static void skipBlanks(const char **p, const char *end) {
+    while (*p < end && (**p == ' ' || **p == '\t' || **p == '\r')) (*p)++;
+}
+
+// Consumes word and the blanks after it when p is at that whole word.
+static int takeWord(const char **p, const char *end, const char *word) {
+    size_t len = identAt(*p, end);
+    if (len != strlen(word) || memcmp(*p, word, len) != 0) return 0;
+    *p += len;
+    skipBlanks(p, end);
+    return 1;
+}
+
+static int takeAny(const char **p, const char *end, const char *const *words) {
+    for (int i = 0; words[i]; i++) {
+        if (takeWord(p, end, words[i])) return 1;
+    }
+    return 0;
+}
+
+// The buffer is not NUL-terminated, so searches are bounded by end.
+static const char *findText(const char *p, const char *end, const char *text) {
+    size_t len = strlen(text);
+    for (; p + len <= end; p++) {
+        if (memcmp(p, text, len) == 0) return p;
+    }
+    return NULL;
+}
+
+static int isWord(const char *p, size_t len, const char *const *words) {
+    for (int i = 0; words[i]; i++) {
+        if (strlen(words[i]) == len && memcmp(p, words[i], len) == 0) return 1;
+    }
+    return 0;
+}
+
+static void addFound(Scan *scan, const char *name, size_t len, uint32_t line, int kind) {
+    if (!len || len > SYMBOL_NAME_MAX) return;
+    if (scan->count == scan->cap) {
+        uint32_t cap = scan->cap ? scan->cap * 2 : 256;
+        Found *items = (Found *)realloc(scan->items, cap * sizeof(Found));
+        if (!items) return;
+        scan->items = items;
+        scan->cap = cap;
+    }
+    Found *f = &scan->items[scan->count++];
+    f->offset = (uint32_t)(name - scan->buf);
+    f->len = (uint32_t)len;
+    f->line = line;
+    f->kind = kind;
+}
+
+// Adds the identifier at p, if there is one.
+static void addIdent(Scan *scan, const char *p, const char *end, uint32_t line, int kind) {
+    addFound(scan, p, identAt(p, end), line, kind);
+}
+
+// Blanks comments and string literals. Python uses # comments and triple
+// quotes; the rest share C's comments, and Go and JavaScript add
+// backquoted strings that may span lines.
+static void blankComments(char *buf, size_t len, int lang) {
+    size_t i = 0;
+    while (i < len) {
+        char c = buf[i];
+        size_t start = i;
+        if (lang == LANG_PYTHON && c == '#') {
+            while (i < len && buf[i] != '\n') buf[i++] = ' ';
+        } else if (lang != LANG_PYTHON && c == '/' && i + 1 < len && buf[i + 1] == '/') {
+            while (i < len && buf[i] != '\n') buf[i++] = ' ';
+        } else if (lang != LANG_PYTHON && c == '/' && i + 1 < len && buf[i + 1] == '*') {
+            i += 2;
+            while (i < len && !(buf[i - 1] == '*' && buf[i] == '/' && i - 1 > start + 1)) i++;
+            if (i < len) i++;
+            for (size_t k = start; k < i; k++) if (buf[k] != '\n') buf[k] = ' ';
+        } else if (lang == LANG_PYTHON && (c == '"' || c == '\'') && i + 2 < len &&
+                   buf[i + 1] == c && buf[i + 2] == c) {
+            i += 3;
+            while (i < len && !(buf[i] == c && i + 2 < len && buf[i + 1] == c && buf[i + 2] == c)) {
+                i += buf[i] == '\\' ? 2 : 1;
+            }
+            i = i + 3 < len ? i + 3 : len;
+            for (size_t k = start; k < i; k++) if (buf[k] != '\n') buf[k] = ' ';
+        } else if (c == '"' || (c == '\'' && lang != LANG_C) || (c == '`' && (lang == LANG_GO || lang == LANG_JS))) {
+            // C's quotes are left alone: a stray apostrophe in a
+            // preprocessor line would blank the rest of the file.
+            i++;
+            while (i < len && buf[i] != c && (c == '`' || buf[i] != '\n')) i += buf[i] == '\\' && c != '`' ? 2 : 1;
+            if (i < len) i++;
+            if (i > len) i = len;
+            for (size_t k = start + 1; k + 1 < i; k++) if (buf[k] != '\n') buf[k] = ' ';
+        } else {
+            i++;
+        }
+    }
+}
+
+// Whether the parameter list opening at open is followed by a body rather
+// than a semicolon, comma or operator: what tells a definition from a
+// prototype or a call.
+static int hasBody(const char *open, const char *end, int lang) {
+    const char *p = open, *limit = open + SYMBOL_LOOKAHEAD < end ? open + SYMBOL_LOOKAHEAD : end;
+    int depth = 0;
+    for (; p < limit; p++) {
+        if (*p == '(') depth++;
+        else if (*p == ')' && --depth == 0) break;
+    }
+    if (p >= limit) return 0;
+    for (p++; p < limit && isspace((unsigned char)*p); p++);
+    if (p >= limit) return 0;
+    if (*p == '{') return 1;
+    switch (lang) {
+        case LANG_C:    // const, noexcept, K&R parameters, initializer lists, trailing returns
+            return isIdentChar((unsigned char)*p) || (*p == ':' && p + 1 < limit && p[1] != ':') ||
+                   (*p == '-' && p + 1 < limit && p[1] == '>');
+        case LANG_JAVA: return takeWord(&p, limit, "throws");
+        case LANG_JS:   return *p == ':';   // a TypeScript return type
+    }
+    return 0;
+}
+
+// The identifier just before the first '(' on the line, or NULL.
+static const char *nameBeforeParen(const char *p, const char *end, const char **open) {
+    const char *paren = (const char *)memchr(p, '(', (size_t)(end - p));
+    if (!paren) return NULL;
+    const char *q = paren;
+    while (q > p && (q[-1] == ' ' || q[-1] == '\t')) q--;
+    const char *name = q;
+    while (name > p && isIdentChar((unsigned char)name[-1])) name--;
+    if (name == q) return NULL;
+    *open = paren;
+    return name;
+}
+
+static const char *const controlWords[] = {
+    "if", "else", "for", "while", "do", "switch", "case", "return", "goto", "sizeof", "catch",
+    "new", "throw", "delete", "typeof", "await", "yield", "function", "super", "this", NULL
+};
+
+// Definitions at column 0: functions whose parameter list is followed by a
+// body, struct, union, enum and class bodies, typedef names and macros.
+// Indented code is skipped, which loses class members defined inline but
+// keeps out locals and calls.
+static void scanCLine(Scan *scan, const char *p, const char *end, uint32_t line) {
+    static const char *const tagWords[] = {"struct", "union", "enum", "class", NULL};
+    if (p == end || *p == ' ' || *p == '\t') return;
+    if (*p == '#') {
+        p++;
+        skipBlanks(&p, end);
+        if (takeWord(&p, end, "define")) addIdent(scan, p, end, line, SYMBOL_MACRO);
+        return;
+    }
+    if (*p == '}') {
+        // "} Name;" closing a typedef'd struct
+        p++;
+        skipBlanks(&p, end);
+        size_t len = identAt(p, end);
+        if (len && memchr(p, ';', (size_t)(end - p))) addFound(scan, p, len, line, SYMBOL_TYPE);
+        return;
+    }
+    const char *semi = (const char *)memchr(p, ';', (size_t)(end - p));
+    if (takeWord(&p, end, "typedef")) {
+        const char *tag = p;
+        if (takeAny(&tag, end, tagWords) && !semi) {
+            addIdent(scan, tag, end, line, SYMBOL_TYPE);
+            return;
+        }
+        if (!semi) return;
+        const char *pointer = findText(p, semi, "(*");
+        if (pointer) {
+            pointer += 2;
+            skipBlanks(&pointer, end);
+            addIdent(scan, pointer, end, line, SYMBOL_TYPE);
+            return;
+        }
+        const char *q = semi;
+        while (q > p && (q[-1] == ' ' || q[-1] == ']' || isdigit((unsigned char)q[-1]) || q[-1] == '[')) q--;
+        const char *name = q;
+        while (name > p && isIdentChar((unsigned char)name[-1])) name--;
+        addFound(scan, name, (size_t)(q - name), line, SYMBOL_TYPE);
+        return;
+    }
+    takeWord(&p, end, "template");
+    const char *tag = p;
+    const char *open;
+    const char *name = nameBeforeParen(p, end, &open);
+    if (takeAny(&tag, end, tagWords) && (!name || name < tag)) {
+        // "struct Name {" or a lone "struct Name", not a declaration
+        if (semi && !memchr(p, '{', (size_t)(semi - p))) return;
+        addIdent(scan, tag, end, line, SYMBOL_TYPE);
+        return;
+    }
+    if (!name || isWord(name, (size_t)(open - name), controlWords) || isWord(p, identAt(p, end), controlWords)) return;
+    if (!hasBody(open, scan->end, LANG_C)) return;
+    int method = name - p >= 2 && name[-1] == ':' && name[-2] == ':';
+    addFound(scan, name, identAt(name, end), line, method ? SYMBOL_METHOD : SYMBOL_FUNCTION);
+}
+
+static void scanPythonLine(Scan *scan, const char *p, const char *end, uint32_t line) {
+    const char *start = p;
+    skipBlanks(&p, end);
+    int indented = p > start;
+    takeWord(&p, end, "async");
+    if (takeWord(&p, end, "def")) addIdent(scan, p, end, line, indented ? SYMBOL_METHOD : SYMBOL_FUNCTION);
+    else if (takeWord(&p, end, "class")) addIdent(scan, p, end, line, SYMBOL_TYPE);
+}
+
+// Go declares at column 0, and groups types in "type (...)" blocks, whose
+// state is kept in *block between lines.
+static void scanGoLine(Scan *scan, const char *p, const char *end, uint32_t line, int *block) {
+    if (*block) {
+        skipBlanks(&p, end);
+        if (p < end && *p == ')') *block = 0;
+        else addIdent(scan, p, end, line, SYMBOL_TYPE);
+        return;
+    }
+    if (takeWord(&p, end, "func")) {
+        int method = p < end && *p == '(';
+        if (method) {
+            const char *close = (const char *)memchr(p, ')', (size_t)(end - p));
+            if (!close) return;
+            p = close + 1;
+            skipBlanks(&p, end);
+        }
+        addIdent(scan, p, end, line, method ? SYMBOL_METHOD : SYMBOL_FUNCTION);
+    } else if (takeWord(&p, end, "type")) {
+        if (p < end && *p == '(') *block = 1;
+        else addIdent(scan, p, end, line, SYMBOL_TYPE);
+    }
+}
+
+static void scanJsLine(Scan *scan, const char *p, const char *end, uint32_t line) {
+    static const char *const leadWords[] = {"export", "default", "declare", "abstract", "async", NULL};
+    static const char *const memberWords[] = {
+        "static", "async", "get", "set", "public", "private", "protected", "readonly", "override", NULL
+    };
+    static const char *const bindWords[] = {"const", "let", "var", NULL};
+    static const char *const typeWords[] = {"class", "interface", "enum", "namespace", NULL};
+    const char *start = p;
+    skipBlanks(&p, end);
+    int indented = p > start;
+    while (takeAny(&p, end, leadWords));
+    if (takeWord(&p, end, "function")) {
+        if (p < end && *p == '*') p++;
+        skipBlanks(&p, end);
+        addIdent(scan, p, end, line, SYMBOL_FUNCTION);
+        return;
+    }
+    if (takeAny(&p, end, typeWords)) {
+        addIdent(scan, p, end, line, SYMBOL_TYPE);
+        return;
+    }
+    const char *name = p;
+    if (takeWord(&p, end, "type") && identAt(p, end) && memchr(p, '=', (size_t)(end - p))) {
+        addIdent(scan, p, end, line, SYMBOL_TYPE);
+        return;
+    }
+    p = name;
+    if (takeAny(&p, end, bindWords)) {
+        // const name = (...) => or = function
+        size_t len = identAt(p, end);
+        const char *eq = (const char *)memchr(p, '=', (size_t)(end - p));
+        if (len && eq && (findText(eq + 1, end, "=>") || findText(eq, end, "function")))
+            addFound(scan, p, len, line, SYMBOL_FUNCTION);
+        return;
+    }
+    if (!indented) return;
+    // A class member: "name(args) {" after any modifiers
+    while (takeAny(&p, end, memberWords));
+    size_t len = identAt(p, end);
+    const char *q = p + len;
+    skipBlanks(&q, end);
+    if (!len || q >= end || *q != '(' || isWord(p, len, controlWords)) return;
+    if (hasBody(q, scan->end, LANG_JS)) addFound(scan, p, len, line, SYMBOL_METHOD);
+}
+
+static void scanJavaLine(Scan *scan, const char *p, const char *end, uint32_t line) {
+    static const char *const modifierWords[] = {
+        "public", "private", "protected", "static", "final", "abstract", "sealed", "strictfp",
+        "synchronized", "native", "default", "transient", "volatile", NULL
+    };
+    static const char *const typeWords[] = {"class", "interface", "enum", "record", NULL};
+    skipBlanks(&p, end);
+    int modifiers = 0;
+    for (;;) {
+        if (p < end && *p == '@') {
+            const char *q = p + 1;
+            if (takeWord(&q, end, "interface")) {
+                addIdent(scan, q, end, line, SYMBOL_TYPE);
+                return;
+            }
+            // an annotation, with its arguments if on the same line
+            p = q + identAt(q, end);
+            if (p < end && *p == '(') {
+                const char *close = (const char *)memchr(p, ')', (size_t)(end - p));
+                p = close ? close + 1 : end;
+            }
+            skipBlanks(&p, end);
+        } else if (takeAny(&p, end, modifierWords)) {
+            modifiers++;
+        } else {
+            break;
+        }
+    }
+    if (takeAny(&p, end, typeWords)) {
+        addIdent(scan, p, end, line, SYMBOL_TYPE);
+        return;
+    }
+    // [<T>] Type name(...) or, after a modifier, a constructor Name(...)
+    if (p < end && *p == '<') {
+        const char *close = (const char *)memchr(p, '>', (size_t)(end - p));
+        if (!close) return;
+        p = close + 1;
+        skipBlanks(&p, end);
+    }
+    const char *open;
+    const char *name = nameBeforeParen(p, end, &open);
+    if (!name || isWord(p, identAt(p, end), controlWords) || isWord(name, (size_t)(open - name), controlWords)) return;
+    if (name == p && !modifiers) return;
+    if (name > p && name[-1] != ' ' && name[-1] != '\t') return;
+    if (memchr(p, '=', (size_t)(name - p)) || memchr(p, '.', (size_t)(name - p))) return;
+    if (hasBody(open, scan->end, LANG_JAVA)) addFound(scan, name, identAt(name, end), line, SYMBOL_METHOD);
+}
+
+static void scanSource(Scan *scan, char *buf, size_t len, int lang) {
+    blankComments(buf, len, lang);
+    scan->buf = buf;
+    scan->end = buf + len;
+    scan->count = 0;
+    int block = 0;
+    uint32_t line = 1;
+    for (const char *p = buf; p < buf + len; line++) {
+        const char *end = (const char *)memchr(p, '\n', (size_t)(buf + len - p));
+        if (!end) end = buf + len;
+        switch (lang) {
+            case LANG_C:      scanCLine(scan, p, end, line);            break;
+            case LANG_PYTHON: scanPythonLine(scan, p, end, line);       break;
+            case LANG_GO:     scanGoLine(scan, p, end, line, &block);   break;
+            case LANG_JS:     scanJsLine(scan, p, end, line);           break;
+            case LANG_JAVA:   scanJavaLine(scan, p, end, line);         break;
+        }
+        p = end + 1;
+    }
+}
+
+// --- Symbol Index ---
+
+typedef struct Symbol {
+    uint32_t name;          // code in the name table
+    uint32_t line;
+    int kind;
+} Symbol;
+
+typedef struct SymbolFile {
+    char *path;
+    uint32_t id;            // index entry id when last listed
+    int lang;
+    int64_t mtime;          // as scanned, -1 before the first scan
+    int64_t size;
+    Symbol *symbols;
+    uint32_t count;
+    int seen;               // generation of the last update that listed it
+    int64_t liveMtime;      // as the index has it now
+    int64_t liveSize;
+} SymbolFile;
+
+struct IndexSymbols {
+    Index *ix;
+    char file[INDEX_MAX_PATH];  // side file, empty for none
+    mutex_t lock;
+    SymbolFile **files;
+    uint32_t count;
+    uint32_t cap;
+    uint32_t *slots;        // path hash -> files index + 1
+    uint32_t slotCap;       // power of two
+
+    // Interned names. A name stays once its last symbol goes, with no refs.
+    char **names;
+    uint32_t *refs;
+    uint32_t nameCount;
+    uint32_t nameCap;
+    uint32_t *nameSlots;    // name hash -> code + 1
+    uint32_t nameSlotCap;   // power of two
+
+    int generation;
+    long lastScanned;
+    long lastDropped;
+};
+
+typedef struct SymbolJob {
+    IndexSymbols *si;
+    SymbolFile **todo;
+    uint32_t count;
+    uint32_t next;
+    mutex_t lock;           // guards next, the name table and refs
+} SymbolJob;
+
+static SymbolFile *findFile(IndexSymbols *si, const char *path) {
+    if (!si->slotCap) return NULL;
+    uint32_t mask = si->slotCap - 1;
+    for (uint32_t i = (uint32_t)hashBytes(path, strlen(path)) & mask; si->slots[i]; i = (i + 1) & mask) {
+        SymbolFile *sf = si->files[si->slots[i] - 1];
+        if (strcmp(sf->path, path) == 0) return sf;
+    }
+    return NULL;
+}
+
+// Rebuilds the path slots for the first count files.
+static int rehashFiles(IndexSymbols *si, uint32_t slotCap) {
+    uint32_t *slots = (uint32_t *)calloc(slotCap, sizeof(uint32_t));
+    if (!slots) return -1;
+    for (uint32_t f = 0; f < si->count; f++) {
+        const char *path = si->files[f]->path;
+        uint32_t i = (uint32_t)hashBytes(path, strlen(path)) & (slotCap - 1);
+        while (slots[i]) i = (i + 1) & (slotCap - 1);
+        slots[i] = f + 1;
+    }
+    free(si->slots);
+    si->slots = slots;
+    si->slotCap = slotCap;
+    return 0;
+}
+
+static SymbolFile *addFile(IndexSymbols *si, const char *path) {
+    if (si->count == si->cap) {
+        uint32_t newCap = si->cap ? si->cap * 2 : 1024;
+        SymbolFile **grown = (SymbolFile **)realloc(si->files, newCap * sizeof(SymbolFile *));
+        if (!grown) return NULL;
+        si->files = grown;
+        si->cap = newCap;
+    }
+    if ((si->count + 1) * 2 > si->slotCap && rehashFiles(si, si->slotCap ? si->slotCap * 2 : 2048) < 0) return NULL;
+    SymbolFile *sf = (SymbolFile *)calloc(1, sizeof(SymbolFile));
+    if (!sf || !(sf->path = strdup(path))) {
+        free(sf);
+        return NULL;
+    }
+    sf->mtime = -1;
+    si->files[si->count++] = sf;
+    uint32_t i = (uint32_t)hashBytes(path, strlen(path)) & (si->slotCap - 1);
+    while (si->slots[i]) i = (i + 1) & (si->slotCap - 1);
+    si->slots[i] = si->count;
+    return sf;
+}
+
+static void releaseSymbols(IndexSymbols *si, SymbolFile *sf) {
+    for (uint32_t i = 0; i < sf->count; i++) si->refs[sf->symbols[i].name]--;
+    free(sf->symbols);
+    sf->symbols = NULL;
+    sf->count = 0;
+}
+
+static void freeSymbolFile(SymbolFile *sf) {
+    free(sf->symbols);
+    free(sf->path);
+    free(sf);
+}
+
+static int growNames(IndexSymbols *si, uint32_t slotCap) {
+    uint32_t *slots = (uint32_t *)calloc(slotCap, sizeof(uint32_t));
+    if (!slots) return -1;
+    for (uint32_t n = 0; n < si->nameCount; n++) {
+        uint32_t i = (uint32_t)hashBytes(si->names[n], strlen(si->names[n])) & (slotCap - 1);
+        while (slots[i]) i = (i + 1) & (slotCap - 1);
+        slots[i] = n + 1;
+    }
+    free(si->nameSlots);
+    si->nameSlots = slots;
+    si->nameSlotCap = slotCap;
+    return 0;
+}
+
+// Returns the code for name, adding it if new, or UINT32_MAX when out of
+// memory. Caller holds the job lock, or is the only thread.
+static uint32_t internName(IndexSymbols *si, const char *name, size_t len) {
+    uint64_t h = hashBytes(name, len);
+    if (si->nameSlotCap) {
+        uint32_t mask = si->nameSlotCap - 1;
+        for (uint32_t i = (uint32_t)h & mask; si->nameSlots[i]; i = (i + 1) & mask) {
+            const char *known = si->names[si->nameSlots[i] - 1];
+            if (strncmp(known, name, len) == 0 && known[len] == '\0') return si->nameSlots[i] - 1;
+        }
+    }
+    if (si->nameCount == si->nameCap) {
+        uint32_t newCap = si->nameCap ? si->nameCap * 2 : 4096;
+        char **names = (char **)realloc(si->names, newCap * sizeof(char *));
+        if (names) si->names = names;
+        uint32_t *refs = (uint32_t *)realloc(si->refs, newCap * sizeof(uint32_t));
+        if (refs) si->refs = refs;
+        if (!names || !refs) return UINT32_MAX;
+        si->nameCap = newCap;
+    }
+    if ((si->nameCount + 1) * 2 > si->nameSlotCap &&
+        growNames(si, si->nameSlotCap ? si->nameSlotCap * 2 : 8192) < 0) return UINT32_MAX;
+    char *copy = (char *)malloc(len + 1);
+    if (!copy) return UINT32_MAX;
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+    uint32_t code = si->nameCount++;
+    si->names[code] = copy;
+    si->refs[code] = 0;
+    uint32_t i = (uint32_t)h & (si->nameSlotCap - 1);
+    while (si->nameSlots[i]) i = (i + 1) & (si->nameSlotCap - 1);
+    si->nameSlots[i] = code + 1;
+    return code;
+}
+
+// Reads a whole source file into *buf. Returns its length, or -1 for
+// files that are missing, too large or binary.
+static long readSourceFile(const char *path, char **buf, size_t *cap) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    size_t len = 0;
+    for (;;) {
+        if (len == *cap) {
+            size_t newCap = *cap ? *cap * 2 : 65536;
+            char *grown = newCap <= SYMBOL_MAX_FILE ? (char *)realloc(*buf, newCap) : NULL;
+            if (!grown) {
+                fclose(f);
+                return -1;
+            }
+            *buf = grown;
+            *cap = newCap;
+        }
+        size_t got = fread(*buf + len, 1, *cap - len, f);
+        if (got == 0) break;
+        len += got;
+    }
+    fclose(f);
+    if (memchr(*buf, 0, len < BINARY_PROBE ? len : BINARY_PROBE)) return -1;
+    return (long)len;
+}
+
+// Rescans one file. The read and the scan run without any lock; the file
+// record is only touched by this worker, and interning takes the job lock.
+static void updateSymbols(SymbolJob *job, SymbolFile *sf, Scan *scan, char **buf, size_t *cap) {
+    long len = readSourceFile(sf->path, buf, cap);
+    scan->count = 0;
+    if (len > 0) scanSource(scan, *buf, (size_t)len, sf->lang);
+    Symbol *symbols = scan->count ? (Symbol *)malloc(scan->count * sizeof(Symbol)) : NULL;
+    uint32_t count = 0;
+
+    mutex_lock(&job->lock);
+    IndexSymbols *si = job->si;
+    releaseSymbols(si, sf);
+    for (uint32_t i = 0; symbols && i < scan->count; i++) {
+        const Found *found = &scan->items[i];
+        uint32_t code = internName(si, *buf + found->offset, found->len);
+        if (code == UINT32_MAX) break;
+        si->refs[code]++;
+        symbols[count].name = code;
+        symbols[count].line = found->line;
+        symbols[count].kind = found->kind;
+        count++;
+    }
+    si->lastScanned++;
+    mutex_unlock(&job->lock);
+
+    sf->symbols = symbols;
+    sf->count = count;
+    sf->mtime = sf->liveMtime;
+    sf->size = sf->liveSize;
+}
+
+static void symbolWorker(void *arg) {
+    SymbolJob *job = (SymbolJob *)arg;
+    Scan scan;
+    memset(&scan, 0, sizeof(scan));
+    char *buf = NULL;
+    size_t cap = 0;
+    for (;;) {
+        mutex_lock(&job->lock);
+        SymbolFile *sf = job->next < job->count ? job->todo[job->next++] : NULL;
+        mutex_unlock(&job->lock);
+        if (!sf) break;
+        updateSymbols(job, sf, &scan, &buf, &cap);
+    }
+    free(scan.items);
+    free(buf);
+}
+
+typedef struct SourceList {
+    IndexSymbols *si;
+    SymbolFile **todo;
+    uint32_t count;
+    uint32_t cap;
+} SourceList;
+
+// Marks one indexed file as listed and queues it when it is a source file
+// whose mtime or size differs from what was scanned.
+static int listSource(const IndexResult *result, void *user) {
+    SourceList *list = (SourceList *)user;
+    int lang = languageOf(result->filename);
+    if (lang == LANG_NONE) return 0;
+    IndexSymbols *si = list->si;
+    SymbolFile *sf = findFile(si, result->fullpath);
+    if (!sf && !(sf = addFile(si, result->fullpath))) return 0;
+    sf->seen = si->generation;
+    sf->id = result->id;
+    sf->lang = lang;
+    sf->liveMtime = result->mtime;
+    sf->liveSize = result->size;
+    if (sf->mtime == result->mtime && sf->size == result->size) return 0;
+    if (list->count == list->cap) {
+        uint32_t newCap = list->cap ? list->cap * 2 : 1024;
+        SymbolFile **grown = (SymbolFile **)realloc(list->todo, newCap * sizeof(SymbolFile *));
+        if (!grown) return 0;
+        list->todo = grown;
+        list->cap = newCap;
+    }
+    list->todo[list->count++] = sf;
+    return 0;
+}
+
+// Rescans changed source files and forgets those no longer indexed.
+// Caller holds si->lock.
+static void refreshSymbols(IndexSymbols *si) {
+    si->generation++;
+    si->lastScanned = 0;
+    si->lastDropped = 0;
+    // The callback only looks at paths, so the index lock it runs under is
+    // held for the listing alone, not for the reads.
+    SourceList list = {si, NULL, 0, 0};
+    indexQuery(si->ix, "", listSource, &list);
+
+    SymbolJob job;
+    memset(&job, 0, sizeof(job));
+    job.si = si;
+    job.todo = list.todo;
+    job.count = list.count;
+    mutex_init(&job.lock);
+    int threads = cpuCount();
+    if (threads > (int)job.count) threads = (int)job.count;
+    IndexTasks *group = indexTasksBegin(TASK_UPDATE);
+    for (int i = 0; i < threads; i++) indexTasksSpawn(group, symbolWorker, &job);
+    indexTasksWait(group);
+    mutex_destroy(&job.lock);
+    free(list.todo);
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < si->count; i++) {
+        SymbolFile *sf = si->files[i];
+        if (sf->seen == si->generation) {
+            si->files[kept++] = sf;
+            continue;
+        }
+        releaseSymbols(si, sf);
+        freeSymbolFile(sf);
+        si->lastDropped++;
+    }
+    if (kept != si->count) {
+        si->count = kept;
+        rehashFiles(si, si->slotCap);
+    }
+}
+
+// --- Ranking ---
+
+typedef struct SymbolHit {
+    float score;
+    uint32_t file;
+    uint32_t symbol;
+} SymbolHit;
+
+// Scores the name features file ranking uses (indexNameMatch). A symbol
+// has no path depth, opens or mtime of its own, so those terms are left
+// out, and an exact name gets a bonus: a symbol query usually names one
+// identifier.
+static float scoreName(const char *name, const char *query, size_t queryLen) {
+    int word;
+    long at = indexNameMatch(name, query, &word);
+    if (at < 0) return -1;
+    size_t len = strlen(name);
+    float position = (float)at;
+    return SYMBOL_EXACT * (position == 0 && len == queryLen) +
+           SYMBOL_POSITION / (1.0f + position) +
+           SYMBOL_WORD * word +
+           SYMBOL_COVER * (float)queryLen / (float)(len + 1);
+}
+
+// Nonzero when a ranks below b. Ties go to the later file and line.
+static int hitBelow(const SymbolHit *a, const SymbolHit *b) {
+    if (a->score != b->score) return a->score < b->score;
+    if (a->file != b->file) return a->file > b->file;
+    return a->symbol > b->symbol;
+}
+
+// Keeps the max best hits in a min-heap, the worst on top.
+static void keepHit(SymbolHit *heap, int *count, int max, SymbolHit hit) {
+    int i;
+    if (*count < max) {
+        i = (*count)++;
+        while (i > 0 && hitBelow(&hit, &heap[(i - 1) / 2])) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap[i] = hit;
+        return;
+    }
+    if (!hitBelow(&heap[0], &hit)) return;
+    i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= *count) break;
+        if (child + 1 < *count && hitBelow(&heap[child + 1], &heap[child])) child++;
+        if (!hitBelow(&heap[child], &hit)) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = hit;
+}
+
+static int compareHits(const void *a, const void *b) {
+    const SymbolHit *ha = (const SymbolHit *)a, *hb = (const SymbolHit *)b;
+    return hitBelow(ha, hb) ? 1 : hitBelow(hb, ha) ? -1 : 0;
+}
+
+// --- Persistence ---
+
+static void writeU32(FILE *f, uint32_t v) { fwrite(&v, sizeof(v), 1, f); }
+static void writeI64(FILE *f, int64_t v) { fwrite(&v, sizeof(v), 1, f); }
+static int readU32(FILE *f, uint32_t *v) { return fread(v, sizeof(*v), 1, f) == 1; }
+static int readI64(FILE *f, int64_t *v) { return fread(v, sizeof(*v), 1, f) == 1; }
+
+static void writeString(FILE *f, const char *s) {
+    uint32_t len = (uint32_t)strlen(s);
+    writeU32(f, len);
+    fwrite(s, 1, len, f);
+}
+
+static int readString(FILE *f, char *buf, size_t size) {
+    uint32_t len;
+    if (!readU32(f, &len) || len >= size || fread(buf, 1, len, f) != len) return 0;
+    buf[len] = '\0';
+    return 1;
+}
+
+// Lines carry the kind in their top bits.
+#define KIND_SHIFT 28
+
+static int loadSymbols(IndexSymbols *si, FILE *f) {
+    uint32_t magic, version, nameCount, count, id, lang, symbolCount;
+    int64_t mtime, size;
+    char buf[INDEX_MAX_PATH];
+    if (!readU32(f, &magic) || magic != SYMBOL_FILE_MAGIC ||
+        !readU32(f, &version) || version != SYMBOL_FILE_VERSION || !readU32(f, &nameCount)) return 0;
+    for (uint32_t n = 0; n < nameCount; n++) {
+        if (!readString(f, buf, SYMBOL_NAME_MAX + 1) || internName(si, buf, strlen(buf)) != n) return 0;
+    }
+    if (!readU32(f, &count)) return 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!readString(f, buf, sizeof(buf)) || !readU32(f, &id) || !readU32(f, &lang) ||
+            !readI64(f, &mtime) || !readI64(f, &size) || !readU32(f, &symbolCount) ||
+            lang == LANG_NONE || lang > LANG_JAVA ||
+            symbolCount > SYMBOL_MAX_FILE) return 0;   // each takes at least a byte of source
+        SymbolFile *sf = findFile(si, buf) ? NULL : addFile(si, buf);
+        if (!sf) return 0;
+        sf->id = id;
+        sf->lang = (int)lang;
+        sf->mtime = mtime;
+        sf->size = size;
+        sf->symbols = (Symbol *)malloc(((size_t)symbolCount + 1) * sizeof(Symbol));
+        if (!sf->symbols) return 0;
+        for (uint32_t s = 0; s < symbolCount; s++) {
+            uint32_t name, where;
+            if (!readU32(f, &name) || !readU32(f, &where) || name >= nameCount ||
+                where >> KIND_SHIFT > SYMBOL_MACRO) return 0;
+            sf->symbols[s].name = name;
+            sf->symbols[s].line = where & ((1u << KIND_SHIFT) - 1);
+            sf->symbols[s].kind = (int)(where >> KIND_SHIFT);
+            si->refs[name]++;
+            sf->count++;
+        }
+    }
+    return 1;
+}
+
+// --- Public Interface ---
+
+IndexSymbols *indexSymbolsOpen(Index *ix, const char *path) {
+    IndexSymbols *si = (IndexSymbols *)calloc(1, sizeof(IndexSymbols));
+    if (!si) return NULL;
+    si->ix = ix;
+    mutex_init(&si->lock);
+    if (path) {
+        snprintf(si->file, sizeof(si->file), "%s", path);
+        FILE *f = fopen(path, "rb");
+        if (f) {
+            int ok = loadSymbols(si, f);
+            fclose(f);
+            if (!ok) {
+                indexSymbolsFree(si);
+                return NULL;
+            }
+        }
+    }
+    return si;
+}
+
+void indexSymbolsFree(IndexSymbols *si) {
+    if (!si) return;
+    for (uint32_t i = 0; i < si->count; i++) freeSymbolFile(si->files[i]);
+    for (uint32_t n = 0; n < si->nameCount; n++) free(si->names[n]);
+    free(si->files);
+    free(si->slots);
+    free(si->names);
+    free(si->refs);
+    free(si->nameSlots);
+    mutex_destroy(&si->lock);
+    free(si);
+}
+
+int indexSymbolsSave(IndexSymbols *si) {
+    if (!si->file[0]) return -1;
+    // Written beside the old file and renamed over it, like the history.
+    char tmp[INDEX_MAX_PATH + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", si->file);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return -1;
+    mutex_lock(&si->lock);
+    writeU32(f, SYMBOL_FILE_MAGIC);
+    writeU32(f, SYMBOL_FILE_VERSION);
+    writeU32(f, si->nameCount);
+    for (uint32_t n = 0; n < si->nameCount; n++) writeString(f, si->names[n]);
+    writeU32(f, si->count);
+    for (uint32_t i = 0; i < si->count; i++) {
+        SymbolFile *sf = si->files[i];
+        writeString(f, sf->path);
+        writeU32(f, sf->id);
+        writeU32(f, (uint32_t)sf->lang);
+        writeI64(f, sf->mtime);
+        writeI64(f, sf->size);
+        writeU32(f, sf->count);
+        for (uint32_t s = 0; s < sf->count; s++) {
+            writeU32(f, sf->symbols[s].name);
+            writeU32(f, sf->symbols[s].line | (uint32_t)sf->symbols[s].kind << KIND_SHIFT);
+        }
+    }
+    mutex_unlock(&si->lock);
+
+    int failed = ferror(f);
+    if (fclose(f) != 0) failed = 1;
+    #ifdef OS_WINDOWS
+    if (!failed) remove(si->file);
+    #endif
+    if (failed || rename(tmp, si->file) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+long indexSymbolsUpdate(IndexSymbols *si) {
+    mutex_lock(&si->lock);
+    refreshSymbols(si);
+    long scanned = si->lastScanned;
+    mutex_unlock(&si->lock);
+    return scanned;
+}
+
+long indexSymbolQuery(IndexSymbols *si, const char *query, IndexSymbol *out, int max) {
+    if (max <= 0) return 0;
+    if (!query) query = "";
+    mutex_lock(&si->lock);
+    refreshSymbols(si);
+
+    // Every distinct name is scored once; occurrences look their score up.
+    size_t queryLen = strlen(query);
+    float *scores = (float *)malloc((si->nameCount + 1) * sizeof(float));
+    SymbolHit *heap = (SymbolHit *)malloc(max * sizeof(SymbolHit));
+    if (!scores || !heap) {
+        free(scores);
+        free(heap);
+        mutex_unlock(&si->lock);
+        return -1;
+    }
+    for (uint32_t n = 0; n < si->nameCount; n++) {
+        scores[n] = si->refs[n] && strlen(si->names[n]) >= queryLen ? scoreName(si->names[n], query, queryLen) : -1;
+    }
+    long matches = 0;
+    int kept = 0;
+    for (uint32_t i = 0; i < si->count; i++) {
+        const SymbolFile *sf = si->files[i];
+        for (uint32_t s = 0; s < sf->count; s++) {
+            float score = scores[sf->symbols[s].name];
+            if (score < 0) continue;
+            SymbolHit hit = {score, i, s};
+            matches++;
+            keepHit(heap, &kept, max, hit);
+        }
+    }
+    qsort(heap, kept, sizeof(SymbolHit), compareHits);
+    for (int k = 0; k < kept; k++) {
+        const SymbolFile *sf = si->files[heap[k].file];
+        const Symbol *sym = &sf->symbols[heap[k].symbol];
+        IndexSymbol *o = &out[k];
+        snprintf(o->name, sizeof(o->name), "%s", si->names[sym->name]);
+        snprintf(o->fullpath, sizeof(o->fullpath), "%s", sf->path);
+        o->id = sf->id;
+        o->line = (long)sym->line;
+        o->kind = sym->kind;
+    }
+    free(scores);
+    free(heap);
+    mutex_unlock(&si->lock);
+    return matches;
+}
+
+void indexSymbolStats(IndexSymbols *si, IndexSymbolStats *stats) {
+    mutex_lock(&si->lock);
+    memset(stats, 0, sizeof(*stats));
+    stats->files = si->count;
+    for (uint32_t i = 0; i < si->count; i++) stats->symbols += si->files[i]->count;
+    for (uint32_t n = 0; n < si->nameCount; n++) stats->names += si->refs[n] > 0;
+    stats->lastScanned = si->lastScanned;
+    stats->lastDropped = si->lastDropped;
+    mutex_unlock(&si->lock);
+}